@@ -0,0 +1,298 @@
+/**
+@addtogroup Group9
+@{
+*/
+/**
+@file 	TCPLoad.c
+@author Catiuscia Melle
+
+@brief 	Generatore di carico per i TCP echo server (TCPModelS.c, TCPConcurrentS.c).
+
+Il programma avvia <em>clients</em> thread che, per <em>secs</em> secondi,
+ripetono ciascuno una sessione completa con il server:
+-# <em>connect()</em>;
+-# invio di <em>msgs</em> messaggi (default 1), attendendo l'echo di ciascuno;
+-# chiusura della connessione.
+
+Al termine visualizza il numero di client serviti al secondo, la latenza
+della <em>connect()</em> e quella dell'intera sessione (mediana, 99-esimo
+percentile e massimo), permettendo di confrontare i modelli di concorrenza
+del server.
+
+Dopo una sessione fallita (ad esempio per ECONNREFUSED, con il server non
+ancora avviato o la listen queue piena) il thread attende prima di ritentare,
+con un ritardo che raddoppia ad ogni errore consecutivo.
+
+La connessione viene chiusa con SO_LINGER a 0 (segmento RST): in questo
+modo il client non lascia socket in TIME_WAIT, che esaurirebbero le porte
+effimere dopo qualche decina di migliaia di sessioni.
+*/
+
+#include "Header.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define MAXSAMPLES 1000000 	/**< campioni di latenza per thread */
+
+
+static struct addrinfo *server; 	/**< indirizzo risolto del server */
+static int msgs = 1; 			/**< messaggi per sessione */
+static double endTime = 0; 		/**< fine del test */
+
+/** risultati di un thread */
+struct clientStats {
+	pthread_t tid;
+	long sessions; 		/**< sessioni completate */
+	long errors; 		/**< sessioni fallite */
+	double *connLat; 	/**< latenza di connect(), in us */
+	double *sessLat; 	/**< latenza della sessione, in us */
+	long nsamples;
+};
+
+
+/**
+@brief Restituisce il tempo corrente in microsecondi
+*/
+double now_us(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/**
+@brief Una sessione con il server
+@param cs - statistiche del thread
+@return true se la sessione è stata completata
+*/
+bool session(struct clientStats *cs){
+
+	char msg[BUFSIZE] = "TCPLoad echo message";
+	char reply[BUFSIZE] = "";
+	int len = strlen(msg);
+	int i = 0;
+
+	double start = now_us();
+
+	int sockfd = socket(server->ai_family, server->ai_socktype, server->ai_protocol);
+	if (sockfd == -1)
+	{
+		perror("socket() error: ");
+		return false;
+	}
+
+	if (connect(sockfd, server->ai_addr, server->ai_addrlen) == -1)
+	{
+		close(sockfd);
+		return false;
+	}
+	double connected = now_us();
+
+	for (i = 0; i < msgs; i++)
+	{
+		if (send(sockfd, msg, len, 0) != len)
+		{
+			close(sockfd);
+			return false;
+		}
+
+		//attendo l'echo completo del messaggio
+		int got = 0;
+		while (got < len)
+		{
+			ssize_t n = recv(sockfd, reply + got, len - got, 0);
+			if (n <= 0)
+			{
+				close(sockfd);
+				return false;
+			}
+			got += n;
+		}
+	}
+
+	//chiusura con RST: nessun socket in TIME_WAIT
+	struct linger lg = { 1, 0 };
+	setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+	close(sockfd);
+
+	if (cs->nsamples < MAXSAMPLES)
+	{
+		cs->connLat[cs->nsamples] = connected - start;
+		cs->sessLat[cs->nsamples] = now_us() - start;
+		cs->nsamples++;
+	}
+	return true;
+}
+
+
+/**
+@brief Thread client: ripete le sessioni fino alla fine del test
+*/
+void *clientThread(void *arg){
+
+	struct clientStats *cs = arg;
+	int backoff = 0; 	//attesa dopo una sessione fallita, in us
+
+	while (now_us() < endTime)
+	{
+		if (session(cs))
+		{
+			cs->sessions++;
+			backoff = 0;
+		}
+		else
+		{
+			/*
+			ad esempio ECONNREFUSED con la listen queue piena: attendo, con
+			un ritardo che raddoppia ad ogni errore (fino a 100 ms), invece
+			di ritentare subito
+			*/
+			cs->errors++;
+			backoff = (backoff == 0) ? 1000 : backoff * 2;
+			if (backoff > 100000)
+				backoff = 100000;
+			usleep(backoff);
+		}
+	}
+	return NULL;
+}
+
+
+/**
+@brief Funzione di confronto per qsort()
+*/
+int cmp_double(const void *a, const void *b){
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+@brief Visualizza mediana, 99-esimo percentile e massimo dei campioni
+*/
+void printLatency(const char *name, double *samples, long n){
+
+	if (n == 0)
+		return;
+	qsort(samples, n, sizeof(double), cmp_double);
+	printf("%s latency (us): p50 %.0f  p99 %.0f  max %.0f\n", name,
+		samples[n / 2], samples[n * 99 / 100], samples[n - 1]);
+}
+
+
+/**
+@brief Utility
+@param name - nome del programma
+@return nulla
+*/
+void usage(char *name){
+	printf("Usage: %s <hostname> <clients> <secs> [msgs]\n", name);
+	printf("\tclients: sessioni concorrenti (un thread ciascuna)\n");
+	printf("\tmsgs: messaggi per sessione (default 1)\n");
+}
+
+
+
+int main(int argc, char *argv[]){
+
+	if ((argc != 4) && (argc != 5)) {
+		usage(argv[0]);
+		return INVALID;
+	}
+
+	int nclients = atoi(argv[2]);
+	int secs = atoi(argv[3]);
+	if (argc == 5)
+		msgs = atoi(argv[4]);
+	if ((nclients <= 0) || (secs <= 0) || (msgs < 0))
+	{
+		usage(argv[0]);
+		return INVALID;
+	}
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+
+	int ecode = getaddrinfo(argv[1], SERVICEPORT, &hints, &server);
+	if (ecode != 0)
+	{
+		printf("getaddrinfo: %s\n", gai_strerror(ecode));
+		return FAILURE;
+	}
+
+	struct clientStats *cs = calloc(nclients, sizeof(struct clientStats));
+	if (cs == NULL)
+	{
+		perror("calloc() error: ");
+		return FAILURE;
+	}
+
+	double start = now_us();
+	endTime = start + secs * 1e6;
+
+	int i = 0;
+	for (i = 0; i < nclients; i++)
+	{
+		cs[i].connLat = malloc(MAXSAMPLES * sizeof(double));
+		cs[i].sessLat = malloc(MAXSAMPLES * sizeof(double));
+		if ((cs[i].connLat == NULL) || (cs[i].sessLat == NULL))
+		{
+			perror("malloc() error: ");
+			return FAILURE;
+		}
+		if (pthread_create(&cs[i].tid, NULL, clientThread, &cs[i]) != 0)
+		{
+			printf("pthread_create() error\n");
+			return FAILURE;
+		}
+	}
+
+	long sessions = 0, errors = 0, nsamples = 0;
+	for (i = 0; i < nclients; i++)
+	{
+		pthread_join(cs[i].tid, NULL);
+		sessions += cs[i].sessions;
+		errors += cs[i].errors;
+		nsamples += cs[i].nsamples;
+	}
+	double elapsed = (now_us() - start) / 1e6;
+
+	//riunisco i campioni di tutti i thread
+	double *connLat = malloc(nsamples * sizeof(double) + 1);
+	double *sessLat = malloc(nsamples * sizeof(double) + 1);
+	if ((connLat == NULL) || (sessLat == NULL))
+	{
+		perror("malloc() error: ");
+		return FAILURE;
+	}
+	long n = 0;
+	for (i = 0; i < nclients; i++)
+	{
+		memcpy(connLat + n, cs[i].connLat, cs[i].nsamples * sizeof(double));
+		memcpy(sessLat + n, cs[i].sessLat, cs[i].nsamples * sizeof(double));
+		n += cs[i].nsamples;
+		free(cs[i].connLat);
+		free(cs[i].sessLat);
+	}
+
+	printf("%d clients, %d msgs per session, %.1f s\n", nclients, msgs, elapsed);
+	printf("%.0f clients served/s (%ld sessions, %ld errors)\n",
+		sessions / elapsed, sessions, errors);
+	printLatency("connect", connLat, n);
+	printLatency("session", sessLat, n);
+
+	free(connLat);
+	free(sessLat);
+	free(cs);
+	freeaddrinfo(server);
+
+return 0;
+}
+
+/** @} */
@@ -0,0 +1,580 @@
+/**
+@addtogroup Group9
+@{
+*/
+/**
+@file 	TCPModelS.c
+@author Catiuscia Melle
+
+@brief 	TCP echo server concorrente con modello di concorrenza selezionabile.
+
+Il server è quello di TCPConcurrentS.c (<em>getaddrinfo()</em> per la passive
+open, echo dei messaggi del client), ma il modello con cui le connessioni
+sono servite è scelto da linea di comando:
+-# <b>fork</b>: un processo figlio per ogni connessione accettata (come
+   TCPConcurrentS.c);
+-# <b>prefork</b>: <em>workers</em> processi creati all'avvio, che eseguono
+   <em>accept()</em> sullo stesso listening socket, uno alla volta: la
+   <em>accept()</em> è serializzata da un lock <em>fcntl()</em> su un file;
+   il parent sostituisce i processi che terminano e, con SIGTERM o SIGINT,
+   termina i figli prima di uscire;
+-# <b>thread</b>: un thread per ogni connessione accettata;
+-# <b>pool</b>: <em>workers</em> thread creati all'avvio; il main thread
+   accetta le connessioni e le inserisce in una coda condivisa, da cui i
+   thread le prelevano;
+-# <b>reuseport</b>: <em>workers</em> thread, ciascuno con un proprio
+   listening socket sulla stessa porta (opzione SO_REUSEPORT): su Linux è
+   il kernel a distribuire le nuove connessioni tra i socket.
+
+Nei modelli prefork, pool e reuseport un worker serve una connessione alla
+volta: le connessioni oltre il numero di worker attendono nella coda.
+Per non falsare le misure (vedi TCPLoad.c), il server non visualizza i
+messaggi ricevuti.
+*/
+
+#include "Header.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+#define WORKERS 4 		/**< numero di worker di default */
+#define QUEUESIZE 1024 	/**< dimensione della coda di connessioni del modello pool */
+
+
+/** modelli di concorrenza */
+typedef enum { M_FORK, M_PREFORK, M_THREAD, M_POOL, M_REUSEPORT } model_t;
+
+static const char *modelNames[] = { "fork", "prefork", "thread", "pool", "reuseport" };
+
+static int domain = 0; 	/**< dominio richiesto (0, 4, 6) */
+static int lockfd = -1; 	/**< file usato per serializzare accept() (prefork) */
+static volatile sig_atomic_t stopServer = 0; /**< SIGTERM/SIGINT ricevuto (prefork) */
+
+/** coda di connessioni accettate del modello pool */
+static int queue[QUEUESIZE];
+static int qhead = 0, qcount = 0;
+static pthread_mutex_t qmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qnotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t qnotFull = PTHREAD_COND_INITIALIZER;
+
+
+
+/**
+@brief Utility
+@param name - nome del programma
+@return nulla
+*/
+void usage(char *name){
+	printf("Usage: %s <domain> <model> [workers]\n", name);
+	printf("\tdomain=0 => AF_UNSPEC domain\n");
+	printf("\tdomain=4 => AF_INET domain\n");
+	printf("\tdomain=6 => AF_INET6 domain\n");
+	printf("\tmodel: fork, prefork, thread, pool, reuseport\n");
+	printf("\tworkers: processi o thread di prefork, pool e reuseport (default %d)\n", WORKERS);
+}
+
+
+/**
+@brief Gestione dei child che terminano l'elaborazione della richiesta...
+*/
+void sigchld_handler(int s){
+
+	while(waitpid(-1, NULL, WNOHANG) > 0);
+}
+
+
+/**
+@brief Handler di SIGTERM e SIGINT del parent prefork: ne chiede la terminazione
+*/
+void stop_handler(int s){
+
+	stopServer = 1;
+}
+
+
+/**
+@brief Handler di SIGCHLD del parent prefork: non fa nulla, serve solo a
+interrompere sigsuspend() (i figli sono raccolti dal ciclo del parent)
+*/
+void wake_handler(int s){
+}
+
+
+/**
+@brief Passive open sulla porta SERVICEPORT nel dominio richiesto
+@param reuseport - se true imposta SO_REUSEPORT prima della bind()
+@return il listening socket, -1 in caso di errore
+*/
+int openListener(bool reuseport){
+
+	struct addrinfo hints, *result, *p;
+	int sockfd = -1;
+	int yes = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	switch (domain){
+		case 4:
+			hints.ai_family = AF_INET;
+			break;
+		case 6:
+			hints.ai_family = AF_INET6;
+			break;
+		default:
+			hints.ai_family = AF_UNSPEC;
+			break;
+	}//switch
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+	int ecode = getaddrinfo(NULL, SERVICEPORT, &hints, &result);
+	if (ecode != 0)
+	{
+		printf("getaddrinfo: %s\n", gai_strerror(ecode));
+		return -1;
+	}
+
+	for (p = result; p != NULL; p = p->ai_next)
+	{
+		sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+		if (sockfd == -1)
+		{
+			perror("socket() error: ");
+			continue;
+		}
+
+		setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		if (reuseport &&
+			(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1))
+		{
+			perror("setsockopt(SO_REUSEPORT) error: ");
+			close(sockfd);
+			continue;
+		}
+
+		if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1)
+		{
+			perror("bind() error: ");
+			close(sockfd);
+			continue;
+		}
+		break; //success
+	}//for
+
+	freeaddrinfo(result);
+	if (p == NULL)
+		return -1;
+
+	//coda di connessioni massima: con molti client il default BACKLOG si riempie
+	if (listen(sockfd, SOMAXCONN) == -1)
+	{
+		perror("listen() error: ");
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/**
+@brief Echo dei messaggi del client fino alla chiusura della connessione
+@param clientfd - socket connesso al client (viene chiuso)
+*/
+void serveClient(int clientfd){
+
+	char msg[BUFSIZE] = "";
+	ssize_t num = 0;
+
+	while ((num = recv(clientfd, msg, BUFSIZE, 0)) > 0)
+	{
+		if (send(clientfd, msg, num, 0) != num)
+			break;
+	}
+	//num == 0: il client ha chiuso; num == -1: ad esempio connection reset
+
+	close(clientfd);
+}
+
+
+/**
+@brief Acquisisce (lock true) o rilascia (lock false) il lock su lockfd
+*/
+void acceptLock(bool lock){
+
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = lock ? F_WRLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+
+	while (fcntl(lockfd, F_SETLKW, &fl) == -1)
+	{
+		if (errno != EINTR)
+		{
+			perror("fcntl() lock error: ");
+			exit(1);
+		}
+	}
+}
+
+
+/**
+@brief Ciclo di un processo del modello prefork
+*/
+void preforkChild(int sockfd){
+
+	while (1)
+	{
+		//un solo processo alla volta è bloccato in accept()
+		acceptLock(true);
+		int clientfd = accept(sockfd, NULL, NULL);
+		acceptLock(false);
+
+		if (clientfd == -1)
+		{
+			perror("accept() error: ");
+			continue;
+		}
+		serveClient(clientfd);
+	}
+}
+
+
+/**
+@brief Crea un processo del modello prefork
+@param sockfd - listening socket
+@param mask - signal mask da ripristinare nel figlio
+@return il pid del figlio, -1 in caso di errore
+*/
+pid_t spawnWorker(int sockfd, sigset_t *mask){
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		//il figlio non eredita la gestione dei segnali del parent
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
+		sigprocmask(SIG_SETMASK, mask, NULL);
+		preforkChild(sockfd); //non ritorna
+	}
+	if (pid == -1)
+		perror("fork() error: ");
+	return pid;
+}
+
+
+/**
+@brief Thread del modello thread: serve una connessione e termina
+*/
+void *connThread(void *arg){
+
+	serveClient((int)(intptr_t)arg);
+	return NULL;
+}
+
+
+/**
+@brief Thread del modello pool: preleva le connessioni dalla coda condivisa
+*/
+void *poolThread(void *arg){
+
+	while (1)
+	{
+		pthread_mutex_lock(&qmtx);
+		while (qcount == 0)
+			pthread_cond_wait(&qnotEmpty, &qmtx);
+		int clientfd = queue[qhead];
+		qhead = (qhead + 1) % QUEUESIZE;
+		qcount--;
+		pthread_cond_signal(&qnotFull);
+		pthread_mutex_unlock(&qmtx);
+
+		serveClient(clientfd);
+	}
+	return NULL;
+}
+
+
+/**
+@brief Thread del modello reuseport: accetta e serve le connessioni del proprio socket
+*/
+void *reuseportThread(void *arg){
+
+	int sockfd = (int)(intptr_t)arg;
+
+	while (1)
+	{
+		int clientfd = accept(sockfd, NULL, NULL);
+		if (clientfd == -1)
+		{
+			perror("accept() error: ");
+			continue;
+		}
+		serveClient(clientfd);
+	}
+	return NULL;
+}
+
+
+/**
+@brief Crea un thread detached
+@return 0 in caso di successo, -1 in caso di errore
+*/
+int startThread(void *(*func)(void *), void *arg){
+
+	pthread_t tid;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	int res = pthread_create(&tid, &attr, func, arg);
+	pthread_attr_destroy(&attr);
+	if (res != 0)
+	{
+		printf("pthread_create() error: %s\n", strerror(res));
+		return -1;
+	}
+	return 0;
+}
+
+
+
+int main(int argc, char *argv[]){
+
+	if ((argc != 3) && (argc != 4)) {
+		usage(argv[0]);
+		return INVALID;
+	}
+	domain = atoi(argv[1]);
+
+	int model = -1;
+	int i = 0;
+	for (i = 0; i <= M_REUSEPORT; i++)
+	{
+		if (strcmp(argv[2], modelNames[i]) == 0)
+			model = i;
+	}
+	int workers = (argc == 4) ? atoi(argv[3]) : WORKERS;
+	if ((model == -1) || (workers <= 0))
+	{
+		usage(argv[0]);
+		return INVALID;
+	}
+
+	//i client che chiudono prima della risposta non devono terminare il server
+	signal(SIGPIPE, SIG_IGN);
+
+	//signal handler per la gestione dei child
+	struct sigaction sa;
+	sa.sa_handler = sigchld_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGCHLD, &sa, NULL) == -1)
+	{
+		perror("sigaction error: ");
+		exit(1);
+	}
+
+	int sockfd = openListener(model == M_REUSEPORT);
+	if (sockfd == -1)
+	{
+		printf("Non siamo riusciti ad avviare il server nel dominio AF_INET%s\n", argv[1]);
+		return FAILURE;
+	}
+
+	printf("\tTCP Server listening on port %s, model %s", SERVICEPORT, modelNames[model]);
+	if ((model == M_PREFORK) || (model == M_POOL) || (model == M_REUSEPORT))
+		printf(", %d workers", workers);
+	printf("\n\n");
+	//svuoto il buffer di stdout, altrimenti ogni child lo erediterebbe
+	fflush(stdout);
+
+	int clientfd = 0;
+
+	switch (model)
+	{
+		case M_FORK:
+			while (1)
+			{
+				clientfd = accept(sockfd, NULL, NULL);
+				if (clientfd == -1)
+				{
+					perror("accept() error: ");
+					continue;
+				}
+
+				//creo un child per ogni connessione
+				pid_t pid = fork();
+				if (pid == 0)
+				{
+					close(sockfd);
+					serveClient(clientfd);
+					//_exit(): il child non deve svuotare i buffer stdio del parent
+					_exit(0);
+				}
+				if (pid == -1)
+					perror("fork() error: ");
+
+				//al parent non interessa gestire il client
+				close(clientfd);
+			}//wend
+			break;
+
+		case M_PREFORK:
+		{
+			//file di lock: rimosso subito, resta accessibile tramite il descriptor
+			char lockname[] = "/tmp/TCPModelS.XXXXXX";
+			lockfd = mkstemp(lockname);
+			if (lockfd == -1)
+			{
+				perror("mkstemp() error: ");
+				return FAILURE;
+			}
+			unlink(lockname);
+
+			//il parent raccoglie i figli e gestisce SIGTERM/SIGINT solo dentro
+			//sigsuspend(): fino ad allora i segnali restano bloccati
+			sigset_t blocked, oldmask;
+			sigemptyset(&blocked);
+			sigaddset(&blocked, SIGCHLD);
+			sigaddset(&blocked, SIGTERM);
+			sigaddset(&blocked, SIGINT);
+			sigprocmask(SIG_BLOCK, &blocked, &oldmask);
+
+			sa.sa_handler = wake_handler;
+			sa.sa_flags = 0;
+			sigaction(SIGCHLD, &sa, NULL);
+			sa.sa_handler = stop_handler;
+			sigaction(SIGTERM, &sa, NULL);
+			sigaction(SIGINT, &sa, NULL);
+
+			pid_t *pids = calloc(workers, sizeof(pid_t));
+			if (pids == NULL)
+			{
+				perror("calloc() error: ");
+				return FAILURE;
+			}
+			for (i = 0; i < workers; i++)
+			{
+				pids[i] = spawnWorker(sockfd, &oldmask);
+				if (pids[i] == -1)
+				{
+					stopServer = 1;
+					break;
+				}
+			}
+
+			//sostituisco i figli terminati, finché non arriva SIGTERM o SIGINT
+			while (!stopServer)
+			{
+				pid_t pid;
+				while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+				{
+					for (i = 0; i < workers; i++)
+					{
+						if (pids[i] == pid)
+							pids[i] = -1;
+					}
+				}
+				for (i = 0; i < workers; i++)
+				{
+					if (pids[i] == -1)
+						pids[i] = spawnWorker(sockfd, &oldmask);
+				}
+				//se una fork() è fallita riprovo dopo 1 secondo
+				for (i = 0; i < workers; i++)
+				{
+					if (pids[i] == -1)
+						break;
+				}
+				if (i < workers)
+				{
+					sigprocmask(SIG_SETMASK, &oldmask, NULL);
+					sleep(1);
+					sigprocmask(SIG_BLOCK, &blocked, NULL);
+				}
+				else
+					sigsuspend(&oldmask);
+			}
+
+			//termino i figli, che altrimenti terrebbero occupata la porta
+			for (i = 0; i < workers; i++)
+			{
+				if (pids[i] > 0)
+					kill(pids[i], SIGTERM);
+			}
+			while (wait(NULL) > 0);
+			free(pids);
+			close(sockfd);
+			return 0;
+		}
+
+		case M_THREAD:
+			while (1)
+			{
+				clientfd = accept(sockfd, NULL, NULL);
+				if (clientfd == -1)
+				{
+					perror("accept() error: ");
+					continue;
+				}
+
+				//creo un thread per ogni connessione
+				if (startThread(connThread, (void *)(intptr_t)clientfd) == -1)
+					close(clientfd);
+			}//wend
+			break;
+
+		case M_POOL:
+			for (i = 0; i < workers; i++)
+			{
+				if (startThread(poolThread, NULL) == -1)
+					return FAILURE;
+			}
+
+			while (1)
+			{
+				clientfd = accept(sockfd, NULL, NULL);
+				if (clientfd == -1)
+				{
+					perror("accept() error: ");
+					continue;
+				}
+
+				//inserisco la connessione nella coda condivisa dai thread
+				pthread_mutex_lock(&qmtx);
+				while (qcount == QUEUESIZE)
+					pthread_cond_wait(&qnotFull, &qmtx);
+				queue[(qhead + qcount) % QUEUESIZE] = clientfd;
+				qcount++;
+				pthread_cond_signal(&qnotEmpty);
+				pthread_mutex_unlock(&qmtx);
+			}//wend
+			break;
+
+		case M_REUSEPORT:
+			//il primo thread usa il socket già aperto, gli altri ne aprono uno ciascuno
+			for (i = 0; i < workers; i++)
+			{
+				int fd = (i == 0) ? sockfd : openListener(true);
+				if (fd == -1)
+					return FAILURE;
+				if (startThread(reuseportThread, (void *)(intptr_t)fd) == -1)
+					return FAILURE;
+			}
+
+			while (1)
+				pause();
+			break;
+	}
+
+	//never reached
+	close(sockfd);
+
+return 0;
+}
+
+/** @} */
@@ -0,0 +1,408 @@
+/**
+@addtogroup Group11
+@{
+*/
+/**
+@file 	EventLoop.c
+@author Catiuscia Melle
+
+@brief 	Implementazione del modulo di I/O multiplexing con backend selezionabile.
+
+La tabella degli handler è un array indicizzato dal socket descriptor,
+raddoppiato quando necessario: la ricerca dell'handler di un socket pronto
+costa O(1), indipendentemente dal numero di connessioni.
+
+Il costo di ogni attesa dipende invece dal backend:
+-# con <em>epoll()</em> il kernel restituisce solo i socket pronti, e
+   l'interest list non viene ricostruita ad ogni attesa;
+-# con <em>poll()</em> l'array di pollfd viene passato al kernel ad ogni
+   attesa e scandito per intero, ma non ci sono limiti sui descriptor;
+-# con <em>select()</em> il set viene ricopiato ad ogni attesa e scandito
+   fino a maxfd, con il limite FD_SETSIZE sul valore dei descriptor.
+
+Un handler può rimuovere (ed il server chiudere) qualsiasi socket, ed
+accettare nuove connessioni: ogni entry ricorda l'attesa in cui è stata
+aggiunta, ed un evento rilevato prima dell'aggiunta (ad esempio per un
+descriptor chiuso e subito riassegnato da accept()) viene ignorato.
+*/
+
+#include "EventLoop.h"
+
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#define EV_MAXEVENTS 256 	/**< eventi restituiti da una epoll_wait() */
+
+/** entry della tabella degli handler, indicizzata dal descriptor */
+struct evEntry {
+	evHandler handler; 	/**< NULL se il descriptor non è registrato */
+	void *arg;
+	unsigned long epoch; 	/**< attesa durante la quale è stata aggiunta */
+	int pidx; 			/**< posizione nell'array di pollfd (EV_POLL) */
+};
+
+struct evLoop {
+	evBackend backend;
+	struct evEntry *tab; 	/**< tabella degli handler */
+	int tabsize;
+	int count; 			/**< socket registrati */
+	unsigned long epoch; 	/**< contatore delle attese */
+
+	int epfd; 			/**< EV_EPOLL: epoll instance */
+
+	struct pollfd *pfds; 	/**< EV_POLL: array compatto di pollfd */
+	int npfds;
+	int pcap;
+	bool pdirty; 		/**< EV_POLL: ci sono pollfd da compattare */
+
+	fd_set allset; 		/**< EV_SELECT: set dei socket registrati */
+	int maxfd;
+};
+
+
+
+int evBackendFromName(const char *name){
+#ifdef __linux__
+	if (strcmp(name, "epoll") == 0)
+		return EV_EPOLL;
+#endif
+	if (strcmp(name, "poll") == 0)
+		return EV_POLL;
+	if (strcmp(name, "select") == 0)
+		return EV_SELECT;
+	return -1;
+}
+
+
+
+const char *evBackendName(struct evLoop *loop){
+	switch (loop->backend)
+	{
+		case EV_EPOLL: return "epoll";
+		case EV_POLL: return "poll";
+		default: return "select";
+	}
+}
+
+
+
+struct evLoop *evCreate(evBackend backend){
+
+	struct evLoop *loop = calloc(1, sizeof(struct evLoop));
+	if (loop == NULL)
+		return NULL;
+
+	loop->backend = backend;
+	loop->epfd = -1;
+	loop->maxfd = -1;
+	FD_ZERO(&loop->allset);
+
+	if (backend == EV_EPOLL)
+	{
+#ifdef __linux__
+		loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (loop->epfd == -1)
+		{
+			free(loop);
+			return NULL;
+		}
+#else
+		free(loop);
+		errno = ENOSYS;
+		return NULL;
+#endif
+	}
+
+	return loop;
+}
+
+
+
+/**
+@brief Garantisce che la tabella degli handler contenga l'entry fd
+*/
+static int growTable(struct evLoop *loop, int fd){
+
+	if (fd < loop->tabsize)
+		return 0;
+
+	int size = (loop->tabsize > 0) ? loop->tabsize : 64;
+	while (size <= fd)
+		size *= 2;
+
+	struct evEntry *tab = realloc(loop->tab, size * sizeof(struct evEntry));
+	if (tab == NULL)
+		return -1;
+
+	memset(tab + loop->tabsize, 0,
+		(size - loop->tabsize) * sizeof(struct evEntry));
+	loop->tab = tab;
+	loop->tabsize = size;
+	return 0;
+}
+
+
+
+int evAdd(struct evLoop *loop, int fd, evHandler handler, void *arg){
+
+	if (fd < 0 || handler == NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if (loop->backend == EV_SELECT && fd >= FD_SETSIZE)
+	{
+		errno = EMFILE;
+		return -1;
+	}
+	if (growTable(loop, fd) == -1)
+		return -1;
+	if (loop->tab[fd].handler != NULL)
+	{
+		errno = EEXIST;
+		return -1;
+	}
+
+	switch (loop->backend)
+	{
+#ifdef __linux__
+		case EV_EPOLL:
+		{
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = fd;
+			if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+				return -1;
+			break;
+		}
+#endif
+		case EV_POLL:
+			if (loop->npfds == loop->pcap)
+			{
+				int cap = (loop->pcap > 0) ? loop->pcap * 2 : 64;
+				struct pollfd *p = realloc(loop->pfds,
+					cap * sizeof(struct pollfd));
+				if (p == NULL)
+					return -1;
+				loop->pfds = p;
+				loop->pcap = cap;
+			}
+			loop->pfds[loop->npfds].fd = fd;
+			loop->pfds[loop->npfds].events = POLLIN;
+			loop->pfds[loop->npfds].revents = 0;
+			loop->tab[fd].pidx = loop->npfds++;
+			break;
+
+		default:
+			FD_SET(fd, &loop->allset);
+			if (fd > loop->maxfd)
+				loop->maxfd = fd;
+			break;
+	}
+
+	loop->tab[fd].handler = handler;
+	loop->tab[fd].arg = arg;
+	loop->tab[fd].epoch = loop->epoch;
+	loop->count++;
+	return 0;
+}
+
+
+
+int evDel(struct evLoop *loop, int fd){
+
+	if (fd < 0 || fd >= loop->tabsize || loop->tab[fd].handler == NULL)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+
+	switch (loop->backend)
+	{
+#ifdef __linux__
+		case EV_EPOLL:
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+			break;
+#endif
+		case EV_POLL:
+			//l'array viene compattato al termine della scansione
+			loop->pfds[loop->tab[fd].pidx].fd = -1;
+			loop->pdirty = true;
+			break;
+
+		default:
+			FD_CLR(fd, &loop->allset);
+			while (loop->maxfd >= 0 && !FD_ISSET(loop->maxfd, &loop->allset))
+				loop->maxfd--;
+			break;
+	}
+
+	loop->tab[fd].handler = NULL;
+	loop->tab[fd].arg = NULL;
+	loop->count--;
+	return 0;
+}
+
+
+
+int evCount(struct evLoop *loop){
+	return loop->count;
+}
+
+
+
+/**
+@brief Invoca l'handler del socket fd, se è registrato da prima dell'attesa
+@return 1 se l'handler è stato invocato, 0 altrimenti
+*/
+static int dispatch(struct evLoop *loop, int fd){
+
+	if (fd >= loop->tabsize)
+		return 0;
+
+	struct evEntry *e = &loop->tab[fd];
+	if (e->handler == NULL || e->epoch == loop->epoch)
+		return 0;
+
+	e->handler(loop, fd, e->arg);
+	return 1;
+}
+
+
+
+/**
+@brief Elimina dall'array di pollfd le entry rimosse con evDel()
+*/
+static void compactPoll(struct evLoop *loop){
+
+	int i = 0, j = 0;
+	for (i = 0; i < loop->npfds; i++)
+	{
+		if (loop->pfds[i].fd == -1)
+			continue;
+		loop->pfds[j] = loop->pfds[i];
+		loop->tab[loop->pfds[j].fd].pidx = j;
+		j++;
+	}
+	loop->npfds = j;
+	loop->pdirty = false;
+}
+
+
+
+int evWait(struct evLoop *loop, int timeout){
+
+	int ready = 0;
+	int handled = 0;
+	int i = 0;
+
+	/*
+	gli handler invocati in questa attesa non vedono le entry aggiunte
+	durante la stessa (epoch uguale)
+	*/
+	loop->epoch++;
+
+	switch (loop->backend)
+	{
+#ifdef __linux__
+		case EV_EPOLL:
+		{
+			struct epoll_event events[EV_MAXEVENTS];
+
+			ready = epoll_wait(loop->epfd, events, EV_MAXEVENTS, timeout);
+			if (ready == -1)
+				return -1;
+			for (i = 0; i < ready; i++)
+				handled += dispatch(loop, events[i].data.fd);
+			break;
+		}
+#endif
+		case EV_POLL:
+		{
+			int n = loop->npfds;
+
+			ready = poll(loop->pfds, n, timeout);
+			if (ready == -1)
+				return -1;
+			for (i = 0; i < n && ready > 0; i++)
+			{
+				struct pollfd *p = &loop->pfds[i];
+				if (p->fd == -1 || p->revents == 0)
+					continue;
+				ready--;
+				handled += dispatch(loop, p->fd);
+			}
+			if (loop->pdirty)
+				compactPoll(loop);
+			break;
+		}
+
+		default:
+		{
+			/*
+			rset è un value-result argument: lo ricopiamo ad ogni attesa
+			*/
+			fd_set rset = loop->allset;
+			struct timeval tv, *tvp = NULL;
+
+			if (timeout >= 0)
+			{
+				tv.tv_sec = timeout / 1000;
+				tv.tv_usec = (timeout % 1000) * 1000;
+				tvp = &tv;
+			}
+
+			ready = select(loop->maxfd + 1, &rset, NULL, NULL, tvp);
+			if (ready == -1)
+				return -1;
+			for (i = 0; i <= loop->maxfd && ready > 0; i++)
+			{
+				if (!FD_ISSET(i, &rset))
+					continue;
+				ready--;
+				handled += dispatch(loop, i);
+			}
+			break;
+		}
+	}
+
+	return handled;
+}
+
+
+
+void evDestroy(struct evLoop *loop){
+
+	if (loop == NULL)
+		return;
+	if (loop->epfd != -1)
+		close(loop->epfd);
+	free(loop->pfds);
+	free(loop->tab);
+	free(loop);
+}
+
+
+
+long evRaiseFdLimit(void){
+
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+		return -1;
+	if (rl.rlim_cur < rl.rlim_max)
+	{
+		//su Mac OS X il limite hard può essere RLIM_INFINITY
+		rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY) ? 65536 : rl.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+			return -1;
+	}
+	return (long) rl.rlim_cur;
+}
+
+/** @} */
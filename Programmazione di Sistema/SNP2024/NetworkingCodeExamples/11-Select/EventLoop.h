@@ -0,0 +1,115 @@
+/**
+@addtogroup Group11
+@{
+*/
+/**
+@file 	EventLoop.h
+@author Catiuscia Melle
+
+@brief 	Interfaccia del modulo di I/O multiplexing con backend selezionabile.
+
+Il modulo nasconde dietro un'unica interfaccia tre meccanismi di attesa:
+<em>epoll()</em> (solo Linux), <em>poll()</em> e <em>select()</em>.
+Il chiamante registra un socket insieme alla funzione (handler) da invocare
+quando il socket è pronto in lettura; <em>evWait()</em> attende gli eventi e
+invoca gli handler dei soli socket pronti.
+*/
+
+#ifndef __EVENTLOOP_H__
+#define __EVENTLOOP_H__
+
+#include "Header.h"
+
+/** backend di I/O multiplexing disponibili */
+typedef enum {
+	EV_EPOLL, 	/**< epoll(), O(1) per socket pronto (solo Linux) */
+	EV_POLL, 	/**< poll(), O(n) per attesa, nessun limite sui descriptor */
+	EV_SELECT 	/**< select(), O(maxfd) per attesa, descriptor < FD_SETSIZE */
+} evBackend;
+
+struct evLoop; //struttura opaca, definita in EventLoop.c
+
+/**
+@brief Funzione invocata quando un socket registrato è pronto in lettura
+@param loop - l'event loop che ha rilevato l'evento
+@param fd - il socket pronto
+@param arg - il parametro specificato in evAdd()
+*/
+typedef void (*evHandler)(struct evLoop *loop, int fd, void *arg);
+
+
+/**
+@brief Converte il nome di un backend ("epoll", "poll", "select")
+@param name - nome del backend
+@return il backend corrispondente, -1 se il nome non è valido o il
+backend non è disponibile su questa piattaforma
+*/
+int evBackendFromName(const char *name);
+
+/**
+@brief Restituisce il nome del backend usato dall'event loop
+*/
+const char *evBackendName(struct evLoop *loop);
+
+/**
+@brief Crea un event loop che usa il backend specificato
+@param backend - EV_EPOLL, EV_POLL o EV_SELECT
+@return ptr all'event loop, NULL in caso di errore
+*/
+struct evLoop *evCreate(evBackend backend);
+
+/**
+@brief Registra un socket da monitorare in lettura
+@param loop - l'event loop
+@param fd - il socket da monitorare
+@param handler - funzione invocata quando fd è pronto
+@param arg - parametro passato all'handler
+@return 0 in caso di successo, -1 in caso di errore (con select(), se fd
+non è inferiore a FD_SETSIZE, errno vale EMFILE)
+
+La tabella degli handler è indicizzata dal descriptor e cresce secondo
+necessità: il numero di socket non ha limiti (eccetto RLIMIT_NOFILE).
+*/
+int evAdd(struct evLoop *loop, int fd, evHandler handler, void *arg);
+
+/**
+@brief Rimuove un socket dall'insieme di quelli monitorati
+@param loop - l'event loop
+@param fd - il socket da rimuovere (da invocare prima di close(fd))
+@return 0 in caso di successo, -1 se fd non era registrato
+
+Può essere invocata anche da un handler, per qualsiasi socket.
+*/
+int evDel(struct evLoop *loop, int fd);
+
+/**
+@brief Restituisce il numero di socket registrati
+*/
+int evCount(struct evLoop *loop);
+
+/**
+@brief Attende che almeno un socket sia pronto ed invoca i relativi handler
+@param loop - l'event loop
+@param timeout - attesa massima in millisecondi (-1 per attendere
+indefinitamente)
+@return numero di handler invocati (0 se scade il timeout), -1 in caso
+di errore
+*/
+int evWait(struct evLoop *loop, int timeout);
+
+/**
+@brief Dealloca l'event loop (non chiude i socket registrati)
+*/
+void evDestroy(struct evLoop *loop);
+
+/**
+@brief Alza il limite soft RLIMIT_NOFILE fino al limite hard
+@return il nuovo limite sul numero di descriptor, -1 in caso di errore
+
+Necessaria per gestire più di 1024 connessioni.
+*/
+long evRaiseFdLimit(void);
+
+#endif /* __EVENTLOOP_H__ */
+
+/** @} */
@@ -35,9 +35,8 @@ L'header definisce costanti comuni al client e server.
 #define SERVICEPORT 	"49152" 	/**< TCP listening port, name */
 #define PORT_STRLEN 6 /**< lunghezza di una stringa rappresentativa di un indirizzo di trasporto */
 
-#define BACKLOG 10 	/**< dimensione della coda di connessioni */
-
-#define SIZE 15 /**< dimensione della coda di connessioni concorrenti gestite dal server */
+#define BACKLOG SOMAXCONN 	/**< dimensione della coda di connessioni (massima, per gestire
+						molte connessioni in arrivo) */
 
 #define BUFSIZE 512 /**< dimensione del buffer di messaggio */
 
@@ -0,0 +1,258 @@
+/**
+@addtogroup Group11 
+@{
+*/
+/**
+@file 	LoadClient.c
+@author Catiuscia Melle
+
+@brief TCP Client per misurare la latenza del server con molte connessioni.
+
+Il client apre <em>idle</em> connessioni TCP che restano inattive, e poi
+<em>active</em> connessioni su cui, per <em>seconds</em> secondi, invia un
+messaggio ed attende la risposta del server prima di inviare il successivo
+(un solo messaggio in transito per connessione).
+Le connessioni attive sono monitorate con <em>poll()</em>.
+
+Al termine visualizza il numero di messaggi al secondo e la distribuzione
+della latenza (round trip time) dei messaggi: confrontando i backend del
+server (epoll, poll, select) si osserva il costo per attesa di poll() e
+select(), proporzionale al numero totale di connessioni e non al numero
+di connessioni attive.
+
+Esempio (10000 connessioni inattive, 100 attive):
+	$ ./SelectS 4 epoll > /dev/null &
+	$ ./LoadC 127.0.0.1 10000 100 10
+*/
+
+#include "Header.h"
+#include "Utility.h"
+#include "EventLoop.h"
+
+#include <poll.h>
+#include <time.h>
+
+#define MAXSAMPLES 4000000 	/**< numero massimo di campioni di latenza */
+
+
+/**
+@brief Restituisce il tempo corrente in microsecondi
+*/
+double now_us(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+/**
+@brief Apre una connessione TCP verso l'indirizzo risolto
+@return il socket connesso, -1 in caso di errore
+*/
+int connect_to(struct addrinfo *ai){
+
+	int sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (sock == -1)
+	{
+		perror("socket() error: ");
+		return INSUCCESS;
+	}
+	if (connect(sock, ai->ai_addr, ai->ai_addrlen) == -1)
+	{
+		perror("connect() error: ");
+		close(sock);
+		return INSUCCESS;
+	}
+	return sock;
+}
+
+
+/**
+@brief Funzione di confronto per qsort()
+*/
+int cmp_double(const void *a, const void *b){
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+@brief Funzione di utilità
+@param name, nome dell'eseguibile
+*/
+void usage(char *name){
+	printf("Usage: %s <hostname> <idle> <active> <seconds>\n", name);
+}
+
+
+
+int main(int argc, char *argv[]){
+
+	if (argc != 5)
+	{
+		usage(argv[0]);
+		return INVALID;
+	}
+
+	int nidle = atoi(argv[2]);
+	int nactive = atoi(argv[3]);
+	int secs = atoi(argv[4]);
+	if ((nidle < 0) || (nactive <= 0) || (secs <= 0))
+	{
+		usage(argv[0]);
+		return INVALID;
+	}
+
+	long limit = evRaiseFdLimit();
+	if (nidle + nactive + 16 > limit)
+	{
+		printf("Troppe connessioni: il limite sui descriptor è %ld\n", limit);
+		return ERROR;
+	}
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	int rv = getaddrinfo(argv[1], SERVICEPORT, &hints, &res);
+	if (rv != 0)
+	{
+		printf("getaddrinfo: %s\n", gai_strerror(rv));
+		return FAILURE;
+	}
+
+	//apro le connessioni inattive
+	int *idle = calloc(nidle + 1, sizeof(int));
+	if (idle == NULL)
+	{
+		perror("calloc() error: ");
+		return FAILURE;
+	}
+	int i = 0;
+	for (i = 0; i < nidle; i++)
+	{
+		idle[i] = connect_to(res);
+		if (idle[i] == -1)
+			return FAILURE;
+	}
+	printf("%d idle connections open\n", nidle);
+
+	//apro le connessioni attive
+	struct pollfd *pfds = calloc(nactive, sizeof(struct pollfd));
+	if (pfds == NULL)
+	{
+		perror("calloc() error: ");
+		return FAILURE;
+	}
+	double *sent_at = calloc(nactive, sizeof(double));
+	if (sent_at == NULL)
+	{
+		perror("calloc() error: ");
+		return FAILURE;
+	}
+	double *samples = malloc(MAXSAMPLES * sizeof(double));
+	if (samples == NULL)
+	{
+		perror("malloc() error: ");
+		return FAILURE;
+	}
+	for (i = 0; i < nactive; i++)
+	{
+		pfds[i].fd = connect_to(res);
+		if (pfds[i].fd == -1)
+			return FAILURE;
+		pfds[i].events = POLLIN;
+	}
+	freeaddrinfo(res);
+
+	char msg[BUFSIZE] = "";
+	char reply[BUFSIZE] = "";
+	int len = snprintf(msg, BUFSIZE, "latency probe message");
+	long nsamples = 0;
+	long nmsgs = 0;
+
+	double start = now_us();
+	double end = start + secs * 1e6;
+
+	//ogni connessione attiva invia il primo messaggio
+	for (i = 0; i < nactive; i++)
+	{
+		sent_at[i] = now_us();
+		if (send(pfds[i].fd, msg, len, 0) != len)
+		{
+			perror("send() error: ");
+			return FAILURE;
+		}
+	}
+
+	while (now_us() < end)
+	{
+		int ready = poll(pfds, nactive, 1000);
+		if (ready == -1)
+		{
+			perror("poll() error: ");
+			return FAILURE;
+		}
+
+		for (i = 0; (i < nactive) && (ready > 0); i++)
+		{
+			if (pfds[i].revents == 0)
+				continue;
+			ready--;
+
+			//la risposta ha la stessa lunghezza del messaggio
+			int got = 0;
+			while (got < len)
+			{
+				ssize_t n = recv(pfds[i].fd, reply + got, len - got, 0);
+				if (n <= 0)
+				{
+					printf("Il server ha chiuso la connessione\n");
+					return FAILURE;
+				}
+				got += n;
+			}
+
+			double t = now_us();
+			if (nsamples < MAXSAMPLES)
+				samples[nsamples++] = t - sent_at[i];
+			nmsgs++;
+
+			sent_at[i] = t;
+			if (send(pfds[i].fd, msg, len, 0) != len)
+			{
+				perror("send() error: ");
+				return FAILURE;
+			}
+		}
+	}
+	double elapsed = (now_us() - start) / 1e6;
+
+	qsort(samples, nsamples, sizeof(double), cmp_double);
+
+	printf("%d idle + %d active connections, %.1f s\n", nidle, nactive, elapsed);
+	printf("%.0f msg/s\n", nmsgs / elapsed);
+	if (nsamples > 0)
+	{
+		printf("latency (us): p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+			samples[nsamples / 2], samples[nsamples * 9 / 10],
+			samples[nsamples * 99 / 100], samples[nsamples - 1]);
+	}
+
+	//chiudo tutte le connessioni
+	for (i = 0; i < nactive; i++)
+		close(pfds[i].fd);
+	for (i = 0; i < nidle; i++)
+		close(idle[i]);
+
+	free(idle);
+	free(pfds);
+	free(sent_at);
+	free(samples);
+
+return 0;
+}
+
+/** @} */
@@ -13,93 +13,85 @@
 		-# accepted TCP sockets (established connections)
 		-# UDP sockets
 
-Il server aggiunge il socket connesso TCP al set di descriptor da monitorare.
+Il server registra ogni socket nell'event loop (EventLoop.c) insieme alla funzione che ne gestisce gli eventi:
+il backend di attesa (<em>epoll()</em>, <em>poll()</em> o <em>select()</em>) è scelto da linea di comando.
+Ad ogni attesa vengono invocati i soli handler dei socket pronti, senza scandire tutte le connessioni,
+ed il numero di connessioni TCP non è limitato da un array di dimensione fissa
+(con <em>select()</em> resta il limite FD_SETSIZE sul valore dei descriptor).
 Il codice è protocol-indipendent (utilizzo di <em>getnameinfo()</em> per la lettura dei dati del client da una <em>struct sockaddr_storage</em>). 
 
 */
 
 #include "Header.h"
 #include "Utility.h"
+#include "EventLoop.h"
+
+#include <fcntl.h>
+
 
 /**
-variabili globale client sockets array
-rappresenta l'array di socket descriptor connessi ai client TCP
+@brief Handler del socket UDP: riceve il datagram e risponde
 */
-int conn_set[SIZE]; 
-
+void onUDPMessage(struct evLoop *loop, int sockU, void *arg){
+	handleUDPMessage(sockU);
+}
 
 
 /**
-@brief aggiunge la nuova connessione all'array di client connessi
-@param sockfd, il socket della nuova connessione
-@param conn_set, ptr all'array delle connessioni
-@param dim, dimensione dell'array
-@return true se la nuova connessione è stata registrata, false se la coda è piena
+@brief Handler di una connessione TCP: elabora il messaggio del client.
+Se il client ha chiuso la connessione (o in caso di errore), il socket viene rimosso
+dall'event loop e chiuso.
 */
-bool add_client(int sockfd, int *conn_set, int dim){
-	
-	int i = 0;
-	bool is_registered = false;
-	for (i = 0; i < dim; i++)
+void onTCPClient(struct evLoop *loop, int sock, void *arg){
+
+	int status = handleTCPClient(sock);
+	if (status <= 0)
 	{
-		if (conn_set[i] == -1)
-		{
-			conn_set[i] = sockfd;
-			is_registered = true;
-			break;
-		}
+		//rimuovo il socket dal set da monitorare prima di chiuderlo
+		evDel(loop, sock);
+		close(sock);
 	}
-
-	return is_registered;
 }
 
 
 /**
-@brief Funzione che gestisce l'arrivo di nuove connessioni sul listening socket TCP.
-@param sockT - listening TCP socket del server
-@return intero:
--# pari a -1 se la connessione è stata rifiutata.
--# pari al socket descriptor della nuova connessione (se correttamente inserita in elenco)
+@brief Handler del listening socket TCP: accetta le nuove connessioni e le registra
+nell'event loop.
+
+Il listening socket è non bloccante: ad ogni evento si accettano tutte le connessioni
+in coda, fino ad EAGAIN, in modo che la coda non si riempia quando molti client
+si connettono insieme.
 */
-int handleNewConn(int sockT){
+void onNewConn(struct evLoop *loop, int sockT, void *arg){
 
 	struct sockaddr_storage client; 
 	socklen_t sslen = sizeof(client);
 
-	int conn = accept(sockT, (struct sockaddr *)&client, &sslen);
-	if (conn == -1)
+	while (1)
 	{
-		perror("accept() error: ");
-		return -1;
-	}
-
-	printf("TCP listening socket accepted new connection from ");
-	printAddressInfo((struct sockaddr *)&client, sslen);
-	printf("\n");
-
-	bool is_added = add_client(conn, conn_set, SIZE);
-	if (is_added == false)
-	{
-		printf("max client queue\n");
-		close(conn);
-		return -1;
-	}
-
-return conn;
-}
+		sslen = sizeof(client);
+		int conn = accept(sockT, (struct sockaddr *)&client, &sslen);
+		if (conn == -1)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				perror("accept() error: ");
+			return;
+		}
 
+		//su Mac OS X il socket connesso eredita O_NONBLOCK: handleTCPClient() usa I/O bloccante
+		fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) & ~O_NONBLOCK);
 
-/** 
-@brief Inizializza l'array dei socket connessi
-@param conn_set, ptr all'arrayd di interi
-@param dim, dimensione dell'array
-*/
-void setConnSet(int *conn_set, int dim){
+		printf("TCP listening socket accepted new connection from ");
+		printAddressInfo((struct sockaddr *)&client, sslen);
+		printf("\n");
 
-	int i = 0;
-	for (i = 0; i < dim; i++)
-	{
-		conn_set[i] = -1;
+		if (evAdd(loop, conn, onTCPClient, NULL) == -1)
+		{
+			perror("evAdd() error: ");
+			close(conn);
+			continue;
+		}
+		printf("%d TCP connections\n", evCount(loop) - 2);
 	}
 }
 
@@ -109,22 +101,41 @@ void setConnSet(int *conn_set, int dim){
 @param name, nome dell'eseguibile
 */
 void usage(char *name){
-	printf("Usage: %s <domain>\n", name);
+	printf("Usage: %s <domain> [backend]\n", name);
 	printf("\tdomain: 0 (UNSPEC), 4 (INET), 6 (INET6)\n");
+#ifdef __linux__
+	printf("\tbackend: epoll (default), poll, select\n");
+#else
+	printf("\tbackend: poll (default), select\n");
+#endif
 } 
 
 
 
 int main(int argc, char *argv[]){
 
-	if (argc != 2) 
+	if ((argc != 2) && (argc != 3))
 	{
 		usage(argv[0]);
 		return INVALID;
 	}
 	
 	int family = getFamily(argv[1]);
-	
+
+#ifdef __linux__
+	int backend = EV_EPOLL;
+#else
+	int backend = EV_POLL;
+#endif
+	if (argc == 3)
+	{
+		backend = evBackendFromName(argv[2]);
+		if (backend == -1)
+		{
+			usage(argv[0]);
+			return INVALID;
+		}
+	}
 	
 	int sockT = 0; //TCP listening socket
 	int sockU = 0; //UDP listening socket
@@ -146,134 +157,51 @@ int main(int argc, char *argv[]){
 	*/
 	printf("TCP Server and UDP server running on port %s\n", SERVICEPORT);
 
-	//inizializzo l'array
-	setConnSet(conn_set, SIZE); 
-
-	//handle delle nuove connessioni (socket connessi)
-	int conn = 0; 
+	//listening socket non bloccante (vedi onNewConn())
+	fcntl(sockT, F_SETFL, fcntl(sockT, F_GETFL) | O_NONBLOCK);
 
-	//protocol-independent management of connections
-	struct sockaddr_storage client; 
-	socklen_t sslen = sizeof(client);
+	//oltre 1024 connessioni occorre alzare il limite sui descriptor
+	long limit = evRaiseFdLimit();
 
+	struct evLoop *loop = evCreate(backend);
+	if (loop == NULL)
+	{
+		perror("evCreate() error: ");
+		return ERROR;
+	}
+	printf("Using %s(), up to %ld descriptors\n", evBackendName(loop), limit);
 
 	/*
-	definiamo il set dei file descriptor da monitorare:
+	registriamo i socket da monitorare in lettura:
 	il server sarà in attesa di:
 	- connessioni 
 	- messaggi, 
 	- e tutte condizioni monitorabili in lettura
 	*/
-
-	//dichiaro 2 read file descriptor set
-	fd_set rset, allset; 
-
-	FD_ZERO(&rset); //azzero set descrittori
-	FD_ZERO(&allset); //azzero set descrittori copia
-
-	FD_SET(sockT, &rset); //aggiungo socket TCP
-	FD_SET(sockU, &rset); //aggiungo socket UDP
-
-	//prendo il max tra i 2, più 1
-	int max = (sockT > sockU)?sockT+1: sockU+1; 
-
-	//duplico il set - allset contiene sempre i 2 socket TCP ed UDP
-	allset = rset; 
+	if ((evAdd(loop, sockT, onNewConn, NULL) == -1) ||
+		(evAdd(loop, sockU, onUDPMessage, NULL) == -1))
+	{
+		perror("evAdd() error: ");
+		return ERROR;
+	}
 	
 	int result = 0;
 	int quit = 0;
 	while (!quit)
 	{
-		/*
-		rfds è un value-result argument, modificato da select():
-		dobbiamo re-inizializzarlo
-		*/
-		FD_ZERO(&rset);
-		rset = allset; 
-
-		//wait for select forever
-		result = select(max, &rset, NULL, NULL, NULL);
+		//wait forever: gli handler dei socket pronti sono invocati da evWait()
+		result = evWait(loop, -1);
 
 		if (result == -1)
 		{
-			perror("select() error: ");
+			perror("evWait() error: ");
 			continue;
 		}
-		else if (result == 0)
-		{ 
-			//timeout su select (non specificato, non dovrei mai arrivarci)
-			continue;	
-		} 
-		else 
-		{
-			//result è pari al numero di descriptor pronti in lettura...
-			printf("%d socket ready for reading\n", result);
-
-			//verifichiamo chi ha dati da leggere...
-			if ( FD_ISSET(sockU, &rset))
-			{
-				printf("Received a datagram...\n");
-				handleUDPMessage(sockU);
-				//printf("decrement result...\n");
-				result--;
-			}
-
-			if ( FD_ISSET(sockT, &rset))
-			{
-				//new TCP Connection 
-				conn = handleNewConn(sockT);
-			
-				if (conn != -1)
-				{ 
-					//printf("add new conn to allset\n");
-					FD_SET(conn, &allset);
-				
-					if ( (conn + 1) > max)
-						max = conn+1;
-				}
-				result--;
-			}
-
-			if (result == 0)
-			{
-				//skip the rest
-				continue;
-			}
-
-			//a questo punto devo controllare tutte le connessioni attive dei client
-			int j = 0; //indice dell'array di connessioni TCP client
-			while (result > 0)
-			{
-				if ( (conn_set[j] != -1)  && FD_ISSET(conn_set[j], &rset))
-				{
-					printf("Client Connection number %d ready for reading ...\n", j);
-					int status = handleTCPClient(conn_set[j]);
-
-					//decremento result
-					result--;
-
-					if (status == 0)
-					{ 
-						//client ha chiuso la connessione
-						close(conn_set[j]);
-
-						//rimuovo il socket dal set da monitorare
-						FD_CLR(conn_set[j], &allset);
-
-						//libero la sua posizione nell'array
-						conn_set[j] = -1;
-					}//fi status
-				}//fi FD_ISSET
-				
-				//passo al prossimo elemento dell'array di connessioni TCP 
-				j++;
-			}//wend client connection
-
-		}//fi result
 
 	}//wend
 	
 	//never here
+	evDestroy(loop);
 	close(sockT);
 	close(sockU);
 	
@@ -0,0 +1,239 @@
+/**
+@addtogroup Group14
+@{
+*/
+/**
+@file 	Feed.c
+@author Catiuscia Melle
+@brief 	Sender e receiver di un feed multicast sequenziato (solo Linux).
+
+In modalità <em>send</em> il programma invia al gruppo multicast, per
+<em>secs</em> secondi, messaggi di <em>size</em> byte (default 64) con
+numeri di sequenza consecutivi (struct feedHeader), a <em>rate</em> messaggi
+al secondo (0 per inviare alla massima velocità), con una
+<em>sendmmsg()</em> ogni RELAY_BATCH messaggi.
+
+In modalità <em>recv</em> il programma esegue il join al gruppo, riceve
+per <em>secs</em> secondi con <em>recvmmsg()</em>, e visualizza ogni
+secondo i messaggi ricevuti al secondo, i messaggi persi (gap nella
+sequenza di ogni sender) e quelli fuori ordine.
+
+Serve per misurare il throughput e le perdite di MulticastRelay.
+*/
+
+#define _GNU_SOURCE //recvmmsg(), sendmmsg()
+#include "Relay.h"
+
+#include <sys/time.h>
+
+
+/**
+@brief Restituisce il tempo corrente in secondi
+*/
+double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+@brief Invia il feed sequenziato al gruppo
+*/
+int feedSend(char *group, char *port, long rate, int secs, size_t size){
+
+	struct sockaddr_storage addr;
+	socklen_t len = 0;
+	if (resolveGroup(group, port, &addr, &len) == -1)
+		return FAILURE;
+
+	int sockfd = socket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (sockfd < 0)
+	{
+		perror("socket() error: ");
+		return FAILURE;
+	}
+	setTTL(sockfd, 1, addr.ss_family);
+
+	static char bufs[RELAY_BATCH][RELAY_MSGSIZE];
+	struct mmsghdr msgs[RELAY_BATCH];
+	struct iovec iovs[RELAY_BATCH];
+	int i = 0;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RELAY_BATCH; i++)
+	{
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = size;
+		msgs[i].msg_hdr.msg_name = &addr;
+		msgs[i].msg_hdr.msg_namelen = len;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	uint64_t seq = 0;
+	unsigned long errors = 0;
+	double start = now();
+	double end = start + secs;
+
+	double t = 0;
+	while ((t = now()) < end)
+	{
+		int n = RELAY_BATCH;
+
+		//con rate limitato, invio solo i messaggi già dovuti; se non ce ne
+		//sono, attendo il prossimo (al più fino alla fine) e ricontrollo
+		if (rate > 0)
+		{
+			uint64_t due = (uint64_t)((t - start) * rate) + 1;
+			if (due <= seq)
+			{
+				double next = start + (double)seq / rate;
+				double wait = ((next < end) ? next : end) - t;
+				struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+				nanosleep(&ts, NULL);
+				continue;
+			}
+			if (due - seq < (uint64_t)n)
+				n = (int)(due - seq);
+		}
+
+		for (i = 0; i < n; i++)
+			feedEncode(bufs[i], size, seq + i);
+
+		int j = 0;
+		while (j < n)
+		{
+			int sent = sendmmsg(sockfd, &msgs[j], n - j, 0);
+			if (sent < 0)
+			{
+				//il messaggio non inviato resta un gap nella sequenza
+				errors++;
+				j++;
+				continue;
+			}
+			j += sent;
+		}
+		seq += n;
+	}
+
+	double elapsed = now() - start;
+	printf("sent %llu messages of %zu bytes in %.1f s: %.0f msg/s, %.1f MB/s, %lu errors\n",
+		(unsigned long long)seq, size, elapsed, seq / elapsed,
+		seq * size / elapsed / 1e6, errors);
+
+	close(sockfd);
+	return SUCCESS;
+}
+
+
+/**
+@brief Riceve il feed dal gruppo e verifica i numeri di sequenza
+*/
+int feedRecv(char *group, char *port, int secs){
+
+	int sockfd = openGroupReceiver(group, port, 4 * 1024 * 1024);
+	if (sockfd == -1)
+		return FAILURE;
+
+	//timeout in ricezione, per visualizzare le statistiche anche senza traffico
+	struct timeval tv = { 1, 0 };
+	setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	static char bufs[RELAY_BATCH][RELAY_MSGSIZE];
+	struct mmsghdr msgs[RELAY_BATCH];
+	struct iovec iovs[RELAY_BATCH];
+	struct sockaddr_storage addrs[RELAY_BATCH];
+	int i = 0;
+
+	//la tabella contiene SEQ_MAXSOURCES sender: non sta sullo stack
+	static struct seqTable tab;
+	struct seqTracker t;
+	memset(&t, 0, sizeof(t));
+	unsigned long total = 0, prev = 0;
+
+	double start = now();
+	double end = start + secs;
+	double next = start + 1;
+
+	while (now() < end)
+	{
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < RELAY_BATCH; i++)
+		{
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = RELAY_MSGSIZE;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		}
+
+		int got = recvmmsg(sockfd, msgs, RELAY_BATCH, MSG_WAITFORONE, NULL);
+		if (got < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+			{
+				perror("recvmmsg() error: ");
+				break;
+			}
+			got = 0;
+		}
+
+		for (i = 0; i < got; i++)
+			seqCheckFrom(&tab, &addrs[i], bufs[i], msgs[i].msg_len);
+		total += got;
+		seqTotals(&tab, &t);
+
+		if (now() >= next)
+		{
+			printf("%9lu msg/s  lost %lu  late %lu\n", total - prev, t.lost, t.late);
+			prev = total;
+			next += 1;
+		}
+	}
+
+	unsigned long expected = total - t.late + t.lost - t.unsequenced;
+	printf("received %lu messages from %d senders in %d s, lost %lu (%.3f%%), "
+		"late %lu, restarts %lu\n", total, seqTotals(&tab, &t), secs, t.lost,
+		expected ? 100.0 * t.lost / expected : 0.0, t.late, t.restarts);
+
+	//la chiusura del socket comporta il leave dal gruppo
+	close(sockfd);
+	return SUCCESS;
+}
+
+
+/**
+@brief Funzione di utilità
+@param name, nome dell'eseguibile
+*/
+void usage(char *name){
+	printf("Usage: %s send <group> <port> <rate> <secs> [size]\n", name);
+	printf("       %s recv <group> <port> <secs>\n", name);
+	printf("\trate: messaggi al secondo, 0 per la massima velocità\n");
+}
+
+
+
+int main(int argc, char *argv[]){
+
+	if ((argc >= 6) && (argc <= 7) && (strcmp(argv[1], "send") == 0))
+	{
+		size_t size = (argc == 7) ? atoi(argv[6]) : 64;
+		if ((size < sizeof(struct feedHeader)) || (size > RELAY_MSGSIZE))
+		{
+			printf("size deve essere tra %zu e %d\n", sizeof(struct feedHeader), RELAY_MSGSIZE);
+			return FAILURE;
+		}
+		return (feedSend(argv[2], argv[3], atol(argv[4]), atoi(argv[5]), size) == SUCCESS) ? 0 : 1;
+	}
+
+	if ((argc == 5) && (strcmp(argv[1], "recv") == 0))
+		return (feedRecv(argv[2], argv[3], atoi(argv[4])) == SUCCESS) ? 0 : 1;
+
+	usage(argv[0]);
+	return FAILURE;
+}
+
+/** @} */
@@ -0,0 +1,130 @@
+/**
+@addtogroup Group14
+@{
+*/
+/**
+@file 	MulticastRelay.c
+@author Catiuscia Melle
+@brief 	Relay multicast multi-thread (solo Linux).
+
+Il relay esegue il join al gruppo di ingresso e ritrasmette ogni datagram
+ricevuto su tutti i gruppi di uscita (vedi Relay.c). A differenza di
+ChatMulticast, che usa un processo figlio ed una <em>recvfrom()</em> per
+messaggio, il relay usa due thread ed un ring buffer, riceve con
+<em>recvmmsg()</em> ed invia con <em>sendmmsg()</em>.
+
+Ogni secondo visualizza, per il gruppo di ingresso, i messaggi ed i byte
+ricevuti al secondo, i sender, i messaggi persi (gap nei numeri di sequenza
+del feed, verificati per ogni sender) e quelli fuori ordine; per ogni gruppo di uscita, i messaggi inviati al
+secondo e quelli non inviati.
+
+Esempio:
+	$ ./MulticastRelay 239.255.255.150 45678 45679 239.255.255.151 239.255.255.152
+	$ ./Feed recv 239.255.255.151 45679 10
+	$ ./Feed send 239.255.255.150 45678 0 5
+*/
+
+#define _GNU_SOURCE //recvmmsg(), sendmmsg()
+#include "Relay.h"
+
+#define RELAY_RCVBUF (4 * 1024 * 1024) 	/**< receive buffer del socket di ingresso */
+
+
+/**
+@brief Funzione di utilità
+@param name, nome dell'eseguibile
+*/
+void usage(char *name){
+	printf("Usage: %s <in-group> <in-port> <out-port> <out-group> [out-group ...]\n", name);
+	printf("\tal massimo %d gruppi di uscita\n", RELAY_MAXGROUPS);
+}
+
+
+
+int main(int argc, char *argv[]){
+
+	if ((argc < 5) || (argc - 4 > RELAY_MAXGROUPS))
+	{
+		usage(argv[0]);
+		return FAILURE;
+	}
+
+	static struct relay r; //contiene i contatori: meglio non sullo stack
+	memset(&r, 0, sizeof(r));
+
+	char *ingroup = argv[1];
+	char *inport = argv[2];
+	char *outport = argv[3];
+	int i = 0;
+
+	printf("Multicast RELAY %s:%s ->", ingroup, inport);
+	for (i = 4; i < argc; i++)
+	{
+		if ((strcmp(argv[i], ingroup) == 0) && (strcmp(outport, inport) == 0))
+		{
+			printf("\nil gruppo di uscita coincide con quello di ingresso\n");
+			return FAILURE;
+		}
+		if (resolveGroup(argv[i], outport, &r.groups[r.ngroups], &r.grouplens[r.ngroups]) == -1)
+			return FAILURE;
+		r.ngroups++;
+		printf(" %s:%s", argv[i], outport);
+	}
+	printf("\n");
+
+	r.insock = openGroupReceiver(ingroup, inport, RELAY_RCVBUF);
+	if (r.insock == -1)
+	{
+		printf("Error on join multicast group\n");
+		return FAILURE;
+	}
+
+	r.outsock = socket(r.groups[0].ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (r.outsock < 0)
+	{
+		perror("socket() error: ");
+		return FAILURE;
+	}
+	//TTL 1: il traffico ritrasmesso resta nella rete locale
+	if (setTTL(r.outsock, 1, r.groups[0].ss_family) != SUCCESS)
+		return FAILURE;
+
+	if (relayStart(&r, RELAY_RINGSIZE, RELAY_BATCH) == -1)
+		return FAILURE;
+
+	struct groupStats in, prevIn;
+	struct seqTracker seq;
+	struct groupStats out[RELAY_MAXGROUPS], prevOut[RELAY_MAXGROUPS];
+	memset(&prevIn, 0, sizeof(prevIn));
+	memset(prevOut, 0, sizeof(prevOut));
+
+	while (1)
+	{
+		sleep(1);
+		int sources = relayStats(&r, &in, &seq, out);
+
+		unsigned long msgs = in.msgs - prevIn.msgs;
+		unsigned long calls = in.calls - prevIn.calls;
+		printf("in  %s:%s %9lu msg/s %8.1f MB/s  %5.1f msg/call  "
+			"senders %d  lost %lu  late %lu  restarts %lu\n",
+			ingroup, inport, msgs, (in.bytes - prevIn.bytes) / 1e6,
+			calls ? (double)msgs / calls : 0.0, sources, seq.lost, seq.late,
+			seq.restarts);
+
+		for (i = 0; i < r.ngroups; i++)
+		{
+			printf("out %s:%s %9lu msg/s %8.1f MB/s  errors %lu\n",
+				argv[4 + i], outport, out[i].msgs - prevOut[i].msgs,
+				(out[i].bytes - prevOut[i].bytes) / 1e6, out[i].errors);
+		}
+
+		fflush(stdout);
+
+		prevIn = in;
+		memcpy(prevOut, out, sizeof(out));
+	}
+
+return 0;
+}
+
+/** @} */
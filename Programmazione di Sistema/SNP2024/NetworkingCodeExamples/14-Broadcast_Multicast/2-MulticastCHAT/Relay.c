@@ -0,0 +1,483 @@
+/**
+@addtogroup Group14
+@{
+*/
+/**
+@file 	Relay.c
+@author Catiuscia Melle
+
+@brief Implementazione del relay multicast multi-thread (solo Linux).
+
+Il ring è condiviso da un solo produttore (il receiver) e da un solo
+consumatore (il forwarder): gli indici head e tail crescono sempre, lo slot
+è dato da (indice & (ringsize - 1)). Il mutex è acquisito una sola volta per
+batch di datagram, per aggiornare gli indici ed i contatori, mai durante le
+system call.
+
+Se il forwarder non riesce a tenere il passo, il ring si riempie ed il
+receiver si ferma: i datagram in eccesso sono scartati dal kernel quando il
+receive buffer del socket è pieno, e sono rilevati come gap nei numeri di
+sequenza.
+*/
+
+#define _GNU_SOURCE //recvmmsg(), sendmmsg()
+#include "Relay.h"
+
+
+/**
+@brief Conversione di un intero a 64 bit in network byte order
+*/
+static uint64_t hton64(uint64_t v){
+	uint32_t hi = htonl((uint32_t)(v >> 32));
+	uint32_t lo = htonl((uint32_t)v);
+	uint64_t r = 0;
+	memcpy(&r, &hi, 4);
+	memcpy((char *)&r + 4, &lo, 4);
+	return r;
+}
+
+/**
+@brief Conversione di un intero a 64 bit da network byte order
+*/
+static uint64_t ntoh64(uint64_t v){
+	uint32_t hi = 0, lo = 0;
+	memcpy(&hi, &v, 4);
+	memcpy(&lo, (char *)&v + 4, 4);
+	return ((uint64_t)ntohl(hi) << 32) | ntohl(lo);
+}
+
+
+
+void feedEncode(char *buf, size_t len, uint64_t seq){
+
+	struct feedHeader h;
+	h.magic = htonl(FEED_MAGIC);
+	h.len = htonl((uint32_t)len);
+	h.seq = hton64(seq);
+	memcpy(buf, &h, sizeof(h));
+	memset(buf + sizeof(h), 'x', len - sizeof(h));
+}
+
+
+
+void seqCheck(struct seqTracker *t, const char *buf, size_t len){
+
+	struct feedHeader h;
+	if (len < sizeof(h))
+	{
+		t->unsequenced++;
+		return;
+	}
+
+	memcpy(&h, buf, sizeof(h));
+	if (ntohl(h.magic) != FEED_MAGIC)
+	{
+		t->unsequenced++;
+		return;
+	}
+
+	uint64_t seq = ntoh64(h.seq);
+	if (!t->started)
+	{
+		//il primo messaggio ricevuto fissa l'inizio della sequenza
+		t->started = true;
+		t->expected = seq + 1;
+	}
+	else if ((seq < t->expected) && (t->expected - seq > SEQ_RESYNC))
+	{
+		//salto all'indietro troppo ampio: il sender è ripartito da capo
+		t->restarts++;
+		t->expected = seq + 1;
+	}
+	else if (seq >= t->expected)
+	{
+		//seq > expected: i messaggi intermedi sono andati persi
+		t->lost += seq - t->expected;
+		t->expected = seq + 1;
+	}
+	else
+	{
+		//duplicato, o arrivato dopo un messaggio successivo (già contato come perso)
+		t->late++;
+	}
+}
+
+
+
+/**
+@brief Verifica se due indirizzi identificano lo stesso sender (IP e porta)
+*/
+static bool sameSource(const struct sockaddr_storage *a,
+	const struct sockaddr_storage *b){
+
+	if (a->ss_family != b->ss_family)
+		return false;
+
+	if (a->ss_family == AF_INET)
+	{
+		const struct sockaddr_in *x = (const struct sockaddr_in *)a;
+		const struct sockaddr_in *y = (const struct sockaddr_in *)b;
+		return (x->sin_port == y->sin_port) &&
+			(x->sin_addr.s_addr == y->sin_addr.s_addr);
+	}
+
+	if (a->ss_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *x = (const struct sockaddr_in6 *)a;
+		const struct sockaddr_in6 *y = (const struct sockaddr_in6 *)b;
+		return (x->sin6_port == y->sin6_port) &&
+			(memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0);
+	}
+
+	return false;
+}
+
+
+
+/**
+@brief Accumula i contatori di un sender in quelli complessivi
+*/
+static void seqAdd(struct seqTracker *tot, const struct seqTracker *t){
+	tot->lost += t->lost;
+	tot->late += t->late;
+	tot->unsequenced += t->unsequenced;
+	tot->restarts += t->restarts;
+}
+
+
+
+void seqCheckFrom(struct seqTable *tab, const struct sockaddr_storage *from,
+	const char *buf, size_t len){
+
+	struct seqSource *s = NULL;
+	int i = 0;
+
+	tab->clock++;
+	for (i = 0; i < tab->nsrc; i++)
+	{
+		if (sameSource(&tab->src[i].addr, from))
+		{
+			s = &tab->src[i];
+			break;
+		}
+	}
+
+	if (s == NULL)
+	{
+		if (tab->nsrc < SEQ_MAXSOURCES)
+			s = &tab->src[tab->nsrc++];
+		else
+		{
+			//tabella piena: sostituisco il sender meno recente
+			s = &tab->src[0];
+			for (i = 1; i < tab->nsrc; i++)
+				if (tab->src[i].last < s->last)
+					s = &tab->src[i];
+			seqAdd(&tab->retired, &s->t);
+		}
+		memset(s, 0, sizeof(*s));
+		s->addr = *from;
+	}
+
+	s->last = tab->clock;
+	seqCheck(&s->t, buf, len);
+}
+
+
+
+int seqTotals(const struct seqTable *tab, struct seqTracker *tot){
+
+	int i = 0;
+	*tot = tab->retired;
+	for (i = 0; i < tab->nsrc; i++)
+		seqAdd(tot, &tab->src[i].t);
+	return tab->nsrc;
+}
+
+
+
+int resolveGroup(char *group, char *port, struct sockaddr_storage *addr, socklen_t *len){
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_protocol = IPPROTO_UDP;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+	int ecode = getaddrinfo(group, port, &hints, &res);
+	if (ecode != 0)
+	{
+		printf("getaddrinfo error: %s\n", gai_strerror(ecode));
+		return -1;
+	}
+
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+
+
+int openGroupReceiver(char *group, char *port, int rcvbuf){
+
+	struct sockaddr_storage addr;
+	socklen_t len = 0;
+	if (resolveGroup(group, port, &addr, &len) == -1)
+		return -1;
+
+	int sockfd = socket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if (sockfd < 0)
+	{
+		perror("socket() error: ");
+		return -1;
+	}
+
+	int y = 1;
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(y)) < 0)
+	{
+		perror("setsockopt() error: ");
+		close(sockfd);
+		return -1;
+	}
+
+	if ((rcvbuf > 0) &&
+		(setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0))
+	{
+		perror("setsockopt(SO_RCVBUF) error: ");
+	}
+
+	//il socket è legato al multicast address: riceve solo il traffico del gruppo
+	if (bind(sockfd, (struct sockaddr *)&addr, len) < 0)
+	{
+		perror("bind() error: ");
+		close(sockfd);
+		return -1;
+	}
+
+	if (join_group(sockfd, (struct sockaddr *)&addr, len) != SUCCESS)
+	{
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+
+/**
+@brief Thread receiver: riempie il ring con recvmmsg()
+*/
+static void *receiverThread(void *arg){
+
+	struct relay *r = arg;
+	unsigned int mask = r->ringsize - 1;
+	int i = 0;
+
+	while (1)
+	{
+		//attendo che ci sia almeno uno slot libero
+		pthread_mutex_lock(&r->mtx);
+		while (r->head - r->tail == r->ringsize)
+			pthread_cond_wait(&r->notFull, &r->mtx);
+		unsigned int space = r->ringsize - (r->head - r->tail);
+		pthread_mutex_unlock(&r->mtx);
+
+		//gli slot liberi contigui, fino alla fine del ring
+		unsigned int idx = r->head & mask;
+		unsigned int n = r->batch;
+		if (n > space)
+			n = space;
+		if (n > r->ringsize - idx)
+			n = r->ringsize - idx;
+
+		for (i = 0; i < n; i++)
+		{
+			r->rxiovs[i].iov_base = r->ring[idx + i].buf;
+			r->rxiovs[i].iov_len = RELAY_MSGSIZE;
+			memset(&r->rxmsgs[i].msg_hdr, 0, sizeof(struct msghdr));
+			r->rxmsgs[i].msg_hdr.msg_iov = &r->rxiovs[i];
+			r->rxmsgs[i].msg_hdr.msg_iovlen = 1;
+			r->rxmsgs[i].msg_hdr.msg_name = &r->rxaddrs[i];
+			r->rxmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		}
+
+		//attende il primo datagram, poi preleva quelli già in coda
+		int got = recvmmsg(r->insock, r->rxmsgs, n, MSG_WAITFORONE, NULL);
+		if (got < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("recvmmsg() error: ");
+			break;
+		}
+
+		unsigned long bytes = 0;
+		for (i = 0; i < got; i++)
+		{
+			r->ring[idx + i].len = r->rxmsgs[i].msg_len;
+			bytes += r->rxmsgs[i].msg_len;
+		}
+
+		pthread_mutex_lock(&r->mtx);
+		for (i = 0; i < got; i++)
+			seqCheckFrom(&r->seq, &r->rxaddrs[i], r->ring[idx + i].buf,
+				r->ring[idx + i].len);
+		r->in.msgs += got;
+		r->in.bytes += bytes;
+		r->in.calls++;
+		r->head += got;
+		pthread_cond_signal(&r->notEmpty);
+		pthread_mutex_unlock(&r->mtx);
+	}
+
+	return NULL;
+}
+
+
+
+/**
+@brief Thread forwarder: ritrasmette il contenuto del ring su tutti i gruppi di uscita
+*/
+static void *forwarderThread(void *arg){
+
+	struct relay *r = arg;
+	unsigned int mask = r->ringsize - 1;
+	struct groupStats delta[RELAY_MAXGROUPS];
+	int i = 0, g = 0;
+
+	while (1)
+	{
+		pthread_mutex_lock(&r->mtx);
+		while (r->head == r->tail)
+			pthread_cond_wait(&r->notEmpty, &r->mtx);
+		unsigned int avail = r->head - r->tail;
+		pthread_mutex_unlock(&r->mtx);
+
+		unsigned int idx = r->tail & mask;
+		unsigned int n = RELAY_BATCH;
+		if (n > avail)
+			n = avail;
+		if (n > r->ringsize - idx)
+			n = r->ringsize - idx;
+
+		/*
+		una mmsghdr per ogni coppia (datagram, gruppo): il datagram non viene
+		copiato, tutte le iovec puntano allo stesso slot del ring
+		*/
+		int k = 0;
+		for (i = 0; i < n; i++)
+		{
+			for (g = 0; g < r->ngroups; g++, k++)
+			{
+				struct msghdr *mh = &r->txmsgs[k].msg_hdr;
+				r->txiovs[k].iov_base = r->ring[idx + i].buf;
+				r->txiovs[k].iov_len = r->ring[idx + i].len;
+				mh->msg_name = &r->groups[g];
+				mh->msg_namelen = r->grouplens[g];
+				mh->msg_iov = &r->txiovs[k];
+				mh->msg_iovlen = 1;
+				mh->msg_control = NULL;
+				mh->msg_controllen = 0;
+				mh->msg_flags = 0;
+			}
+		}
+
+		memset(delta, 0, sizeof(delta));
+		int j = 0;
+		while (j < k)
+		{
+			int sent = sendmmsg(r->outsock, &r->txmsgs[j], k - j, 0);
+			delta[0].calls++;
+			if (sent < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				//errore sul primo messaggio del batch: lo scarto e proseguo
+				delta[j % r->ngroups].errors++;
+				j++;
+				continue;
+			}
+			for (i = j; i < j + sent; i++)
+			{
+				delta[i % r->ngroups].msgs++;
+				delta[i % r->ngroups].bytes += r->txiovs[i].iov_len;
+			}
+			j += sent;
+		}
+
+		pthread_mutex_lock(&r->mtx);
+		for (g = 0; g < r->ngroups; g++)
+		{
+			r->out[g].msgs += delta[g].msgs;
+			r->out[g].bytes += delta[g].bytes;
+			r->out[g].errors += delta[g].errors;
+			r->out[g].calls += delta[0].calls; //una sendmmsg() serve tutti i gruppi
+		}
+		r->tail += n;
+		pthread_cond_signal(&r->notFull);
+		pthread_mutex_unlock(&r->mtx);
+	}
+
+	return NULL;
+}
+
+
+
+int relayStart(struct relay *r, unsigned int ringsize, int batch){
+
+	unsigned int size = 1;
+	while (size < ringsize)
+		size *= 2;
+
+	r->ringsize = size;
+	r->batch = (batch > 0 && batch <= RELAY_BATCH) ? batch : RELAY_BATCH;
+	r->head = 0;
+	r->tail = 0;
+	memset(&r->in, 0, sizeof(r->in));
+	memset(&r->seq, 0, sizeof(r->seq));
+	memset(r->out, 0, sizeof(r->out));
+
+	//tutta la memoria usata dai thread è allocata qui
+	r->ring = calloc(size, sizeof(struct relaySlot));
+	r->rxmsgs = calloc(RELAY_BATCH, sizeof(struct mmsghdr));
+	r->rxiovs = calloc(RELAY_BATCH, sizeof(struct iovec));
+	r->rxaddrs = calloc(RELAY_BATCH, sizeof(struct sockaddr_storage));
+	r->txmsgs = calloc(RELAY_BATCH * RELAY_MAXGROUPS, sizeof(struct mmsghdr));
+	r->txiovs = calloc(RELAY_BATCH * RELAY_MAXGROUPS, sizeof(struct iovec));
+	if (!r->ring || !r->rxmsgs || !r->rxiovs || !r->rxaddrs || !r->txmsgs || !r->txiovs)
+	{
+		perror("calloc() error: ");
+		return -1;
+	}
+
+	pthread_mutex_init(&r->mtx, NULL);
+	pthread_cond_init(&r->notEmpty, NULL);
+	pthread_cond_init(&r->notFull, NULL);
+
+	if ((pthread_create(&r->receiver, NULL, receiverThread, r) != 0) ||
+		(pthread_create(&r->forwarder, NULL, forwarderThread, r) != 0))
+	{
+		printf("pthread_create() error\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+int relayStats(struct relay *r, struct groupStats *in, struct seqTracker *seq,
+	struct groupStats *out){
+
+	pthread_mutex_lock(&r->mtx);
+	*in = r->in;
+	int sources = seqTotals(&r->seq, seq);
+	memcpy(out, r->out, r->ngroups * sizeof(struct groupStats));
+	pthread_mutex_unlock(&r->mtx);
+	return sources;
+}
+
+/** @} */
@@ -0,0 +1,206 @@
+/**
+@addtogroup Group14
+@{
+*/
+/**
+@file 	Relay.h
+@author Catiuscia Melle
+
+@brief Interfaccia del relay multicast multi-thread (solo Linux).
+
+Il relay riceve il traffico di un gruppo multicast (ad esempio un feed di
+market data) e lo ritrasmette su uno o più gruppi multicast di uscita:
+- un thread receiver riceve i datagram con <em>recvmmsg()</em> direttamente
+  negli slot liberi di un ring buffer preallocato, e verifica i numeri di
+  sequenza;
+- un thread forwarder ritrasmette gli slot pieni del ring su tutti i gruppi
+  di uscita con una sola <em>sendmmsg()</em> per batch, senza copie né
+  allocazioni: ogni datagram del ring è referenziato da una struct mmsghdr
+  per ciascun gruppo di uscita.
+
+Ogni messaggio del feed inizia con una struct feedHeader; i messaggi senza
+header (ad esempio quelli della chat) sono ritrasmessi senza verifica della
+sequenza. La sequenza è verificata separatamente per ogni sender, identificato
+dall'indirizzo IP e dalla porta sorgente.
+*/
+
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include "Utility.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define RELAY_MSGSIZE 1472 	/**< dimensione massima di un datagram (MTU Ethernet) */
+#define RELAY_MAXGROUPS 8 	/**< numero massimo di gruppi di uscita */
+#define RELAY_BATCH 64 		/**< datagram per recvmmsg()/sendmmsg() */
+#define RELAY_RINGSIZE 4096 /**< slot del ring (default) */
+
+#define FEED_MAGIC 0x46454544 	/**< "FEED", identifica i messaggi sequenziati */
+#define SEQ_MAXSOURCES 16 	/**< sender di cui è verificata la sequenza */
+#define SEQ_RESYNC RELAY_RINGSIZE 	/**< salto all'indietro che indica un sender riavviato */
+
+/** header dei messaggi del feed (in network byte order) */
+struct feedHeader {
+	uint32_t magic; 	/**< FEED_MAGIC */
+	uint32_t len; 		/**< lunghezza del messaggio, header compreso */
+	uint64_t seq; 		/**< numero di sequenza, consecutivo per ogni sender
+				(indirizzo e porta sorgente) */
+};
+
+/** stato della verifica dei numeri di sequenza di un flusso */
+struct seqTracker {
+	bool started; 		/**< ricevuto il primo messaggio sequenziato */
+	uint64_t expected; 	/**< prossimo numero di sequenza atteso */
+	unsigned long lost; 	/**< messaggi mancanti (gap nella sequenza) */
+	unsigned long late; 	/**< messaggi duplicati o fuori ordine */
+	unsigned long unsequenced; /**< messaggi senza feedHeader */
+	unsigned long restarts; 	/**< sequenze ripartite da capo (sender riavviato) */
+};
+
+/** stato della sequenza di un sender */
+struct seqSource {
+	struct sockaddr_storage addr; 	/**< indirizzo e porta del sender */
+	unsigned long last; 		/**< ultimo messaggio ricevuto (per la sostituzione) */
+	struct seqTracker t;
+};
+
+/** stato della sequenza di tutti i sender di un gruppo */
+struct seqTable {
+	struct seqSource src[SEQ_MAXSOURCES];
+	int nsrc; 			/**< sender presenti nella tabella */
+	unsigned long clock; 	/**< messaggi ricevuti, ordina i sender per recenza */
+	struct seqTracker retired; 	/**< contatori dei sender rimossi dalla tabella */
+};
+
+/** contatori di un gruppo multicast */
+struct groupStats {
+	unsigned long msgs; 	/**< messaggi ricevuti o inviati */
+	unsigned long bytes; 	/**< byte ricevuti o inviati */
+	unsigned long calls; 	/**< invocazioni di recvmmsg()/sendmmsg() */
+	unsigned long errors; 	/**< messaggi non inviati */
+};
+
+/** slot del ring: un datagram ricevuto */
+struct relaySlot {
+	char buf[RELAY_MSGSIZE];
+	size_t len;
+};
+
+/** stato del relay */
+struct relay {
+	int insock; 		/**< socket di ricezione, join al gruppo di ingresso */
+	int outsock; 		/**< socket di invio verso i gruppi di uscita */
+
+	struct sockaddr_storage groups[RELAY_MAXGROUPS]; /**< gruppi di uscita */
+	socklen_t grouplens[RELAY_MAXGROUPS];
+	int ngroups;
+
+	struct relaySlot *ring; 	/**< ring buffer, ringsize slot */
+	unsigned int ringsize; 		/**< potenza di 2 */
+	unsigned int head; 		/**< prossimo slot da riempire (receiver) */
+	unsigned int tail; 		/**< prossimo slot da inviare (forwarder) */
+	pthread_mutex_t mtx; 		/**< protegge head e tail */
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+
+	int batch; 			/**< datagram per recvmmsg() */
+
+	//strutture per recvmmsg() e sendmmsg(), preallocate
+	struct mmsghdr *rxmsgs;
+	struct iovec *rxiovs;
+	struct sockaddr_storage *rxaddrs; 	/**< sender dei datagram ricevuti */
+	struct mmsghdr *txmsgs;
+	struct iovec *txiovs;
+
+	//contatori, protetti da mtx
+	struct groupStats in;
+	struct seqTable seq;
+	struct groupStats out[RELAY_MAXGROUPS];
+
+	pthread_t receiver;
+	pthread_t forwarder;
+};
+
+
+/**
+@brief Prepara un messaggio del feed: scrive l'header e riempie il payload
+@param buf - buffer di almeno len byte
+@param len - lunghezza del messaggio (almeno sizeof(struct feedHeader))
+@param seq - numero di sequenza
+*/
+void feedEncode(char *buf, size_t len, uint64_t seq);
+
+/**
+@brief Aggiorna lo stato della sequenza con un messaggio ricevuto
+@param t - stato della sequenza del flusso
+@param buf - messaggio ricevuto
+@param len - lunghezza del messaggio
+
+Un numero di sequenza inferiore di oltre SEQ_RESYNC a quello atteso (un ritardo
+maggiore dell'intero ring del relay) indica un sender riavviato: la sequenza
+riparte da quel messaggio.
+*/
+void seqCheck(struct seqTracker *t, const char *buf, size_t len);
+
+/**
+@brief Aggiorna lo stato della sequenza del sender di un messaggio ricevuto
+@param tab - stato della sequenza dei sender
+@param from - indirizzo del sender (msg_name di recvmmsg())
+@param buf - messaggio ricevuto
+@param len - lunghezza del messaggio
+
+Se la tabella è piena, il sender meno recente è sostituito ed i suoi
+contatori sono accumulati in tab->retired.
+*/
+void seqCheckFrom(struct seqTable *tab, const struct sockaddr_storage *from,
+	const char *buf, size_t len);
+
+/**
+@brief Somma i contatori di tutti i sender
+@param tab - stato della sequenza dei sender
+@param tot - contatori complessivi
+@return numero di sender presenti nella tabella
+*/
+int seqTotals(const struct seqTable *tab, struct seqTracker *tot);
+
+/**
+@brief Apre un socket UDP legato al gruppo multicast ed esegue il join
+@param group - indirizzo del gruppo (IPv4 o IPv6)
+@param port - porta UDP
+@param rcvbuf - dimensione del receive buffer (0 per il default)
+@return il socket, -1 in caso di errore
+*/
+int openGroupReceiver(char *group, char *port, int rcvbuf);
+
+/**
+@brief Risolve l'indirizzo di un gruppo multicast
+@return 0 in caso di successo, -1 in caso di errore
+*/
+int resolveGroup(char *group, char *port, struct sockaddr_storage *addr, socklen_t *len);
+
+/**
+@brief Inizializza il relay ed avvia i thread receiver e forwarder
+@param r - stato del relay; insock, outsock, groups, grouplens e ngroups
+devono essere già avvalorati
+@param ringsize - numero di slot del ring (arrotondato ad una potenza di 2)
+@param batch - datagram per recvmmsg() (al massimo RELAY_BATCH)
+@return 0 in caso di successo, -1 in caso di errore
+*/
+int relayStart(struct relay *r, unsigned int ringsize, int batch);
+
+/**
+@brief Copia i contatori correnti del relay
+@param r - stato del relay
+@param in - contatori del gruppo di ingresso
+@param seq - contatori della sequenza del gruppo di ingresso, sommati su
+tutti i sender
+@param out - array di r->ngroups contatori dei gruppi di uscita
+@return numero di sender del gruppo di ingresso
+*/
+int relayStats(struct relay *r, struct groupStats *in, struct seqTracker *seq,
+	struct groupStats *out);
+
+#endif
+/** @} */
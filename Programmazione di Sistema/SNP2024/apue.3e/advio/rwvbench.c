@@ -0,0 +1,173 @@
+#include "apue.h"
+#include <sys/socket.h>
+#include <time.h>
+
+/*
+ * Compare ways of sending a header plus a body over many connections:
+ * writen()/readn() for each part, a single writevn()/readvn(), and
+ * writevn_batch()/readvn_batch() over all connections with the
+ * system call and io_uring backends.
+ *
+ * usage: rwvbench [-n npairs] [-c rounds] [-h hdrsize] [-b bodysize]
+ */
+
+static int		npairs = 64, nrounds = 2000;
+static size_t	hdrsize = 32, bodysize = 1024;
+static int		(*sv)[2];
+static char		*hdr, *body, *rhdr, *rbody;
+
+static double
+now(void)
+{
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		err_sys("clock_gettime error");
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+report(const char *name, double start, unsigned long nsys)
+{
+	double	secs = now() - start;
+	double	nmsgs = (double)npairs * nrounds;
+
+	printf("%-16s %10.0f msgs/s %9.1f MB/s %6.2f syscalls/msg\n", name,
+	  nmsgs / secs, nmsgs * (hdrsize + bodysize) / secs / 1e6,
+	  nsys / nmsgs / 2);	/* per message sent and received */
+}
+
+static void
+run_writen(void)
+{
+	int				i, r;
+	unsigned long	nsys = 0;
+	double			start = now();
+
+	for (r = 0; r < nrounds; r++) {
+		for (i = 0; i < npairs; i++) {
+			if (writen(sv[i][0], hdr, hdrsize) != hdrsize ||
+			  writen(sv[i][0], body, bodysize) != bodysize)
+				err_sys("writen error");
+			nsys += 2;
+		}
+		for (i = 0; i < npairs; i++) {
+			if (readn(sv[i][1], rhdr, hdrsize) != hdrsize ||
+			  readn(sv[i][1], rbody, bodysize) != bodysize)
+				err_sys("readn error");
+			nsys += 2;
+		}
+	}
+	report("writen+writen", start, nsys);
+}
+
+static void
+setiov(struct iovec *iov, char *h, char *b)
+{
+	iov[0].iov_base = h;
+	iov[0].iov_len = hdrsize;
+	iov[1].iov_base = b;
+	iov[1].iov_len = bodysize;
+}
+
+static void
+run_writevn(void)
+{
+	int				i, r;
+	struct iovec	iov[2];
+	unsigned long	nsys = rwv_syscalls();
+	double			start = now();
+
+	for (r = 0; r < nrounds; r++) {
+		for (i = 0; i < npairs; i++) {
+			setiov(iov, hdr, body);
+			if (writevn(sv[i][0], iov, 2) != hdrsize + bodysize)
+				err_sys("writevn error");
+		}
+		for (i = 0; i < npairs; i++) {
+			setiov(iov, rhdr, rbody);
+			if (readvn(sv[i][1], iov, 2) != hdrsize + bodysize)
+				err_sys("readvn error");
+		}
+	}
+	report("writevn", start, rwv_syscalls() - nsys);
+}
+
+static void
+run_batch(const char *name)
+{
+	int				i, r;
+	struct iovec	*iov;
+	struct iovreq	*reqs;
+	unsigned long	nsys = rwv_syscalls();
+	double			start;
+
+	if ((iov = malloc(npairs * 2 * sizeof(struct iovec))) == NULL ||
+	  (reqs = malloc(npairs * sizeof(struct iovreq))) == NULL)
+		err_sys("malloc error");
+
+	start = now();
+	for (r = 0; r < nrounds; r++) {
+		for (i = 0; i < npairs; i++) {
+			setiov(&iov[2*i], hdr, body);
+			reqs[i].ir_fd = sv[i][0];
+			reqs[i].ir_iov = &iov[2*i];
+			reqs[i].ir_iovcnt = 2;
+		}
+		if (writevn_batch(reqs, npairs) < 0)
+			err_sys("writevn_batch error");
+		for (i = 0; i < npairs; i++) {
+			setiov(&iov[2*i], rhdr, rbody);
+			reqs[i].ir_fd = sv[i][1];
+			reqs[i].ir_iov = &iov[2*i];
+			reqs[i].ir_iovcnt = 2;
+		}
+		if (readvn_batch(reqs, npairs) < 0)
+			err_sys("readvn_batch error");
+	}
+	report(name, start, rwv_syscalls() - nsys);
+	free(iov);
+	free(reqs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int		c, i;
+
+	while ((c = getopt(argc, argv, "n:c:h:b:")) != -1) {
+		switch (c) {
+		case 'n':	npairs = atoi(optarg);		break;
+		case 'c':	nrounds = atoi(optarg);		break;
+		case 'h':	hdrsize = atol(optarg);		break;
+		case 'b':	bodysize = atol(optarg);	break;
+		default:
+			err_quit("usage: rwvbench [-n npairs] [-c rounds] "
+			  "[-h hdrsize] [-b bodysize]");
+		}
+	}
+	if (npairs <= 0 || nrounds <= 0 || hdrsize == 0 || bodysize == 0)
+		err_quit("arguments must be positive");
+
+	if ((sv = malloc(npairs * sizeof(*sv))) == NULL ||
+	  (hdr = malloc(hdrsize)) == NULL || (rhdr = malloc(hdrsize)) == NULL ||
+	  (body = malloc(bodysize)) == NULL || (rbody = malloc(bodysize)) == NULL)
+		err_sys("malloc error");
+	memset(hdr, 'h', hdrsize);
+	memset(body, 'b', bodysize);
+	for (i = 0; i < npairs; i++)
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]) < 0)
+			err_sys("socketpair error");
+
+	printf("%d connections, %d rounds, %lu+%lu byte messages\n",
+	  npairs, nrounds, (unsigned long)hdrsize, (unsigned long)bodysize);
+	run_writen();
+	run_writevn();
+	rwv_setbackend(RWV_SYSCALL);
+	run_batch("batch/syscall");
+	if (rwv_setbackend(RWV_URING) == RWV_URING)
+		run_batch("batch/io_uring");
+	else
+		printf("io_uring not available; skipped\n");
+	exit(0);
+}
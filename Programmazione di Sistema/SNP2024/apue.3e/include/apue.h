@@ -25,6 +25,7 @@
 #include <string.h>		/* for convenience */
 #include <unistd.h>		/* for convenience */
 #include <signal.h>		/* for SIG_ERR */
+#include <sys/uio.h>		/* for struct iovec */
 
 #define	MAXLINE	4096			/* max line length */
 
@@ -63,6 +64,28 @@ void	 daemonize(const char *);			/* {Prog daemoninit} */
 void	 sleep_us(unsigned int);			/* {Ex sleepus} */
 ssize_t	 readn(int, void *, size_t);		/* {Prog readn_writen} */
 ssize_t	 writen(int, const void *, size_t);	/* {Prog readn_writen} */
+void	 iov_advance(struct iovec **, int *, size_t);
+ssize_t	 readvn(int, struct iovec *, int);
+ssize_t	 writevn(int, struct iovec *, int);
+
+/*
+ * One request in a batch passed to readvn_batch() or writevn_batch().
+ */
+struct iovreq {
+	int				 ir_fd;
+	struct iovec	*ir_iov;		/* advanced as data is transferred */
+	int				 ir_iovcnt;
+	ssize_t			 ir_nbytes;		/* result: bytes transferred */
+	int				 ir_errno;		/* result: 0, or error number */
+};
+
+#define	RWV_SYSCALL	0			/* backends for rwv_setbackend() */
+#define	RWV_URING	1
+
+int		 rwv_setbackend(int);
+int		 readvn_batch(struct iovreq *, int);
+int		 writevn_batch(struct iovreq *, int);
+unsigned long	rwv_syscalls(void);
 
 int		 fd_pipe(int *);					/* {Prog sock_fdpipe} */
 int		 recv_fd(int, ssize_t (*func)(int,
@@ -0,0 +1,305 @@
+#include "apue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#ifndef	IOV_MAX
+#define	IOV_MAX	16
+#endif
+
+/*
+ * Batched readvn()/writevn() over many descriptors.  With the
+ * RWV_SYSCALL backend, each request is handled in turn with
+ * readvn()/writevn().  With the RWV_URING backend (Linux 5.1 and
+ * later), one readv/writev operation per request is queued on an
+ * io_uring and the whole batch is submitted, and waited for, with a
+ * single io_uring_enter() system call; requests that complete only
+ * partially are resubmitted in the next round.
+ *
+ * The two backends behave alike on nonblocking descriptors: a request
+ * that would block ends with ir_errno set to EAGAIN.  Whether io_uring
+ * itself honours O_NONBLOCK varies between kernels, so each operation
+ * is first queued with RWF_NOWAIT; if that fails with EAGAIN and the
+ * descriptor turns out to be in blocking mode, the request is queued
+ * again without RWF_NOWAIT, and then waits like readv() would.
+ */
+
+extern unsigned long	rwv_nsyscalls;
+
+static int	backend = RWV_SYSCALL;
+
+#ifdef	LINUX
+#include <sys/syscall.h>
+#endif
+
+#if defined(LINUX) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#define	URING_ENTRIES	256
+
+static struct {
+	int					 fd;
+	unsigned			*sq_tail, *sq_mask, *sq_array;
+	unsigned			 sq_entries;
+	struct io_uring_sqe	*sqes;
+	unsigned			*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+} ring = { -1 };
+
+/*
+ * Create the ring and map its submission queue, completion queue,
+ * and submission queue entries.  Return 0 on success, or -1 if
+ * io_uring is not available (old kernel, or disabled by policy).
+ */
+static int
+uring_setup(void)
+{
+	struct io_uring_params	p;
+	size_t					sqsz, cqsz;
+	char					*sq, *cq;
+	int						fd;
+
+	memset(&p, 0, sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+		return(-1);
+
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		sqsz = cqsz = max(sqsz, cqsz);
+
+	sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	  fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto errout;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto errout;
+	}
+	ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	  IORING_OFF_SQES);
+	if (ring.sqes == MAP_FAILED)
+		goto errout;
+
+	ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+	ring.sq_entries = p.sq_entries;
+	ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+	ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring.fd = fd;
+	return(0);
+
+errout:
+	close(fd);		/* mappings are released with the process */
+	return(-1);
+}
+
+static int
+uring_enter(unsigned tosubmit, unsigned mincomplete)
+{
+	rwv_nsyscalls++;
+	return(syscall(__NR_io_uring_enter, ring.fd, tosubmit, mincomplete,
+	  IORING_ENTER_GETEVENTS, NULL, 0));
+}
+
+/*
+ * Is "fd" in nonblocking mode?  If we can't tell, assume not.
+ */
+static int
+is_nonblock(int fd)
+{
+	int		flags;
+
+	rwv_nsyscalls++;
+	flags = fcntl(fd, F_GETFL);
+	return(flags != -1 && (flags & O_NONBLOCK) != 0);
+}
+
+static int
+uring_batch(struct iovreq *reqs, int nreq, int opcode, char *done)
+{
+	struct io_uring_sqe	*sqe;
+	struct io_uring_cqe	*cqe;
+	unsigned			tail, head, nsub, nsubmitted, nreap;
+	int					i, n, pending;
+	char				*mayblock;	/* queue without RWF_NOWAIT */
+
+	if ((mayblock = calloc(nreq > 0 ? nreq : 1, 1)) == NULL)
+		return(-1);
+	for (pending = 0, i = 0; i < nreq; i++)
+		if (!done[i])
+			pending++;
+
+	while (pending > 0) {
+		/*
+		 * Queue one operation for each unfinished request,
+		 * as far as the submission queue allows.
+		 */
+		tail = *ring.sq_tail;
+		for (nsub = 0, i = 0; i < nreq && nsub < ring.sq_entries; i++) {
+			if (done[i])
+				continue;
+			sqe = &ring.sqes[tail & *ring.sq_mask];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = opcode;
+			sqe->fd = reqs[i].ir_fd;
+			sqe->off = (__u64)-1;		/* use (and update) file offset */
+			sqe->addr = (unsigned long)reqs[i].ir_iov;
+			sqe->len = min(reqs[i].ir_iovcnt, IOV_MAX);
+			sqe->rw_flags = mayblock[i] ? 0 : RWF_NOWAIT;
+			sqe->user_data = i;
+			ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+			tail++;
+			nsub++;
+		}
+		__atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+		/*
+		 * Submit and wait for all of them.  io_uring_enter() returns
+		 * the number of entries it actually consumed, and doesn't
+		 * wait at all if that is fewer than we asked for: the rest
+		 * stay queued, and are resubmitted on the next call, so we
+		 * only ever wait once everything has been submitted, and
+		 * then only for the operations still in flight.  EINTR,
+		 * and EAGAIN or EBUSY (kernel short of memory, or completion
+		 * queue full), are retried after reaping whatever has
+		 * completed.  (An EAGAIN completion is different: see below.)
+		 */
+		for (nsubmitted = 0, nreap = 0; nreap < nsub; ) {
+			n = uring_enter(nsub - nsubmitted, nsub - nreap);
+			if (n >= 0)
+				nsubmitted += n;
+			else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				free(mayblock);
+				return(-1);
+			}
+
+			head = *ring.cq_head;
+			while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+				cqe = &ring.cqes[head & *ring.cq_mask];
+				i = cqe->user_data;
+				if (cqe->res > 0) {
+					reqs[i].ir_nbytes += cqe->res;
+					iov_advance(&reqs[i].ir_iov, &reqs[i].ir_iovcnt, cqe->res);
+					iov_advance(&reqs[i].ir_iov, &reqs[i].ir_iovcnt, 0);
+					done[i] = (reqs[i].ir_iovcnt == 0);
+				} else if (cqe->res == 0) {
+					done[i] = 1;				/* EOF */
+				} else if (!mayblock[i] && (cqe->res == -EOPNOTSUPP ||
+				  (cqe->res == -EAGAIN && !is_nonblock(reqs[i].ir_fd)))) {
+					/*
+					 * Would block on a blocking descriptor, or
+					 * RWF_NOWAIT isn't supported for this file:
+					 * try again, this time waiting.
+					 */
+					mayblock[i] = 1;
+				} else if (cqe->res != -EINTR) {
+					/* EAGAIN here means a nonblocking descriptor */
+					reqs[i].ir_errno = -cqe->res;
+					done[i] = 1;
+				}
+				if (done[i])
+					pending--;
+				head++;
+				nreap++;
+			}
+			__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		}
+	}
+	free(mayblock);
+	return(0);
+}
+#endif	/* LINUX && __NR_io_uring_setup */
+
+/*
+ * Select the backend used by readvn_batch() and writevn_batch().
+ * Returns the backend actually in effect: if RWV_URING is requested
+ * but io_uring is unavailable, we fall back to RWV_SYSCALL.
+ */
+int
+rwv_setbackend(int which)
+{
+	backend = RWV_SYSCALL;
+#if defined(LINUX) && defined(__NR_io_uring_setup)
+	if (which == RWV_URING && (ring.fd >= 0 || uring_setup() == 0))
+		backend = RWV_URING;
+#endif
+	return(backend);
+}
+
+static int
+rwv_batch(struct iovreq *reqs, int nreq, int write)
+{
+	char	*done;
+	int		i, err;
+	ssize_t	n;
+
+	if ((done = malloc(nreq > 0 ? nreq : 1)) == NULL)
+		return(-1);
+	for (i = 0; i < nreq; i++) {
+		reqs[i].ir_nbytes = 0;
+		reqs[i].ir_errno = 0;
+		iov_advance(&reqs[i].ir_iov, &reqs[i].ir_iovcnt, 0);
+		done[i] = (reqs[i].ir_iovcnt == 0);
+	}
+
+	err = 0;
+#if defined(LINUX) && defined(__NR_io_uring_setup)
+	if (backend == RWV_URING) {
+		err = uring_batch(reqs, nreq,
+		  write ? IORING_OP_WRITEV : IORING_OP_READV, done);
+	} else
+#endif
+	{
+		for (i = 0; i < nreq; i++) {
+			if (done[i])
+				continue;
+			errno = 0;
+			if (write)
+				n = writevn(reqs[i].ir_fd, reqs[i].ir_iov, reqs[i].ir_iovcnt);
+			else
+				n = readvn(reqs[i].ir_fd, reqs[i].ir_iov, reqs[i].ir_iovcnt);
+			if (n < 0) {
+				reqs[i].ir_errno = errno;
+			} else {
+				reqs[i].ir_nbytes = n;
+				iov_advance(&reqs[i].ir_iov, &reqs[i].ir_iovcnt, 0);
+				if (reqs[i].ir_iovcnt != 0)		/* 0 for EOF */
+					reqs[i].ir_errno = (errno == EINTR) ? 0 : errno;
+			}
+		}
+	}
+
+	for (i = 0; i < nreq && err == 0; i++)
+		if (reqs[i].ir_errno != 0 || reqs[i].ir_iovcnt != 0)
+			err = -1;
+	free(done);
+	return(err);
+}
+
+/*
+ * Read (or write) all the buffers of each request in "reqs".
+ * Each request's ir_iov and ir_iovcnt are advanced past the data
+ * transferred, and ir_nbytes and ir_errno report the outcome.
+ * Returns 0 if every request was transferred in full, else -1.
+ */
+int
+readvn_batch(struct iovreq *reqs, int nreq)
+{
+	return(rwv_batch(reqs, nreq, 0));
+}
+
+int
+writevn_batch(struct iovreq *reqs, int nreq)
+{
+	return(rwv_batch(reqs, nreq, 1));
+}
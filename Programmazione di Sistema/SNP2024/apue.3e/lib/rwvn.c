@@ -0,0 +1,114 @@
+#include "apue.h"
+#include <errno.h>
+#include <limits.h>
+
+#ifndef	IOV_MAX
+#define	IOV_MAX	16
+#endif
+
+unsigned long	rwv_nsyscalls;	/* I/O system calls made; statistics only */
+
+/*
+ * Account for "n" bytes transferred from the front of an iovec array.
+ * Fully consumed elements are set to zero length and skipped, and the
+ * first partly consumed element is trimmed, so that the same array
+ * can be passed to readv()/writev() again to resume the transfer.
+ */
+void
+iov_advance(struct iovec **iovp, int *iovcntp, size_t n)
+{
+	struct iovec	*iov = *iovp;
+	int				cnt = *iovcntp;
+
+	while (cnt > 0 && n >= iov->iov_len) {
+		n -= iov->iov_len;
+		iov->iov_len = 0;
+		iov++;
+		cnt--;
+	}
+	if (cnt > 0 && n > 0) {
+		iov->iov_base = (char *)iov->iov_base + n;
+		iov->iov_len -= n;
+	}
+	*iovp = iov;
+	*iovcntp = cnt;
+}
+
+static size_t
+iov_total(const struct iovec *iov, int iovcnt)
+{
+	size_t	n = 0;
+
+	while (iovcnt-- > 0)
+		n += (iov++)->iov_len;
+	return(n);
+}
+
+/*
+ * Read into all the buffers of an iovec array, like readn().
+ * On return, "iov" has been advanced past the data read, so after a
+ * short count (EOF, or EAGAIN on a nonblocking descriptor) the
+ * caller can simply call again with the same arguments.
+ */
+ssize_t
+readvn(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t		n, nleft;
+	ssize_t		nread;
+
+	n = nleft = iov_total(iov, iovcnt);
+	while (nleft > 0) {
+		iov_advance(&iov, &iovcnt, 0);	/* skip empty buffers */
+		rwv_nsyscalls++;
+		if ((nread = readv(fd, iov, min(iovcnt, IOV_MAX))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (nleft == n)
+				return(-1); /* error, return -1 */
+			else
+				break;      /* error, return amount read so far */
+		} else if (nread == 0) {
+			break;          /* EOF */
+		}
+		nleft -= nread;
+		iov_advance(&iov, &iovcnt, nread);
+	}
+	return(n - nleft);      /* return >= 0 */
+}
+
+/*
+ * Write all the buffers of an iovec array, like writen(), so that
+ * (for example) a header and body go out in a single writev().
+ * "iov" is advanced as for readvn().
+ */
+ssize_t
+writevn(int fd, struct iovec *iov, int iovcnt)
+{
+	size_t		n, nleft;
+	ssize_t		nwritten;
+
+	n = nleft = iov_total(iov, iovcnt);
+	while (nleft > 0) {
+		iov_advance(&iov, &iovcnt, 0);	/* skip empty buffers */
+		rwv_nsyscalls++;
+		if ((nwritten = writev(fd, iov, min(iovcnt, IOV_MAX))) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (nleft == n)
+				return(-1); /* error, return -1 */
+			else
+				break;      /* error, return amount written so far */
+		} else if (nwritten == 0) {
+			break;
+		}
+		nleft -= nwritten;
+		iov_advance(&iov, &iovcnt, nwritten);
+	}
+	return(n - nleft);      /* return >= 0 */
+}
+
+unsigned long
+rwv_syscalls(void)
+{
+	return(rwv_nsyscalls);
+}
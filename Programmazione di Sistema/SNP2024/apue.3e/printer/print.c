@@ -77,6 +77,7 @@ submit_file(int fd, int sockfd, const char *fname, size_t nbytes,
 	struct printreq		req;
 	struct printresp	res;
 	char				buf[IOBUFSZ];
+	struct iovec		iov[2];
 
 	/*
 	 * First build the header.
@@ -106,21 +107,28 @@ submit_file(int fd, int sockfd, const char *fname, size_t nbytes,
 	}
 
 	/*
-	 * Send the header to the server.
+	 * Send the header to the server, together with the first
+	 * block of the file, in a single writev.
 	 */
-	nw = writen(sockfd, &req, sizeof(struct printreq));
-	if (nw != sizeof(struct printreq)) {
+	if ((nr = read(fd, buf, IOBUFSZ)) < 0)
+		err_sys("can't read %s", fname);
+	iov[0].iov_base = (char *)&req;
+	iov[0].iov_len = sizeof(struct printreq);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = nr;
+	nw = writevn(sockfd, iov, 2);
+	if (nw != sizeof(struct printreq) + nr) {
 		if (nw < 0)
 			err_sys("can't write to print server");
 		else
 			err_quit("short write (%d/%d) to print server",
-			  nw, sizeof(struct printreq));
+			  nw, sizeof(struct printreq) + nr);
 	}
 
 	/*
-	 * Now send the file.
+	 * Now send the rest of the file.
 	 */
-	while ((nr = read(fd, buf, IOBUFSZ)) != 0) {
+	while (nr != 0 && (nr = read(fd, buf, IOBUFSZ)) != 0) {
 		nw = writen(sockfd, buf, nr);
 		if (nw != nr) {
 			if (nw < 0)
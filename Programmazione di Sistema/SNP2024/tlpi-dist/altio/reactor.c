@@ -0,0 +1,679 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* reactor.c
+
+   An event loop ("reactor") library built on epoll, generalizing
+   epoll_input.c so that it can serve as the core of a network server.
+
+   A reactor consists of 'numThreads' loops. Each loop has its own thread
+   and its own epoll instance, so that the file descriptors belonging to
+   one connection are handled by one thread, without locking. Within a
+   loop:
+
+   * reAdd() registers a file descriptor with a callback function. If
+     EPOLLET is included in the event mask, the callback is called once
+     per edge and must drain the file descriptor (read, accept, or write
+     until EAGAIN); this saves epoll_wait() calls when data is arriving
+     continuously.
+
+   * reAddTimer() creates a timer using timerfd (see demo_timerfd.c),
+     so that timers are just another file descriptor in the epoll set.
+
+   * rePost() queues a function to be run by the loop's thread, and wakes
+     the loop via an eventfd. This is also how reStop() wakes the loops,
+     and replaces the self-pipe trick (self_pipe.c): an eventfd needs one
+     file descriptor rather than two, and repeated wakeups just add to a
+     counter rather than filling a pipe.
+
+   A file descriptor that all loops should listen on (typically, a
+   listening socket) is registered with reAddShared(), in one of two
+   modes:
+
+   RE_EXCLUSIVE: the file descriptor is added to every loop's epoll
+     instance with EPOLLEXCLUSIVE, so that when it becomes ready, the
+     kernel wakes one (or a few) of the waiting threads, rather than all
+     of them (see multithread_epoll_wait.c).
+
+   RE_ONESHOT: the file descriptor is added, with EPOLLONESHOT, to an
+     epoll instance shared by all loops; that instance is itself in each
+     loop's epoll instance (EPOLLEXCLUSIVE can't be used for a nested
+     epoll instance, so all of the loops may wake). A ready event is
+     delivered to exactly one thread, and the file descriptor is rearmed
+     after the callback returns, so that only one thread at a time is
+     handling it.
+
+   Handlers and timers must be removed (reRemove(), reCancelTimer()) by
+   the thread of the loop they belong to, or while the reactor is not
+   running; this may be done from within any callback, including the
+   handler's own. A file descriptor must be removed before it is closed.
+   reStop() and rePost() may be called from any thread.
+
+   This module is Linux-specific.
+*/
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <time.h>
+#include "reactor.h"
+#include "tlpi_hdr.h"
+
+struct reHandler {
+    int fd;
+    uint32_t events;
+    int epfd;                   /* epoll instance that 'fd' is in */
+    reIoFunc func;
+    void *arg;
+    struct reLoop *loop;        /* NULL for RE_ONESHOT shared handlers */
+    bool rearm;                 /* Rearm after each call (RE_ONESHOT) */
+    bool removed;
+    struct reTimer *timer;      /* If this handler belongs to a timer */
+    struct reHandler *prev, *next;      /* In loop's (or reactor's) list */
+};
+
+struct reTimer {
+    int fd;                     /* timerfd */
+    reTimerFunc func;
+    void *arg;
+    struct reHandler *h;
+};
+
+struct task {
+    reTaskFunc func;
+    void *arg;
+    struct task *next;
+};
+
+struct reLoop {
+    struct Reactor *r;
+    int index;
+    int epfd;
+    int evfd;                   /* eventfd used to wake the loop */
+    pthread_t thread;
+    struct epoll_event *evlist;
+    struct reHandler *live;     /* Registered handlers */
+    struct reHandler *dead;     /* Removed handlers, freed once events
+                                   that may refer to them are dispatched */
+    pthread_mutex_t taskMtx;
+    struct task *taskHead, *taskTail;
+    struct reStats stats;
+    char pad[64];               /* Keep loops in separate cache lines */
+};
+
+struct Reactor {
+    int numLoops;
+    int maxEvents;
+    struct reLoop *loops;
+    int stop;
+    pthread_mutex_t sharedMtx;
+    int sharedEpfd;             /* For RE_ONESHOT handlers, or -1 */
+    struct reHandler *shared;   /* Handlers added by reAddShared() */
+};
+
+#define SHARED_BATCH 4          /* Events taken from the shared epoll
+                                   instance by one thread at a time */
+
+void
+reDefaultOptions(struct reOptions *opts)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    opts->numThreads = (n > 0) ? n : 1;
+    opts->maxEvents = 64;
+}
+
+static void
+pushHandler(struct reHandler **list, struct reHandler *h)
+{
+    h->prev = NULL;
+    h->next = *list;
+    if (*list != NULL)
+        (*list)->prev = h;
+    *list = h;
+}
+
+static void
+unlinkHandler(struct reHandler **list, struct reHandler *h)
+{
+    if (h->prev != NULL)
+        h->prev->next = h->next;
+    else
+        *list = h->next;
+    if (h->next != NULL)
+        h->next->prev = h->prev;
+}
+
+static void
+freeHandlers(struct reHandler *h)
+{
+    while (h != NULL) {
+        struct reHandler *next = h->next;
+        if (h->timer != NULL) {
+            close(h->timer->fd);
+            free(h->timer);
+        }
+        free(h);
+        h = next;
+    }
+}
+
+/* Create a handler and add 'fd' to the epoll instance 'epfd' */
+
+static struct reHandler *
+newHandler(struct reLoop *loop, int epfd, int fd, uint32_t events,
+           reIoFunc func, void *arg)
+{
+    struct reHandler *h = calloc(1, sizeof(*h));
+    struct epoll_event ev;
+
+    if (h == NULL)
+        return NULL;
+    h->fd = fd;
+    h->events = events;
+    h->epfd = epfd;
+    h->func = func;
+    h->arg = arg;
+    h->loop = loop;
+
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        int savedErrno = errno;
+        free(h);
+        errno = savedErrno;
+        return NULL;
+    }
+    return h;
+}
+
+/* Call the handlers for the 'n' events in 'evlist' */
+
+static void
+dispatch(struct reLoop *loop, struct epoll_event *evlist, int n)
+{
+    for (int j = 0; j < n; j++) {
+        struct reHandler *h = evlist[j].data.ptr;
+
+        if (h->removed)         /* By a handler earlier in this batch */
+            continue;
+        loop->stats.numEvents++;
+        h->func(loop, h->fd, evlist[j].events, h->arg);
+
+        if (h->rearm) {
+            struct epoll_event ev;
+
+            ev.events = h->events;
+            ev.data.ptr = h;
+            if (epoll_ctl(h->epfd, EPOLL_CTL_MOD, h->fd, &ev) == -1)
+                errMsg("reactor: epoll_ctl-rearm fd %d", h->fd);
+        }
+    }
+}
+
+/* Handler for the shared epoll instance: take a few of its events, and
+   dispatch them in this thread */
+
+static void
+sharedReady(struct reLoop *loop, int fd, uint32_t events, void *arg)
+{
+    struct epoll_event evlist[SHARED_BATCH];
+    int n;
+
+    n = epoll_wait(fd, evlist, SHARED_BATCH, 0);
+    if (n > 0)
+        dispatch(loop, evlist, n);
+}
+
+/* Handler for the loop's eventfd: run any posted tasks */
+
+static void
+wakeupReady(struct reLoop *loop, int fd, uint32_t events, void *arg)
+{
+    struct task *t, *next;
+    uint64_t cnt;
+
+    if (read(fd, &cnt, sizeof(cnt)) == -1)      /* Reset the counter */
+        return;
+    loop->stats.numWakeups++;
+
+    pthread_mutex_lock(&loop->taskMtx);
+    t = loop->taskHead;
+    loop->taskHead = loop->taskTail = NULL;
+    pthread_mutex_unlock(&loop->taskMtx);
+
+    for (; t != NULL; t = next) {
+        next = t->next;
+        t->func(loop, t->arg);
+        loop->stats.numTasks++;
+        free(t);
+    }
+}
+
+static void
+wakeLoop(struct reLoop *loop)
+{
+    uint64_t one = 1;
+
+    if (write(loop->evfd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+        errMsg("reactor: write-eventfd");
+}
+
+/* Handler for a timerfd */
+
+static void
+timerReady(struct reLoop *loop, int fd, uint32_t events, void *arg)
+{
+    struct reTimer *t = arg;
+    uint64_t numExp;
+
+    if (read(fd, &numExp, sizeof(numExp)) != sizeof(numExp))
+        return;                 /* EAGAIN: timer was reset */
+    loop->stats.numTimerExp += numExp;
+    t->func(loop, numExp, t->arg);      /* May cancel 't' */
+}
+
+struct Reactor *
+reCreate(const struct reOptions *opts)
+{
+    struct Reactor *r;
+    int savedErrno;
+
+    if (opts->numThreads < 1 || opts->maxEvents < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    r->numLoops = opts->numThreads;
+    r->maxEvents = opts->maxEvents;
+    r->sharedEpfd = -1;
+    pthread_mutex_init(&r->sharedMtx, NULL);
+
+    r->loops = calloc(r->numLoops, sizeof(struct reLoop));
+    if (r->loops == NULL)
+        goto fail;
+    for (int j = 0; j < r->numLoops; j++) {
+        r->loops[j].epfd = -1;
+        r->loops[j].evfd = -1;
+    }
+
+    for (int j = 0; j < r->numLoops; j++) {
+        struct reLoop *loop = &r->loops[j];
+        struct reHandler *h;
+
+        loop->r = r;
+        loop->index = j;
+        pthread_mutex_init(&loop->taskMtx, NULL);
+
+        loop->evlist = calloc(r->maxEvents, sizeof(struct epoll_event));
+        if (loop->evlist == NULL)
+            goto fail;
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd == -1)
+            goto fail;
+        loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->evfd == -1)
+            goto fail;
+
+        h = newHandler(loop, loop->epfd, loop->evfd, EPOLLIN, wakeupReady,
+                       NULL);
+        if (h == NULL)
+            goto fail;
+        pushHandler(&loop->live, h);
+    }
+    return r;
+
+fail:
+    savedErrno = errno;
+    reDestroy(r);
+    errno = savedErrno;
+    return NULL;
+}
+
+static int
+runLoop(struct reLoop *loop)
+{
+    struct Reactor *r = loop->r;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(loop->epfd, loop->evlist, r->maxEvents, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        loop->stats.numWaits++;
+        dispatch(loop, loop->evlist, n);
+
+        freeHandlers(loop->dead);
+        loop->dead = NULL;
+    }
+    return 0;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    return (void *) (long) runLoop(arg);
+}
+
+/* Run the reactor: loop 0 runs in the calling thread, and the others in
+   threads created here. Returns when reStop() is called, or an error
+   occurs, in which case -1 is returned. */
+
+int
+reRun(struct Reactor *r)
+{
+    int status = 0, s;
+    void *res;
+
+    for (int j = 1; j < r->numLoops; j++) {
+        s = pthread_create(&r->loops[j].thread, NULL, threadFunc,
+                           &r->loops[j]);
+        if (s != 0) {
+            reStop(r);
+            for (int k = 1; k < j; k++)
+                pthread_join(r->loops[k].thread, NULL);
+            errno = s;
+            return -1;
+        }
+    }
+
+    if (runLoop(&r->loops[0]) == -1) {
+        status = -1;
+        reStop(r);
+    }
+
+    for (int j = 1; j < r->numLoops; j++) {
+        s = pthread_join(r->loops[j].thread, &res);
+        if (s == 0 && res != NULL)
+            status = -1;
+    }
+    return status;
+}
+
+void
+reStop(struct Reactor *r)
+{
+    __atomic_store_n(&r->stop, 1, __ATOMIC_RELEASE);
+    for (int j = 0; j < r->numLoops; j++)
+        wakeLoop(&r->loops[j]);
+}
+
+/* Free the reactor. File descriptors added by the caller are not closed;
+   timers' file descriptors are. */
+
+void
+reDestroy(struct Reactor *r)
+{
+    if (r == NULL)
+        return;
+
+    for (int j = 0; r->loops != NULL && j < r->numLoops; j++) {
+        struct reLoop *loop = &r->loops[j];
+
+        freeHandlers(loop->live);
+        freeHandlers(loop->dead);
+        while (loop->taskHead != NULL) {
+            struct task *next = loop->taskHead->next;
+            free(loop->taskHead);
+            loop->taskHead = next;
+        }
+        if (loop->epfd != -1)
+            close(loop->epfd);
+        if (loop->evfd != -1)
+            close(loop->evfd);
+        free(loop->evlist);
+        pthread_mutex_destroy(&loop->taskMtx);
+    }
+    freeHandlers(r->shared);
+    if (r->sharedEpfd != -1)
+        close(r->sharedEpfd);
+    pthread_mutex_destroy(&r->sharedMtx);
+    free(r->loops);
+    free(r);
+}
+
+int
+reNumLoops(struct Reactor *r)
+{
+    return r->numLoops;
+}
+
+struct reLoop *
+reGetLoop(struct Reactor *r, int n)
+{
+    return (n >= 0 && n < r->numLoops) ? &r->loops[n] : NULL;
+}
+
+int
+reLoopIndex(struct reLoop *loop)
+{
+    return loop->index;
+}
+
+struct Reactor *
+reLoopReactor(struct reLoop *loop)
+{
+    return loop->r;
+}
+
+/* Register 'fd' with 'loop'. 'events' is an epoll event mask, for
+   example, EPOLLIN | EPOLLET. */
+
+struct reHandler *
+reAdd(struct reLoop *loop, int fd, uint32_t events, reIoFunc func,
+      void *arg)
+{
+    struct reHandler *h;
+
+    h = newHandler(loop, loop->epfd, fd, events, func, arg);
+    if (h != NULL)
+        pushHandler(&loop->live, h);
+    return h;
+}
+
+/* Register 'fd' with all loops; 'mode' is RE_EXCLUSIVE or RE_ONESHOT.
+   Shared handlers remain registered until the reactor is destroyed. */
+
+int
+reAddShared(struct Reactor *r, int fd, uint32_t events, int mode,
+            reIoFunc func, void *arg)
+{
+    struct reHandler *h;
+    int status = -1;
+
+    if (mode != RE_EXCLUSIVE && mode != RE_ONESHOT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&r->sharedMtx);
+
+    if (mode == RE_EXCLUSIVE) {
+        for (int j = 0; j < r->numLoops; j++) {
+            h = newHandler(&r->loops[j], r->loops[j].epfd, fd,
+                           events | EPOLLEXCLUSIVE, func, arg);
+            if (h == NULL)
+                goto out;
+            pushHandler(&r->shared, h);
+        }
+
+    } else {
+        if (r->sharedEpfd == -1) {      /* First RE_ONESHOT handler */
+            r->sharedEpfd = epoll_create1(EPOLL_CLOEXEC);
+            if (r->sharedEpfd == -1)
+                goto out;
+            for (int j = 0; j < r->numLoops; j++) {
+                h = newHandler(&r->loops[j], r->loops[j].epfd,
+                               r->sharedEpfd, EPOLLIN, sharedReady, r);
+                if (h == NULL)
+                    goto out;
+                pushHandler(&r->shared, h);
+            }
+        }
+
+        h = newHandler(NULL, r->sharedEpfd, fd, events | EPOLLONESHOT,
+                       func, arg);
+        if (h == NULL)
+            goto out;
+        h->rearm = true;
+        pushHandler(&r->shared, h);
+    }
+    status = 0;
+
+out:
+    pthread_mutex_unlock(&r->sharedMtx);
+    return status;
+}
+
+int
+reModify(struct reHandler *h, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(h->epfd, EPOLL_CTL_MOD, h->fd, &ev) == -1)
+        return -1;
+    h->events = events;
+    return 0;
+}
+
+/* Remove a handler added by reAdd(). It is freed once the loop has
+   finished dispatching the current batch of events. */
+
+int
+reRemove(struct reHandler *h)
+{
+    struct reLoop *loop = h->loop;
+    int status;
+
+    if (h->removed || loop == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    status = epoll_ctl(h->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+    h->removed = true;
+    unlinkHandler(&loop->live, h);
+    pushHandler(&loop->dead, h);
+    return status;
+}
+
+/* Create a timer that first expires after 'initMsecs' milliseconds, and
+   then every 'intervalMsecs' milliseconds (0: once only) */
+
+struct reTimer *
+reAddTimer(struct reLoop *loop, long initMsecs, long intervalMsecs,
+           reTimerFunc func, void *arg)
+{
+    struct itimerspec ts;
+    struct reTimer *t;
+    int savedErrno;
+
+    if (initMsecs <= 0 || intervalMsecs < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL)
+        return NULL;
+    t->func = func;
+    t->arg = arg;
+
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t->fd == -1)
+        goto fail;
+
+    ts.it_value.tv_sec = initMsecs / 1000;
+    ts.it_value.tv_nsec = (initMsecs % 1000) * 1000000;
+    ts.it_interval.tv_sec = intervalMsecs / 1000;
+    ts.it_interval.tv_nsec = (intervalMsecs % 1000) * 1000000;
+    if (timerfd_settime(t->fd, 0, &ts, NULL) == -1)
+        goto fail;
+
+    t->h = reAdd(loop, t->fd, EPOLLIN, timerReady, t);
+    if (t->h == NULL)
+        goto fail;
+    t->h->timer = t;
+    return t;
+
+fail:
+    savedErrno = errno;
+    if (t->fd != -1)
+        close(t->fd);
+    free(t);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Cancel a timer, closing its file descriptor. The timer is freed along
+   with its handler. */
+
+int
+reCancelTimer(struct reTimer *t)
+{
+    struct itimerspec ts;
+
+    memset(&ts, 0, sizeof(ts));
+    timerfd_settime(t->fd, 0, &ts, NULL);       /* Disarm */
+    return reRemove(t->h);
+}
+
+/* Arrange for 'func' to be called by the thread of 'loop' */
+
+int
+rePost(struct reLoop *loop, reTaskFunc func, void *arg)
+{
+    struct task *t = malloc(sizeof(*t));
+    bool wasEmpty;
+
+    if (t == NULL)
+        return -1;
+    t->func = func;
+    t->arg = arg;
+    t->next = NULL;
+
+    pthread_mutex_lock(&loop->taskMtx);
+    wasEmpty = (loop->taskHead == NULL);
+    if (wasEmpty)
+        loop->taskHead = t;
+    else
+        loop->taskTail->next = t;
+    loop->taskTail = t;
+    pthread_mutex_unlock(&loop->taskMtx);
+
+    if (wasEmpty)               /* Otherwise, a wakeup is already pending */
+        wakeLoop(loop);
+    return 0;
+}
+
+/* Sum the statistics of all loops. The counts are exact only if the
+   reactor is not running. */
+
+void
+reGetStats(struct Reactor *r, struct reStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int j = 0; j < r->numLoops; j++) {
+        const struct reStats *ls = &r->loops[j].stats;
+
+        stats->numWaits += ls->numWaits;
+        stats->numEvents += ls->numEvents;
+        stats->numTimerExp += ls->numTimerExp;
+        stats->numTasks += ls->numTasks;
+        stats->numWakeups += ls->numWakeups;
+    }
+}
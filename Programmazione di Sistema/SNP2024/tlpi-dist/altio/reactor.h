@@ -0,0 +1,100 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* reactor.h
+
+   Header file for reactor.c.
+*/
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <sys/epoll.h>
+#include <stdint.h>
+
+struct Reactor;                 /* Opaque; see reactor.c */
+struct reLoop;                  /* One thread's event loop */
+struct reHandler;               /* A file descriptor registered with a loop */
+struct reTimer;
+
+/* Called when 'fd' is ready; 'events' is the epoll event mask. If 'fd'
+   was registered with EPOLLET, the function must read (or accept, or
+   write) until the call fails with EAGAIN. */
+
+typedef void (*reIoFunc)(struct reLoop *loop, int fd, uint32_t events,
+                         void *arg);
+
+/* Called when a timer expires; 'numExp' is the number of expirations
+   since the last call (more than 1 if the loop fell behind) */
+
+typedef void (*reTimerFunc)(struct reLoop *loop, uint64_t numExp,
+                            void *arg);
+
+/* A function run in a loop's thread by rePost() */
+
+typedef void (*reTaskFunc)(struct reLoop *loop, void *arg);
+
+struct reOptions {
+    int numThreads;             /* Loops (each with its own thread) */
+    int maxEvents;              /* Events fetched per epoll_wait() */
+};
+
+#define RE_EXCLUSIVE    0       /* Shared fd is in every loop's epoll
+                                   instance, with EPOLLEXCLUSIVE */
+#define RE_ONESHOT      1       /* Shared fd is in one epoll instance
+                                   common to all loops, with EPOLLONESHOT */
+
+struct reStats {
+    unsigned long numWaits;     /* epoll_wait() calls that returned events */
+    unsigned long numEvents;    /* Events dispatched to handlers */
+    unsigned long numTimerExp;  /* Timer expirations */
+    unsigned long numTasks;     /* Tasks run via rePost() */
+    unsigned long numWakeups;   /* Times a loop was woken via its eventfd */
+};
+
+void reDefaultOptions(struct reOptions *opts);
+
+struct Reactor *reCreate(const struct reOptions *opts);
+
+int reRun(struct Reactor *r);
+
+void reStop(struct Reactor *r);
+
+void reDestroy(struct Reactor *r);
+
+int reNumLoops(struct Reactor *r);
+
+struct reLoop *reGetLoop(struct Reactor *r, int n);
+
+int reLoopIndex(struct reLoop *loop);
+
+struct Reactor *reLoopReactor(struct reLoop *loop);
+
+struct reHandler *reAdd(struct reLoop *loop, int fd, uint32_t events,
+                        reIoFunc func, void *arg);
+
+int reAddShared(struct Reactor *r, int fd, uint32_t events, int mode,
+                reIoFunc func, void *arg);
+
+int reModify(struct reHandler *h, uint32_t events);
+
+int reRemove(struct reHandler *h);
+
+struct reTimer *reAddTimer(struct reLoop *loop, long initMsecs,
+                           long intervalMsecs, reTimerFunc func, void *arg);
+
+int reCancelTimer(struct reTimer *t);
+
+int rePost(struct reLoop *loop, reTaskFunc func, void *arg);
+
+void reGetStats(struct Reactor *r, struct reStats *stats);
+
+#endif
@@ -0,0 +1,369 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* reactor_bench.c
+
+   Measure the connections per second and events per second handled by
+   an echo server built on reactor.c.
+
+   Usage: reactor_bench [-t threads] [-c clients] [-m msgs] [-s size]
+                [-d secs]
+
+   The program creates a TCP echo server, listening on an ephemeral port
+   on the loopback address, using a reactor with 'threads' loops (default:
+   the number of CPUs). It then runs 'clients' (default 8) client threads,
+   each of which repeatedly connects to the server, sends 'msgs' (default
+   10) messages of 'size' (default 64) bytes, reading each one back
+   before sending the next, and closes the connection. After 'secs'
+   (default 2) seconds, a timer in the reactor tells the clients to stop,
+   and the last client to finish stops the reactor.
+
+   This is done for each combination of:
+
+   * the listening socket being shared among the loops with RE_EXCLUSIVE
+     or RE_ONESHOT; and
+
+   * the connected sockets being monitored edge-triggered (EPOLLET, with
+     handlers that read until EAGAIN) or level-triggered (handlers that
+     do one read per event).
+
+   For each run, the program displays the connections, messages, and
+   reactor events per second, the average number of events returned by
+   each epoll_wait() call, and the share of connections handled by the
+   busiest loop.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE             /* For accept4() */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+#include "reactor.h"
+#include "tlpi_hdr.h"
+
+static int numClients = 8;
+static long numMsgs = 10;
+static size_t msgSize = 64;
+static long durationMsecs = 2000;
+
+static struct Reactor *r;
+static int lfd;                         /* Listening socket */
+static struct sockaddr_in svaddr;
+static bool edgeTriggered;
+static unsigned long *loopConns;        /* Connections accepted per loop */
+static struct conn **openConns;         /* Per-loop lists of connections
+                                           still open; each is touched only
+                                           by its loop's thread */
+
+static int clientsStop;                 /* Set when the timer expires */
+static int clientsLeft;                 /* Clients not yet finished */
+
+struct conn {
+    struct reHandler *h;
+    int fd;
+    struct conn *prev, *next;           /* In openConns[loop] */
+};
+
+struct clientResult {
+    unsigned long numConns;
+    unsigned long numMsgs;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Server: echo data on a connected socket */
+
+static void
+closeConn(struct reLoop *loop, struct conn *c)
+{
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        openConns[reLoopIndex(loop)] = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+
+    close(c->fd);
+    free(c);
+}
+
+static void
+echoReady(struct reLoop *loop, int fd, uint32_t events, void *arg)
+{
+    struct conn *c = arg;
+    char buf[4096];
+    ssize_t numRead;
+
+    for (;;) {
+        numRead = read(fd, buf, sizeof(buf));
+        if (numRead == -1 && errno == EAGAIN)
+            return;                     /* Drained */
+        if (numRead <= 0)               /* EOF or error (e.g., ECONNRESET) */
+            break;
+
+        /* Each client waits for its message to be echoed before sending
+           another, so the socket send buffer never fills */
+
+        if (write(fd, buf, numRead) != numRead)
+            break;
+
+        if (!edgeTriggered)             /* Wait for the next event */
+            return;
+    }
+
+    reRemove(c->h);
+    closeConn(loop, c);
+}
+
+/* Server: accept connections until there are no more pending, and add
+   them to this loop */
+
+static void
+acceptReady(struct reLoop *loop, int fd, uint32_t events, void *arg)
+{
+    for (;;) {
+        int cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd == -1) {
+            if (errno != EAGAIN && errno != ECONNABORTED)
+                errMsg("accept4");
+            return;
+        }
+
+        int optval = 1;
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+        struct conn *c = malloc(sizeof(*c));
+        if (c == NULL)
+            errExit("malloc");
+        c->fd = cfd;
+        c->h = reAdd(loop, cfd, EPOLLIN | (edgeTriggered ? EPOLLET : 0),
+                     echoReady, c);
+        if (c->h == NULL)
+            errExit("reAdd");
+
+        int n = reLoopIndex(loop);
+        c->prev = NULL;
+        c->next = openConns[n];
+        if (c->next != NULL)
+            c->next->prev = c;
+        openConns[n] = c;
+        loopConns[n]++;
+    }
+}
+
+/* The run has gone on long enough: tell the clients to stop */
+
+static void
+stopTimer(struct reLoop *loop, uint64_t numExp, void *arg)
+{
+    __atomic_store_n(&clientsStop, 1, __ATOMIC_RELEASE);
+}
+
+static void
+readFully(int fd, char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n <= 0)
+            fatal("client: read returned %ld", (long) n);
+        buf += n;
+        len -= n;
+    }
+}
+
+static void *
+clientFunc(void *arg)
+{
+    struct clientResult *res = arg;
+    struct linger lin = { 1, 0 };       /* Close with RST, so that we don't
+                                           fill up with TIME_WAIT sockets */
+    char *buf = calloc(1, msgSize);
+    int optval = 1;
+
+    if (buf == NULL)
+        errExit("calloc");
+
+    while (!__atomic_load_n(&clientsStop, __ATOMIC_ACQUIRE)) {
+        int cfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (cfd == -1)
+            errExit("socket");
+        if (connect(cfd, (struct sockaddr *) &svaddr, sizeof(svaddr)) == -1)
+            errExit("connect");
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+
+        for (long j = 0; j < numMsgs; j++) {
+            if (write(cfd, buf, msgSize) != msgSize)
+                errExit("client: write");
+            readFully(cfd, buf, msgSize);
+            res->numMsgs++;
+        }
+
+        setsockopt(cfd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin));
+        close(cfd);
+        res->numConns++;
+    }
+
+    /* The last client to finish stops the reactor; reStop() wakes each
+       loop via its eventfd */
+
+    if (__atomic_sub_fetch(&clientsLeft, 1, __ATOMIC_ACQ_REL) == 0)
+        reStop(r);
+
+    free(buf);
+    return NULL;
+}
+
+static void
+runBench(const struct reOptions *opts, int mode, bool et)
+{
+    pthread_t *clients = calloc(numClients, sizeof(pthread_t));
+    struct clientResult *results = calloc(numClients, sizeof(*results));
+    int s;
+
+    if (clients == NULL || results == NULL)
+        errExit("calloc");
+
+    r = reCreate(opts);
+    if (r == NULL)
+        errExit("reCreate");
+    if (reAddShared(r, lfd, EPOLLIN, mode, acceptReady, NULL) == -1)
+        errExit("reAddShared");
+    if (reAddTimer(reGetLoop(r, 0), durationMsecs, 0, stopTimer,
+                   NULL) == NULL)
+        errExit("reAddTimer");
+
+    edgeTriggered = et;
+    memset(loopConns, 0, opts->numThreads * sizeof(unsigned long));
+    clientsStop = 0;
+    clientsLeft = numClients;
+
+    double start = now();
+    for (int j = 0; j < numClients; j++) {
+        s = pthread_create(&clients[j], NULL, clientFunc, &results[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    if (reRun(r) == -1)
+        errExit("reRun");
+    double secs = now() - start;
+
+    struct clientResult tot = { 0, 0 };
+    for (int j = 0; j < numClients; j++) {
+        s = pthread_join(clients[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        tot.numConns += results[j].numConns;
+        tot.numMsgs += results[j].numMsgs;
+    }
+
+    struct reStats st;
+    reGetStats(r, &st);
+
+    unsigned long maxConns = 0;
+    for (int j = 0; j < opts->numThreads; j++)
+        maxConns = max(maxConns, loopConns[j]);
+
+    printf("%-9s %-5s %10.0f %10.0f %10.0f %9.2f %8.0f%%\n",
+           (mode == RE_EXCLUSIVE) ? "exclusive" : "oneshot",
+           et ? "edge" : "level", tot.numConns / secs, tot.numMsgs / secs,
+           st.numEvents / secs, (double) st.numEvents / st.numWaits,
+           (tot.numConns == 0) ? 0.0 : 100.0 * maxConns / tot.numConns);
+
+    /* Connections still open at this point were closed by the clients
+       but not yet seen by the server. reDestroy() frees their handlers but
+       doesn't close them, so close them here; otherwise each run would
+       leak descriptors into the next. The loops have stopped, so no
+       thread is using the lists. */
+
+    for (int j = 0; j < opts->numThreads; j++)
+        while (openConns[j] != NULL)
+            closeConn(reGetLoop(r, j), openConns[j]);
+
+    reDestroy(r);
+    free(clients);
+    free(results);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct reOptions opts;
+    socklen_t addrlen = sizeof(svaddr);
+    int opt, optval;
+
+    reDefaultOptions(&opts);
+
+    while ((opt = getopt(argc, argv, "t:c:m:s:d:")) != -1) {
+        switch (opt) {
+        case 't': opts.numThreads = getInt(optarg, GN_GT_0, "threads"); break;
+        case 'c': numClients = getInt(optarg, GN_GT_0, "clients");      break;
+        case 'm': numMsgs = getLong(optarg, GN_GT_0, "msgs");           break;
+        case 's': msgSize = getLong(optarg, GN_GT_0, "size");           break;
+        case 'd': durationMsecs = getLong(optarg, GN_GT_0, "secs") * 1000;
+                  break;
+        default:
+            usageErr("%s [-t threads] [-c clients] [-m msgs] [-s size] "
+                     "[-d secs]\n", argv[0]);
+        }
+    }
+
+    loopConns = calloc(opts.numThreads, sizeof(unsigned long));
+    openConns = calloc(opts.numThreads, sizeof(struct conn *));
+    if (loopConns == NULL || openConns == NULL)
+        errExit("calloc");
+
+    /* Create the listening socket, on an ephemeral port */
+
+    lfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd == -1)
+        errExit("socket");
+    optval = 1;
+    if (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &optval,
+                   sizeof(optval)) == -1)
+        errExit("setsockopt");
+
+    memset(&svaddr, 0, sizeof(svaddr));
+    svaddr.sin_family = AF_INET;
+    svaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    svaddr.sin_port = 0;
+    if (bind(lfd, (struct sockaddr *) &svaddr, sizeof(svaddr)) == -1)
+        errExit("bind");
+    if (listen(lfd, SOMAXCONN) == -1)
+        errExit("listen");
+    if (getsockname(lfd, (struct sockaddr *) &svaddr, &addrlen) == -1)
+        errExit("getsockname");
+
+    printf("%d loops, %d clients, %ld msgs/conn of %zu bytes, %ld secs\n\n",
+           opts.numThreads, numClients, numMsgs, msgSize,
+           durationMsecs / 1000);
+    printf("%-9s %-5s %10s %10s %10s %9s %9s\n", "Listener", "Mode",
+           "Conns/s", "Msgs/s", "Events/s", "Ev/wait", "Busiest");
+
+    runBench(&opts, RE_EXCLUSIVE, true);
+    runBench(&opts, RE_EXCLUSIVE, false);
+    runBench(&opts, RE_ONESHOT, true);
+    runBench(&opts, RE_ONESHOT, false);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,372 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* par_tree_walk.c
+
+   A multithreaded alternative to nftw(FTW_PHYS) for walking large
+   directory trees. ptwWalk() calls a visit function for every entry in
+   the tree (including the root), passing it the per-thread context of
+   the calling thread, so that (for example) statistics can be gathered
+   without locking and merged once the walk is complete.
+
+   Each thread has a deque of directories still to be read. A thread
+   pushes the subdirectories it finds onto the back of its own deque and
+   takes work from there too, so that it descends depth first; a thread
+   whose deque is empty steals from the front of another thread's deque,
+   where the (probably larger) directories nearer the root are.
+
+   Directories are opened with openat() relative to a descriptor for their
+   parent, so that no pathnames are built or resolved. A directory's
+   descriptor stays open until it has been read and all of its queued
+   subdirectories have been opened.
+
+   Directories are read with getdents64() into a large buffer, and the
+   d_type field is used for the type of each entry. An entry is statted
+   (with statx(), asking only for the fields in 'statxMask') only if the
+   file system doesn't supply d_type, or if the caller asks for more than
+   the file type.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include "par_tree_walk.h"
+#include "tlpi_hdr.h"
+
+#define DEF_BUF_SIZE (256 * 1024)
+
+struct linux_dirent64 {         /* As returned by getdents64() */
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+struct dirRef {                 /* An open directory, shared by the items
+                                   for its subdirectories */
+    int fd;
+    int refs;
+};
+
+struct item {                   /* A directory still to be read */
+    struct dirRef *parent;      /* NULL for the root */
+    int depth;
+    char name[];
+};
+
+struct deque {                  /* Ring buffer of items */
+    pthread_mutex_t mtx;
+    struct item **items;
+    size_t cap;                 /* A power of 2 */
+    size_t head, tail;          /* Steal at head; push and pop at tail */
+};
+
+struct walker;
+
+struct worker {
+    struct walker *w;
+    int num;
+    void *ctx;                  /* Caller's per-thread context */
+    struct deque dq;
+    char *buf;                  /* getdents64() buffer */
+    struct ptwStats stats;
+};
+
+struct walker {                 /* State shared by all threads */
+    const struct ptwOptions *opts;
+    ptwVisitFn visit;
+    struct worker *workers;
+    long pending;               /* Items queued or being read */
+};
+
+void
+ptwDefaultOptions(struct ptwOptions *opts)
+{
+    opts->numThreads = 1;
+    opts->statxMask = STATX_TYPE;
+    opts->bufSize = DEF_BUF_SIZE;
+}
+
+static void
+releaseDir(struct dirRef *dr)
+{
+    if (dr != NULL &&
+            __atomic_sub_fetch(&dr->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(dr->fd);
+        free(dr);
+    }
+}
+
+static void
+push(struct worker *wk, struct item *it)
+{
+    struct deque *dq = &wk->dq;
+
+    __atomic_add_fetch(&wk->w->pending, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&dq->mtx);
+    if (dq->tail - dq->head == dq->cap) {       /* Full: double the size */
+        size_t newCap = (dq->cap == 0) ? 64 : 2 * dq->cap;
+        struct item **items = malloc(newCap * sizeof(struct item *));
+        if (items == NULL)
+            errExit("malloc");
+        for (size_t j = dq->head; j != dq->tail; j++)
+            items[j & (newCap - 1)] = dq->items[j & (dq->cap - 1)];
+        free(dq->items);
+        dq->items = items;
+        dq->cap = newCap;
+    }
+    dq->items[dq->tail++ & (dq->cap - 1)] = it;
+    pthread_mutex_unlock(&dq->mtx);
+}
+
+static struct item *
+take(struct deque *dq, bool fromHead)
+{
+    struct item *it = NULL;
+
+    pthread_mutex_lock(&dq->mtx);
+    if (dq->head != dq->tail)
+        it = fromHead ? dq->items[dq->head++ & (dq->cap - 1)] :
+                        dq->items[--dq->tail & (dq->cap - 1)];
+    pthread_mutex_unlock(&dq->mtx);
+    return it;
+}
+
+static struct item *
+steal(struct worker *wk)
+{
+    int n = wk->w->opts->numThreads;
+
+    for (int j = 1; j < n; j++) {
+        struct worker *victim = &wk->w->workers[(wk->num + j) % n];
+
+        /* Peek without the lock, to avoid contending for empty deques */
+
+        if (__atomic_load_n(&victim->dq.tail, __ATOMIC_RELAXED) ==
+                __atomic_load_n(&victim->dq.head, __ATOMIC_RELAXED))
+            continue;
+
+        struct item *it = take(&victim->dq, true);
+        if (it != NULL) {
+            wk->stats.numSteals++;
+            return it;
+        }
+    }
+    return NULL;
+}
+
+/* Determine the type of an entry, statting it if we must, and visit it.
+   If it is a directory, queue it; 'parent' (NULL for the root) describes
+   the directory containing it. */
+
+static void
+visitEntry(struct worker *wk, struct dirRef *parent, const char *name,
+           unsigned char dType, int depth)
+{
+    int dirFd = (parent == NULL) ? AT_FDCWD : parent->fd;
+    const struct ptwOptions *opts = wk->w->opts;
+    struct statx stx;
+    struct ptwEntry ent;
+
+    ent.dirFd = dirFd;
+    ent.name = name;
+    ent.depth = depth;
+    ent.stx = NULL;
+    ent.type = (dType == DT_UNKNOWN) ? 0 : DTTOIF(dType);
+
+    if (ent.type == 0 || (opts->statxMask & ~STATX_TYPE) != 0) {
+        wk->stats.numStatx++;
+        if (statx(dirFd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                  opts->statxMask | STATX_TYPE, &stx) == 0) {
+            ent.stx = &stx;
+            ent.type = stx.stx_mode & S_IFMT;
+        } else {
+            wk->stats.numErrors++;
+        }
+    }
+
+    wk->stats.numEntries++;
+    wk->w->visit(wk->ctx, &ent);
+
+    if (ent.type == S_IFDIR) {
+        size_t len = strlen(name) + 1;
+        struct item *it = malloc(sizeof(struct item) + len);
+        if (it == NULL)
+            errExit("malloc");
+        if (parent != NULL)
+            __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+        it->parent = parent;
+        it->depth = depth;
+        memcpy(it->name, name, len);
+        push(wk, it);
+    }
+}
+
+/* Read the directory described by 'it', visiting its entries */
+
+static void
+readDir(struct worker *wk, struct item *it, struct dirRef *self)
+{
+    long nread;
+
+    while ((nread = syscall(SYS_getdents64, self->fd, wk->buf,
+                            wk->w->opts->bufSize)) > 0) {
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)
+                                       (wk->buf + off);
+            off += d->d_reclen;
+
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+                continue;
+
+            visitEntry(wk, self, d->d_name, d->d_type, it->depth + 1);
+        }
+    }
+    if (nread == -1)
+        wk->stats.numErrors++;
+}
+
+static void
+processItem(struct worker *wk, struct item *it)
+{
+    int parentFd = (it->parent == NULL) ? AT_FDCWD : it->parent->fd;
+    int fd = openat(parentFd, it->name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    releaseDir(it->parent);
+
+    if (fd == -1) {
+        wk->stats.numErrors++;
+    } else {
+        struct dirRef *self = malloc(sizeof(struct dirRef));
+        if (self == NULL)
+            errExit("malloc");
+        self->fd = fd;
+        self->refs = 1;                 /* Our reference */
+
+        wk->stats.numDirs++;
+        readDir(wk, it, self);
+        releaseDir(self);
+    }
+
+    free(it);
+    __atomic_sub_fetch(&wk->w->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void *
+workerThread(void *arg)
+{
+    struct worker *wk = arg;
+
+    for (;;) {
+        struct item *it = take(&wk->dq, false);
+        if (it == NULL)
+            it = steal(wk);
+
+        if (it != NULL)
+            processItem(wk, it);
+        else if (__atomic_load_n(&wk->w->pending, __ATOMIC_ACQUIRE) == 0)
+            break;                      /* Nothing queued anywhere */
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+/* Walk the tree at 'root' with 'opts->numThreads' threads. Thread 'j'
+   passes 'threadCtx[j]' to 'visit'. Statistics for the walk are returned
+   in '*stats' if that isn't NULL. Returns 0 on success, or -1 if the walk
+   couldn't be started (e.g., 'root' doesn't exist). */
+
+int
+ptwWalk(const char *root, const struct ptwOptions *opts, ptwVisitFn visit,
+        void *threadCtx[], struct ptwStats *stats)
+{
+    struct walker w;
+    int n = opts->numThreads, s, j;
+
+    if (n < 1 || opts->bufSize < sizeof(struct linux_dirent64) + NAME_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Like nftw(), fail if the root itself can't be statted */
+
+    struct statx stx;
+    if (statx(AT_FDCWD, root, AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stx) == -1)
+        return -1;
+
+    w.opts = opts;
+    w.visit = visit;
+    w.pending = 0;
+    w.workers = calloc(n, sizeof(struct worker));
+    if (w.workers == NULL)
+        return -1;
+
+    for (j = 0; j < n; j++) {
+        struct worker *wk = &w.workers[j];
+        wk->w = &w;
+        wk->num = j;
+        wk->ctx = threadCtx[j];
+        wk->buf = malloc(opts->bufSize);
+        if (wk->buf == NULL)
+            errExit("malloc");
+        s = pthread_mutex_init(&wk->dq.mtx, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_init");
+    }
+
+    /* The root is visited (and, if it is a directory, queued) by the
+       first thread's worker */
+
+    visitEntry(&w.workers[0], NULL, root, DT_UNKNOWN, 0);
+
+    pthread_t *tids = calloc(n, sizeof(pthread_t));
+    if (tids == NULL)
+        errExit("calloc");
+    for (j = 1; j < n; j++) {
+        s = pthread_create(&tids[j], NULL, workerThread, &w.workers[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    workerThread(&w.workers[0]);
+    for (j = 1; j < n; j++) {
+        s = pthread_join(tids[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    free(tids);
+
+    if (stats != NULL)
+        memset(stats, 0, sizeof(struct ptwStats));
+    for (j = 0; j < n; j++) {
+        struct worker *wk = &w.workers[j];
+        if (stats != NULL) {
+            stats->numEntries += wk->stats.numEntries;
+            stats->numDirs += wk->stats.numDirs;
+            stats->numStatx += wk->stats.numStatx;
+            stats->numSteals += wk->stats.numSteals;
+            stats->numErrors += wk->stats.numErrors;
+        }
+        free(wk->buf);
+        free(wk->dq.items);
+        pthread_mutex_destroy(&wk->dq.mtx);
+    }
+    free(w.workers);
+    return 0;
+}
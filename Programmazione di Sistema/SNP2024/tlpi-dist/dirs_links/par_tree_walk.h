@@ -0,0 +1,61 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* par_tree_walk.h
+
+   Header file for par_tree_walk.c.
+*/
+#ifndef PAR_TREE_WALK_H
+#define PAR_TREE_WALK_H
+
+#include <sys/types.h>
+
+struct statx;                   /* Defined in <sys/stat.h> if _GNU_SOURCE */
+
+struct ptwEntry {               /* Passed to the visit function */
+    int dirFd;                  /* Directory containing the entry (or
+                                   AT_FDCWD, for the root) */
+    const char *name;           /* Name relative to 'dirFd' */
+    mode_t type;                /* S_IFREG, S_IFDIR, ..., or 0 if the type
+                                   couldn't be determined */
+    const struct statx *stx;    /* Result of statx(), or NULL if the entry
+                                   wasn't statted */
+    int depth;                  /* 0 for the root */
+};
+
+typedef void (*ptwVisitFn)(void *threadCtx, const struct ptwEntry *ent);
+
+struct ptwOptions {
+    int numThreads;
+    unsigned int statxMask;     /* Fields the visit function needs; if just
+                                   STATX_TYPE (or 0), entries are statted
+                                   only when getdents64() gives no d_type */
+    size_t bufSize;             /* Size of each thread's getdents64()
+                                   buffer */
+};
+
+struct ptwStats {
+    unsigned long numEntries;   /* Entries visited */
+    unsigned long numDirs;      /* Directories read */
+    unsigned long numStatx;     /* statx() calls */
+    unsigned long numSteals;    /* Directories taken from another thread */
+    unsigned long numErrors;    /* Directories that couldn't be opened or
+                                   read, and entries that couldn't be
+                                   statted */
+};
+
+void ptwDefaultOptions(struct ptwOptions *opts);
+
+int ptwWalk(const char *root, const struct ptwOptions *opts,
+            ptwVisitFn visit, void *threadCtx[], struct ptwStats *stats);
+
+#endif
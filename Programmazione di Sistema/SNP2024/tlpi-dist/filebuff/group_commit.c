@@ -0,0 +1,377 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* group_commit.c
+
+   Durable appends to a file, with "group commit". write_bytes.c shows
+   the two extremes: no syncing at all, or an fsync()/fdatasync() after
+   every write(). Here, any number of threads call gcAppend(), each of
+   which returns only once its record is on disk, but the records of
+   concurrent callers share a single pwritev() and a single sync.
+
+   There is no dedicated I/O thread. A caller that finds no other thread
+   writing takes the writer role (it becomes the "leader"): it optionally
+   waits up to 'maxDelayUsecs' for a full batch to accumulate, takes up
+   to 'maxBatchRecs' records or 'maxBatchBytes' bytes from the queue,
+   assigns them consecutive offsets, and writes them with pwritev(). It
+   then gives up the writer role, so that the next batch can be written
+   while it syncs this one, and finally marks the records of its batch
+   done and wakes their submitters together.
+
+   Sync modes:
+
+   GC_SYNC_FDATASYNC    fdatasync() after each batch.
+
+   GC_SYNC_FSYNC        fsync() after each batch.
+
+   GC_SYNC_RANGE        sync_file_range() on just the range written by the
+                        batch. This doesn't write file metadata, and doesn't
+                        flush the disk's write cache, so it makes records
+                        durable only if the file is preallocated (and so
+                        its size doesn't change) and the device has no
+                        volatile cache. It allows syncs of successive
+                        batches to proceed in parallel, however.
+
+   GC_SYNC_NONE         No syncing.
+
+   If 'preallocSize' is nonzero, the file is extended in steps of that
+   many bytes with fallocate(), so that fdatasync() usually needn't
+   update the file size; gcClose() truncates the file to the end of the
+   last record. After a crash, the file may therefore end with zero bytes;
+   records should be self-delimiting.
+
+   Records are written at explicit offsets, starting at the size of the
+   file when gcOpen() is called; the file must not have been opened with
+   O_APPEND. If a write or sync fails, the affected records fail with its
+   errno, as do all later calls to gcAppend(), since the file may no
+   longer be a valid log.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "group_commit.h"
+#include "tlpi_hdr.h"
+
+struct gcRecord {               /* Lives on the submitter's stack */
+    const void *buf;
+    size_t len;
+    off_t off;                  /* Where the record was written */
+    int err;                    /* 0, or errno if the commit failed */
+    bool done;                  /* Set (under mutex) when committed */
+    struct gcRecord *next;
+};
+
+void
+gcDefaultOptions(struct gcOptions *opts)
+{
+    opts->maxBatchRecs = 256;
+    opts->maxBatchBytes = 1024 * 1024;
+    opts->maxDelayUsecs = 0;
+    opts->preallocSize = 0;
+    opts->syncMode = GC_SYNC_FDATASYNC;
+}
+
+int
+gcOpen(struct GroupCommit *gc, int fd, const struct gcOptions *opts)
+{
+    struct stat sb;
+    pthread_condattr_t attr;
+    int s;
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fstat(fd, &sb) == -1)
+        return -1;
+    if ((flags & O_APPEND) || opts->maxBatchRecs == 0 ||
+            opts->maxBatchBytes == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(gc, 0, sizeof(struct GroupCommit));
+    gc->fd = fd;
+    gc->opts = *opts;
+    gc->end = sb.st_size;
+    gc->allocEnd = sb.st_size;
+
+    gc->iov = calloc(opts->maxBatchRecs, sizeof(struct iovec));
+    if (gc->iov == NULL)
+        return -1;
+
+    /* The leader's timed wait for a batch to fill uses CLOCK_MONOTONIC */
+
+    s = pthread_condattr_init(&attr);
+    if (s == 0)
+        s = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (s == 0)
+        s = pthread_cond_init(&gc->fillCond, &attr);
+    if (s == 0)
+        s = pthread_cond_init(&gc->doneCond, NULL);
+    if (s == 0)
+        s = pthread_mutex_init(&gc->mtx, NULL);
+    pthread_condattr_destroy(&attr);
+    if (s != 0) {
+        free(gc->iov);
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+/* Write all of the 'iovcnt' buffers in 'iov' at 'off', resuming after
+   partial writes. 'iov' is modified. */
+
+static int
+pwritevFull(int fd, struct iovec *iov, int iovcnt, off_t off)
+{
+    while (iovcnt > 0) {
+        ssize_t n = pwritev(fd, iov, min(iovcnt, IOV_MAX), off);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += n;
+
+        /* Skip the buffers that were written in full, and adjust the
+           first that wasn't */
+
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static bool
+batchFull(const struct GroupCommit *gc)
+{
+    return gc->queueRecs >= gc->opts.maxBatchRecs ||
+           gc->queueBytes >= gc->opts.maxBatchBytes;
+}
+
+/* Called with the mutex held, and 'writing' false. Take the writer role,
+   write and sync one batch, and complete its records. If an earlier batch
+   has failed, the batch fails with the same error, without any I/O.
+   Returns with the mutex held. */
+
+static void
+leadBatch(struct GroupCommit *gc)
+{
+    gc->writing = true;
+
+    /* Give other threads a chance to add to the batch */
+
+    if (gc->err == 0 && gc->opts.maxDelayUsecs > 0 && !batchFull(gc)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += gc->opts.maxDelayUsecs / 1000000;
+        deadline.tv_nsec += (gc->opts.maxDelayUsecs % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!batchFull(gc))
+            if (pthread_cond_timedwait(&gc->fillCond, &gc->mtx,
+                                       &deadline) == ETIMEDOUT)
+                break;
+    }
+
+    /* Take the batch from the front of the queue */
+
+    struct gcRecord *first = gc->head, *rp;
+    size_t numRecs = 0, numBytes = 0;
+    off_t start = gc->end;
+
+    for (rp = first; rp != NULL; rp = rp->next) {
+        if (numRecs > 0 && (numRecs == gc->opts.maxBatchRecs ||
+                numBytes + rp->len > gc->opts.maxBatchBytes))
+            break;
+        rp->off = start + numBytes;
+        gc->iov[numRecs].iov_base = (void *) rp->buf;
+        gc->iov[numRecs].iov_len = rp->len;
+        numRecs++;
+        numBytes += rp->len;
+    }
+
+    gc->head = rp;
+    if (rp == NULL)
+        gc->tail = NULL;
+    gc->queueRecs -= numRecs;
+    gc->queueBytes -= numBytes;
+    gc->end += numBytes;
+
+    /* If an earlier batch failed, these records fail with its error:
+       writing them after a hole in the log would be wrong */
+
+    int err = gc->err, numPreallocs = 0;
+
+    pthread_mutex_unlock(&gc->mtx);
+
+    /* Preallocate, if the batch would run past the allocated space. If
+       the file system doesn't support fallocate(), stop trying. */
+
+    if (err == 0 && gc->opts.preallocSize > 0 &&
+            start + (off_t) numBytes > gc->allocEnd) {
+        off_t newEnd = start + numBytes + gc->opts.preallocSize;
+        int s = posix_fallocate(gc->fd, gc->allocEnd, newEnd - gc->allocEnd);
+        if (s == 0) {
+            gc->allocEnd = newEnd;
+            numPreallocs++;
+        } else if (s == EOPNOTSUPP || s == EINVAL) {
+            gc->opts.preallocSize = 0;
+        } else {
+            err = s;
+        }
+    }
+
+    if (err == 0 && pwritevFull(gc->fd, gc->iov, numRecs, start) == -1)
+        err = errno;
+
+    /* Hand on the writer role, so that the next batch can be written
+       while we sync this one */
+
+    pthread_mutex_lock(&gc->mtx);
+    if (err != 0 && gc->err == 0)
+        gc->err = err;
+    gc->writing = false;
+    pthread_cond_broadcast(&gc->doneCond);
+    pthread_mutex_unlock(&gc->mtx);
+
+    if (err == 0) {
+        int s = 0;
+        switch (gc->opts.syncMode) {
+        case GC_SYNC_FDATASYNC: s = fdatasync(gc->fd);                  break;
+        case GC_SYNC_FSYNC:     s = fsync(gc->fd);                      break;
+        case GC_SYNC_RANGE:
+            s = sync_file_range(gc->fd, start, numBytes,
+                                SYNC_FILE_RANGE_WAIT_BEFORE |
+                                SYNC_FILE_RANGE_WRITE |
+                                SYNC_FILE_RANGE_WAIT_AFTER);
+            break;
+        default:                                                        break;
+        }
+        if (s == -1)
+            err = errno;
+    }
+
+    /* Complete the batch. Once 'done' is set, a record may vanish (its
+       submitter may return), so fetch 'next' first. */
+
+    pthread_mutex_lock(&gc->mtx);
+    if (err != 0 && gc->err == 0)
+        gc->err = err;
+
+    rp = first;
+    for (size_t j = 0; j < numRecs; j++) {
+        struct gcRecord *next = rp->next;
+        rp->err = err;
+        rp->done = true;
+        rp = next;
+    }
+
+    gc->stats.numRecs += numRecs;
+    gc->stats.numBatches++;
+    gc->stats.numPreallocs += numPreallocs;
+    gc->stats.maxBatch = max(gc->stats.maxBatch, numRecs);
+    pthread_cond_broadcast(&gc->doneCond);
+}
+
+/* Append the 'len' bytes at 'buf' to the file, returning once they are
+   durable. The offset at which they were written is returned in '*offp',
+   if that isn't NULL. Return 0 on success, or -1 with errno set. */
+
+int
+gcAppend(struct GroupCommit *gc, const void *buf, size_t len, off_t *offp)
+{
+    struct gcRecord rec;
+
+    rec.buf = buf;
+    rec.len = len;
+    rec.err = 0;
+    rec.done = false;
+    rec.next = NULL;
+
+    pthread_mutex_lock(&gc->mtx);
+
+    if (gc->err != 0) {
+        int err = gc->err;
+        pthread_mutex_unlock(&gc->mtx);
+        errno = err;
+        return -1;
+    }
+
+    if (gc->tail == NULL)
+        gc->head = &rec;
+    else
+        gc->tail->next = &rec;
+    gc->tail = &rec;
+    gc->queueRecs++;
+    gc->queueBytes += len;
+    if (batchFull(gc))
+        pthread_cond_signal(&gc->fillCond);
+
+    /* Wait until our record is committed, leading batches (not
+       necessarily containing our record) whenever nobody else is */
+
+    while (!rec.done) {
+        if (!gc->writing && gc->head != NULL)
+            leadBatch(gc);
+        else
+            pthread_cond_wait(&gc->doneCond, &gc->mtx);
+    }
+
+    pthread_mutex_unlock(&gc->mtx);
+
+    if (rec.err != 0) {
+        errno = rec.err;
+        return -1;
+    }
+    if (offp != NULL)
+        *offp = rec.off;
+    return 0;
+}
+
+void
+gcGetStats(struct GroupCommit *gc, struct gcStats *stats)
+{
+    pthread_mutex_lock(&gc->mtx);
+    *stats = gc->stats;
+    pthread_mutex_unlock(&gc->mtx);
+}
+
+/* Release resources and trim any preallocated space beyond the last
+   record. No thread may be in gcAppend(). The descriptor isn't closed. */
+
+int
+gcClose(struct GroupCommit *gc)
+{
+    int s = 0;
+
+    if (gc->allocEnd > gc->end && gc->err == 0)
+        s = ftruncate(gc->fd, gc->end);
+
+    free(gc->iov);
+    pthread_mutex_destroy(&gc->mtx);
+    pthread_cond_destroy(&gc->doneCond);
+    pthread_cond_destroy(&gc->fillCond);
+    return s;
+}
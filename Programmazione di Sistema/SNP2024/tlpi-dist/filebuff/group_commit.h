@@ -0,0 +1,80 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* group_commit.h
+
+   Header file for group_commit.c.
+*/
+#ifndef GROUP_COMMIT_H
+#define GROUP_COMMIT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/* How a batch is made durable */
+
+#define GC_SYNC_FDATASYNC   0   /* fdatasync() */
+#define GC_SYNC_FSYNC       1   /* fsync() */
+#define GC_SYNC_RANGE       2   /* sync_file_range() on the batch (see
+                                   group_commit.c for the caveats) */
+#define GC_SYNC_NONE        3   /* No syncing; for comparison */
+
+struct gcOptions {
+    size_t maxBatchRecs;        /* Maximum records in one batch */
+    size_t maxBatchBytes;       /* Maximum bytes in one batch */
+    long maxDelayUsecs;         /* How long a leader may wait for a batch
+                                   to fill before writing it (0: don't) */
+    off_t preallocSize;         /* If > 0, extend the file with fallocate()
+                                   in steps of this many bytes */
+    int syncMode;               /* One of GC_SYNC_* */
+};
+
+struct gcStats {
+    unsigned long numRecs;      /* Records committed */
+    unsigned long numBatches;   /* Batches (pwritev() + sync) */
+    unsigned long maxBatch;     /* Most records in one batch */
+    unsigned long numPreallocs; /* fallocate() calls */
+};
+
+struct gcRecord;                /* A submitted record; see group_commit.c */
+
+struct GroupCommit {            /* Treat as opaque */
+    int fd;
+    struct gcOptions opts;
+    pthread_mutex_t mtx;
+    pthread_cond_t doneCond;    /* A batch completed, or the writer role
+                                   became free */
+    pthread_cond_t fillCond;    /* The queue reached a full batch */
+    struct gcRecord *head, *tail;       /* Queue of unwritten records */
+    size_t queueRecs, queueBytes;
+    bool writing;               /* Some thread holds the writer role */
+    off_t end;                  /* Offset of next record */
+    off_t allocEnd;             /* End of space preallocated so far */
+    int err;                    /* Sticky error; once set, appends fail */
+    struct iovec *iov;          /* Used by the writer */
+    struct gcStats stats;
+};
+
+void gcDefaultOptions(struct gcOptions *opts);
+
+int gcOpen(struct GroupCommit *gc, int fd, const struct gcOptions *opts);
+
+int gcAppend(struct GroupCommit *gc, const void *buf, size_t len,
+             off_t *offp);
+
+void gcGetStats(struct GroupCommit *gc, struct gcStats *stats);
+
+int gcClose(struct GroupCommit *gc);
+
+#endif
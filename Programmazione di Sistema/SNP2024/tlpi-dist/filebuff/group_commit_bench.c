@@ -0,0 +1,185 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* group_commit_bench.c
+
+   Measure durable append throughput and commit latency with
+   group_commit.c.
+
+   Usage: group_commit_bench [-t max-threads] [-n records] [-s rec-size]
+                [-b max-batch] [-d delay-usecs] [-p prealloc-kib]
+                [-m fdatasync|fsync|range|none] file
+
+   For 1, 2, 4, ... up to 'max-threads' (default 16) threads, each thread
+   appends 'records' (default 2000) records of 'rec-size' (default 128)
+   bytes to 'file' (which is truncated first), timing each gcAppend()
+   call. A line is printed for each thread count, giving the commit rate
+   and the median, 99th percentile, and maximum commit latency, along with
+   the average batch size.
+
+   With "-b 1", every record is written and synced on its own, which
+   corresponds to write_bytes_fdatasync (or, with "-m fsync",
+   write_bytes_fsync).
+
+   This program is Linux-specific.
+*/
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include "group_commit.h"
+#include "tlpi_hdr.h"
+
+static struct GroupCommit gc;
+static long numRecs = 2000;
+static int recSize = 128;
+static double *lat;             /* Latencies of all records, in usecs */
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    long tnum = (long) arg;
+    double *myLat = lat + tnum * numRecs;
+
+    char *rec = malloc(recSize);
+    if (rec == NULL)
+        errExit("malloc");
+
+    for (long j = 0; j < numRecs; j++) {
+        snprintf(rec, recSize, "%ld:%ld", tnum, j);
+        memset(rec + strlen(rec), ' ', recSize - strlen(rec) - 1);
+        rec[recSize - 1] = '\n';
+
+        double start = now();
+        if (gcAppend(&gc, rec, recSize, NULL) == -1)
+            errExit("gcAppend");
+        myLat[j] = (now() - start) * 1e6;
+    }
+
+    free(rec);
+    return NULL;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct gcOptions opts;
+    int maxThreads = 16;
+    int opt;
+
+    gcDefaultOptions(&opts);
+
+    while ((opt = getopt(argc, argv, "t:n:s:b:d:p:m:")) != -1) {
+        switch (opt) {
+        case 't': maxThreads = getInt(optarg, GN_GT_0, "max-threads");  break;
+        case 'n': numRecs = getLong(optarg, GN_GT_0, "records");        break;
+        case 's': recSize = getInt(optarg, GN_GT_0, "rec-size");        break;
+        case 'b': opts.maxBatchRecs = getLong(optarg, GN_GT_0,
+                                              "max-batch");             break;
+        case 'd': opts.maxDelayUsecs = getLong(optarg, GN_NONNEG,
+                                               "delay-usecs");          break;
+        case 'p': opts.preallocSize = getLong(optarg, GN_NONNEG,
+                                              "prealloc-kib") * 1024;   break;
+        case 'm':
+            if (strcmp(optarg, "fdatasync") == 0)
+                opts.syncMode = GC_SYNC_FDATASYNC;
+            else if (strcmp(optarg, "fsync") == 0)
+                opts.syncMode = GC_SYNC_FSYNC;
+            else if (strcmp(optarg, "range") == 0)
+                opts.syncMode = GC_SYNC_RANGE;
+            else if (strcmp(optarg, "none") == 0)
+                opts.syncMode = GC_SYNC_NONE;
+            else
+                cmdLineErr("Unknown sync mode: %s\n", optarg);
+            break;
+        default:
+            usageErr("%s [-t max-threads] [-n records] [-s rec-size] "
+                     "[-b max-batch] [-d delay-usecs] [-p prealloc-kib] "
+                     "[-m fdatasync|fsync|range|none] file\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [options] file\n", argv[0]);
+    if (recSize < 32)
+        cmdLineErr("rec-size must be at least 32\n");
+
+    lat = calloc((size_t) maxThreads * numRecs, sizeof(double));
+    pthread_t *tids = calloc(maxThreads, sizeof(pthread_t));
+    if (lat == NULL || tids == NULL)
+        errExit("calloc");
+
+    printf("%7s %10s %9s %9s %9s %9s\n", "Threads", "Records/s",
+           "p50 (us)", "p99 (us)", "max (us)", "Avg batch");
+
+    for (int numThreads = 1; numThreads <= maxThreads;
+            numThreads = (numThreads < maxThreads &&
+                          numThreads * 2 > maxThreads) ? maxThreads :
+                                                         numThreads * 2) {
+        int fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC,
+                      S_IRUSR | S_IWUSR);
+        if (fd == -1)
+            errExit("open");
+        if (gcOpen(&gc, fd, &opts) == -1)
+            errExit("gcOpen");
+
+        double start = now();
+        for (long j = 0; j < numThreads; j++) {
+            int s = pthread_create(&tids[j], NULL, threadFunc, (void *) j);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        }
+        for (int j = 0; j < numThreads; j++) {
+            int s = pthread_join(tids[j], NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        }
+        double secs = now() - start;
+
+        struct gcStats st;
+        gcGetStats(&gc, &st);
+        if (gcClose(&gc) == -1)
+            errExit("gcClose");
+
+        struct stat sb;
+        if (fstat(fd, &sb) == -1)
+            errExit("fstat");
+        if (sb.st_size != (off_t) numThreads * numRecs * recSize)
+            fatal("file size is %lld; expected %lld", (long long) sb.st_size,
+                  (long long) numThreads * numRecs * recSize);
+        close(fd);
+
+        long total = numThreads * numRecs;
+        qsort(lat, total, sizeof(double), cmpDouble);
+        printf("%7d %10.0f %9.0f %9.0f %9.0f %9.1f\n", numThreads,
+               total / secs, lat[total / 2], lat[total * 99 / 100],
+               lat[total - 1], (double) st.numRecs / st.numBatches);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,473 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* range_lock.c
+
+   A byte-range lock manager for multithreaded programs.
+
+   The fcntl() record locks used by region_locking.c are owned by a
+   process, so they can't be used to make the threads of one process
+   exclude each other, and every lock and unlock is a system call. Here,
+   the ranges locked by the threads of a process are kept in an interval
+   tree (a treap ordered by start offset, with each node recording the
+   largest end offset in its subtree), protected by a mutex. A thread
+   whose range conflicts with one held by another thread waits on a
+   condition variable.
+
+   Exclusion between processes uses open file description (OFD) locks on
+   the descriptor given to rlInit(), and these are kept to a minimum: the
+   kernel lock state for the file is maintained as the union of the
+   ranges held by the process's threads. A read lock on a range that is
+   already wholly covered by other threads' read locks, and the release
+   of a range still covered by other locks, need no fcntl() call at all;
+   when a range is released, only the parts no longer covered by any
+   other range are unlocked.
+
+   When another process holds a conflicting lock, the thread waits in
+   F_OFD_SETLKW without holding the mutex, so that the other threads of
+   the process can continue to lock unrelated ranges; meanwhile, its
+   range is marked "pending" and conflicts with any overlapping request.
+
+   Unlike fcntl() locks, a range must be unlocked as a whole, using the
+   'struct RangeLock' with which it was locked, and locks are not
+   converted or merged: a thread that locks overlapping ranges of its own
+   will deadlock, as with a nonrecursive mutex. The OFD locks are not
+   subject to the kernel's deadlock detection.
+
+   Each manager collects statistics on waits and system calls (see
+   rlGetStats()).
+
+   This code is Linux-specific (OFD locks are available since Linux 3.15).
+*/
+#define _GNU_SOURCE             /* For F_OFD_SETLK and friends */
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include "range_lock.h"
+#include "tlpi_hdr.h"
+
+/* Largest value of an 'off_t'; used as the end of "to EOF" ranges */
+
+#define OFF_T_MAX ((off_t) ~((unsigned long long) 1 << (sizeof(off_t) * 8 - 1)))
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Interval tree operations. Nodes are ordered by start offset, with ties
+   broken by address, so that every node has a distinct key. */
+
+static bool
+before(const struct RangeLock *a, const struct RangeLock *b)
+{
+    return a->start < b->start ||
+           (a->start == b->start && (uintptr_t) a < (uintptr_t) b);
+}
+
+static void
+update(struct RangeLock *t)
+{
+    t->maxEnd = t->end;
+    if (t->left != NULL && t->left->maxEnd > t->maxEnd)
+        t->maxEnd = t->left->maxEnd;
+    if (t->right != NULL && t->right->maxEnd > t->maxEnd)
+        t->maxEnd = t->right->maxEnd;
+}
+
+/* Split 't' into the nodes before 'key' ('*l') and the rest ('*r') */
+
+static void
+split(struct RangeLock *t, const struct RangeLock *key,
+      struct RangeLock **l, struct RangeLock **r)
+{
+    if (t == NULL) {
+        *l = *r = NULL;
+        return;
+    }
+
+    if (before(t, key)) {
+        split(t->right, key, &t->right, r);
+        *l = t;
+    } else {
+        split(t->left, key, l, &t->left);
+        *r = t;
+    }
+    update(t);
+}
+
+/* Join 'a' and 'b', where every node of 'a' comes before every node of 'b' */
+
+static struct RangeLock *
+merge(struct RangeLock *a, struct RangeLock *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+
+    if (a->prio > b->prio) {
+        a->right = merge(a->right, b);
+        update(a);
+        return a;
+    } else {
+        b->left = merge(a, b->left);
+        update(b);
+        return b;
+    }
+}
+
+static struct RangeLock *
+treeInsert(struct RangeLock *t, struct RangeLock *n)
+{
+    if (t == NULL || n->prio > t->prio) {
+        split(t, n, &n->left, &n->right);
+        update(n);
+        return n;
+    }
+
+    if (before(n, t))
+        t->left = treeInsert(t->left, n);
+    else
+        t->right = treeInsert(t->right, n);
+    update(t);
+    return t;
+}
+
+static struct RangeLock *
+treeRemove(struct RangeLock *t, struct RangeLock *n)
+{
+    if (t == NULL)
+        return NULL;
+    if (t == n)
+        return merge(t->left, t->right);
+
+    if (before(n, t))
+        t->left = treeRemove(t->left, n);
+    else
+        t->right = treeRemove(t->right, n);
+    update(t);
+    return t;
+}
+
+/* Does any range in 't' prevent 'rl' from being locked? */
+
+static bool
+conflicts(const struct RangeLock *t, const struct RangeLock *rl)
+{
+    if (t == NULL || t->maxEnd <= rl->start)
+        return false;           /* Nothing in this subtree overlaps */
+
+    if (conflicts(t->left, rl))
+        return true;
+
+    if (t->start >= rl->end)    /* This node, and all to its right, */
+        return false;           /* start after 'rl' ends */
+
+    if (t->end > rl->start &&
+            (rl->type == F_WRLCK || t->type == F_WRLCK || t->pending))
+        return true;
+
+    return conflicts(t->right, rl);
+}
+
+/* Apply an OFD lock operation to [start, end) */
+
+static int
+ofdLock(struct RangeLockMgr *m, int cmd, int type, off_t start, off_t end)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));         /* 'l_pid' must be 0 for OFD locks */
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = (end == OFF_T_MAX) ? 0 : end - start;
+
+    __atomic_add_fetch(&m->stats.numOfdCalls, 1, __ATOMIC_RELAXED);
+    return fcntl(m->fd, cmd, &fl);
+}
+
+/* Visit the ranges in 't' that overlap [*pos, end), in order of start
+   offset, advancing '*pos' past each of them. Parts of the interval
+   that no range covers are "gaps"; if 'unlockErr' is not NULL, the OFD
+   lock on each gap is removed (with errno saved in '*unlockErr' if that
+   fails). Returns the number of gaps found before the final '*pos'. */
+
+static int
+walkGaps(struct RangeLockMgr *m, const struct RangeLock *t, off_t *pos,
+         off_t end, int *unlockErr)
+{
+    if (t == NULL || *pos >= end || t->maxEnd <= *pos)
+        return 0;
+
+    int numGaps = walkGaps(m, t->left, pos, end, unlockErr);
+
+    if (*pos >= end || t->start >= end)
+        return numGaps;
+
+    if (t->start > *pos) {
+        numGaps++;
+        if (unlockErr != NULL &&
+                ofdLock(m, F_OFD_SETLK, F_UNLCK, *pos, t->start) == -1)
+            *unlockErr = errno;
+    }
+    if (t->end > *pos)
+        *pos = t->end;
+
+    return numGaps + walkGaps(m, t->right, pos, end, unlockErr);
+}
+
+/* Return the number of parts of [start, end) not covered by any range in
+   the tree, unlocking them if 'unlockErr' is not NULL */
+
+static int
+findGaps(struct RangeLockMgr *m, off_t start, off_t end, int *unlockErr)
+{
+    off_t pos = start;
+    int numGaps = walkGaps(m, m->root, &pos, end, unlockErr);
+
+    if (pos < end) {
+        numGaps++;
+        if (unlockErr != NULL &&
+                ofdLock(m, F_OFD_SETLK, F_UNLCK, pos, end) == -1)
+            *unlockErr = errno;
+    }
+    return numGaps;
+}
+
+/* Remove 'rl' from the tree and drop the OFD locks on the parts of its
+   range that are no longer covered. Returns the number of such parts.
+   Called with the mutex held. */
+
+static int
+removeRange(struct RangeLockMgr *m, struct RangeLock *rl, int *unlockErr)
+{
+    m->root = treeRemove(m->root, rl);
+    return (m->fd == -1) ? 0 : findGaps(m, rl->start, rl->end, unlockErr);
+}
+
+static void
+lockMutex(struct RangeLockMgr *m)
+{
+    int s = pthread_mutex_lock(&m->mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+}
+
+static void
+unlockMutex(struct RangeLockMgr *m)
+{
+    int s = pthread_mutex_unlock(&m->mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+}
+
+static void
+wakeWaiters(struct RangeLockMgr *m)
+{
+    int s = pthread_cond_broadcast(&m->cond);
+    if (s != 0)
+        errExitEN(s, "pthread_cond_broadcast");
+}
+
+/* Initialize a lock manager. 'fd' is an open file on which OFD locks are
+   placed to exclude other processes, or -1 to arbitrate only among the
+   threads of this process. Returns 0 on success, or -1 on error. */
+
+int
+rlInit(struct RangeLockMgr *m, int fd)
+{
+    int s;
+
+    m->fd = fd;
+    m->root = NULL;
+    m->seed = 2463534242U;
+    memset(&m->stats, 0, sizeof(m->stats));
+
+    s = pthread_mutex_init(&m->mtx, NULL);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    s = pthread_cond_init(&m->cond, NULL);
+    if (s != 0) {
+        pthread_mutex_destroy(&m->mtx);
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+/* Destroy a lock manager; fails with EBUSY if any range is still locked */
+
+int
+rlDestroy(struct RangeLockMgr *m)
+{
+    if (m->root != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mtx);
+    return 0;
+}
+
+/* Lock 'len' bytes starting at offset 'start' (if 'len' is 0, through
+   to the largest possible offset) with a lock of 'type' (F_RDLCK or
+   F_WRLCK), using 'rl' to record the lock. If 'wait' is false and the
+   range is locked by another thread or process, fail with EAGAIN. Returns
+   0 on success, or -1 on error. */
+
+int
+rlLock(struct RangeLockMgr *m, struct RangeLock *rl, int type,
+       off_t start, off_t len, bool wait)
+{
+    if ((type != F_RDLCK && type != F_WRLCK) || start < 0 || len < 0 ||
+            (len > 0 && start > OFF_T_MAX - len)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rl->start = start;
+    rl->end = (len == 0) ? OFF_T_MAX : start + len;
+    rl->type = type;
+    rl->pending = false;
+
+    double waitStart = 0;
+
+    lockMutex(m);
+
+    /* Wait until no other thread holds a conflicting range */
+
+    while (conflicts(m->root, rl)) {
+        if (!wait) {
+            m->stats.numBusy++;
+            unlockMutex(m);
+            errno = EAGAIN;
+            return -1;
+        }
+        if (waitStart == 0) {
+            waitStart = now();
+            m->stats.numWaits++;
+        }
+        int s = pthread_cond_wait(&m->cond, &m->mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_cond_wait");
+    }
+
+    /* If the range is already covered by (read) locks of other threads,
+       this process already holds the OFD lock that we need */
+
+    bool needOfd = m->fd != -1 && findGaps(m, rl->start, rl->end, NULL) > 0;
+
+    m->seed ^= m->seed << 13;           /* xorshift32 */
+    m->seed ^= m->seed >> 17;
+    m->seed ^= m->seed << 5;
+    rl->prio = m->seed;
+    m->root = treeInsert(m->root, rl);
+
+    if (!needOfd) {
+        if (m->fd != -1)
+            m->stats.numOfdElided++;
+
+    } else if (ofdLock(m, F_OFD_SETLK, type, rl->start, rl->end) == -1) {
+        int savedErrno = (errno == EACCES) ? EAGAIN : errno;
+
+        if (!wait || savedErrno != EAGAIN) {
+            if (savedErrno == EAGAIN)
+                m->stats.numBusy++;
+            removeRange(m, rl, NULL);
+            unlockMutex(m);
+            errno = savedErrno;
+            return -1;
+        }
+
+        /* Another process holds a conflicting lock. Wait for it without
+           blocking the other threads of this process; our range is marked
+           "pending" in the meantime. */
+
+        rl->pending = true;
+        m->stats.numOfdWaits++;
+        if (waitStart == 0)
+            waitStart = now();
+        unlockMutex(m);
+
+        int s;
+        while ((s = ofdLock(m, F_OFD_SETLKW, type, rl->start,
+                            rl->end)) == -1 && errno == EINTR)
+            continue;
+        savedErrno = errno;
+
+        lockMutex(m);
+        rl->pending = false;
+        wakeWaiters(m);                 /* Overlapping requests may proceed */
+
+        if (s == -1) {
+            removeRange(m, rl, NULL);
+            unlockMutex(m);
+            errno = savedErrno;
+            return -1;
+        }
+    }
+
+    m->stats.numLocks++;
+    if (waitStart != 0) {
+        double secs = now() - waitStart;
+        m->stats.totWaitSecs += secs;
+        if (secs > m->stats.maxWaitSecs)
+            m->stats.maxWaitSecs = secs;
+    }
+
+    unlockMutex(m);
+    return 0;
+}
+
+/* Release the range locked with 'rl'. Returns 0 on success, or -1 if an
+   OFD lock could not be removed. */
+
+int
+rlUnlock(struct RangeLockMgr *m, struct RangeLock *rl)
+{
+    int unlockErr = 0;
+
+    lockMutex(m);
+
+    if (removeRange(m, rl, &unlockErr) == 0 && m->fd != -1)
+        m->stats.numOfdElided++;        /* Still covered by other ranges */
+
+    wakeWaiters(m);
+    unlockMutex(m);
+
+    if (unlockErr != 0) {
+        errno = unlockErr;
+        return -1;
+    }
+    return 0;
+}
+
+/* Return a snapshot of the statistics of manager 'm' */
+
+void
+rlGetStats(struct RangeLockMgr *m, struct RangeLockStats *stats)
+{
+    lockMutex(m);
+    *stats = m->stats;
+    stats->numOfdCalls = __atomic_load_n(&m->stats.numOfdCalls,
+                                         __ATOMIC_RELAXED);
+    unlockMutex(m);
+}
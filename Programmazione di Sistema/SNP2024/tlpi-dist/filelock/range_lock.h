@@ -0,0 +1,69 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* range_lock.h
+
+   Header file for range_lock.c.
+*/
+#ifndef RANGE_LOCK_H
+#define RANGE_LOCK_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/* A byte range locked (or being locked) by a thread. The caller supplies
+   the storage, which must remain valid until rlUnlock(); it serves as a
+   node of the manager's interval tree. */
+
+struct RangeLock {
+    off_t start;                /* Range is [start, end) */
+    off_t end;
+    int type;                   /* F_RDLCK or F_WRLCK */
+    bool pending;               /* Waiting for a lock held by another process */
+    off_t maxEnd;               /* Largest 'end' in this subtree */
+    unsigned int prio;          /* Heap priority (the tree is a treap) */
+    struct RangeLock *left, *right;
+};
+
+struct RangeLockStats {
+    unsigned long numLocks;     /* Successful rlLock() calls */
+    unsigned long numBusy;      /* rlLock() calls that failed with EAGAIN */
+    unsigned long numWaits;     /* Waits for another thread in this process */
+    unsigned long numOfdWaits;  /* Waits for another process */
+    unsigned long numOfdCalls;  /* fcntl() calls made */
+    unsigned long numOfdElided; /* Lock/unlock operations needing no fcntl() */
+    double totWaitSecs;         /* Total time spent waiting */
+    double maxWaitSecs;         /* Longest single wait */
+};
+
+struct RangeLockMgr {
+    int fd;                     /* File for OFD locks, or -1 */
+    pthread_mutex_t mtx;        /* Protects the following fields */
+    pthread_cond_t cond;        /* Signaled when a range is released */
+    struct RangeLock *root;     /* Interval tree of held/pending ranges */
+    unsigned int seed;          /* For treap priorities */
+    struct RangeLockStats stats;
+};
+
+int rlInit(struct RangeLockMgr *m, int fd);
+
+int rlDestroy(struct RangeLockMgr *m);
+
+int rlLock(struct RangeLockMgr *m, struct RangeLock *rl, int type,
+           off_t start, off_t len, bool wait);
+
+int rlUnlock(struct RangeLockMgr *m, struct RangeLock *rl);
+
+void rlGetStats(struct RangeLockMgr *m, struct RangeLockStats *stats);
+
+#endif
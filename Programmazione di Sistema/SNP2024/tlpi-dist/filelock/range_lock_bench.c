@@ -0,0 +1,190 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* range_lock_bench.c
+
+   Exercise range_lock.c with record-oriented writers: each of 'threads'
+   threads in each of 'procs' processes repeatedly picks a random record
+   of the file, locks it, rewrites it with pwrite(), and unlocks it.
+
+   Usage: range_lock_bench [-p procs] [-t threads] [-n updates]
+                [-r num-records] [-s record-size] [-w] [-x] file
+
+   Defaults: 1 process, 4 threads, 100000 updates per thread, 1000
+   records of 128 bytes.
+
+   -w   Lock the whole file for each update (the behavior of writers that
+        serialize on a single lock), rather than just the record.
+
+   -x   Don't use OFD locks (arbitrate only among threads). Only sensible
+        with a single process.
+
+   Each process prints its lock manager statistics; the parent then
+   reports the total update rate.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include "range_lock.h"
+#include "tlpi_hdr.h"
+
+static struct RangeLockMgr mgr;
+static long numUpdates = 100000;
+static int numRecs = 1000, recSize = 128;
+static bool wholeFile = false;
+static int fd;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    unsigned int seed = (unsigned int) (uintptr_t) arg;
+    char *rec = malloc(recSize);
+    if (rec == NULL)
+        errExit("malloc");
+
+    for (long j = 0; j < numUpdates; j++) {
+        struct RangeLock rl;
+        int r = rand_r(&seed) % numRecs;
+        off_t off = (off_t) r * recSize;
+
+        if (rlLock(&mgr, &rl, F_WRLCK, wholeFile ? 0 : off,
+                   wholeFile ? 0 : recSize, true) == -1)
+            errExit("rlLock");
+
+        memset(rec, 'a' + j % 26, recSize);
+        if (pwrite(fd, rec, recSize, off) != recSize)
+            fatal("pwrite failed");
+
+        if (rlUnlock(&mgr, &rl) == -1)
+            errExit("rlUnlock");
+    }
+
+    free(rec);
+    return NULL;
+}
+
+/* Run 'numThreads' updater threads in this process, then print stats */
+
+static void
+runProcess(const char *path, int numThreads, bool useOfd, int procNum)
+{
+    fd = open(path, O_RDWR);    /* A separate open file description per
+                                   process, so OFD locks conflict */
+    if (fd == -1)
+        errExit("open");
+
+    if (rlInit(&mgr, useOfd ? fd : -1) == -1)
+        errExit("rlInit");
+
+    pthread_t *tids = calloc(numThreads, sizeof(pthread_t));
+    if (tids == NULL)
+        errExit("calloc");
+
+    for (int j = 0; j < numThreads; j++) {
+        int s = pthread_create(&tids[j], NULL, threadFunc,
+                               (void *) (uintptr_t) (procNum * 1000 + j + 1));
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (int j = 0; j < numThreads; j++) {
+        int s = pthread_join(tids[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    struct RangeLockStats st;
+    rlGetStats(&mgr, &st);
+    printf("[%ld] %lu locks; waits: %lu thread, %lu process "
+           "(avg %.1f us, max %.1f us); fcntl: %lu calls, %lu elided\n",
+           (long) getpid(), st.numLocks, st.numWaits, st.numOfdWaits,
+           (st.numWaits + st.numOfdWaits) ?
+                st.totWaitSecs * 1e6 / (st.numWaits + st.numOfdWaits) : 0.0,
+           st.maxWaitSecs * 1e6, st.numOfdCalls, st.numOfdElided);
+
+    if (rlDestroy(&mgr) == -1)
+        errExit("rlDestroy");
+    close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int numProcs = 1, numThreads = 4;
+    bool useOfd = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:t:n:r:s:wx")) != -1) {
+        switch (opt) {
+        case 'p': numProcs = getInt(optarg, GN_GT_0, "procs");          break;
+        case 't': numThreads = getInt(optarg, GN_GT_0, "threads");      break;
+        case 'n': numUpdates = getLong(optarg, GN_GT_0, "updates");     break;
+        case 'r': numRecs = getInt(optarg, GN_GT_0, "num-records");     break;
+        case 's': recSize = getInt(optarg, GN_GT_0, "record-size");     break;
+        case 'w': wholeFile = true;                                     break;
+        case 'x': useOfd = false;                                       break;
+        default:  usageErr("%s [-p procs] [-t threads] [-n updates] "
+                           "[-r num-records] [-s record-size] [-w] [-x] "
+                           "file\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [options] file\n", argv[0]);
+
+    int cfd = open(argv[optind], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (cfd == -1)
+        errExit("open");
+    if (ftruncate(cfd, (off_t) numRecs * recSize) == -1)
+        errExit("ftruncate");
+    close(cfd);
+
+    double start = now();
+
+    if (numProcs == 1) {
+        runProcess(argv[optind], numThreads, useOfd, 0);
+    } else {
+        fflush(stdout);
+        for (int p = 0; p < numProcs; p++) {
+            switch (fork()) {
+            case -1:
+                errExit("fork");
+            case 0:
+                runProcess(argv[optind], numThreads, useOfd, p);
+                exit(EXIT_SUCCESS);
+            default:
+                break;
+            }
+        }
+        while (wait(NULL) > 0)
+            continue;
+    }
+
+    double secs = now() - start;
+    long total = numUpdates * numThreads * numProcs;
+    printf("%ld updates (%s locks) in %.3f s: %.0f updates/s\n", total,
+           wholeFile ? "whole-file" : "record", secs, total / secs);
+
+    exit(EXIT_SUCCESS);
+}
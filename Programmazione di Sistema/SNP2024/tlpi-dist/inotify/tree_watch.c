@@ -0,0 +1,935 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* tree_watch.c
+
+   Monitor a directory tree for changes. This is a reworking, as a reusable
+   module, of the ideas in inotify_dtree.c, designed so that the cost of
+   handling an event doesn't depend on the size of the tree:
+
+   * The watched directories are held as a tree of nodes (a "trie" of
+     pathname components): each node records its own name and a pointer to
+     its parent, and full pathnames are built only when needed. So, renaming
+     a directory means relinking one node, rather than rewriting the cached
+     pathnames of every directory beneath it.
+
+   * Nodes are found by watch descriptor, and by (parent, name), through
+     hash tables, rather than by a linear search of an array.
+
+   * IN_MOVED_FROM events for directories are held, keyed by cookie, until
+     the matching IN_MOVED_TO arrives, which needn't be the next event.
+     Only if no match arrives, even after waiting 'moveWaitUsecs' for more
+     events, is the directory treated as having left the tree, and only
+     its own subtree is dropped. A rename that we nevertheless fail to
+     pair up is detected when inotify_add_watch() returns the watch
+     descriptor of a directory we already know, and is then handled as
+     a rename. There are thus no full rescans, except after a queue
+     overflow (IN_Q_OVERFLOW), when events have been lost.
+
+   * Events are read with large read()s until the inotify descriptor is
+     drained, and, within one read(), repeats of an event (same directory,
+     name, and mask, with no other event for that name in between) are
+     reported only once.
+
+   Alternatively, the fanotify backend marks the entire file system
+   containing the root with FAN_MARK_FILESYSTEM and FAN_REPORT_DFID_NAME,
+   so that no per-directory watches are needed at all; events outside the
+   tree are discarded. This requires CAP_SYS_ADMIN (and, to turn the
+   directory file handles in events into pathnames, CAP_DAC_READ_SEARCH).
+   If it isn't permitted, twOpen() fails with EPERM, and the caller can
+   fall back to the inotify backend.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include "tree_watch.h"
+#include "tlpi_hdr.h"
+
+#define DEF_READ_BUF_SIZE (256 * 1024)
+#define SEEN_SIZE 4096          /* Slots in the coalescing table */
+
+/* Events we need on every directory, to maintain the tree */
+
+#define DIR_EVENTS (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+
+struct twDir {                  /* A watched directory */
+    int wd;
+    char *name;                 /* Name in parent; pathname for the root */
+    struct twDir *parent;       /* NULL for the root, and while moving */
+    struct twDir *firstChild;
+    struct twDir *prevSib, *nextSib;
+    struct twDir *nextByWd;     /* Hash chain in 'wdTab' */
+    struct twDir *nextByName;   /* Hash chain in 'nameTab' */
+};
+
+struct pendingMove {            /* A directory awaiting its IN_MOVED_TO */
+    uint32_t cookie;
+    struct twDir *dir;
+    struct pendingMove *next;
+};
+
+struct seen {                   /* Slot in the coalescing table */
+    unsigned int gen;           /* Slot is in use if equal to 'seenGen' */
+    uint32_t mask;
+    const void *key;            /* Watch descriptor or file handle */
+    size_t keyLen;              /* 0 for a wd; else file handle size */
+    const char *name;
+};
+
+struct TreeWatch {
+    struct twOptions opts;
+    twEventFn fn;
+    void *arg;
+    int fd;                     /* inotify or fanotify descriptor */
+    char *buf;
+    uint32_t watchMask;
+    struct twDir *root;
+    bool rootGone;
+    struct twDir **wdTab, **nameTab;
+    size_t tabSize;             /* Buckets in each table (a power of 2) */
+    struct pendingMove *pending;
+    struct seen *seenTab;
+    unsigned int seenGen;
+    int mountFd;                /* fanotify: for open_by_handle_at() */
+    char *rootReal;             /* fanotify: root as an absolute path */
+    size_t rootRealLen;
+    struct twStats stats;
+};
+
+void
+twDefaultOptions(struct twOptions *opts)
+{
+    opts->backend = TW_INOTIFY;
+    opts->eventMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+    opts->readBufSize = DEF_READ_BUF_SIZE;
+    opts->moveWaitUsecs = 2000;
+}
+
+/***********************************************************************/
+
+/* Hash tables */
+
+static size_t
+strHash(const char *s)
+{
+    size_t h = 2166136261u;             /* FNV-1a */
+
+    while (*s != '\0')
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    return h;
+}
+
+static size_t
+nameSlot(const struct TreeWatch *tw, const struct twDir *parent,
+         const char *name)
+{
+    return (strHash(name) ^ ((uintptr_t) parent >> 4)) & (tw->tabSize - 1);
+}
+
+static size_t
+wdSlot(const struct TreeWatch *tw, int wd)
+{
+    return ((unsigned int) wd * 2654435761u) & (tw->tabSize - 1);
+}
+
+static void
+insertDir(struct TreeWatch *tw, struct twDir *d);
+
+/* Double the size of the tables once they hold as many entries as they
+   have buckets */
+
+static void
+growTables(struct TreeWatch *tw)
+{
+    struct twDir **oldWd = tw->wdTab;
+    size_t oldSize = tw->tabSize;
+
+    tw->tabSize = (oldSize == 0) ? 1024 : 2 * oldSize;
+    tw->wdTab = calloc(tw->tabSize, sizeof(struct twDir *));
+    free(tw->nameTab);
+    tw->nameTab = calloc(tw->tabSize, sizeof(struct twDir *));
+    if (tw->wdTab == NULL || tw->nameTab == NULL)
+        errExit("calloc");
+
+    /* Every node is in 'wdTab', so reinsert from there */
+
+    for (size_t j = 0; j < oldSize; j++) {
+        struct twDir *d, *next;
+        for (d = oldWd[j]; d != NULL; d = next) {
+            next = d->nextByWd;
+            insertDir(tw, d);
+        }
+    }
+    free(oldWd);
+}
+
+static void
+insertName(struct TreeWatch *tw, struct twDir *d)
+{
+    if (d->parent != NULL) {
+        size_t s = nameSlot(tw, d->parent, d->name);
+        d->nextByName = tw->nameTab[s];
+        tw->nameTab[s] = d;
+    }
+}
+
+static void
+removeName(struct TreeWatch *tw, struct twDir *d)
+{
+    if (d->parent != NULL) {
+        struct twDir **dp = &tw->nameTab[nameSlot(tw, d->parent, d->name)];
+        while (*dp != d)
+            dp = &(*dp)->nextByName;
+        *dp = d->nextByName;
+    }
+}
+
+static void
+insertDir(struct TreeWatch *tw, struct twDir *d)
+{
+    size_t s = wdSlot(tw, d->wd);
+
+    d->nextByWd = tw->wdTab[s];
+    tw->wdTab[s] = d;
+    insertName(tw, d);
+}
+
+static struct twDir *
+lookupWd(const struct TreeWatch *tw, int wd)
+{
+    struct twDir *d;
+
+    for (d = tw->wdTab[wdSlot(tw, wd)]; d != NULL; d = d->nextByWd)
+        if (d->wd == wd)
+            break;
+    return d;
+}
+
+static struct twDir *
+lookupChild(const struct TreeWatch *tw, const struct twDir *parent,
+            const char *name)
+{
+    struct twDir *d;
+
+    for (d = tw->nameTab[nameSlot(tw, parent, name)]; d != NULL;
+            d = d->nextByName)
+        if (d->parent == parent && strcmp(d->name, name) == 0)
+            break;
+    return d;
+}
+
+/***********************************************************************/
+
+/* The directory tree */
+
+/* Link 'd' into the tree as child 'name' of 'parent' */
+
+static void
+linkDir(struct TreeWatch *tw, struct twDir *d, struct twDir *parent,
+        const char *name)
+{
+    if (d->name != name) {
+        char *s = strdup(name);
+        if (s == NULL)
+            errExit("strdup");
+        free(d->name);
+        d->name = s;
+    }
+
+    d->parent = parent;
+    d->prevSib = NULL;
+    d->nextSib = parent->firstChild;
+    if (parent->firstChild != NULL)
+        parent->firstChild->prevSib = d;
+    parent->firstChild = d;
+    insertName(tw, d);
+}
+
+/* Detach 'd' (and so its subtree) from its parent */
+
+static void
+unlinkDir(struct TreeWatch *tw, struct twDir *d)
+{
+    if (d->parent == NULL)
+        return;
+
+    removeName(tw, d);
+    if (d->prevSib != NULL)
+        d->prevSib->nextSib = d->nextSib;
+    else
+        d->parent->firstChild = d->nextSib;
+    if (d->nextSib != NULL)
+        d->nextSib->prevSib = d->prevSib;
+    d->parent = d->prevSib = d->nextSib = NULL;
+}
+
+/* Build the pathname of 'd' in 'buf', returning a pointer to it (which
+   lies somewhere within 'buf'), or NULL if it is too long */
+
+static char *
+dirPath(const struct twDir *d, char *buf, size_t size)
+{
+    char *p = buf + size - 1;
+
+    *p = '\0';
+    for (; d != NULL; d = d->parent) {
+        size_t len = strlen(d->name);
+        if ((size_t) (p - buf) < len + 1)
+            return NULL;
+        if (*p != '\0')
+            *--p = '/';
+        p -= len;
+        memcpy(p, d->name, len);
+    }
+    return p;
+}
+
+/* If 'd' is awaiting the IN_MOVED_TO for its rename, stop waiting */
+
+static void
+cancelPendingMove(struct TreeWatch *tw, const struct twDir *d)
+{
+    struct pendingMove **pmp;
+
+    for (pmp = &tw->pending; *pmp != NULL; pmp = &(*pmp)->next) {
+        if ((*pmp)->dir == d) {
+            struct pendingMove *pm = *pmp;
+            *pmp = pm->next;
+            free(pm);
+            return;
+        }
+    }
+}
+
+/* Remove 'd' and its subtree. The watch of 'd' itself is removed only if
+   'rmWatch' is true (it is already gone after IN_DELETE_SELF). */
+
+static void
+zapDir(struct TreeWatch *tw, struct twDir *d, bool rmWatch)
+{
+    while (d->firstChild != NULL)
+        zapDir(tw, d->firstChild, true);
+
+    if (rmWatch)
+        inotify_rm_watch(tw->fd, d->wd);        /* May already be gone */
+
+    if (d->parent != NULL)
+        unlinkDir(tw, d);
+    else if (d != tw->root)                     /* Only pending moves */
+        cancelPendingMove(tw, d);
+
+    struct twDir **dp = &tw->wdTab[wdSlot(tw, d->wd)];
+    while (*dp != d)
+        dp = &(*dp)->nextByWd;
+    *dp = d->nextByWd;
+
+    if (d == tw->root)
+        tw->root = NULL;
+    free(d->name);
+    free(d);
+    tw->stats.numDirs--;
+}
+
+/* Return true if 'a' is 'd' or one of its ancestors. Our view of the tree
+   may lag behind reality, so we check this before relinking, lest we
+   create a cycle. */
+
+static bool
+isAncestor(const struct twDir *a, const struct twDir *d)
+{
+    for (; d != NULL; d = d->parent)
+        if (d == a)
+            return true;
+    return false;
+}
+
+/* Watch directory 'name' in 'parent' (or, if 'parent' is NULL, the root,
+   whose pathname is 'name'), and all of its subdirectories */
+
+static void
+addSubtree(struct TreeWatch *tw, struct twDir *parent, const char *name)
+{
+    char buf[PATH_MAX];
+    char *path;
+
+    if (parent == NULL) {
+        path = (char *) name;
+    } else {
+        path = dirPath(parent, buf, sizeof(buf) - NAME_MAX - 1);
+        if (path == NULL)
+            return;                     /* Pathname too long; ignore */
+        size_t len = strlen(path);
+        memmove(buf, path, len);
+        path = buf;
+        snprintf(path + len, sizeof(buf) - len, "/%s", name);
+    }
+
+    /* IN_MOVE_SELF on the root tells us it has gone (from our view); it is
+       requested here so that rescan() restores it along with the watch */
+
+    uint32_t mask = tw->watchMask | IN_ONLYDIR | IN_DONT_FOLLOW;
+    if (parent == NULL)
+        mask |= IN_MOVE_SELF;
+
+    int wd = inotify_add_watch(tw->fd, path, mask);
+    if (wd == -1)
+        return;         /* Probably already deleted or renamed; if renamed,
+                           we'll get an IN_MOVED_TO for the new name */
+
+    struct twDir *known = lookupWd(tw, wd);
+    struct twDir *existing = (parent == NULL) ? NULL :
+                             lookupChild(tw, parent, name);
+
+    if (known != NULL) {
+
+        /* We already watch this directory. If it's at another place in our
+           tree, it has been renamed without our pairing up the events (or
+           the IN_MOVED_TO is yet to come); move it. Either way, its subtree
+           is already being watched. */
+
+        if (parent != NULL && known != existing && known != tw->root &&
+                !isAncestor(known, parent)) {
+            if (existing != NULL)
+                zapDir(tw, existing, true);
+            if (known->parent != NULL)
+                unlinkDir(tw, known);
+            else
+                cancelPendingMove(tw, known);
+            linkDir(tw, known, parent, name);
+            tw->stats.numMoves++;
+        }
+        return;
+    }
+
+    if (existing != NULL)               /* Replaced by a different directory */
+        zapDir(tw, existing, true);
+
+    struct twDir *d = calloc(1, sizeof(struct twDir));
+    if (d == NULL)
+        errExit("calloc");
+    d->wd = wd;
+    d->name = strdup(name);
+    if (d->name == NULL)
+        errExit("strdup");
+
+    if (tw->stats.numDirs >= tw->tabSize)
+        growTables(tw);
+    insertDir(tw, d);
+    if (parent != NULL)
+        linkDir(tw, d, parent, d->name);
+    else
+        tw->root = d;
+    tw->stats.numDirs++;
+
+    /* Subdirectories may have been created before our watch was in place,
+       so look for them. Any whose creation we see as an event too are
+       recognized above by their watch descriptor. */
+
+    int dfd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dfd == -1)
+        return;
+    DIR *dirp = fdopendir(dfd);
+    if (dirp == NULL) {
+        close(dfd);
+        return;
+    }
+
+    struct dirent *dp;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+            continue;
+
+        bool isDir = (dp->d_type == DT_DIR);
+        if (dp->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            isDir = fstatat(dfd, dp->d_name, &sb, AT_SYMLINK_NOFOLLOW) == 0
+                    && S_ISDIR(sb.st_mode);
+        }
+        if (isDir)
+            addSubtree(tw, d, dp->d_name);
+    }
+    closedir(dirp);
+}
+
+/* After a queue overflow, forget everything and rescan the tree */
+
+static void
+rescan(struct TreeWatch *tw)
+{
+    char *rootPath = strdup(tw->root->name);
+    if (rootPath == NULL)
+        errExit("strdup");
+
+    while (tw->pending != NULL) {
+        struct pendingMove *pm = tw->pending;
+        tw->pending = pm->next;
+        zapDir(tw, pm->dir, true);
+        free(pm);
+    }
+    zapDir(tw, tw->root, true);
+    addSubtree(tw, NULL, rootPath);
+    free(rootPath);
+    tw->stats.numRescans++;
+}
+
+/* Drop directories whose IN_MOVED_FROM was never matched: they were
+   renamed out of the tree */
+
+static void
+expirePendingMoves(struct TreeWatch *tw)
+{
+    while (tw->pending != NULL) {
+        struct pendingMove *pm = tw->pending;
+        tw->pending = pm->next;
+        zapDir(tw, pm->dir, true);
+        tw->stats.numMovedOut++;
+        free(pm);
+    }
+}
+
+/***********************************************************************/
+
+/* Return true if the last event seen in this read() for the same
+   directory and name had the same mask. Such repeats carry no new
+   information (e.g., a series of IN_MODIFY events for a file being
+   written), but a sequence such as IN_CREATE, IN_DELETE, IN_CREATE is
+   reported in full. */
+
+static bool
+alreadySeen(struct TreeWatch *tw, uint32_t mask, const void *key,
+            size_t keyLen, const char *name)
+{
+    size_t h = strHash(name);
+    if (keyLen == 0)
+        h ^= (uintptr_t) key * 2654435761u;
+    else
+        for (size_t j = 0; j < keyLen; j++)
+            h = (h ^ ((const unsigned char *) key)[j]) * 16777619u;
+
+    for (size_t j = 0; j < SEEN_SIZE / 4; j++) {        /* Bounded probe */
+        struct seen *s = &tw->seenTab[(h + j) & (SEEN_SIZE - 1)];
+
+        if (s->gen != tw->seenGen) {                    /* Free slot */
+            s->gen = tw->seenGen;
+            s->mask = mask;
+            s->key = key;
+            s->keyLen = keyLen;
+            s->name = name;
+            return false;
+        }
+        if (s->keyLen == keyLen && strcmp(s->name, name) == 0 &&
+                (keyLen == 0 ? s->key == key :
+                               memcmp(s->key, key, keyLen) == 0)) {
+            if (s->mask == mask) {
+                tw->stats.numCoalesced++;
+                return true;
+            }
+            s->mask = mask;
+            return false;
+        }
+    }
+    return false;                       /* Table crowded; just report it */
+}
+
+static void
+report(struct TreeWatch *tw, const struct twDir *d, const char *name,
+       uint32_t mask)
+{
+    char buf[PATH_MAX];
+
+    if (!(mask & tw->opts.eventMask) ||
+            alreadySeen(tw, mask, (void *) (intptr_t) d->wd, 0, name))
+        return;
+
+    const char *path = dirPath(d, buf, sizeof(buf));
+    if (path != NULL)
+        tw->fn(tw->arg, path, name, mask);
+}
+
+static void
+processInotifyEvent(struct TreeWatch *tw, const struct inotify_event *ev)
+{
+    const char *name = (ev->len > 0) ? ev->name : "";
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        if (tw->root != NULL)
+            rescan(tw);
+        tw->fn(tw->arg, NULL, "", IN_Q_OVERFLOW);
+        return;
+    }
+
+    struct twDir *d = lookupWd(tw, ev->wd);
+    if (d == NULL)              /* Event for a watch we have since removed */
+        return;
+
+    report(tw, d, name, ev->mask);
+
+    if ((ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)) &&
+            d == tw->root) {
+
+        /* Like inotify_dtree.c, stop monitoring if the root goes away */
+
+        tw->rootGone = true;
+        expirePendingMoves(tw);
+        zapDir(tw, d, true);
+
+    } else if (ev->mask & (IN_DELETE_SELF | IN_UNMOUNT)) {
+        zapDir(tw, d, false);
+
+    } else if ((ev->mask & (IN_ISDIR | IN_CREATE)) == (IN_ISDIR | IN_CREATE)) {
+        addSubtree(tw, d, name);
+
+    } else if ((ev->mask & (IN_ISDIR | IN_MOVED_FROM)) ==
+               (IN_ISDIR | IN_MOVED_FROM)) {
+        struct twDir *child = lookupChild(tw, d, name);
+        if (child != NULL) {
+            struct pendingMove *pm = malloc(sizeof(struct pendingMove));
+            if (pm == NULL)
+                errExit("malloc");
+            unlinkDir(tw, child);
+            pm->cookie = ev->cookie;
+            pm->dir = child;
+            pm->next = tw->pending;
+            tw->pending = pm;
+        }
+
+    } else if ((ev->mask & (IN_ISDIR | IN_MOVED_TO)) ==
+               (IN_ISDIR | IN_MOVED_TO)) {
+        struct pendingMove **pmp;
+        for (pmp = &tw->pending; *pmp != NULL; pmp = &(*pmp)->next)
+            if ((*pmp)->cookie == ev->cookie)
+                break;
+
+        if (*pmp == NULL) {             /* Moved in from outside the tree */
+            addSubtree(tw, d, name);
+        } else {                        /* Rename within the tree */
+            struct pendingMove *pm = *pmp;
+            *pmp = pm->next;
+
+            struct twDir *existing = lookupChild(tw, d, name);
+            if (existing != NULL)       /* Rename replaced an empty dir */
+                zapDir(tw, existing, true);
+            if (isAncestor(pm->dir, d)) {       /* Our view is stale */
+                zapDir(tw, pm->dir, true);      /* (Frees 'd' too) */
+            } else {
+                linkDir(tw, pm->dir, d, name);
+                tw->stats.numMoves++;
+            }
+            free(pm);
+        }
+    }
+}
+
+static void
+processInotifyBuf(struct TreeWatch *tw, ssize_t numRead)
+{
+    for (char *p = tw->buf; p < tw->buf + numRead; ) {
+        struct inotify_event *ev = (struct inotify_event *) p;
+        p += sizeof(struct inotify_event) + ev->len;
+
+        tw->stats.numEvents++;
+        processInotifyEvent(tw, ev);
+        if (tw->rootGone)
+            break;
+    }
+}
+
+/***********************************************************************/
+
+/* fanotify backend */
+
+static void
+processFanotifyBuf(struct TreeWatch *tw, ssize_t numRead)
+{
+    const struct fanotify_event_metadata *md;
+    char path[PATH_MAX], lastPath[PATH_MAX];
+    const struct file_handle *lastFh = NULL;
+
+    for (md = (const struct fanotify_event_metadata *) tw->buf;
+            FAN_EVENT_OK(md, numRead); md = FAN_EVENT_NEXT(md, numRead)) {
+        tw->stats.numEvents++;
+
+        if (md->mask & FAN_Q_OVERFLOW) {
+            tw->fn(tw->arg, NULL, "", IN_Q_OVERFLOW);
+            continue;
+        }
+        if (md->fd >= 0)                /* Not expected with FID reporting */
+            close(md->fd);
+
+        /* Find the directory file handle and name */
+
+        const struct fanotify_event_info_fid *fid = NULL;
+        for (const char *ip = (const char *) md + md->metadata_len;
+                ip < (const char *) md + md->event_len; ) {
+            const struct fanotify_event_info_header *hdr =
+                    (const struct fanotify_event_info_header *) ip;
+            if (hdr->len == 0)
+                break;
+            if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+                    hdr->info_type == FAN_EVENT_INFO_TYPE_DFID) {
+                fid = (const struct fanotify_event_info_fid *) hdr;
+                break;
+            }
+            ip += hdr->len;
+        }
+        if (fid == NULL)
+            continue;
+
+        const struct file_handle *fh =
+                (const struct file_handle *) fid->handle;
+        const char *name = "";
+        if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+            name = (const char *) fh->f_handle + fh->handle_bytes;
+
+        uint32_t mask = md->mask & (tw->opts.eventMask | IN_ISDIR);
+        size_t fhLen = sizeof(struct file_handle) + fh->handle_bytes;
+        if (alreadySeen(tw, mask, fh, fhLen, name))
+            continue;
+
+        /* Turn the handle into a pathname. Consecutive events are often
+           in the same directory, so remember the last one. */
+
+        if (lastFh == NULL || lastFh->handle_bytes != fh->handle_bytes ||
+                memcmp(lastFh, fh, fhLen) != 0) {
+            int dfd = open_by_handle_at(tw->mountFd,
+                                        (struct file_handle *) fh, O_PATH);
+            if (dfd == -1)
+                continue;               /* E.g., directory since deleted */
+            snprintf(path, sizeof(path), "/proc/self/fd/%d", dfd);
+            ssize_t len = readlink(path, lastPath, sizeof(lastPath) - 1);
+            close(dfd);
+            if (len == -1)
+                continue;
+            lastPath[len] = '\0';
+            lastFh = fh;
+        }
+
+        /* Discard events from outside our tree */
+
+        if (strncmp(lastPath, tw->rootReal, tw->rootRealLen) != 0 ||
+                (lastPath[tw->rootRealLen] != '/' &&
+                 lastPath[tw->rootRealLen] != '\0'))
+            continue;
+
+        tw->fn(tw->arg, lastPath, name, mask);
+    }
+}
+
+static int
+openFanotify(struct TreeWatch *tw, const char *root)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    tw->fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+                           FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (tw->fd == -1)
+        return -1;
+
+    /* fanotify event bits have the same values as their inotify
+       counterparts, and FAN_ONDIR is IN_ISDIR */
+
+    uint64_t mask = (tw->opts.eventMask & (IN_ALL_EVENTS & ~IN_MOVE_SELF &
+                                           ~IN_DELETE_SELF)) | FAN_ONDIR;
+    if (fanotify_mark(tw->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask,
+                      AT_FDCWD, root) == -1)
+        return -1;
+
+    tw->mountFd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    tw->rootReal = realpath(root, NULL);
+    if (tw->mountFd == -1 || tw->rootReal == NULL)
+        return -1;
+    tw->rootRealLen = strlen(tw->rootReal);
+    if (tw->rootRealLen == 1)           /* Root is "/" */
+        tw->rootRealLen = 0;
+    return 0;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/***********************************************************************/
+
+/* Start watching the tree at 'root'. 'fn' is called (with 'arg') for each
+   event. Returns NULL on error, with errno set. */
+
+struct TreeWatch *
+twOpen(const char *root, const struct twOptions *opts, twEventFn fn,
+       void *arg)
+{
+    int savedErrno;
+
+    struct TreeWatch *tw = calloc(1, sizeof(struct TreeWatch));
+    if (tw == NULL)
+        return NULL;
+    tw->opts = *opts;
+    tw->fn = fn;
+    tw->arg = arg;
+    tw->fd = -1;
+    tw->mountFd = -1;
+    tw->seenGen = 1;
+    tw->opts.readBufSize = max(opts->readBufSize,
+                               sizeof(struct inotify_event) + NAME_MAX + 1);
+    tw->buf = malloc(tw->opts.readBufSize);
+    tw->seenTab = calloc(SEEN_SIZE, sizeof(struct seen));
+    if (tw->buf == NULL || tw->seenTab == NULL)
+        goto fail;
+
+    if (opts->backend == TW_FANOTIFY) {
+        if (openFanotify(tw, root) == -1)
+            goto fail;
+        return tw;
+    }
+
+    struct stat sb;
+    if (lstat(root, &sb) == -1)
+        goto fail;
+    if (!S_ISDIR(sb.st_mode)) {
+        errno = ENOTDIR;
+        goto fail;
+    }
+
+    tw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (tw->fd == -1)
+        goto fail;
+    tw->watchMask = DIR_EVENTS | opts->eventMask;
+    growTables(tw);
+
+    addSubtree(tw, NULL, root);
+    if (tw->root == NULL)
+        goto fail;
+    return tw;
+
+fail:
+    savedErrno = errno;
+    twClose(tw);
+    errno = savedErrno;
+    return NULL;
+}
+
+int
+twFd(const struct TreeWatch *tw)
+{
+    return tw->fd;
+}
+
+bool
+twRootGone(const struct TreeWatch *tw)
+{
+    return tw->rootGone;
+}
+
+/* Read and process all events that are available, without blocking
+   (except briefly to wait for the other half of a rename). Returns 0 on
+   success, or -1 on error. */
+
+int
+twProcess(struct TreeWatch *tw)
+{
+    bool waited = false;
+
+    while (!tw->rootGone) {
+        ssize_t numRead = read(tw->fd, tw->buf, tw->opts.readBufSize);
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                return -1;
+
+            /* Drained. Give the IN_MOVED_TO for any unmatched IN_MOVED_FROM
+               a chance to arrive before we decide it isn't coming. */
+
+            if (tw->pending == NULL)
+                break;
+            if (!waited) {
+                struct pollfd pfd = { tw->fd, POLLIN, 0 };
+                waited = true;
+                if (poll(&pfd, 1, (tw->opts.moveWaitUsecs + 999) / 1000) > 0)
+                    continue;
+            }
+            expirePendingMoves(tw);
+            break;
+        }
+
+        tw->stats.numReads++;
+        tw->seenGen++;                  /* Coalesce within each read() */
+
+        if (tw->opts.backend == TW_FANOTIFY)
+            processFanotifyBuf(tw, numRead);
+        else
+            processInotifyBuf(tw, numRead);
+    }
+    return 0;
+}
+
+void
+twGetStats(const struct TreeWatch *tw, struct twStats *stats)
+{
+    *stats = tw->stats;
+}
+
+static void
+dumpDir(const struct twDir *d, FILE *fp)
+{
+    char buf[PATH_MAX];
+    const char *path = dirPath(d, buf, sizeof(buf));
+
+    if (path != NULL)
+        fprintf(fp, "%s\n", path);
+    for (d = d->firstChild; d != NULL; d = d->nextSib)
+        dumpDir(d, fp);
+}
+
+/* Write the pathnames of all watched directories to 'fp' */
+
+int
+twDumpDirs(const struct TreeWatch *tw, FILE *fp)
+{
+    if (tw->opts.backend == TW_FANOTIFY) {
+        errno = ENOTSUP;                /* There are no per-dir watches */
+        return -1;
+    }
+    if (tw->root != NULL)
+        dumpDir(tw->root, fp);
+    return 0;
+}
+
+void
+twClose(struct TreeWatch *tw)
+{
+    if (tw->fd != -1)           /* Removes all watches at once */
+        close(tw->fd);
+    tw->fd = -1;
+
+    while (tw->pending != NULL) {
+        struct pendingMove *pm = tw->pending;
+        tw->pending = pm->next;
+        zapDir(tw, pm->dir, false);
+        free(pm);
+    }
+    if (tw->root != NULL)
+        zapDir(tw, tw->root, false);
+    if (tw->mountFd != -1)
+        close(tw->mountFd);
+    free(tw->rootReal);
+    free(tw->wdTab);
+    free(tw->nameTab);
+    free(tw->seenTab);
+    free(tw->buf);
+    free(tw);
+}
@@ -0,0 +1,72 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* tree_watch.h
+
+   Header file for tree_watch.c.
+*/
+#ifndef TREE_WATCH_H
+#define TREE_WATCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#define TW_INOTIFY      0       /* Backends */
+#define TW_FANOTIFY     1
+
+struct twOptions {
+    int backend;                /* TW_INOTIFY or TW_FANOTIFY */
+    uint32_t eventMask;         /* IN_* events to report to the caller */
+    size_t readBufSize;         /* Bytes fetched by each read() */
+    long moveWaitUsecs;         /* How long to wait for the IN_MOVED_TO
+                                   that may match an IN_MOVED_FROM */
+};
+
+struct twStats {
+    unsigned long numReads;     /* read()s of the notification fd */
+    unsigned long numEvents;    /* Events read */
+    unsigned long numCoalesced; /* Duplicate events not reported */
+    unsigned long numDirs;      /* Directories currently watched */
+    unsigned long numMoves;     /* Directory renames within the tree */
+    unsigned long numMovedOut;  /* Directories renamed out of the tree */
+    unsigned long numRescans;   /* Rescans after queue overflow */
+};
+
+/* Called for each (coalesced) event in 'eventMask'. 'dirPath' is the
+   directory in which the event occurred (NULL for IN_Q_OVERFLOW), and
+   'name' the name of the affected entry ("" if the event concerns the
+   directory itself). */
+
+typedef void (*twEventFn)(void *arg, const char *dirPath, const char *name,
+                          uint32_t mask);
+
+struct TreeWatch;               /* Opaque; see tree_watch.c */
+
+void twDefaultOptions(struct twOptions *opts);
+
+struct TreeWatch *twOpen(const char *root, const struct twOptions *opts,
+                         twEventFn fn, void *arg);
+
+int twFd(const struct TreeWatch *tw);
+
+int twProcess(struct TreeWatch *tw);
+
+bool twRootGone(const struct TreeWatch *tw);
+
+void twGetStats(const struct TreeWatch *tw, struct twStats *stats);
+
+int twDumpDirs(const struct TreeWatch *tw, FILE *fp);
+
+void twClose(struct TreeWatch *tw);
+
+#endif
@@ -0,0 +1,179 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* tree_watch_demo.c
+
+   Monitor a directory tree using tree_watch.c, displaying events as they
+   occur. Like inotify_dtree.c, the program accepts some simple commands on
+   standard input:
+
+        l           List the watched directories
+        w file      Write the list of watched directories to 'file'; this
+                    can be compared with the output of "find DIR -type d"
+        s           Display statistics
+        q           Quit
+
+   Usage: tree_watch_demo [-F] [-b buf-kib] [-q] dir-path
+
+   -F selects the fanotify backend (falling back to inotify if that isn't
+   permitted), -b sets the size of the buffer used to read events, and -q
+   suppresses the display of events (useful when stress testing with
+   rand_dtree.c).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <sys/select.h>
+#include <limits.h>
+#include "tree_watch.h"
+#include "tlpi_hdr.h"
+
+static bool quiet = false;
+
+static void
+displayEvent(void *arg, const char *dirPath, const char *name,
+             uint32_t mask)
+{
+    if (quiet)
+        return;
+
+    if (dirPath == NULL) {
+        printf("Queue overflow: tree rescanned\n");
+        return;
+    }
+
+    printf("%-14s %s%s%s%s\n",
+           (mask & IN_CREATE) ?      "IN_CREATE" :
+           (mask & IN_DELETE) ?      "IN_DELETE" :
+           (mask & IN_MOVED_FROM) ?  "IN_MOVED_FROM" :
+           (mask & IN_MOVED_TO) ?    "IN_MOVED_TO" :
+           (mask & IN_MODIFY) ?      "IN_MODIFY" :
+           (mask & IN_ATTRIB) ?      "IN_ATTRIB" :
+           (mask & IN_CLOSE_WRITE) ? "IN_CLOSE_WRITE" : "(other)",
+           dirPath, (*name != '\0') ? "/" : "", name,
+           (mask & IN_ISDIR) ? " [dir]" : "");
+}
+
+static void
+executeCommand(struct TreeWatch *tw)
+{
+    char line[PATH_MAX + 10], arg[PATH_MAX + 10];
+    struct twStats st;
+    FILE *fp;
+    char cmd;
+
+    ssize_t numRead = read(STDIN_FILENO, line, sizeof(line) - 1);
+    if (numRead <= 0) {
+        printf("bye!\n");
+        exit(EXIT_SUCCESS);
+    }
+    line[numRead] = '\0';
+
+    int ns = sscanf(line, " %c %s", &cmd, arg);
+    if (ns < 1)
+        return;
+
+    switch (cmd) {
+    case 'l':
+        if (twDumpDirs(tw, stdout) == -1)
+            errMsg("twDumpDirs");
+        break;
+
+    case 'w':
+        if (ns < 2) {
+            printf("Usage: w file\n");
+            break;
+        }
+        fp = fopen(arg, "w");
+        if (fp == NULL) {
+            errMsg("fopen");
+            break;
+        }
+        if (twDumpDirs(tw, fp) == -1)
+            errMsg("twDumpDirs");
+        fclose(fp);
+        break;
+
+    case 's':
+        twGetStats(tw, &st);
+        printf("reads: %lu; events: %lu; coalesced: %lu; dirs: %lu\n",
+               st.numReads, st.numEvents, st.numCoalesced, st.numDirs);
+        printf("moves: %lu; moved out: %lu; rescans: %lu\n",
+               st.numMoves, st.numMovedOut, st.numRescans);
+        break;
+
+    case 'q':
+        exit(EXIT_SUCCESS);
+
+    default:
+        printf("Unknown command: %c\n", cmd);
+        break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct twOptions opts;
+    struct TreeWatch *tw;
+    int opt;
+
+    twDefaultOptions(&opts);
+    opts.eventMask |= IN_CLOSE_WRITE;
+
+    while ((opt = getopt(argc, argv, "Fb:q")) != -1) {
+        switch (opt) {
+        case 'F': opts.backend = TW_FANOTIFY;                           break;
+        case 'b': opts.readBufSize = getLong(optarg, GN_GT_0, "buf-kib") *
+                                     1024;                              break;
+        case 'q': quiet = true;                                         break;
+        default:  usageErr("%s [-F] [-b buf-kib] [-q] dir-path\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-F] [-b buf-kib] [-q] dir-path\n", argv[0]);
+
+    tw = twOpen(argv[optind], &opts, displayEvent, NULL);
+    if (tw == NULL && opts.backend == TW_FANOTIFY && errno == EPERM) {
+        fprintf(stderr, "fanotify not permitted; using inotify\n");
+        opts.backend = TW_INOTIFY;
+        tw = twOpen(argv[optind], &opts, displayEvent, NULL);
+    }
+    if (tw == NULL)
+        errExit("twOpen");
+
+    setbuf(stdout, NULL);
+    printf("%s> ", argv[0]);
+
+    while (!twRootGone(tw)) {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(STDIN_FILENO, &rfds);
+        FD_SET(twFd(tw), &rfds);
+        if (select(twFd(tw) + 1, &rfds, NULL, NULL, NULL) == -1)
+            errExit("select");
+
+        if (FD_ISSET(STDIN_FILENO, &rfds)) {
+            executeCommand(tw);
+            printf("%s> ", argv[0]);
+        }
+
+        if (FD_ISSET(twFd(tw), &rfds))
+            if (twProcess(tw) == -1)
+                errExit("twProcess");
+    }
+
+    printf("Root directory has gone; exiting\n");
+    twClose(tw);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,226 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcopy_bench.c
+
+   Find the fastest mmcopy_engine.c strategy for copying files of various
+   sizes on the file system containing a given directory.
+
+   Usage: mmcopy_bench [-d dir] [-s max-size] [-t max-threads] [-r reps]
+
+   Files of 1 MiB, 16 MiB, 256 MiB, ... up to 'max-size' MiB (default 256)
+   are created in 'dir' (default: current directory). Each is copied with
+   each mode, using 1 thread and 'max-threads' threads (default: the
+   number of online CPUs); the best of 'reps' (default 3) copies is
+   reported, and each copy is checked. The fastest strategy for each size
+   is then displayed.
+
+   The source file is in the page cache (we just wrote it), so the figures
+   for the buffered modes are for a warm cache; "direct" mode always goes
+   to the device.
+
+   This program is Linux-specific.
+*/
+#include <sys/statfs.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "mmcopy_engine.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE (1024 * 1024)
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *
+fsName(const char *dir)
+{
+    static char buf[32];
+    struct statfs sfs;
+
+    if (statfs(dir, &sfs) == -1)
+        errExit("statfs");
+
+    switch ((unsigned long) sfs.f_type) {
+    case 0xEF53:        return "ext2/3/4";
+    case 0x58465342:    return "xfs";
+    case 0x9123683E:    return "btrfs";
+    case 0x01021994:    return "tmpfs";
+    case 0x794C7630:    return "overlayfs";
+    case 0x6969:        return "nfs";
+    case 0x2FC12FC1:    return "zfs";
+    default:
+        snprintf(buf, sizeof(buf), "0x%lx", (unsigned long) sfs.f_type);
+        return buf;
+    }
+}
+
+/* Create 'path' containing 'size' bytes of pseudorandom data */
+
+static void
+makeFile(const char *path, off_t size)
+{
+    static unsigned long buf[BUF_SIZE / sizeof(long)];
+    unsigned long x = 88172645463325252UL;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", path);
+
+    for (off_t done = 0; done < size; ) {
+        for (size_t j = 0; j < BUF_SIZE / sizeof(long); j++) {
+            x ^= x << 13;               /* xorshift */
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[j] = x;
+        }
+        size_t len = min(size - done, (off_t) BUF_SIZE);
+        if (write(fd, buf, len) != (ssize_t) len)
+            fatal("write %s failed", path);
+        done += len;
+    }
+
+    if (close(fd) == -1)
+        errExit("close");
+}
+
+/* Check that the files 'a' and 'b' have the same contents */
+
+static void
+checkCopy(const char *a, const char *b)
+{
+    static char bufA[BUF_SIZE], bufB[BUF_SIZE];
+
+    int fdA = open(a, O_RDONLY);
+    int fdB = open(b, O_RDONLY);
+    if (fdA == -1 || fdB == -1)
+        errExit("open");
+
+    for (;;) {
+        ssize_t nA = read(fdA, bufA, BUF_SIZE);
+        ssize_t nB = read(fdB, bufB, BUF_SIZE);
+        if (nA == -1 || nB == -1)
+            errExit("read");
+        if (nA != nB || memcmp(bufA, bufB, nA) != 0)
+            fatal("%s differs from %s", b, a);
+        if (nA == 0)
+            break;
+    }
+    close(fdA);
+    close(fdB);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dir = ".";
+    long maxSize = 256;
+    int maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int reps = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:t:r:")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg;                                         break;
+        case 's': maxSize = getLong(optarg, GN_GT_0, "max-size");       break;
+        case 't': maxThreads = getInt(optarg, GN_GT_0, "max-threads");  break;
+        case 'r': reps = getInt(optarg, GN_GT_0, "reps");               break;
+        default:  usageErr("%s [-d dir] [-s max-size] [-t max-threads] "
+                           "[-r reps]\n", argv[0]);
+        }
+    }
+    if (maxThreads < 1)
+        maxThreads = 1;
+
+    char srcPath[PATH_MAX], dstPath[PATH_MAX];
+    snprintf(srcPath, PATH_MAX, "%s/mmcopy_bench.src.%ld", dir,
+             (long) getpid());
+    snprintf(dstPath, PATH_MAX, "%s/mmcopy_bench.dst.%ld", dir,
+             (long) getpid());
+
+    printf("File system: %s (%s)\n\n", fsName(dir), dir);
+    printf("%9s  %-10s %7s  %9s\n", "Size", "Mode", "Threads", "MB/s");
+
+    for (long mib = 1; mib <= maxSize; mib *= 16) {
+        off_t size = (off_t) mib * 1024 * 1024;
+        const char *bestMode = NULL;
+        int bestThreads = 0;
+        double bestRate = 0;
+
+        makeFile(srcPath, size);
+
+        for (int mode = 0; mode < MC_NUM_MODES; mode++) {
+            for (int threads = 1; threads <= maxThreads;
+                    threads = (threads == maxThreads) ? threads + 1 :
+                                                        maxThreads) {
+                struct mcOptions opts;
+                double best = 0;
+
+                mcDefaultOptions(&opts);
+                opts.mode = mode;
+                opts.numThreads = threads;
+
+                /* With one chunk, extra threads would sit idle */
+
+                if (threads > 1)
+                    opts.chunkSize = min(opts.chunkSize,
+                                         max(size / threads, 1024 * 1024));
+
+                int r;
+                for (r = 0; r < reps; r++) {
+                    unlink(dstPath);
+                    double start = now();
+                    if (mcCopyFile(dstPath, srcPath, &opts) == -1)
+                        break;
+                    double secs = now() - start;
+                    if (best == 0 || secs < best)
+                        best = secs;
+                }
+                if (r < reps) {
+                    printf("%6ld MiB  %-10s %7d  %9s (%s)\n", mib,
+                           mcModeName(mode), threads, "-", strerror(errno));
+                    continue;
+                }
+                checkCopy(srcPath, dstPath);
+
+                double rate = size / best / 1e6;
+                printf("%6ld MiB  %-10s %7d  %9.0f\n", mib, mcModeName(mode),
+                       threads, rate);
+                if (rate > bestRate) {
+                    bestRate = rate;
+                    bestMode = mcModeName(mode);
+                    bestThreads = threads;
+                }
+            }
+        }
+
+        if (bestMode != NULL)
+            printf("%6ld MiB  fastest: %s with %d thread(s)\n\n", mib,
+                   bestMode, bestThreads);
+
+        if (mib > LONG_MAX / 16)
+            break;
+    }
+
+    unlink(srcPath);
+    unlink(dstPath);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,395 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcopy_engine.c
+
+   A file copy engine that generalizes mmcopy.c. The source file is divided
+   into chunks of 'chunkSize' bytes, which 'numThreads' threads claim in
+   turn and copy using one of these modes:
+
+   MC_MMAP          Map a window of each file covering just the chunk,
+                    and memcpy() between the windows. So, unlike mmcopy.c,
+                    files larger than the available address space can be
+                    copied. The source window is advised MADV_SEQUENTIAL,
+                    and optionally both windows are advised MADV_HUGEPAGE
+                    (which is effective only on file systems that support
+                    huge pages in the page cache, such as tmpfs).
+
+   MC_COPY_RANGE    copy_file_range(), which lets the kernel (or the file
+                    system, for example with reflinks or server-side copy)
+                    move the data. If the files don't support it, the chunk
+                    is copied with pread()/pwrite() instead.
+
+   MC_DIRECT        pread()/pwrite() with O_DIRECT, through a suitably
+                    aligned buffer (see filebuff/direct_read.c), so that
+                    the copy doesn't pass through (or evict the existing
+                    contents of) the page cache.
+
+   MC_RW            pread()/pwrite() through an ordinary buffer.
+
+   The functions return 0 on success, or -1 with errno set on error.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "mmcopy_engine.h"
+#include "tlpi_hdr.h"
+
+#define IO_BUF_SIZE (8 * 1024 * 1024)   /* Buffer size for the pread()/
+                                           pwrite() modes */
+#define DIRECT_ALIGN 4096               /* Alignment for O_DIRECT */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static const char *modeNames[MC_NUM_MODES] = {
+    "rw", "mmap", "copy_range", "direct"
+};
+
+struct copyJob {                        /* State shared by copying threads */
+    int srcFd, dstFd;
+    off_t size;
+    size_t chunkSize;
+    const struct mcOptions *opts;
+    off_t next;                         /* Start of next unclaimed chunk */
+    int err;                            /* First error seen, or 0 */
+    bool noCopyRange;                   /* copy_file_range() unsupported */
+};
+
+void
+mcDefaultOptions(struct mcOptions *opts)
+{
+    opts->mode = MC_MMAP;
+    opts->numThreads = 1;
+    opts->chunkSize = MC_DEF_CHUNK_SIZE;
+    opts->hugePages = false;
+    opts->sync = false;
+}
+
+const char *
+mcModeName(int mode)
+{
+    return (mode >= 0 && mode < MC_NUM_MODES) ? modeNames[mode] : "?";
+}
+
+int
+mcModeFromName(const char *name)
+{
+    for (int j = 0; j < MC_NUM_MODES; j++)
+        if (strcmp(name, modeNames[j]) == 0)
+            return j;
+    return -1;
+}
+
+static void
+setError(struct copyJob *job, int err)
+{
+    int expected = 0;
+
+    __atomic_compare_exchange_n(&job->err, &expected, err, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* Copy 'len' bytes at 'off' with pread()/pwrite() through 'buf', which
+   has room for 'bufSize' bytes. With O_DIRECT, 'off' and 'bufSize' are
+   aligned, and the final partial block of the file is written in full;
+   mcCopyFd() truncates the destination to the right size afterward. */
+
+static int
+copyRW(struct copyJob *job, char *buf, size_t bufSize, off_t off,
+       off_t len, bool direct)
+{
+    while (len > 0) {
+        size_t want = min(len, (off_t) bufSize);
+        size_t ioLen = direct ? (want + DIRECT_ALIGN - 1) &
+                                ~(size_t) (DIRECT_ALIGN - 1) : want;
+
+        ssize_t numRead = pread(job->srcFd, buf, ioLen, off);
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (numRead == 0) {             /* Source was truncated under us */
+            errno = EIO;
+            return -1;
+        }
+        if (numRead > (ssize_t) want)
+            numRead = want;
+
+        size_t outLen = numRead;
+        if (direct && (numRead % DIRECT_ALIGN) != 0) {
+            outLen = (numRead + DIRECT_ALIGN - 1) &
+                     ~(size_t) (DIRECT_ALIGN - 1);
+            memset(buf + numRead, 0, outLen - numRead);
+        }
+
+        for (size_t done = 0; done < outLen; ) {
+            ssize_t numWritten = pwrite(job->dstFd, buf + done,
+                                        outLen - done, off + done);
+            if (numWritten == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            done += numWritten;
+        }
+
+        off += numRead;
+        len -= numRead;
+    }
+    return 0;
+}
+
+static int
+copyMmap(struct copyJob *job, off_t off, off_t len)
+{
+    char *src = mmap(NULL, len, PROT_READ, MAP_SHARED, job->srcFd, off);
+    if (src == MAP_FAILED)
+        return -1;
+    char *dst = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     job->dstFd, off);
+    if (dst == MAP_FAILED) {
+        munmap(src, len);
+        return -1;
+    }
+
+    /* The hints are just that, so we ignore errors (e.g., EINVAL from
+       MADV_HUGEPAGE on a kernel or file system without support) */
+
+    madvise(src, len, MADV_SEQUENTIAL);
+    if (job->opts->hugePages) {
+        madvise(src, len, MADV_HUGEPAGE);
+        madvise(dst, len, MADV_HUGEPAGE);
+    }
+
+    memcpy(dst, src, len);
+
+    /* Once copied, the source pages won't be needed again by us */
+
+    madvise(src, len, MADV_DONTNEED);
+
+    if (munmap(src, len) == -1 || munmap(dst, len) == -1)
+        return -1;
+    return 0;
+}
+
+static int
+copyRange(struct copyJob *job, char *buf, size_t bufSize, off_t off,
+          off_t len)
+{
+    while (len > 0 &&
+            !__atomic_load_n(&job->noCopyRange, __ATOMIC_RELAXED)) {
+        off_t inOff = off, outOff = off;
+        ssize_t n = copy_file_range(job->srcFd, &inOff, job->dstFd, &outOff,
+                                    len, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP &&
+                    errno != EINVAL)
+                return -1;
+            __atomic_store_n(&job->noCopyRange, true, __ATOMIC_RELAXED);
+            break;
+        }
+        if (n == 0) {                   /* Source was truncated under us */
+            errno = EIO;
+            return -1;
+        }
+        off += n;
+        len -= n;
+    }
+
+    return (len == 0) ? 0 : copyRW(job, buf, bufSize, off, len, false);
+}
+
+/* Thread start function: claim and copy chunks until none are left or
+   some thread has failed */
+
+static void *
+copyThread(void *arg)
+{
+    struct copyJob *job = arg;
+    int mode = job->opts->mode;
+    size_t bufSize = min(job->chunkSize, (size_t) IO_BUF_SIZE);
+    char *buf = NULL;
+
+    if (mode != MC_MMAP) {
+        buf = memalign(DIRECT_ALIGN, bufSize);
+        if (buf == NULL) {
+            setError(job, errno);
+            return NULL;
+        }
+    }
+
+    while (__atomic_load_n(&job->err, __ATOMIC_RELAXED) == 0) {
+        off_t off = __atomic_fetch_add(&job->next, (off_t) job->chunkSize,
+                                       __ATOMIC_RELAXED);
+        if (off >= job->size)
+            break;
+        off_t len = min(job->size - off, (off_t) job->chunkSize);
+
+        int s;
+        switch (mode) {
+        case MC_MMAP:       s = copyMmap(job, off, len);                break;
+        case MC_COPY_RANGE: s = copyRange(job, buf, bufSize, off, len); break;
+        case MC_DIRECT:     s = copyRW(job, buf, bufSize, off, len, true);
+                                                                        break;
+        default:            s = copyRW(job, buf, bufSize, off, len, false);
+                                                                        break;
+        }
+        if (s == -1)
+            setError(job, errno);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/* Copy the first 'size' bytes of 'srcFd' to 'dstFd', which must both be
+   regular files, and which must be open for reading and writing
+   respectively (and the destination also for reading, for MC_MMAP). On
+   return, the destination file has size 'size'. For MC_DIRECT, O_DIRECT
+   is enabled on both descriptors for the duration of the copy. */
+
+int
+mcCopyFd(int dstFd, int srcFd, off_t size, const struct mcOptions *opts)
+{
+    struct copyJob job;
+    int srcFlags = -1, dstFlags = -1;
+    int numThreads, s;
+
+    if (opts->mode < 0 || opts->mode >= MC_NUM_MODES ||
+            opts->numThreads < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.srcFd = srcFd;
+    job.dstFd = dstFd;
+    job.size = size;
+    job.opts = opts;
+
+    /* Chunks must start at page (or huge page, or O_DIRECT block)
+       boundaries */
+
+    size_t align = (opts->mode == MC_MMAP) ? sysconf(_SC_PAGESIZE) :
+                                              DIRECT_ALIGN;
+    if (opts->hugePages && opts->mode == MC_MMAP)
+        align = HUGE_PAGE_SIZE;
+    job.chunkSize = max(opts->chunkSize, align);
+    job.chunkSize -= job.chunkSize % align;
+
+    if (ftruncate(dstFd, size) == -1)
+        return -1;
+    if (size == 0)
+        return 0;
+
+    if (opts->mode == MC_DIRECT) {
+        srcFlags = fcntl(srcFd, F_GETFL);
+        dstFlags = fcntl(dstFd, F_GETFL);
+        if (srcFlags == -1 || dstFlags == -1)
+            return -1;
+        if (fcntl(srcFd, F_SETFL, srcFlags | O_DIRECT) == -1 ||
+                fcntl(dstFd, F_SETFL, dstFlags | O_DIRECT) == -1) {
+            fcntl(srcFd, F_SETFL, srcFlags);
+            return -1;
+        }
+    }
+
+    numThreads = min((off_t) opts->numThreads,
+                     (size + job.chunkSize - 1) / (off_t) job.chunkSize);
+
+    if (numThreads == 1) {
+        copyThread(&job);
+    } else {
+        pthread_t *tids = calloc(numThreads, sizeof(pthread_t));
+        if (tids == NULL) {
+            setError(&job, errno);
+            numThreads = 0;
+        }
+
+        int created;
+        for (created = 0; created < numThreads; created++) {
+            s = pthread_create(&tids[created], NULL, copyThread, &job);
+            if (s != 0) {
+                setError(&job, s);
+                break;
+            }
+        }
+        for (int j = 0; j < created; j++)
+            pthread_join(tids[j], NULL);
+        free(tids);
+    }
+
+    if (opts->mode == MC_DIRECT) {
+        fcntl(srcFd, F_SETFL, srcFlags);
+        fcntl(dstFd, F_SETFL, dstFlags);
+
+        /* Remove the padding written after the final partial block */
+
+        if (job.err == 0 && ftruncate(dstFd, size) == -1)
+            job.err = errno;
+    }
+
+    if (job.err == 0 && opts->sync && fdatasync(dstFd) == -1)
+        job.err = errno;
+
+    if (job.err != 0) {
+        errno = job.err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Copy the file 'srcPath' to 'dstPath', which is created or truncated */
+
+int
+mcCopyFile(const char *dstPath, const char *srcPath,
+           const struct mcOptions *opts)
+{
+    struct stat sb;
+    int savedErrno, s;
+
+    int srcFd = open(srcPath, O_RDONLY | O_CLOEXEC);
+    if (srcFd == -1)
+        return -1;
+
+    if (fstat(srcFd, &sb) == -1) {
+        savedErrno = errno;
+        close(srcFd);
+        errno = savedErrno;
+        return -1;
+    }
+
+    int dstFd = open(dstPath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                     sb.st_mode & 0777);
+    if (dstFd == -1) {
+        savedErrno = errno;
+        close(srcFd);
+        errno = savedErrno;
+        return -1;
+    }
+
+    s = mcCopyFd(dstFd, srcFd, sb.st_size, opts);
+
+    savedErrno = errno;
+    close(srcFd);
+    if (close(dstFd) == -1 && s == 0)
+        return -1;
+    errno = savedErrno;
+    return s;
+}
@@ -0,0 +1,52 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcopy_engine.h
+
+   Header file for mmcopy_engine.c.
+*/
+#ifndef MMCOPY_ENGINE_H
+#define MMCOPY_ENGINE_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+/* Copy modes */
+
+#define MC_RW           0       /* pread()/pwrite() through a buffer */
+#define MC_MMAP         1       /* memcpy() between windows of mappings */
+#define MC_COPY_RANGE   2       /* copy_file_range() */
+#define MC_DIRECT       3       /* pread()/pwrite() with O_DIRECT */
+#define MC_NUM_MODES    4
+
+#define MC_DEF_CHUNK_SIZE   (64 * 1024 * 1024)
+
+struct mcOptions {
+    int mode;                   /* One of the MC_* modes */
+    int numThreads;             /* Threads copying chunks in parallel */
+    size_t chunkSize;           /* Bytes per chunk (and per mapping window) */
+    bool hugePages;             /* MC_MMAP: also advise MADV_HUGEPAGE */
+    bool sync;                  /* fdatasync() destination when done */
+};
+
+void mcDefaultOptions(struct mcOptions *opts);
+
+const char *mcModeName(int mode);
+
+int mcModeFromName(const char *name);
+
+int mcCopyFd(int dstFd, int srcFd, off_t size, const struct mcOptions *opts);
+
+int mcCopyFile(const char *dstPath, const char *srcPath,
+               const struct mcOptions *opts);
+
+#endif
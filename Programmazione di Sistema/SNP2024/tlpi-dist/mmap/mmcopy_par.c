@@ -0,0 +1,75 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcopy_par.c
+
+   Copy the contents of one file to another file, using mmcopy_engine.c.
+
+   Usage: mmcopy_par [-m mode] [-t threads] [-c chunk-size] [-H] [-s]
+                     source-file dest-file
+
+   'mode' is one of "mmap" (the default), "copy_range", "direct", or "rw";
+   see mmcopy_engine.c. 'chunk-size' is given in MiB (default 64). -H adds
+   MADV_HUGEPAGE advice in mmap mode, and -s makes the copy durable with
+   fdatasync().
+
+   This program is Linux-specific.
+*/
+#include <time.h>
+#include "mmcopy_engine.h"
+#include "tlpi_hdr.h"
+
+int
+main(int argc, char *argv[])
+{
+    struct mcOptions opts;
+    int opt;
+
+    mcDefaultOptions(&opts);
+
+    while ((opt = getopt(argc, argv, "m:t:c:Hs")) != -1) {
+        switch (opt) {
+        case 'm':
+            opts.mode = mcModeFromName(optarg);
+            if (opts.mode == -1)
+                cmdLineErr("Unknown mode: %s\n", optarg);
+            break;
+        case 't': opts.numThreads = getInt(optarg, GN_GT_0, "threads"); break;
+        case 'c': opts.chunkSize = getLong(optarg, GN_GT_0, "chunk-size") *
+                                   1024 * 1024;                         break;
+        case 'H': opts.hugePages = true;                                break;
+        case 's': opts.sync = true;                                     break;
+        default:
+            usageErr("%s [-m mode] [-t threads] [-c chunk-size] [-H] [-s] "
+                     "source-file dest-file\n", argv[0]);
+        }
+    }
+    if (optind != argc - 2)
+        usageErr("%s [options] source-file dest-file\n", argv[0]);
+
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    if (mcCopyFile(argv[optind + 1], argv[optind], &opts) == -1)
+        errExit("mcCopyFile (%s)", mcModeName(opts.mode));
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%s, %d thread(s): %.3f s\n", mcModeName(opts.mode),
+            opts.numThreads, secs);
+
+    exit(EXIT_SUCCESS);
+}
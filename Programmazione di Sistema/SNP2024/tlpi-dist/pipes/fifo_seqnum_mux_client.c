@@ -0,0 +1,155 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_mux_client.c
+
+   A client for fifo_seqnum_mux_server.c that makes many requests over a
+   persistent FIFO. Unlike fifo_seqnum_client.c, we open our FIFO for
+   reading before sending the first request, and keep it (and the server
+   FIFO) open until we are done, so that the server can keep its end of
+   our FIFO open too.
+
+   Usage: fifo_seqnum_mux_client [-n num-reqs] [-w window] [seq-len]
+
+   'num-reqs' (default 1) requests are sent, with up to 'window' (default
+   1) of them outstanding at any time. The server answers the requests of
+   a client in order, so we check that the sequence numbers we get back
+   increase. With more than one request, the elapsed time and request rate
+   are reported; with one, the sequence number is displayed, as
+   fifo_seqnum_client does.
+
+   The client works with fifo_seqnum_server.c only if 'num-reqs' is 1.
+*/
+#include <limits.h>
+#include <time.h>
+#include "fifo_seqnum.h"
+
+static char clientFifo[CLIENT_FIFO_NAME_LEN];
+
+static void             /* Invoked on exit to delete client FIFO */
+removeFifo(void)
+{
+    unlink(clientFifo);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int serverFd, clientFd;
+    struct request req;
+    long numReqs = 1, window = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        switch (opt) {
+        case 'n': numReqs = getLong(optarg, GN_GT_0, "num-reqs");       break;
+        case 'w': window = getLong(optarg, GN_GT_0, "window");          break;
+        default:  usageErr("%s [-n num-reqs] [-w window] [seq-len]\n",
+                           argv[0]);
+        }
+    }
+
+    /* Keep a window's worth of requests within the capacity of both
+       FIFOs, so that neither we nor the server can block indefinitely */
+
+    if (window * sizeof(struct request) > PIPE_BUF)
+        window = PIPE_BUF / sizeof(struct request);
+
+    /* Create our FIFO and open it for reading (nonblocking, since there
+       is no writer yet) before sending any request */
+
+    umask(0);                   /* So we get the permissions we want */
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+            (long) getpid());
+    if (mkfifo(clientFifo, S_IRUSR | S_IWUSR | S_IWGRP) == -1
+                && errno != EEXIST)
+        errExit("mkfifo %s", clientFifo);
+
+    if (atexit(removeFifo) != 0)
+        errExit("atexit");
+
+    clientFd = open(clientFifo, O_RDONLY | O_NONBLOCK);
+    if (clientFd == -1)
+        errExit("open %s", clientFifo);
+
+    /* Open an extra write descriptor, so that we don't see EOF before the
+       server has opened our FIFO */
+
+    if (open(clientFifo, O_WRONLY) == -1)
+        errExit("open %s", clientFifo);
+    if (fcntl(clientFd, F_SETFL, 0) == -1)
+        errExit("fcntl");
+
+    serverFd = open(SERVER_FIFO, O_WRONLY);
+    if (serverFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    req.pid = getpid();
+    req.seqLen = (optind < argc) ? getInt(argv[optind], GN_GT_0, "seq-len")
+                                 : 1;
+
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    long sent = 0, received = 0;
+    int lastSeqNum = -1;
+
+    while (received < numReqs) {
+
+        /* Fill the window of outstanding requests with a single write(),
+           which is atomic, since it is no more than PIPE_BUF bytes */
+
+        long n = min(window - (sent - received), numReqs - sent);
+        if (n > 0) {
+            struct request reqs[PIPE_BUF / sizeof(struct request)];
+            for (long j = 0; j < n; j++)
+                reqs[j] = req;
+            if (write(serverFd, reqs, n * sizeof(struct request)) !=
+                    (ssize_t) (n * sizeof(struct request)))
+                fatal("Can't write to server");
+            sent += n;
+        }
+
+        /* Read whatever responses are available, waiting for at least one */
+
+        struct response resps[PIPE_BUF / sizeof(struct response)];
+        ssize_t numRead = read(clientFd, resps,
+                               (sent - received) * sizeof(struct response));
+        if (numRead <= 0 || numRead % sizeof(struct response) != 0)
+            fatal("Can't read response from server");
+
+        for (long j = 0; j < numRead / (ssize_t) sizeof(struct response);
+                j++) {
+            if (resps[j].seqNum <= lastSeqNum)
+                fatal("Sequence number %d follows %d", resps[j].seqNum,
+                      lastSeqNum);
+            lastSeqNum = resps[j].seqNum;
+            received++;
+        }
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    if (numReqs == 1) {
+        printf("%d\n", lastSeqNum);
+    } else {
+        double secs = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%ld requests (window %ld) in %.3f s: %.0f requests/s; "
+               "last sequence number %d\n", numReqs, window, secs,
+               numReqs / secs, lastSeqNum);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,357 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_mux_server.c
+
+   A variant of fifo_seqnum_server.c that keeps client FIFOs open between
+   requests, so that a client that makes many requests (see
+   fifo_seqnum_mux_client.c) costs the server one open() in total, rather
+   than an open() and a close() per request.
+
+   The server is driven by an epoll loop:
+
+   * Requests are read from the well-known FIFO in batches of up to
+     BATCH_SIZE bytes. Since each request is smaller than PIPE_BUF bytes,
+     it is written atomically, so a batch contains only whole requests
+     (a partial request at the end of a read is nonetheless carried over
+     to the next read).
+
+   * The responses generated by a batch are accumulated in per-client
+     output buffers, and each client's buffer is then written with a single
+     write(). The client FIFOs are nonblocking; if a client falls behind so
+     that its FIFO fills, the unsent responses are kept and EPOLLOUT is
+     requested for that FIFO.
+
+   * Each open client FIFO stays in the epoll interest list. When a client
+     closes its end of the FIFO (e.g., because it terminated), the server
+     gets EPOLLERR and closes its descriptor.
+
+   The request and response formats are those of fifo_seqnum.h, and
+   fifo_seqnum_client.c works unchanged with this server. Such a client
+   opens its FIFO only after sending its request, so if a nonblocking open
+   of a client FIFO fails with ENXIO (no reader yet), the server falls back
+   to a blocking open, as fifo_seqnum_server.c does.
+
+   Usage: fifo_seqnum_mux_server
+
+   This program is Linux-specific.
+*/
+#include <sys/epoll.h>
+#include <signal.h>
+#include "fifo_seqnum.h"
+
+#define BATCH_SIZE 65536        /* Bytes fetched by a single read() of
+                                   the server FIFO */
+#define MAX_EVENTS 64
+#define HASH_SIZE 1024          /* Buckets in the client hash table */
+
+struct client {                 /* A client whose FIFO we hold open */
+    pid_t pid;
+    int fd;
+    struct client *next;        /* Next client in hash bucket */
+    struct client *nextDirty;   /* Next client with responses to flush */
+    bool dirty;                 /* On the 'dirty' list? */
+    bool waitOut;               /* Waiting for EPOLLOUT? */
+    size_t outLen;              /* Bytes of responses in 'out' */
+    size_t outCap;
+    char *out;
+};
+
+static struct client *clients[HASH_SIZE];
+static struct client *dirty;            /* Clients with responses to flush */
+static int epfd;
+static int seqNum = 0;                  /* This is our "service" */
+
+static unsigned long numReqs, numReads, numWrites, numOpens;
+
+static struct client **
+lookupClient(pid_t pid)
+{
+    struct client **cpp;
+
+    for (cpp = &clients[pid % HASH_SIZE]; *cpp != NULL; cpp = &(*cpp)->next)
+        if ((*cpp)->pid == pid)
+            break;
+    return cpp;
+}
+
+static void
+closeClient(struct client *c)
+{
+    struct client **cpp = lookupClient(c->pid);
+
+    *cpp = c->next;
+    if (close(c->fd) == -1)     /* Also removes 'fd' from the epoll list */
+        errMsg("close");
+    free(c->out);
+    c->fd = -1;                 /* Freed once it is off the 'dirty' list */
+    if (!c->dirty)
+        free(c);
+}
+
+/* Open the FIFO of client 'pid' and register it with epoll. Return NULL
+   if the FIFO can't be opened. */
+
+static struct client *
+openClient(pid_t pid)
+{
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+            (long) pid);
+
+    int fd = open(clientFifo, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1 && errno == ENXIO) {   /* Client hasn't opened FIFO yet */
+        fd = open(clientFifo, O_WRONLY | O_CLOEXEC);
+        if (fd != -1 && fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+            errExit("fcntl");
+    }
+    if (fd == -1) {                     /* Open failed, give up on client */
+        errMsg("open %s", clientFifo);
+        return NULL;
+    }
+    numOpens++;
+
+    struct client *c = calloc(1, sizeof(struct client));
+    if (c == NULL)
+        errExit("calloc");
+    c->pid = pid;
+    c->fd = fd;
+
+    /* EPOLLERR (the reader has gone away) is always reported */
+
+    struct epoll_event ev;
+    ev.events = 0;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    struct client **cpp = lookupClient(pid);
+    c->next = *cpp;
+    *cpp = c;
+    return c;
+}
+
+static void
+setWaitOut(struct client *c, bool waitOut)
+{
+    struct epoll_event ev;
+
+    if (c->waitOut == waitOut)
+        return;
+    c->waitOut = waitOut;
+    ev.events = waitOut ? EPOLLOUT : 0;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1)
+        errExit("epoll_ctl");
+}
+
+/* Write as much of the client's pending output as the FIFO will take.
+   Return -1 if the client has gone away (and so has been closed). */
+
+static int
+flushClient(struct client *c)
+{
+    size_t done = 0;
+
+    while (done < c->outLen) {
+        ssize_t numWritten = write(c->fd, c->out + done, c->outLen - done);
+        numWrites++;
+        if (numWritten == -1) {
+            if (errno == EAGAIN)
+                break;
+            if (errno != EPIPE)
+                errMsg("write to client %ld", (long) c->pid);
+            closeClient(c);
+            return -1;
+        }
+        done += numWritten;
+    }
+
+    c->outLen -= done;
+    memmove(c->out, c->out + done, c->outLen);
+    setWaitOut(c, c->outLen > 0);
+    return 0;
+}
+
+/* Allocate a sequence for one request, and queue the response */
+
+static void
+handleRequest(const struct request *req)
+{
+    struct client *c = *lookupClient(req->pid);
+
+    if (c == NULL) {
+        c = openClient(req->pid);
+        if (c == NULL)
+            return;
+    }
+
+    if (c->outLen + sizeof(struct response) > c->outCap) {
+        c->outCap = (c->outCap == 0) ? 16 * sizeof(struct response) :
+                                       2 * c->outCap;
+        c->out = realloc(c->out, c->outCap);
+        if (c->out == NULL)
+            errExit("realloc");
+    }
+
+    struct response resp;
+    resp.seqNum = seqNum;
+    memcpy(c->out + c->outLen, &resp, sizeof(struct response));
+    c->outLen += sizeof(struct response);
+
+    if (!c->dirty) {
+        c->dirty = true;
+        c->nextDirty = dirty;
+        dirty = c;
+    }
+
+    seqNum += req->seqLen;              /* Update our sequence number */
+    numReqs++;
+}
+
+/* Read a batch of requests from the server FIFO and answer them */
+
+static void
+readRequests(int serverFd)
+{
+    static char buf[BATCH_SIZE];
+    static size_t carry = 0;            /* Bytes of a partial request */
+    ssize_t numRead;
+
+    while ((numRead = read(serverFd, buf + carry, BATCH_SIZE - carry)) > 0) {
+        size_t len = carry + numRead;
+        size_t off;
+
+        numReads++;
+        for (off = 0; off + sizeof(struct request) <= len;
+                off += sizeof(struct request)) {
+            struct request req;
+            memcpy(&req, buf + off, sizeof(struct request));
+            handleRequest(&req);
+        }
+
+        carry = len - off;
+        memmove(buf, buf + off, carry);
+
+        if (numRead < BATCH_SIZE - carry)  /* FIFO probably drained */
+            break;
+    }
+    if (numRead == -1 && errno != EAGAIN)
+        errExit("read %s", SERVER_FIFO);
+
+    /* Send the responses for this batch, one write() per client. A client
+       whose FIFO is already full is left for EPOLLOUT. */
+
+    while (dirty != NULL) {
+        struct client *c = dirty;
+        dirty = c->nextDirty;
+        c->dirty = false;
+        if (c->fd == -1)                /* Closed while on the list */
+            free(c);
+        else if (!c->waitOut)
+            flushClient(c);
+    }
+}
+
+static volatile sig_atomic_t gotSigusr1 = 0;
+
+static void
+usr1Handler(int sig)
+{
+    gotSigusr1 = 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int serverFd, dummyFd;
+    struct epoll_event evlist[MAX_EVENTS];
+
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageErr("%s\n", argv[0]);
+
+    /* Create well-known FIFO, and open it for reading */
+
+    umask(0);                           /* So we get the permissions we want */
+    if (mkfifo(SERVER_FIFO, S_IRUSR | S_IWUSR | S_IWGRP) == -1
+            && errno != EEXIST)
+        errExit("mkfifo %s", SERVER_FIFO);
+    serverFd = open(SERVER_FIFO, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (serverFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Open an extra write descriptor, so that we never see EOF */
+
+    dummyFd = open(SERVER_FIFO, O_WRONLY | O_CLOEXEC);
+    if (dummyFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Let's find out about broken client pipe via failed write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)    errExit("signal");
+
+    /* SIGUSR1 causes statistics to be displayed; no SA_RESTART, so that
+       epoll_wait() is interrupted */
+
+    struct sigaction sa;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = usr1Handler;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                 /* NULL identifies the server FIFO */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, serverFd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    for (;;) {
+        if (gotSigusr1) {
+            gotSigusr1 = 0;
+            fprintf(stderr, "%lu requests; %lu reads, %lu writes, "
+                    "%lu client opens\n", numReqs, numReads, numWrites,
+                    numOpens);
+        }
+
+        int ready = epoll_wait(epfd, evlist, MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        /* Deal with departed and writable clients before reading new
+           requests, so that a departed client's PID, if it is recycled,
+           doesn't find the old FIFO still open */
+
+        bool haveRequests = false;
+        for (int j = 0; j < ready; j++) {
+            struct client *c = evlist[j].data.ptr;
+
+            if (c == NULL)
+                haveRequests = true;
+            else if (evlist[j].events & EPOLLERR)
+                closeClient(c);
+            else if (evlist[j].events & EPOLLOUT)
+                flushClient(c);
+        }
+
+        if (haveRequests)
+            readRequests(serverFd);
+    }
+}
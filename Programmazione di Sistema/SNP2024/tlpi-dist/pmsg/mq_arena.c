@@ -0,0 +1,402 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 52 */
+
+/* mq_arena.c
+
+   Pass large messages between processes via a POSIX message queue,
+   without copying them through the kernel (and without the limit on
+   message size imposed by 'mq_msgsize').
+
+   The payloads are placed in an "arena": a POSIX shared memory object
+   (shm_open() plus mmap()) divided into 'numSlots' slots of 'slotSize'
+   bytes. The messages sent on the queue are just descriptors (struct
+   mqaDesc) giving the offset and length of a payload in the arena. So
+   the queue retains its priority ordering and its blocking semantics,
+   but the payload is written once, by the sender, directly into shared
+   memory, and read there by the receiver.
+
+   Each slot has a reference count. mqaAlloc() returns a slot with a
+   count of 1; that reference is passed to the receiver along with the
+   descriptor, and the receiver calls mqaRelease() when it has finished
+   with the payload. (A sender that sends the same payload on several
+   queues calls mqaRef() for each additional message.) When the count
+   falls to 0, the slot returns to the arena's free list.
+
+   The free list is a lock-free stack, whose head carries a tag that is
+   incremented by each operation, to avoid the ABA problem. A
+   process-shared POSIX semaphore in the arena counts the free slots, so
+   that mqaAlloc() can block when the arena is full.
+
+   mqaReceive() waits for a message with mq_timedreceive() and then
+   drains further waiting messages (up to 'max') by calling
+   mq_timedreceive() with an expired timeout, which returns immediately
+   if the queue is empty. Thus a receiver that is woken once can collect
+   a whole batch of descriptors, even though the queue descriptor is in
+   blocking mode.
+
+   If a process dies while holding references, the slots concerned are
+   never reclaimed; the arena must then be re-created.
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include "mq_arena.h"
+#include "tlpi_hdr.h"
+
+#define MQA_MAGIC       0x6d716172      /* "mqar" */
+
+struct slotHdr {
+    uint32_t refCnt;
+    uint32_t next;              /* Next free slot + 1 (0: none) */
+};
+
+struct arenaHdr {
+    uint32_t magic;             /* Set once the arena is initialized */
+    uint32_t numSlots;
+    uint64_t slotSize;
+    uint64_t dataOffset;        /* Of slot 0, from the start of arena */
+    uint64_t freeTop;           /* Head of free stack:
+                                   (tag << 32) | (slot + 1) */
+    sem_t freeSem;              /* Counts free slots */
+    struct slotHdr slots[];
+};
+
+struct mqArena {
+    struct arenaHdr *hdr;
+    size_t mapSize;
+    char *data;                 /* Address of slot 0 */
+};
+
+static size_t
+roundUp(size_t n, size_t mult)
+{
+    return (n + mult - 1) / mult * mult;
+}
+
+static void
+pushFree(struct arenaHdr *hdr, uint32_t slot)
+{
+    uint64_t top = __atomic_load_n(&hdr->freeTop, __ATOMIC_ACQUIRE);
+    uint64_t newTop;
+
+    do {
+        hdr->slots[slot].next = (uint32_t) top;
+        newTop = ((top >> 32) + 1) << 32 | (slot + 1);
+    } while (!__atomic_compare_exchange_n(&hdr->freeTop, &top, newTop,
+                true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/* Pop a slot from the free stack; the caller has already decremented
+   the semaphore, so the stack is not empty */
+
+static uint32_t
+popFree(struct arenaHdr *hdr)
+{
+    uint64_t top = __atomic_load_n(&hdr->freeTop, __ATOMIC_ACQUIRE);
+    uint64_t newTop;
+    uint32_t slot;
+
+    do {
+        slot = (uint32_t) top - 1;
+
+        /* If another process pops this slot first, 'next' may be stale,
+           but then the tag in 'freeTop' changes, and the CAS fails */
+
+        newTop = ((top >> 32) + 1) << 32 |
+                 __atomic_load_n(&hdr->slots[slot].next, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&hdr->freeTop, &top, newTop,
+                true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return slot;
+}
+
+static struct mqArena *
+mapArena(int fd, size_t size)
+{
+    struct mqArena *a = malloc(sizeof(*a));
+
+    if (a == NULL)
+        return NULL;
+    a->hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (a->hdr == MAP_FAILED) {
+        free(a);
+        return NULL;
+    }
+    a->mapSize = size;
+    a->data = (char *) a->hdr + a->hdr->dataOffset;
+    return a;
+}
+
+/* Create the shared memory object 'name' (e.g., "/myarena") holding
+   'numSlots' slots of (at least) 'slotSize' bytes */
+
+struct mqArena *
+mqaCreate(const char *name, size_t slotSize, unsigned int numSlots,
+          mode_t perms)
+{
+    struct arenaHdr hdr;
+    struct mqArena *a;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    int fd, savedErrno;
+
+    if (slotSize == 0 || numSlots == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.numSlots = numSlots;
+    hdr.slotSize = roundUp(slotSize, pageSize);
+    hdr.dataOffset = roundUp(sizeof(struct arenaHdr) +
+                             numSlots * sizeof(struct slotHdr), pageSize);
+
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, perms);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, hdr.dataOffset + hdr.slotSize * numSlots) == -1)
+        goto fail;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        goto fail;
+
+    a = mapArena(fd, hdr.dataOffset + hdr.slotSize * numSlots);
+    if (a == NULL)
+        goto fail;
+    close(fd);
+
+    if (sem_init(&a->hdr->freeSem, 1, numSlots) == -1) {
+        savedErrno = errno;
+        mqaClose(a);
+        shm_unlink(name);
+        errno = savedErrno;
+        return NULL;
+    }
+    for (unsigned int j = numSlots; j > 0; j--)
+        pushFree(a->hdr, j - 1);
+
+    __atomic_store_n(&a->hdr->magic, MQA_MAGIC, __ATOMIC_RELEASE);
+    return a;
+
+fail:
+    savedErrno = errno;
+    close(fd);
+    shm_unlink(name);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Open an existing arena. Fails with EAGAIN if its creator has not yet
+   finished initializing it. */
+
+struct mqArena *
+mqaOpen(const char *name)
+{
+    struct mqArena *a;
+    struct stat sb;
+    int fd, savedErrno;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1)
+        goto fail;
+    if (sb.st_size < (off_t) sizeof(struct arenaHdr)) {
+        errno = EAGAIN;                 /* Not yet sized by creator */
+        goto fail;
+    }
+    a = mapArena(fd, sb.st_size);
+    if (a == NULL)
+        goto fail;
+    close(fd);
+
+    if (__atomic_load_n(&a->hdr->magic, __ATOMIC_ACQUIRE) != MQA_MAGIC) {
+        mqaClose(a);
+        errno = EAGAIN;
+        return NULL;
+    }
+    return a;
+
+fail:
+    savedErrno = errno;
+    close(fd);
+    errno = savedErrno;
+    return NULL;
+}
+
+int
+mqaUnlink(const char *name)
+{
+    return shm_unlink(name);
+}
+
+void
+mqaClose(struct mqArena *a)
+{
+    munmap(a->hdr, a->mapSize);
+    free(a);
+}
+
+size_t
+mqaSlotSize(struct mqArena *a)
+{
+    return a->hdr->slotSize;
+}
+
+/* Allocate a slot for a payload of 'len' bytes, filling in 'desc' and
+   returning the address at which the payload should be written. If no
+   slot is free, wait for one if 'wait' is true, or else fail with
+   EAGAIN. */
+
+void *
+mqaAlloc(struct mqArena *a, size_t len, bool wait, struct mqaDesc *desc)
+{
+    uint32_t slot;
+
+    if (len > a->hdr->slotSize) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    if (wait) {
+        while (sem_wait(&a->hdr->freeSem) == -1)
+            if (errno != EINTR)
+                return NULL;
+    } else {
+        if (sem_trywait(&a->hdr->freeSem) == -1)
+            return NULL;
+    }
+
+    slot = popFree(a->hdr);
+    __atomic_store_n(&a->hdr->slots[slot].refCnt, 1, __ATOMIC_RELAXED);
+
+    desc->offset = (uint64_t) slot * a->hdr->slotSize;
+    desc->length = len;
+    return a->data + desc->offset;
+}
+
+/* Return the slot number for 'desc', or -1 if it is invalid */
+
+static long
+descSlot(struct mqArena *a, const struct mqaDesc *desc)
+{
+    uint64_t slot = desc->offset / a->hdr->slotSize;
+
+    if (desc->offset % a->hdr->slotSize != 0 || slot >= a->hdr->numSlots ||
+            desc->length > a->hdr->slotSize) {
+        errno = EINVAL;
+        return -1;
+    }
+    return slot;
+}
+
+/* Return the address of the payload described by 'desc' */
+
+void *
+mqaPtr(struct mqArena *a, const struct mqaDesc *desc)
+{
+    if (descSlot(a, desc) == -1)
+        return NULL;
+    return a->data + desc->offset;
+}
+
+/* Add a reference to a payload, for example, before sending its
+   descriptor on a second queue */
+
+int
+mqaRef(struct mqArena *a, const struct mqaDesc *desc)
+{
+    long slot = descSlot(a, desc);
+
+    if (slot == -1)
+        return -1;
+    __atomic_add_fetch(&a->hdr->slots[slot].refCnt, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Drop a reference to a payload; the last reference frees the slot */
+
+int
+mqaRelease(struct mqArena *a, const struct mqaDesc *desc)
+{
+    long slot = descSlot(a, desc);
+
+    if (slot == -1)
+        return -1;
+    if (__atomic_sub_fetch(&a->hdr->slots[slot].refCnt, 1,
+                           __ATOMIC_ACQ_REL) == 0) {
+        pushFree(a->hdr, slot);
+        if (sem_post(&a->hdr->freeSem) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Open (and, if 'flags' includes O_CREAT, create) a message queue whose
+   messages are descriptors: its 'mq_msgsize' is the size of a
+   descriptor, as mqaReceive() requires. 'maxMsg' is used only when
+   creating the queue; 0 means 10 (the Linux default, which is also the
+   limit for unprivileged processes). */
+
+mqd_t
+mqaOpenQueue(const char *name, int flags, mode_t perms, long maxMsg)
+{
+    struct mq_attr attr;
+
+    attr.mq_maxmsg = (maxMsg > 0) ? maxMsg : 10;
+    attr.mq_msgsize = sizeof(struct mqaDesc);
+    return mq_open(name, flags, perms, &attr);
+}
+
+/* Send the descriptor 'desc', passing the reference to its payload to
+   the receiver */
+
+int
+mqaSend(mqd_t mqd, const struct mqaDesc *desc, unsigned int prio)
+{
+    return mq_send(mqd, (const char *) desc, sizeof(*desc), prio);
+}
+
+/* Receive up to 'max' descriptors (and, if 'prios' is not NULL, their
+   priorities), in priority order. Waits until 'abstime' (or, if it is
+   NULL, indefinitely) for the first descriptor. Returns the number
+   received, or -1 on error (including ETIMEDOUT). */
+
+int
+mqaReceive(mqd_t mqd, struct mqaDesc descs[], unsigned int prios[],
+           int max, const struct timespec *abstime)
+{
+    static const struct timespec expired = { 0, 0 };
+    unsigned int prio;
+    ssize_t numRead;
+    int n;
+
+    for (n = 0; n < max; n++) {
+        if (n == 0 && abstime == NULL)
+            numRead = mq_receive(mqd, (char *) &descs[n],
+                                 sizeof(struct mqaDesc), &prio);
+        else
+            numRead = mq_timedreceive(mqd, (char *) &descs[n],
+                                      sizeof(struct mqaDesc), &prio,
+                                      (n == 0) ? abstime : &expired);
+        if (numRead == -1) {
+            if (n == 0)
+                return -1;
+            break;                      /* Queue drained (ETIMEDOUT) */
+        }
+        if (numRead != sizeof(struct mqaDesc)) {
+            errno = EBADMSG;
+            return (n > 0) ? n : -1;
+        }
+        if (prios != NULL)
+            prios[n] = prio;
+    }
+    return n;
+}
@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 52 */
+
+/* mq_arena.h
+
+   Header file for mq_arena.c.
+*/
+#ifndef MQ_ARENA_H
+#define MQ_ARENA_H
+
+#include <sys/types.h>
+#include <mqueue.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct mqaDesc {                /* The message actually sent on the queue */
+    uint64_t offset;            /* Of the payload, within the arena */
+    uint64_t length;            /* Of the payload */
+};
+
+struct mqArena;                 /* Opaque; see mq_arena.c */
+
+struct mqArena *mqaCreate(const char *name, size_t slotSize,
+                          unsigned int numSlots, mode_t perms);
+
+struct mqArena *mqaOpen(const char *name);
+
+int mqaUnlink(const char *name);
+
+void mqaClose(struct mqArena *a);
+
+size_t mqaSlotSize(struct mqArena *a);
+
+void *mqaAlloc(struct mqArena *a, size_t len, bool wait,
+               struct mqaDesc *desc);
+
+void *mqaPtr(struct mqArena *a, const struct mqaDesc *desc);
+
+int mqaRef(struct mqArena *a, const struct mqaDesc *desc);
+
+int mqaRelease(struct mqArena *a, const struct mqaDesc *desc);
+
+mqd_t mqaOpenQueue(const char *name, int flags, mode_t perms, long maxMsg);
+
+int mqaSend(mqd_t mqd, const struct mqaDesc *desc, unsigned int prio);
+
+int mqaReceive(mqd_t mqd, struct mqaDesc descs[], unsigned int prios[],
+               int max, const struct timespec *abstime);
+
+#endif
@@ -0,0 +1,324 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 52 */
+
+/* mqa_bench.c
+
+   Compare the throughput of passing large payloads between two processes
+   by copying them through a POSIX message queue (as pmsg_send.c and
+   pmsg_receive.c do) and by sending descriptors of payloads placed in a
+   shared memory arena (mq_arena.c).
+
+   Usage: mqa_bench [-n payloads] [-s size] [-m msgsize] [-q maxmsg]
+                [-k slots] [-b batch]
+
+   The parent process sends 'payloads' (default 2000) payloads of 'size'
+   (default 1048576) bytes each to a child process, with priorities
+   cycling from 0 to 3:
+
+   * First, each payload is built in a buffer and sent as a series of
+     messages of at most 'msgsize' (default 8192, the default limit on
+     'mq_msgsize') bytes, on a queue holding 'maxmsg' (default 10)
+     messages. The child receives each message into its own buffer.
+
+   * Then, each payload is built directly in an arena of 'slots' (default
+     16) slots, and its descriptor is sent on a queue holding 'maxmsg'
+     descriptors. The child receives up to 'batch' (default 64)
+     descriptors per mqaReceive() call, and releases each slot once it
+     has read the payload.
+
+   In both cases, the child computes a checksum over the payloads, which
+   is compared with that computed by the parent. The program displays
+   the throughput in MiB/s and payloads/s, and the average number of
+   messages received per receive call.
+*/
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include "mq_arena.h"
+#include "tlpi_hdr.h"
+
+static long numPayloads = 2000;
+static size_t payloadSize = 1048576;
+static long msgSize = 8192;
+static long maxMsg = 10;
+static unsigned int numSlots = 16;
+static int batchSize = 64;
+
+static char mqName[64], arenaName[64];
+
+struct result {                 /* Sent by the child to the parent */
+    uint64_t checksum;
+    long numCalls;              /* Receive calls */
+    long numMsgs;               /* Messages received */
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build payload number 'n' at 'buf', returning its checksum */
+
+static uint64_t
+fillPayload(char *buf, long n)
+{
+    uint64_t *w = (uint64_t *) buf, sum = 0;
+
+    for (size_t j = 0; j < payloadSize / sizeof(uint64_t); j++) {
+        w[j] = n + j;
+        sum += w[j];
+    }
+    return sum;
+}
+
+static uint64_t
+sumBytes(const char *buf, size_t len)
+{
+    const uint64_t *w = (const uint64_t *) buf;
+    uint64_t sum = 0;
+
+    for (size_t j = 0; j < len / sizeof(uint64_t); j++)
+        sum += w[j];
+    return sum;
+}
+
+/* Child: receive the payloads copied through the queue */
+
+static void
+copyReceiver(struct result *res)
+{
+    long msgsPerPayload = (payloadSize + msgSize - 1) / msgSize;
+    char *buf = malloc(msgSize);
+    mqd_t mqd;
+
+    if (buf == NULL)
+        errExit("malloc");
+    mqd = mq_open(mqName, O_RDONLY);
+    if (mqd == (mqd_t) -1)
+        errExit("mq_open");
+
+    for (long j = 0; j < numPayloads * msgsPerPayload; j++) {
+        ssize_t numRead = mq_receive(mqd, buf, msgSize, NULL);
+        if (numRead == -1)
+            errExit("mq_receive");
+        res->checksum += sumBytes(buf, numRead);
+        res->numCalls++;
+        res->numMsgs++;
+    }
+    mq_close(mqd);
+    free(buf);
+}
+
+/* Child: receive descriptors of payloads in the arena */
+
+static void
+arenaReceiver(struct result *res)
+{
+    struct mqaDesc *descs = calloc(batchSize, sizeof(struct mqaDesc));
+    struct mqArena *a;
+    mqd_t mqd;
+
+    if (descs == NULL)
+        errExit("calloc");
+    a = mqaOpen(arenaName);
+    if (a == NULL)
+        errExit("mqaOpen");
+    mqd = mqaOpenQueue(mqName, O_RDONLY, 0, 0);
+    if (mqd == (mqd_t) -1)
+        errExit("mqaOpenQueue");
+
+    while (res->numMsgs < numPayloads) {
+        int n = mqaReceive(mqd, descs, NULL, batchSize, NULL);
+        if (n == -1)
+            errExit("mqaReceive");
+        res->numCalls++;
+
+        for (int j = 0; j < n; j++) {
+            char *p = mqaPtr(a, &descs[j]);
+            if (p == NULL)
+                errExit("mqaPtr");
+            res->checksum += sumBytes(p, descs[j].length);
+            if (mqaRelease(a, &descs[j]) == -1)
+                errExit("mqaRelease");
+        }
+        res->numMsgs += n;
+    }
+    mq_close(mqd);
+    mqaClose(a);
+    free(descs);
+}
+
+/* Parent: copy payloads through the queue */
+
+static uint64_t
+copySender(struct mqArena *unused)
+{
+    char *buf = malloc(payloadSize);
+    uint64_t sum = 0;
+    mqd_t mqd;
+
+    if (buf == NULL)
+        errExit("malloc");
+    mqd = mq_open(mqName, O_WRONLY);
+    if (mqd == (mqd_t) -1)
+        errExit("mq_open");
+
+    for (long n = 0; n < numPayloads; n++) {
+        sum += fillPayload(buf, n);
+        for (size_t off = 0; off < payloadSize; off += msgSize)
+            if (mq_send(mqd, buf + off, min(msgSize, payloadSize - off),
+                        n % 4) == -1)
+                errExit("mq_send");
+    }
+    mq_close(mqd);
+    free(buf);
+    return sum;
+}
+
+/* Parent: build payloads in the arena, and send their descriptors */
+
+static uint64_t
+arenaSender(struct mqArena *a)
+{
+    struct mqaDesc desc;
+    uint64_t sum = 0;
+    mqd_t mqd;
+
+    mqd = mqaOpenQueue(mqName, O_WRONLY, 0, 0);
+    if (mqd == (mqd_t) -1)
+        errExit("mqaOpenQueue");
+
+    for (long n = 0; n < numPayloads; n++) {
+        char *p = mqaAlloc(a, payloadSize, true, &desc);
+        if (p == NULL)
+            errExit("mqaAlloc");
+        sum += fillPayload(p, n);
+        if (mqaSend(mqd, &desc, n % 4) == -1)
+            errExit("mqaSend");
+    }
+    mq_close(mqd);
+    return sum;
+}
+
+/* Run one test: fork a child to run 'receiver', while the parent runs
+   'sender'; then display the results */
+
+static void
+runTest(const char *name, void (*receiver)(struct result *),
+        uint64_t (*sender)(struct mqArena *), struct mqArena *a)
+{
+    struct result res;
+    int pfd[2], status;
+    pid_t pid;
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    double start = now();
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        close(pfd[0]);
+        memset(&res, 0, sizeof(res));
+        receiver(&res);
+        if (write(pfd[1], &res, sizeof(res)) != sizeof(res))
+            errExit("write");
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(pfd[1]);
+    uint64_t sum = sender(a);
+    if (read(pfd[0], &res, sizeof(res)) != sizeof(res))
+        fatal("%s: child failed", name);
+    if (waitpid(pid, &status, 0) == -1)
+        errExit("waitpid");
+    double secs = now() - start;
+    close(pfd[0]);
+
+    if (res.checksum != sum)
+        fatal("%s: checksum mismatch", name);
+
+    printf("%-6s %10.0f %10.0f %12.1f\n", name,
+           numPayloads * (double) payloadSize / secs / (1024 * 1024),
+           numPayloads / secs, (double) res.numMsgs / res.numCalls);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mq_attr attr;
+    struct mqArena *a;
+    mqd_t mqd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:m:q:k:b:")) != -1) {
+        switch (opt) {
+        case 'n': numPayloads = getLong(optarg, GN_GT_0, "payloads");   break;
+        case 's': payloadSize = getLong(optarg, GN_GT_0, "size");       break;
+        case 'm': msgSize = getLong(optarg, GN_GT_0, "msgsize");        break;
+        case 'q': maxMsg = getLong(optarg, GN_GT_0, "maxmsg");          break;
+        case 'k': numSlots = getInt(optarg, GN_GT_0, "slots");          break;
+        case 'b': batchSize = getInt(optarg, GN_GT_0, "batch");         break;
+        default:
+            usageErr("%s [-n payloads] [-s size] [-m msgsize] [-q maxmsg] "
+                     "[-k slots] [-b batch]\n", argv[0]);
+        }
+    }
+    payloadSize = payloadSize / sizeof(uint64_t) * sizeof(uint64_t);
+    if (payloadSize == 0 || msgSize % sizeof(uint64_t) != 0)
+        cmdLineErr("size and msgsize must be multiples of %zu\n",
+                   sizeof(uint64_t));
+
+    snprintf(mqName, sizeof(mqName), "/mqa_bench.%ld", (long) getpid());
+    snprintf(arenaName, sizeof(arenaName), "/mqa_bench_arena.%ld",
+             (long) getpid());
+
+    printf("%ld payloads of %zu bytes\n\n", numPayloads, payloadSize);
+    printf("%-6s %10s %10s %12s\n", "Method", "MiB/s", "Payloads/s",
+           "Msgs/call");
+
+    /* Copying through the queue */
+
+    attr.mq_maxmsg = maxMsg;
+    attr.mq_msgsize = msgSize;
+    mqd = mq_open(mqName, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR,
+                  &attr);
+    if (mqd == (mqd_t) -1)
+        errExit("mq_open (msgsize %ld)", msgSize);
+    runTest("copy", copyReceiver, copySender, NULL);
+    mq_close(mqd);
+    mq_unlink(mqName);
+
+    /* Descriptors of payloads in the arena */
+
+    a = mqaCreate(arenaName, payloadSize, numSlots, S_IRUSR | S_IWUSR);
+    if (a == NULL)
+        errExit("mqaCreate");
+    mqd = mqaOpenQueue(mqName, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR,
+                       maxMsg);
+    if (mqd == (mqd_t) -1)
+        errExit("mqaOpenQueue");
+    runTest("arena", arenaReceiver, arenaSender, a);
+    mq_close(mqd);
+    mq_unlink(mqName);
+    mqaClose(a);
+    mqaUnlink(arenaName);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,162 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* spawn_bench.c
+
+   Measure how the time taken to launch a program (and wait for it)
+   depends on the size of the parent's resident set, for each of the
+   launch methods in spawn_launch.c.
+
+   Usage: spawn_bench [-m max-mib] [-n launches] [-s] [prog [arg...]]
+
+   The parent allocates and touches memory in steps (0, 64, 128, 256, ...
+   MiB, up to 'max-mib', default 1024), and at each step launches 'prog'
+   (default: /bin/true) 'launches' times (default 200) with each method,
+   displaying the average time per launch in microseconds. With -s, the
+   program is run via "sh -c" (as system() does), which adds the cost of
+   starting a shell to every launch.
+
+   With fork(), the time grows in proportion to the resident set size,
+   since the page tables must be copied; with the other methods, it stays
+   constant.
+
+   This program is Linux-specific.
+*/
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "spawn_launch.h"
+#include "tlpi_hdr.h"
+
+static const struct {
+    const char *name;
+    int method;
+} methods[] = {
+    { "fork",    SL_FORK },
+    { "vfork",   SL_VFORK },
+    { "clone",   SL_CLONE },
+    { "spawn",   SL_SPAWN },
+};
+
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Return the resident set size of this process, in MiB */
+
+static long
+rssMib(void)
+{
+    long pages = 0, rss = 0;
+
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        errExit("fopen");
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+        fatal("Unexpected format in /proc/self/statm");
+    fclose(fp);
+    return rss * sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *defArgv[] = { "/bin/true", NULL };
+    char **progArgv = defArgv;
+    long maxMib = 1024, numLaunches = 200;
+    struct slOptions opts;
+    int opt;
+
+    slDefaultOptions(&opts);
+
+    while ((opt = getopt(argc, argv, "+m:n:s")) != -1) {
+        switch (opt) {
+        case 'm': maxMib = getLong(optarg, GN_NONNEG, "max-mib");       break;
+        case 'n': numLaunches = getLong(optarg, GN_GT_0, "launches");   break;
+        case 's': opts.useShell = true;                                 break;
+        default:
+            usageErr("%s [-m max-mib] [-n launches] [-s] [prog [arg...]]\n",
+                     argv[0]);
+        }
+    }
+    if (optind < argc)
+        progArgv = &argv[optind];
+
+    /* With -s, the whole command line is given to the shell */
+
+    char cmd[4096] = "";
+    char *shArgv[] = { cmd, NULL };
+    if (opts.useShell) {
+        for (char **p = progArgv; *p != NULL; p++) {
+            strncat(cmd, *p, sizeof(cmd) - strlen(cmd) - 2);
+            strcat(cmd, " ");
+        }
+        progArgv = shArgv;
+    }
+
+    printf("%8s", "RSS MiB");
+    for (size_t m = 0; m < NUM_METHODS; m++)
+        printf(" %9s", methods[m].name);
+    printf("   (usecs per launch)\n");
+
+    long allocMib = 0;
+    for (long step = 0; ; step = min((step == 0) ? 64 : step * 2, maxMib)) {
+
+        /* Grow our resident set to 'step' MiB (beyond what we started
+           with) by touching newly allocated memory */
+
+        if (step > allocMib) {
+            size_t len = (step - allocMib) * 1024 * 1024;
+            char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                errExit("mmap");
+            memset(p, 1, len);
+            allocMib = step;
+        }
+
+        printf("%8ld", rssMib());
+        fflush(stdout);
+
+        for (size_t m = 0; m < NUM_METHODS; m++) {
+            opts.method = methods[m].method;
+
+            double start = now();
+            for (long j = 0; j < numLaunches; j++) {
+                int status;
+                pid_t pid = slLaunch(progArgv, &opts);
+                if (pid == -1)
+                    errExit("slLaunch %s", methods[m].name);
+                if (slWait(pid, &status, NULL) == -1)
+                    errExit("slWait");
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    fatal("%s: child status %#x", methods[m].name, status);
+            }
+            printf(" %9.1f", (now() - start) / numLaunches * 1e6);
+            fflush(stdout);
+        }
+        printf("\n");
+
+        if (step >= maxMib)
+            break;
+    }
+
+    exit(EXIT_SUCCESS);
+}
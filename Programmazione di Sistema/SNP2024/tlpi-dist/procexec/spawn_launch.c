@@ -0,0 +1,399 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* spawn_launch.c
+
+   Launch programs without the cost of fork().
+
+   fork() must duplicate the caller's page tables (and, later, take a
+   copy-on-write fault for each page that either process modifies), so
+   the time it takes grows with the size of the caller's memory. When the
+   child is going to exec() straight away, this work is wasted. This
+   module launches a program in any of the following ways:
+
+        SL_SPAWN    posix_spawnp(); glibc (since 2.24) implements this
+                    using clone(CLONE_VM | CLONE_VFORK), and reports exec()
+                    failures back to the caller
+        SL_VFORK    vfork() and then execve()
+        SL_CLONE    clone(CLONE_VM | CLONE_VFORK) on a separate stack, and
+                    then execve()
+        SL_FORK     fork() and then execve(), for comparison
+
+   With SL_VFORK and SL_CLONE, the child shares the parent's memory until
+   it execs, so we take the precautions that posix_spawn() implementations
+   take: all signals are blocked around the creation of the child, and
+   the child resets any signal handlers to SIG_DFL before unblocking
+   signals, so that a handler never runs in the child on the parent's
+   memory. The PATH search is done in the parent beforehand. If the
+   exec() fails, the child records the error in shared memory, so that
+   slLaunch() can return it; with SL_FORK, the child just exits with
+   status 127, like system().
+
+   In the child, the file descriptor actions in 'fdActions' are performed
+   in order, the signals in 'sigDefault' are reset to SIG_DFL, and the
+   signal mask is set to 'sigMask'.
+
+   slSystem() is an implementation of system(3) (compare system.c) on top
+   of slLaunch().
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <spawn.h>
+#include "spawn_launch.h"
+#include "tlpi_hdr.h"
+
+#define CLONE_STACK_SIZE (64 * 1024)
+
+extern char **environ;
+
+void
+slDefaultOptions(struct slOptions *opts)
+{
+    memset(opts, 0, sizeof(struct slOptions));
+    opts->method = SL_SPAWN;
+}
+
+struct childArgs {
+    const char *path;
+    char *const *argv;
+    char *const *envp;
+    const struct slOptions *opts;
+    const sigset_t *mask;       /* Signal mask for the child */
+    volatile int err;           /* Set by the child if it fails */
+};
+
+/* Executed in the child for SL_VFORK, SL_CLONE, and SL_FORK. When the
+   child shares the parent's memory, we may only modify 'ca->err'. */
+
+static int
+childExec(void *arg)
+{
+    struct childArgs *ca = arg;
+    const struct slOptions *opts = ca->opts;
+    struct sigaction sa;
+
+    /* All signals are blocked at this point. Reset handled signals (and
+       those in 'sigDefault') to SIG_DFL. */
+
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigaction(sig, NULL, &sa) == -1)
+            continue;                   /* Not a valid signal */
+        if ((sa.sa_handler != SIG_IGN && sa.sa_handler != SIG_DFL) ||
+                (opts->sigDefault != NULL &&
+                 sigismember(opts->sigDefault, sig) == 1)) {
+            sa.sa_handler = SIG_DFL;
+            sa.sa_flags = 0;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+
+    for (int j = 0; j < opts->numFdActions; j++) {
+        const struct slFdAction *fa = &opts->fdActions[j];
+        int fd;
+
+        switch (fa->op) {
+        case SL_FA_OPEN:
+            fd = open(fa->path, fa->flags, fa->mode);
+            if (fd == -1)
+                goto fail;
+            if (fd != fa->fd) {
+                if (dup2(fd, fa->fd) == -1)
+                    goto fail;
+                close(fd);
+            }
+            break;
+        case SL_FA_DUP2:
+            if (fa->fd == fa->newFd) {          /* As for posix_spawn(),
+                                                   clear FD_CLOEXEC */
+                int flags = fcntl(fa->fd, F_GETFD);
+                if (flags == -1 ||
+                        fcntl(fa->fd, F_SETFD, flags & ~FD_CLOEXEC) == -1)
+                    goto fail;
+            } else if (dup2(fa->fd, fa->newFd) == -1) {
+                goto fail;
+            }
+            break;
+        case SL_FA_CLOSE:
+            close(fa->fd);
+            break;
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, ca->mask, NULL);
+    execve(ca->path, ca->argv, ca->envp);
+
+fail:
+    ca->err = errno;
+    _exit(127);
+}
+
+/* Find 'file' in PATH, as execvp() would, placing the result in 'buf' */
+
+static const char *
+searchPath(const char *file, char *buf, size_t size)
+{
+    if (strchr(file, '/') != NULL)
+        return file;
+
+    const char *path = getenv("PATH");
+    if (path == NULL)
+        path = "/bin:/usr/bin";
+
+    int savedErrno = ENOENT;
+    for (const char *p = path; ; p++) {
+        const char *end = strchrnul(p, ':');
+        size_t len = end - p;
+
+        if (snprintf(buf, size, "%.*s%s%s", (int) len, p,
+                     (len > 0) ? "/" : "", file) < (int) size &&
+                access(buf, X_OK) == 0)
+            return buf;
+        if (errno == EACCES)
+            savedErrno = EACCES;
+
+        p = end;
+        if (*p == '\0')
+            break;
+    }
+    errno = savedErrno;
+    return NULL;
+}
+
+static pid_t
+launchSpawn(const char *file, char *const argv[], char *const envp[],
+            const struct slOptions *opts)
+{
+    posix_spawn_file_actions_t fact;
+    posix_spawnattr_t attr;
+    short flags = 0;
+    pid_t pid;
+    int s;
+
+    posix_spawn_file_actions_init(&fact);
+    posix_spawnattr_init(&attr);
+
+    for (int j = 0; j < opts->numFdActions; j++) {
+        const struct slFdAction *fa = &opts->fdActions[j];
+
+        switch (fa->op) {
+        case SL_FA_OPEN:
+            posix_spawn_file_actions_addopen(&fact, fa->fd, fa->path,
+                                             fa->flags, fa->mode);
+            break;
+        case SL_FA_DUP2:
+            posix_spawn_file_actions_adddup2(&fact, fa->fd, fa->newFd);
+            break;
+        case SL_FA_CLOSE:
+            posix_spawn_file_actions_addclose(&fact, fa->fd);
+            break;
+        }
+    }
+
+    if (opts->sigMask != NULL) {
+        posix_spawnattr_setsigmask(&attr, opts->sigMask);
+        flags |= POSIX_SPAWN_SETSIGMASK;
+    }
+    if (opts->sigDefault != NULL) {
+        posix_spawnattr_setsigdefault(&attr, opts->sigDefault);
+        flags |= POSIX_SPAWN_SETSIGDEF;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    s = posix_spawnp(&pid, file, &fact, &attr, argv, envp);
+
+    posix_spawn_file_actions_destroy(&fact);
+    posix_spawnattr_destroy(&attr);
+
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return pid;
+}
+
+/* Launch the program described by 'argv' (see spawn_launch.h) using the
+   method in 'opts' (default options if NULL). Returns the PID of the
+   child, or -1 on error, with errno set (including, except for SL_FORK,
+   if the program couldn't be executed). */
+
+pid_t
+slLaunch(char *const argv[], const struct slOptions *opts)
+{
+    struct slOptions defOpts;
+    char *shArgv[] = { "sh", "-c", NULL, NULL };
+    char pathBuf[PATH_MAX];
+    const char *file;
+    sigset_t allMask, origMask;
+    pid_t pid;
+
+    if (opts == NULL) {
+        slDefaultOptions(&defOpts);
+        opts = &defOpts;
+    }
+
+    char *const *envp = (opts->envp != NULL) ? opts->envp : environ;
+
+    if (opts->useShell) {
+        shArgv[2] = argv[0];
+        argv = shArgv;
+        file = "/bin/sh";
+    } else {
+        file = argv[0];
+    }
+
+    if (opts->method == SL_SPAWN)
+        return launchSpawn(file, argv, envp, opts);
+
+    struct childArgs ca;
+    ca.path = searchPath(file, pathBuf, sizeof(pathBuf));
+    if (ca.path == NULL)
+        return -1;
+    ca.argv = argv;
+    ca.envp = envp;
+    ca.opts = opts;
+    ca.mask = (opts->sigMask != NULL) ? opts->sigMask : &origMask;
+    ca.err = 0;
+
+    /* Block all signals while the child may be sharing our memory */
+
+    sigfillset(&allMask);
+    sigprocmask(SIG_BLOCK, &allMask, &origMask);
+
+    switch (opts->method) {
+    case SL_VFORK:
+        pid = vfork();
+        if (pid == 0)
+            childExec(&ca);             /* Doesn't return */
+        break;
+
+    case SL_CLONE: {
+        char *stack = malloc(CLONE_STACK_SIZE);
+        if (stack == NULL) {
+            pid = -1;
+            break;
+        }
+
+        /* The stack grows downward on all architectures that we
+           care about */
+
+        pid = clone(childExec, stack + CLONE_STACK_SIZE,
+                    CLONE_VM | CLONE_VFORK | SIGCHLD, &ca);
+        free(stack);                    /* Child has exec()ed or exited */
+        break;
+    }
+
+    case SL_FORK:
+        pid = fork();
+        if (pid == 0)
+            childExec(&ca);
+        break;
+
+    default:
+        errno = EINVAL;
+        pid = -1;
+        break;
+    }
+
+    int savedErrno = errno;
+    sigprocmask(SIG_SETMASK, &origMask, NULL);
+    errno = savedErrno;
+
+    if (pid > 0 && ca.err != 0) {       /* exec() (or fd action) failed */
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+            continue;
+        errno = ca.err;
+        return -1;
+    }
+    return pid;
+}
+
+/* Wait for the child 'pid', retrying if interrupted by a signal handler.
+   If 'ru' isn't NULL, the child's resource usage is returned in it. */
+
+int
+slWait(pid_t pid, int *status, struct rusage *ru)
+{
+    while (wait4(pid, status, 0, ru) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+/* An implementation of system(3), like that in system.c, but creating
+   the child with slLaunch(), using the method in 'opts' (if 'opts' is
+   NULL, default options). The command is always run with "sh -c". */
+
+int
+slSystem(const char *command, const struct slOptions *opts)
+{
+    sigset_t blockMask, origMask, defMask;
+    struct sigaction saIgnore, saOrigQuit, saOrigInt;
+    struct slOptions o;
+    int status, savedErrno;
+
+    if (command == NULL)                /* Is a shell available? */
+        return slSystem(":", opts) == 0;
+
+    if (opts != NULL)
+        o = *opts;
+    else
+        slDefaultOptions(&o);
+    o.useShell = true;
+
+    sigemptyset(&blockMask);            /* Block SIGCHLD */
+    sigaddset(&blockMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blockMask, &origMask);
+
+    saIgnore.sa_handler = SIG_IGN;      /* Ignore SIGINT and SIGQUIT */
+    saIgnore.sa_flags = 0;
+    sigemptyset(&saIgnore.sa_mask);
+    sigaction(SIGINT, &saIgnore, &saOrigInt);
+    sigaction(SIGQUIT, &saIgnore, &saOrigQuit);
+
+    /* Rather than undoing the above in the child after fork(), we have
+       the launcher set the child's signal mask and dispositions */
+
+    sigemptyset(&defMask);
+    if (saOrigInt.sa_handler != SIG_IGN)
+        sigaddset(&defMask, SIGINT);
+    if (saOrigQuit.sa_handler != SIG_IGN)
+        sigaddset(&defMask, SIGQUIT);
+    o.sigDefault = &defMask;
+    if (o.sigMask == NULL)
+        o.sigMask = &origMask;
+
+    char *argv[] = { (char *) command, NULL };
+    pid_t childPid = slLaunch(argv, &o);
+    if (childPid == -1) {
+        status = (errno == ENOENT || errno == EACCES) ?
+                 127 << 8 :             /* As if the shell did _exit(127) */
+                 -1;
+    } else if (slWait(childPid, &status, NULL) == -1) {
+        status = -1;
+    }
+
+    /* Unblock SIGCHLD, restore dispositions of SIGINT and SIGQUIT */
+
+    savedErrno = errno;
+
+    sigprocmask(SIG_SETMASK, &origMask, NULL);
+    sigaction(SIGINT, &saOrigInt, NULL);
+    sigaction(SIGQUIT, &saOrigQuit, NULL);
+
+    errno = savedErrno;
+
+    return status;
+}
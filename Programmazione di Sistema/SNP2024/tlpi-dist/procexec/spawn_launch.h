@@ -0,0 +1,66 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* spawn_launch.h
+
+   Header file for spawn_launch.c.
+*/
+#ifndef SPAWN_LAUNCH_H
+#define SPAWN_LAUNCH_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <stdbool.h>
+
+#define SL_SPAWN        0       /* posix_spawnp() */
+#define SL_VFORK        1       /* vfork() + execve() */
+#define SL_CLONE        2       /* clone(CLONE_VM | CLONE_VFORK) + execve() */
+#define SL_FORK         3       /* fork() + execve(); for comparison */
+
+#define SL_FA_OPEN      0       /* open(path, flags, mode) as 'fd' */
+#define SL_FA_DUP2      1       /* dup2(fd, newFd) */
+#define SL_FA_CLOSE     2       /* close(fd) */
+
+struct slFdAction {             /* Performed in the child, in order */
+    int op;                     /* One of SL_FA_* */
+    int fd;
+    int newFd;                  /* SL_FA_DUP2 */
+    const char *path;           /* SL_FA_OPEN */
+    int flags;                  /* SL_FA_OPEN */
+    mode_t mode;                /* SL_FA_OPEN */
+};
+
+struct slOptions {
+    int method;                 /* One of SL_SPAWN, SL_VFORK, ... */
+    bool useShell;              /* Run argv[0] as a command with "sh -c";
+                                   otherwise, argv[0] is the program, which
+                                   is searched for in PATH */
+    const struct slFdAction *fdActions;
+    int numFdActions;
+    const sigset_t *sigMask;    /* Child's signal mask (NULL: the caller's
+                                   mask at the time of the call) */
+    const sigset_t *sigDefault; /* Signals to reset to SIG_DFL in the
+                                   child (NULL: none), as system() does
+                                   for SIGINT and SIGQUIT */
+    char *const *envp;          /* NULL: the caller's environment */
+};
+
+void slDefaultOptions(struct slOptions *opts);
+
+pid_t slLaunch(char *const argv[], const struct slOptions *opts);
+
+int slWait(pid_t pid, int *status, struct rusage *ru);
+
+int slSystem(const char *command, const struct slOptions *opts);
+
+#endif
@@ -77,17 +77,37 @@ inetConnect(const char *host, const char *service, int type)
     return (rp == NULL) ? -1 : sfd;
 }
 
+/* Set the SO_REUSEPORT option on 'sfd'. Return 0 on success, or -1 on
+   error (including if the option is not supported). */
+
+static int
+setReusePort(int sfd)
+{
+#ifdef SO_REUSEPORT
+    int optval = 1;
+
+    return setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+#else
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
 /* Create an Internet domain socket and bind it to the address
    { wildcard-IP-address + 'service'/'type' }.
    If 'doListen' is TRUE, then make this a listening socket (by
    calling listen() with 'backlog'), with the SO_REUSEADDR option set.
+   If 'reusePort' is TRUE, also set SO_REUSEPORT, so that several
+   sockets can be bound to the same port and have the kernel spread
+   incoming connections across them.
    If 'addrLen' is not NULL, then use it to return the size of the
    address structure for the address family for this socket.
    Return the socket descriptor on success, or -1 on error. */
 
-static int              /* Public interfaces: inetBind() and inetListen() */
+static int              /* Public interfaces: inetBind(), inetListen(),
+                           inetListenReusePort(), and inetBindReusePort() */
 inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
-                  Boolean doListen, int backlog)
+                  Boolean doListen, Boolean reusePort, int backlog)
 {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
@@ -123,6 +143,12 @@ inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
             }
         }
 
+        if (reusePort && setReusePort(sfd) == -1) {
+            close(sfd);
+            freeaddrinfo(result);
+            return -1;
+        }
+
         if (bind(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
             break;                      /* Success */
 
@@ -153,7 +179,20 @@ inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
 int
 inetListen(const char *service, int backlog, socklen_t *addrlen)
 {
-    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, backlog);
+    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, FALSE,
+                             backlog);
+}
+
+/* Like inetListen(), but also set the SO_REUSEPORT option, so that
+   (for example) each of several threads can have its own listening
+   socket bound to 'service'. Return socket descriptor on success, or
+   -1 on error. */
+
+int
+inetListenReusePort(const char *service, int backlog, socklen_t *addrlen)
+{
+    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, TRUE,
+                             backlog);
 }
 
 /* Create socket bound to wildcard IP address + port given in
@@ -162,7 +201,18 @@ inetListen(const char *service, int backlog, socklen_t *addrlen)
 int
 inetBind(const char *service, int type, socklen_t *addrlen)
 {
-    return inetPassiveSocket(service, type, addrlen, FALSE, 0);
+    return inetPassiveSocket(service, type, addrlen, FALSE, FALSE, 0);
+}
+
+/* Like inetBind(), but also set the SO_REUSEPORT option, so that (for
+   example) each of several threads can have its own datagram socket
+   bound to 'service', with the kernel spreading incoming datagrams
+   across them. Return socket descriptor on success, or -1 on error. */
+
+int
+inetBindReusePort(const char *service, int type, socklen_t *addrlen)
+{
+    return inetPassiveSocket(service, type, addrlen, FALSE, TRUE, 0);
 }
 
 /* Given a socket address in 'addr', whose length is specified in
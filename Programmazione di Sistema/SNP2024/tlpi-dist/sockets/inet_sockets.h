@@ -24,8 +24,13 @@ int inetConnect(const char *host, const char *service, int type);
 
 int inetListen(const char *service, int backlog, socklen_t *addrlen);
 
+int inetListenReusePort(const char *service, int backlog,
+                socklen_t *addrlen);
+
 int inetBind(const char *service, int type, socklen_t *addrlen);
 
+int inetBindReusePort(const char *service, int type, socklen_t *addrlen);
+
 char *inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
                 char *addrStr, int addrStrLen);
 
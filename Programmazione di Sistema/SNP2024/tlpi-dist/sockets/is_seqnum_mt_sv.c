@@ -0,0 +1,281 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* is_seqnum_mt_sv.c
+
+   A multithreaded version of the sequence-number server in
+   is_seqnum_v2_sv.c. The protocol is unchanged, so is_seqnum_v2_cl.c
+   can be used as the client.
+
+   Each of 'num-threads' threads has its own listening socket, created
+   with inetListenReusePort(); the kernel distributes incoming
+   connections across these sockets, so that the threads do not contend
+   on a single accept queue. Sequence numbers are allocated with an
+   atomic fetch-and-add, so that no lock is needed on the common path.
+
+   Usage: is_seqnum_mt_sv [-t num-threads] [-f hwm-file [-B block-size]]
+                          [-i report-secs] [init-seq-num]
+
+   With -f, the server is durable: it never hands out a sequence number
+   unless a "high-water mark" above that number has first been recorded
+   (with fdatasync()) in 'hwm-file'. The mark is advanced in steps of
+   'block-size' (default 65536) numbers, so that only one request per
+   block pays for a disk flush. On restart, numbering resumes at the
+   recorded mark, so that no number is ever issued twice (at the cost of
+   skipping the unused remainder of the last block).
+
+   With -i, the total allocation rate is printed every 'report-secs'
+   seconds.
+*/
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include "line_reader.h"
+#include "is_seqnum_v2.h"
+
+#define BACKLOG 128
+#define HWM_REC_LEN 21                  /* 20 digits + '\n' */
+
+static uint64_t seqNum;                 /* Next number to allocate */
+static uint64_t durableLimit = UINT64_MAX;
+                                        /* Numbers below this limit are
+                                           covered by the high-water mark
+                                           in 'hwmFd' */
+static int hwmFd = -1;                  /* -1 if not running durably */
+static uint64_t blockSize = 65536;
+static pthread_mutex_t hwmMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {                         /* Per-thread counts of requests */
+    uint64_t count;
+    char pad[64];                       /* Keep threads' counts in separate
+                                           cache lines */
+} *allocCounts;
+
+struct threadArg {
+    int tnum;
+    int lfd;
+};
+
+/* Record a new high-water mark in the file, then publish it as the new
+   'durableLimit'. Called with 'hwmMutex' held. */
+
+static void
+writeHwm(uint64_t hwm)
+{
+    char rec[HWM_REC_LEN + 1];
+
+    snprintf(rec, sizeof(rec), "%020" PRIu64 "\n", hwm);
+
+    /* The record is small and always written at offset 0, so a single
+       pwrite() replaces the old value in place */
+
+    if (pwrite(hwmFd, rec, HWM_REC_LEN, 0) != HWM_REC_LEN)
+        errExit("pwrite");
+    if (fdatasync(hwmFd) == -1)
+        errExit("fdatasync");
+
+    __atomic_store_n(&durableLimit, hwm, __ATOMIC_RELEASE);
+}
+
+/* Open (creating if necessary) the high-water mark file, and return the
+   mark that it records (0 for a new file) */
+
+static uint64_t
+openHwm(const char *path)
+{
+    char rec[HWM_REC_LEN + 1];
+    ssize_t numRead;
+
+    hwmFd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (hwmFd == -1)
+        errExit("open %s", path);
+
+    numRead = pread(hwmFd, rec, HWM_REC_LEN, 0);
+    if (numRead == -1)
+        errExit("pread");
+    if (numRead == 0)
+        return 0;
+
+    rec[numRead] = '\0';
+    return strtoull(rec, NULL, 10);
+}
+
+/* Allocate 'reqLen' numbers, returning the first. In durable mode, do not
+   return until the numbers are covered by a recorded high-water mark. */
+
+static uint64_t
+allocSeqNum(uint64_t reqLen)
+{
+    uint64_t first = __atomic_fetch_add(&seqNum, reqLen, __ATOMIC_RELAXED);
+    uint64_t end = first + reqLen;
+
+    if (end <= __atomic_load_n(&durableLimit, __ATOMIC_ACQUIRE))
+        return first;                   /* Common case; no lock needed */
+
+    /* Another thread may have advanced the mark while we waited for the
+       mutex, so recheck before writing */
+
+    int s = pthread_mutex_lock(&hwmMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+
+    if (end > durableLimit)
+        writeHwm((end / blockSize + 1) * blockSize);
+
+    s = pthread_mutex_unlock(&hwmMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+
+    return first;
+}
+
+static void *
+acceptorFunc(void *arg)
+{
+    struct threadArg *ta = arg;
+    struct LineReader lr;
+    char reqLenStr[INT_LEN];            /* Length of requested sequence */
+    char seqNumStr[INT_LEN];            /* Start of granted sequence */
+
+    if (lrInit(&lr, -1, LR_DEFAULT_BUF) == -1)
+        errExit("lrInit");
+
+    for (;;) {
+        int cfd = accept(ta->lfd, NULL, NULL);
+        if (cfd == -1) {
+            errMsg("accept");
+            continue;
+        }
+
+        lrReset(&lr, cfd);
+        if (lrReadLine(&lr, reqLenStr, INT_LEN) <= 0) {
+            close(cfd);
+            continue;                   /* Failed read; skip request */
+        }
+
+        int reqLen = atoi(reqLenStr);
+        if (reqLen <= 0) {              /* Watch for misbehaving clients */
+            close(cfd);
+            continue;                   /* Bad request; skip it */
+        }
+
+        snprintf(seqNumStr, INT_LEN, "%" PRIu64 "\n", allocSeqNum(reqLen));
+        if (write(cfd, seqNumStr, strlen(seqNumStr)) != strlen(seqNumStr))
+            fprintf(stderr, "Error on write");
+
+        __atomic_fetch_add(&allocCounts[ta->tnum].count, 1, __ATOMIC_RELAXED);
+
+        if (close(cfd) == -1)
+            errMsg("close");
+    }
+
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t num-threads] [-f hwm-file "
+            "[-B block-size]]\n"
+            "              [-i report-secs] [init-seq-num]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char *hwmPath = NULL;
+    Boolean blockSizeSet = FALSE;
+    int reportSecs = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:f:B:i:")) != -1) {
+        switch (opt) {
+        case 't': numThreads = getInt(optarg, GN_GT_0, "num-threads");  break;
+        case 'f': hwmPath = optarg;                                     break;
+        case 'B': blockSize = getLong(optarg, GN_GT_0, "block-size");
+                  blockSizeSet = TRUE;                                  break;
+        case 'i': reportSecs = getInt(optarg, GN_GT_0, "report-secs");  break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+
+    if (blockSizeSet && hwmPath == NULL)
+        cmdLineErr("-B requires -f\n");
+
+    if (numThreads < 1)
+        numThreads = 1;
+
+    seqNum = (optind < argc) ?
+             getLong(argv[optind], GN_NONNEG, "init-seq-num") : 0;
+
+    if (hwmPath != NULL) {
+        uint64_t hwm = openHwm(hwmPath);
+        if (hwm > seqNum)
+            seqNum = hwm;               /* Never reissue earlier numbers */
+        writeHwm(seqNum);               /* Nothing yet covered */
+        printf("Resuming at %" PRIu64 "\n", seqNum);
+    }
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken connection
+       errors via a failure from write(). */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)    errExit("signal");
+
+    allocCounts = calloc(numThreads, sizeof(*allocCounts));
+    struct threadArg *targ = calloc(numThreads, sizeof(struct threadArg));
+    if (allocCounts == NULL || targ == NULL)
+        errExit("calloc");
+
+    /* Create all of the listening sockets before starting any thread, so
+       that a failure (e.g., port in use) is reported immediately */
+
+    for (int j = 0; j < numThreads; j++) {
+        targ[j].tnum = j;
+        targ[j].lfd = inetListenReusePort(PORT_NUM_STR, BACKLOG, NULL);
+        if (targ[j].lfd == -1)
+            errExit("inetListenReusePort");
+    }
+
+    for (int j = 0; j < numThreads; j++) {
+        pthread_t t;
+        int s = pthread_create(&t, NULL, acceptorFunc, &targ[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("%ld acceptor threads listening on port %s\n",
+            numThreads, PORT_NUM_STR);
+
+    uint64_t prevTotal = 0;
+    for (;;) {
+        if (reportSecs == 0) {
+            pause();
+            continue;
+        }
+
+        sleep(reportSecs);
+
+        uint64_t total = 0;
+        for (int j = 0; j < numThreads; j++)
+            total += __atomic_load_n(&allocCounts[j].count, __ATOMIC_RELAXED);
+        printf("%10.0f allocations/s  (next seq-num %" PRIu64 ")\n",
+                (double) (total - prevTotal) / reportSecs,
+                __atomic_load_n(&seqNum, __ATOMIC_RELAXED));
+        prevTotal = total;
+    }
+}
@@ -23,6 +23,7 @@
 #define _BSD_SOURCE             /* To get definitions of NI_MAXHOST and
                                    NI_MAXSERV from <netdb.h> */
 #include <netdb.h>
+#include "line_reader.h"        /* Buffered replacement for readLine() */
 #include "is_seqnum.h"
 
 #define BACKLOG 50
@@ -42,6 +43,7 @@ main(int argc, char *argv[])
     char addrStr[ADDRSTRLEN];
     char host[NI_MAXHOST];
     char service[NI_MAXSERV];
+    struct LineReader lr;               /* Reused for each connection */
 
     if (argc > 1 && strcmp(argv[1], "--help") == 0)
         usageErr("%s [init-seq-num]\n", argv[0]);
@@ -97,6 +99,9 @@ main(int argc, char *argv[])
 
     freeaddrinfo(result);
 
+    if (lrInit(&lr, -1, LR_DEFAULT_BUF) == -1)
+        errExit("lrInit");
+
     for (;;) {                  /* Handle clients iteratively */
 
         /* Accept a client connection, obtaining client's address */
@@ -117,7 +122,8 @@ main(int argc, char *argv[])
 
         /* Read client request, send sequence number back */
 
-        if (readLine(cfd, reqLenStr, INT_LEN) <= 0) {
+        lrReset(&lr, cfd);
+        if (lrReadLine(&lr, reqLenStr, INT_LEN) <= 0) {
             close(cfd);
             continue;                   /* Failed read; skip request */
         }
@@ -22,6 +22,7 @@
 
    See also is_seqnum_v2_cl.c.
 */
+#include "line_reader.h"        /* Buffered replacement for readLine() */
 #include "is_seqnum_v2.h"
 
 int
@@ -48,6 +49,10 @@ main(int argc, char *argv[])
     if (claddr == NULL)
         errExit("malloc");
 
+    struct LineReader lr;               /* Reused for each connection */
+    if (lrInit(&lr, -1, LR_DEFAULT_BUF) == -1)
+        errExit("lrInit");
+
     for (;;) {                  /* Handle clients iteratively */
 
         /* Accept a client connection, obtaining client's address */
@@ -66,7 +71,8 @@ main(int argc, char *argv[])
         /* Read client request, send sequence number back */
 
         char reqLenStr[INT_LEN];        /* Length of requested sequence */
-        if (readLine(cfd, reqLenStr, INT_LEN) <= 0) {
+        lrReset(&lr, cfd);
+        if (lrReadLine(&lr, reqLenStr, INT_LEN) <= 0) {
             close(cfd);
             continue;                   /* Failed read; skip request */
         }
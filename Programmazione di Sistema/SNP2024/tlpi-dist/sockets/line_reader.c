@@ -0,0 +1,192 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* line_reader.c
+
+   A buffered line reader. Unlike readLine(), which performs one read()
+   per byte, the functions here fill a large buffer with each read() and
+   locate newlines with memchr(), which glibc implements with vector
+   (SSE2/AVX2) instructions. lrNextLine() returns lines as pointers into
+   the buffer (no copying); lrReadLine() is a drop-in replacement for
+   readLine() for callers that want a null-terminated copy.
+
+   The reader can be used on both blocking and nonblocking file
+   descriptors. On a nonblocking descriptor, lrNextLine() fails with
+   EAGAIN if no complete line is yet available; any partial line stays
+   buffered and is returned once the rest of it arrives.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "line_reader.h"                /* Declares functions defined here */
+
+/* Initialize 'lr' to read from 'fd' using a buffer of 'bufSize' bytes
+   (LR_DEFAULT_BUF if 'bufSize' is 0). Return 0 on success, or -1 on
+   error. */
+
+int
+lrInit(struct LineReader *lr, int fd, size_t bufSize)
+{
+    if (bufSize == 0)
+        bufSize = LR_DEFAULT_BUF;
+
+    lr->buf = malloc(bufSize);
+    if (lr->buf == NULL)
+        return -1;
+
+    lr->size = bufSize;
+    lrReset(lr, fd);
+    return 0;
+}
+
+/* Discard any buffered input and start reading from 'fd'. This allows
+   a single reader (and its buffer) to be reused for successive
+   connections, for example in an iterative server. */
+
+void
+lrReset(struct LineReader *lr, int fd)
+{
+    lr->fd = fd;
+    lr->start = 0;
+    lr->scan = 0;
+    lr->end = 0;
+    lr->eof = 0;
+}
+
+void                    /* Free the buffer allocated by lrInit() */
+lrFree(struct LineReader *lr)
+{
+    free(lr->buf);
+    lr->buf = NULL;
+    lr->size = 0;
+}
+
+/* Return the next line of input in '*line'. The returned pointer refers
+   to the reader's buffer, and remains valid only until the next call
+   on 'lr'. The line is NOT null-terminated; the function result is its
+   length, including the newline character. A line that does not end
+   in a newline is returned if (a) end-of-file is reached, or (b) the
+   line is longer than the buffer; in the latter case, the rest of the
+   line is returned by subsequent calls.
+
+   Return 0 on end-of-file, or -1 on error (including EAGAIN on a
+   nonblocking file descriptor with no complete line available). */
+
+ssize_t
+lrNextLine(struct LineReader *lr, char **line)
+{
+    ssize_t numRead;
+    size_t len;
+    char *nl;
+
+    for (;;) {
+
+        /* Look for a newline in the bytes not yet scanned. Bytes already
+           scanned on a previous (EAGAIN) call are not searched again. */
+
+        if (lr->scan < lr->end) {
+            nl = memchr(lr->buf + lr->scan, '\n', lr->end - lr->scan);
+            if (nl != NULL) {
+                *line = lr->buf + lr->start;
+                len = nl - *line + 1;
+                lr->start += len;
+                lr->scan = lr->start;
+                return len;
+            }
+            lr->scan = lr->end;
+        }
+
+        if (lr->eof) {                  /* Return any unterminated tail */
+            len = lr->end - lr->start;
+            *line = lr->buf + lr->start;
+            lr->start = lr->end;
+            return len;                 /* 0 if nothing left */
+        }
+
+        /* Make room for more input: either recycle an empty buffer,
+           shift the partial line to the start of the buffer, or, if the
+           partial line already fills the buffer, hand it back as a
+           fragment */
+
+        if (lr->start == lr->end) {
+            lr->start = lr->scan = lr->end = 0;
+
+        } else if (lr->end == lr->size) {
+            if (lr->start == 0) {
+                *line = lr->buf;
+                len = lr->size;
+                lr->start = lr->scan = lr->end = 0;
+                return len;
+            }
+
+            memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+            lr->end -= lr->start;
+            lr->scan -= lr->start;
+            lr->start = 0;
+        }
+
+        numRead = read(lr->fd, lr->buf + lr->end, lr->size - lr->end);
+        if (numRead == -1) {
+            if (errno == EINTR)         /* Interrupted --> restart read() */
+                continue;
+            return -1;                  /* Includes EAGAIN */
+        }
+
+        if (numRead == 0)
+            lr->eof = 1;
+        else
+            lr->end += numRead;
+    }
+}
+
+/* Read a line into 'buffer', with the same semantics as readLine():
+   at most (n - 1) bytes of the line are placed in 'buffer', excess
+   bytes are discarded, and the result is null-terminated. Return the
+   number of bytes placed in 'buffer', 0 on end-of-file, or -1 on
+   error. Intended for blocking file descriptors: on a nonblocking
+   descriptor, use lrNextLine(). */
+
+ssize_t
+lrReadLine(struct LineReader *lr, void *buffer, size_t n)
+{
+    ssize_t len;
+    size_t totRead, cnt;
+    char *buf, *line;
+
+    if (n <= 0 || buffer == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf = buffer;
+    totRead = 0;
+    for (;;) {
+        len = lrNextLine(lr, &line);
+        if (len == -1)
+            return -1;
+        if (len == 0)                   /* EOF */
+            break;
+
+        cnt = n - 1 - totRead;          /* Discard > (n - 1) bytes */
+        if (cnt > (size_t) len)
+            cnt = len;
+        memcpy(buf + totRead, line, cnt);
+        totRead += cnt;
+
+        if (line[len - 1] == '\n')
+            break;
+    }
+
+    buf[totRead] = '\0';
+    return totRead;
+}
@@ -0,0 +1,44 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary header for Chapter 59 */
+
+/* line_reader.h
+
+   Header file for line_reader.c.
+*/
+#ifndef LINE_READER_H
+#define LINE_READER_H           /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+#define LR_DEFAULT_BUF 65536    /* Default buffer size for lrInit() */
+
+struct LineReader {
+    int     fd;                 /* File descriptor from which to read */
+    char   *buf;                /* Buffer allocated by lrInit() */
+    size_t  size;               /* Size of 'buf' */
+    size_t  start;              /* Index of first unconsumed byte in 'buf' */
+    size_t  scan;               /* Index from which to resume newline scan */
+    size_t  end;                /* Index one past last valid byte in 'buf' */
+    int     eof;                /* Nonzero once read() has returned 0 */
+};
+
+int lrInit(struct LineReader *lr, int fd, size_t bufSize);
+
+void lrReset(struct LineReader *lr, int fd);
+
+void lrFree(struct LineReader *lr);
+
+ssize_t lrNextLine(struct LineReader *lr, char **line);
+
+ssize_t lrReadLine(struct LineReader *lr, void *buffer, size_t n);
+
+#endif
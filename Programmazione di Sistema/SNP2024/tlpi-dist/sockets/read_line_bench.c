@@ -0,0 +1,144 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* read_line_bench.c
+
+   Measure the rate at which lines can be read from a file using
+   readLine() (one read() per byte), readLineBuf(), and the buffered
+   line reader in line_reader.c (lrNextLine(), which returns lines
+   without copying them).
+
+   Usage: read_line_bench [-m methods] [-b buf-size] file
+
+   'methods' is a string made up of the letters 'r' (readLine()),
+   'b' (readLineBuf()), and 'l' (lrNextLine()); the default is "rbl".
+   'buf-size' is the buffer size used by the line reader (default
+   LR_DEFAULT_BUF).
+
+   A suitable input file can be created with, for example:
+
+        $ seq 1 20000000 > lines.txt
+
+   Running the program twice ensures that the file is in the page
+   cache, so that the figures reflect the cost of line parsing rather
+   than of disk I/O. (Be patient with 'r' on large files!)
+*/
+#include <time.h>
+#include <fcntl.h>
+#include "read_line.h"
+#include "read_line_buf.h"
+#include "line_reader.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LINE 4096
+
+static struct ReadLineBuf rlbuf;        /* Too large for the stack */
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    return (now.tv_sec - start->tv_sec) +
+           (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+runMethod(const char *path, char method, size_t bufSize)
+{
+    char line[MAX_LINE];
+    struct LineReader lr;
+    struct timespec start;
+    long long numLines, numBytes;
+    ssize_t numRead;
+    const char *name;
+    char *lp;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open");
+
+    numLines = 0;
+    numBytes = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    switch (method) {
+    case 'r':
+        name = "readLine";
+        while ((numRead = readLine(fd, line, MAX_LINE)) > 0) {
+            numLines++;
+            numBytes += numRead;
+        }
+        break;
+
+    case 'b':
+        name = "readLineBuf";
+        readLineBufInit(fd, &rlbuf);
+        while ((numRead = readLineBuf(&rlbuf, line, MAX_LINE)) > 0) {
+            numLines++;
+            numBytes += numRead;
+        }
+        break;
+
+    case 'l':
+        name = "lrNextLine";
+        if (lrInit(&lr, fd, bufSize) == -1)
+            errExit("lrInit");
+        while ((numRead = lrNextLine(&lr, &lp)) > 0) {
+            numLines++;
+            numBytes += numRead;
+        }
+        lrFree(&lr);
+        break;
+
+    default:
+        fatal("Bad method: '%c'", method);
+    }
+
+    if (numRead == -1)
+        errExit("%s", name);
+
+    double secs = elapsed(&start);
+    printf("%-12s %12lld lines %14lld bytes %9.3f s %10.1f MB/s\n",
+            name, numLines, numBytes, secs,
+            (secs > 0) ? numBytes / secs / 1e6 : 0.0);
+
+    if (close(fd) == -1)
+        errExit("close");
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *methods = "rbl";
+    size_t bufSize = LR_DEFAULT_BUF;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:b:")) != -1) {
+        switch (opt) {
+        case 'm': methods = optarg;                                     break;
+        case 'b': bufSize = getLong(optarg, GN_GT_0, "buf-size");       break;
+        default:  usageErr("%s [-m methods] [-b buf-size] file\n", argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageErr("%s [-m methods] [-b buf-size] file\n", argv[0]);
+
+    for (char *m = methods; *m != '\0'; m++)
+        runMethod(argv[optind], *m, bufSize);
+
+    exit(EXIT_SUCCESS);
+}
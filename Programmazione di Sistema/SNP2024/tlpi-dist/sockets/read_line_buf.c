@@ -17,6 +17,7 @@
 */
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include "read_line_buf.h"
 
 void                    /* Initialize a ReadLineBuf structure */
@@ -50,8 +51,11 @@ readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n)
 
         if (rlbuf->next >= rlbuf->len) {
             rlbuf->len = read(rlbuf->fd, rlbuf->buf, RL_MAX_BUF);
-            if (rlbuf->len == -1)
+            if (rlbuf->len == -1) {
+                if (errno == EINTR)     /* Interrupted --> restart read() */
+                    continue;
                 return -1;
+            }
 
             if (rlbuf->len == 0)        /* End of file */
                 break;
@@ -59,13 +63,20 @@ readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n)
             rlbuf->next = 0;
         }
 
-        char c = rlbuf->buf[rlbuf->next];
-        rlbuf->next++;
+        /* Locate the next newline with memchr() (vectorized in glibc),
+           rather than examining one character at a time */
 
-        if (cnt < n)
-            buffer[cnt++] = c;
+        char *start = rlbuf->buf + rlbuf->next;
+        size_t avail = rlbuf->len - rlbuf->next;
+        char *nl = memchr(start, '\n', avail);
+        size_t chunk = (nl != NULL) ? (size_t) (nl - start) + 1 : avail;
 
-        if (c == '\n')
+        size_t ncopy = (chunk < n - cnt) ? chunk : n - cnt;
+        memcpy(buffer + cnt, start, ncopy);
+        cnt += ncopy;
+        rlbuf->next += chunk;
+
+        if (nl != NULL)
             break;
     }
 
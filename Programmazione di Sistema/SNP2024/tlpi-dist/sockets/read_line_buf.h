@@ -21,7 +21,8 @@
 #include <pthread.h>
 #include <errno.h>
 
-#define RL_MAX_BUF 10
+#define RL_MAX_BUF 65536       /* Large enough that each read() fetches
+                                   many lines */
 
 struct ReadLineBuf {
     int     fd;                 /* File descriptor from which to read */
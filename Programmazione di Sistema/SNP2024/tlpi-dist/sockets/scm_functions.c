@@ -20,7 +20,12 @@
    channel and the ancillary data, with some kind of protocol that
    determines how the "real" and ancillary data are used together.
 */
+#define _GNU_SOURCE             /* To get SCM_CREDENTIALS and 'struct ucred'
+                                   definitions from <sys/socket.h> */
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <stdint.h>
 #include <errno.h>
 #include "scm_functions.h"
 
@@ -147,3 +152,231 @@ recvfd(int sockfd)
     memcpy(&fd, CMSG_DATA(cmsgp), sizeof(int));
     return fd;
 }
+
+/* The functions below transfer arbitrarily large sets of file
+   descriptors. The set is split into messages of at most SCM_MAX_FD
+   descriptors. The real data of each message is a 'struct fdsHdr',
+   which lets the receiver check how many descriptors to expect. The
+   control buffer is allocated once, by scmBufInit(), and can then be
+   reused for any number of calls, so that no allocation is done per
+   message. */
+
+struct fdsHdr {
+    uint32_t total;             /* Number of FDs in the whole set */
+    uint32_t count;             /* Number of FDs in this message */
+};
+
+#define SCM_BUF_SIZE (CMSG_SPACE(SCM_MAX_FD * sizeof(int)) + \
+                      CMSG_SPACE(sizeof(struct ucred)))
+
+/* Allocate a control buffer large enough for the largest message
+   built by sendfds() or accepted by recvfds(). Returns 0 on success,
+   or -1 on error. */
+
+int
+scmBufInit(struct ScmBuf *sb)
+{
+    sb->control = malloc(SCM_BUF_SIZE);     /* Suitably aligned */
+    if (sb->control == NULL)
+        return -1;
+    sb->size = SCM_BUF_SIZE;
+    return 0;
+}
+
+void
+scmBufFree(struct ScmBuf *sb)
+{
+    free(sb->control);
+    sb->control = NULL;
+    sb->size = 0;
+}
+
+/* Send the 'nfds' file descriptors in 'fds' over the connected UNIX
+   domain socket 'sockfd', using as many messages as necessary. If
+   'creds' is not NULL, the credentials it points to are sent with each
+   message (the receiver must have set SO_PASSCRED). Returns 0 on
+   success, or -1 on error. */
+
+int
+sendfds(int sockfd, struct ScmBuf *sb, const int *fds, int nfds,
+        const struct ucred *creds)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct fdsHdr hdr;
+    struct cmsghdr *cmsgp;
+
+    if (nfds < 0 || sb->control == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    hdr.total = nfds;
+    int sent = 0;
+
+    do {                        /* Send at least one message, even if
+                                   'nfds' is 0, so the receiver returns */
+        hdr.count = (nfds - sent < SCM_MAX_FD) ? nfds - sent : SCM_MAX_FD;
+
+        msgh.msg_name = NULL;
+        msgh.msg_namelen = 0;
+        iov.iov_base = &hdr;
+        iov.iov_len = sizeof(hdr);
+        msgh.msg_iov = &iov;
+        msgh.msg_iovlen = 1;
+        msgh.msg_flags = 0;
+
+        /* Only as much of the buffer as is needed for this message is
+           described to sendmsg(); it must be zeroed so that
+           CMSG_NXTHDR() works correctly */
+
+        msgh.msg_control = sb->control;
+        msgh.msg_controllen = 0;
+        if (hdr.count > 0)
+            msgh.msg_controllen += CMSG_SPACE(hdr.count * sizeof(int));
+        if (creds != NULL)
+            msgh.msg_controllen += CMSG_SPACE(sizeof(struct ucred));
+        memset(sb->control, 0, msgh.msg_controllen);
+        if (msgh.msg_controllen == 0)
+            msgh.msg_control = NULL;
+
+        cmsgp = CMSG_FIRSTHDR(&msgh);
+        if (hdr.count > 0) {
+            cmsgp->cmsg_level = SOL_SOCKET;
+            cmsgp->cmsg_type = SCM_RIGHTS;
+            cmsgp->cmsg_len = CMSG_LEN(hdr.count * sizeof(int));
+            memcpy(CMSG_DATA(cmsgp), fds + sent, hdr.count * sizeof(int));
+            cmsgp = CMSG_NXTHDR(&msgh, cmsgp);
+        }
+        if (creds != NULL) {
+            cmsgp->cmsg_level = SOL_SOCKET;
+            cmsgp->cmsg_type = SCM_CREDENTIALS;
+            cmsgp->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+            memcpy(CMSG_DATA(cmsgp), creds, sizeof(struct ucred));
+        }
+
+        ssize_t ns;
+        do {
+            ns = sendmsg(sockfd, &msgh, 0);
+        } while (ns == -1 && errno == EINTR);
+        if (ns == -1)
+            return -1;
+        if (ns != sizeof(hdr)) {        /* Can't resend the descriptors */
+            errno = EPROTO;
+            return -1;
+        }
+
+        sent += hdr.count;
+    } while (sent < nfds);
+
+    return 0;
+}
+
+static void             /* Close 'cnt' descriptors in 'fds' */
+closeFds(const int *fds, int cnt)
+{
+    int savedErrno = errno;
+
+    for (int j = 0; j < cnt; j++)
+        close(fds[j]);
+    errno = savedErrno;
+}
+
+/* Receive a set of file descriptors sent by sendfds() on the connected
+   UNIX domain socket 'sockfd', placing them in 'fds'. If 'creds' is not
+   NULL, the credentials received with the first message are returned
+   there (this requires the SO_PASSCRED option on 'sockfd'; if none were
+   received, 'creds->pid' is set to 0). Returns the number of descriptors
+   received, or -1 on error. If the set is larger than 'maxfds', all of
+   the descriptors are closed and the call fails with EMSGSIZE. */
+
+int
+recvfds(int sockfd, struct ScmBuf *sb, int *fds, int maxfds,
+        struct ucred *creds)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct fdsHdr hdr;
+    struct cmsghdr *cmsgp;
+    int numKept, numSeen;       /* FDs placed in 'fds'; FDs received */
+    int64_t total;
+
+    if (maxfds < 0 || sb->control == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (creds != NULL)
+        creds->pid = 0;
+
+    numKept = numSeen = 0;
+    total = -1;                 /* Not known until first message */
+
+    do {
+        msgh.msg_name = NULL;
+        msgh.msg_namelen = 0;
+        iov.iov_base = &hdr;
+        iov.iov_len = sizeof(hdr);
+        msgh.msg_iov = &iov;
+        msgh.msg_iovlen = 1;
+        msgh.msg_control = sb->control;
+        msgh.msg_controllen = sb->size;
+
+        ssize_t nr;
+        do {
+            nr = recvmsg(sockfd, &msgh, 0);
+        } while (nr == -1 && errno == EINTR);
+        if (nr == -1)
+            goto fail;
+
+        /* Take ownership of any descriptors that arrived before checking
+           the message, so that none are leaked if it proves to be bad.
+           Descriptors beyond 'maxfds' are closed at once. */
+
+        uint32_t got = 0;
+        for (cmsgp = CMSG_FIRSTHDR(&msgh); cmsgp != NULL;
+                cmsgp = CMSG_NXTHDR(&msgh, cmsgp)) {
+            if (cmsgp->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmsgp->cmsg_type == SCM_RIGHTS) {
+                int cnt = (cmsgp->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (int j = 0; j < cnt; j++) {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cmsgp) + j * sizeof(int),
+                           sizeof(int));
+                    if (numKept < maxfds)
+                        fds[numKept++] = fd;
+                    else
+                        close(fd);
+                }
+                got += cnt;
+
+            } else if (cmsgp->cmsg_type == SCM_CREDENTIALS &&
+                    creds != NULL && creds->pid == 0) {
+                memcpy(creds, CMSG_DATA(cmsgp), sizeof(struct ucred));
+            }
+        }
+        numSeen += got;
+
+        if (nr != sizeof(hdr) || (msgh.msg_flags & MSG_CTRUNC) ||
+                got != hdr.count ||
+                (total != -1 && hdr.total != total)) {
+            errno = (nr == 0) ? ECONNRESET : EPROTO;
+            goto fail;
+        }
+        total = hdr.total;
+    } while (numSeen < total);
+
+    if (numSeen > maxfds) {
+        closeFds(fds, numKept);
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    return numKept;
+
+fail:
+    closeFds(fds, numKept);
+    return -1;
+}
@@ -24,4 +24,26 @@ int sendfd(int sockfd, int fd);
 
 int recvfd(int sockfd);
 
+/* The Linux kernel accepts at most this many file descriptors in a
+   single SCM_RIGHTS message; sendfds() splits larger sets */
+
+#define SCM_MAX_FD 253
+
+struct ucred;                   /* Defined in <sys/socket.h> if _GNU_SOURCE */
+
+struct ScmBuf {                 /* Control buffer reused across calls */
+    void   *control;
+    size_t  size;
+};
+
+int scmBufInit(struct ScmBuf *sb);
+
+void scmBufFree(struct ScmBuf *sb);
+
+int sendfds(int sockfd, struct ScmBuf *sb, const int *fds, int nfds,
+            const struct ucred *creds);
+
+int recvfds(int sockfd, struct ScmBuf *sb, int *fds, int maxfds,
+            struct ucred *creds);
+
 #endif
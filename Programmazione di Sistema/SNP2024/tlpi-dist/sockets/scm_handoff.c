@@ -0,0 +1,133 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* scm_handoff.c
+
+   Demonstrate (and time) the handoff of a large set of open sockets
+   from one process to another using sendfds() and recvfds() from
+   scm_functions.c, as a server might do when handing its client
+   connections to a new worker process during a graceful restart.
+
+   Usage: scm_handoff [num-fds]     (default: 10000)
+
+   The parent creates 'num-fds' sockets and sends them, with its
+   credentials, to a child over a UNIX domain socket pair. The child
+   checks the sender's credentials and the number of descriptors
+   received, and then acknowledges. The parent reports the elapsed time.
+
+   The soft RLIMIT_NOFILE limit is raised to the hard limit; 'num-fds'
+   must fit within that limit.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "scm_functions.h"
+#include "tlpi_hdr.h"
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageErr("%s [num-fds]\n", argv[0]);
+
+    int numFds = (argc > 1) ? getInt(argv[1], GN_GT_0, "num-fds") : 10000;
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("setrlimit");
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        errExit("socketpair");
+
+    /* The receiver must enable SO_PASSCRED before the messages are sent */
+
+    int optval = 1;
+    if (setsockopt(sv[1], SOL_SOCKET, SO_PASSCRED, &optval,
+                sizeof(optval)) == -1)
+        errExit("setsockopt");
+
+    int *fds = calloc(numFds, sizeof(int));
+    if (fds == NULL)
+        errExit("calloc");
+
+    struct ScmBuf sb;
+    if (scmBufInit(&sb) == -1)
+        errExit("scmBufInit");
+
+    pid_t parentPid = getpid();
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:                     /* Child: the "new worker" */
+        close(sv[0]);
+
+        struct ucred creds;
+        int n = recvfds(sv[1], &sb, fds, numFds, &creds);
+        if (n == -1)
+            errExit("recvfds");
+        if (creds.pid != parentPid)
+            fatal("Unexpected sender PID %ld", (long) creds.pid);
+
+        printf("Child received %d descriptors from PID %ld (UID %ld)\n",
+                n, (long) creds.pid, (long) creds.uid);
+
+        if (write(sv[1], "x", 1) != 1)          /* Acknowledge */
+            errExit("write");
+        exit(EXIT_SUCCESS);
+
+    default:                    /* Parent: the "old server" */
+        close(sv[1]);
+
+        for (int j = 0; j < numFds; j++) {
+            fds[j] = socket(AF_INET, SOCK_STREAM, 0);
+            if (fds[j] == -1)
+                errExit("socket (fd %d)", j);
+        }
+
+        struct ucred myCreds;
+        myCreds.pid = getpid();
+        myCreds.uid = getuid();
+        myCreds.gid = getgid();
+
+        struct timespec start, end;
+        if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+            errExit("clock_gettime");
+
+        if (sendfds(sv[0], &sb, fds, numFds, &myCreds) == -1)
+            errExit("sendfds");
+
+        char ch;
+        if (read(sv[0], &ch, 1) != 1)
+            fatal("Child did not acknowledge");
+
+        if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+            errExit("clock_gettime");
+
+        printf("Handed off %d descriptors in %d messages: %.3f ms\n",
+                numFds, (numFds + SCM_MAX_FD - 1) / SCM_MAX_FD,
+                (end.tv_sec - start.tv_sec) * 1e3 +
+                (end.tv_nsec - start.tv_nsec) / 1e6);
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+        exit(EXIT_SUCCESS);
+    }
+}
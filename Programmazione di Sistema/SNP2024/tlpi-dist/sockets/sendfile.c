@@ -13,59 +13,16 @@
 /* sendfile.c
 
    Implement sendfile() in terms of read(), write(), and lseek().
+   The loop itself is in sendfile_rw.c.
 */
-#include "tlpi_hdr.h"
-#define BUF_SIZE 8192
+#include <sys/sendfile.h>        /* Our definition must match this */
+#include "sendfile_rw.h"
+
+/* The work is done by sendfileRW(), which xfer.c also uses as its fallback
+   when no better kernel primitive applies. */
 
 ssize_t
 sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
 {
-    off_t orig;
-
-    if (offset != NULL) {
-
-        /* Save current file offset and set offset to value in '*offset' */
-
-        orig = lseek(in_fd, 0, SEEK_CUR);
-        if (orig == -1)
-            return -1;
-        if (lseek(in_fd, *offset, SEEK_SET) == -1)
-            return -1;
-    }
-
-    size_t totSent = 0;
-
-    while (count > 0) {
-        size_t toRead = min(BUF_SIZE, count);
-
-        char buf[BUF_SIZE];
-        ssize_t numRead = read(in_fd, buf, toRead);
-        if (numRead == -1)
-            return -1;
-        if (numRead == 0)
-            break;                      /* EOF */
-
-        ssize_t numSent = write(out_fd, buf, numRead);
-        if (numSent == -1)
-            return -1;
-        if (numSent == 0)               /* Should never happen */
-            fatal("sendfile: write() transferred 0 bytes");
-
-        count -= numSent;
-        totSent += numSent;
-    }
-
-    if (offset != NULL) {
-
-        /* Return updated file offset in '*offset', and reset the file offset
-           to the value it had when we were called. */
-
-        *offset = lseek(in_fd, 0, SEEK_CUR);
-        if (*offset == -1)
-            return -1;
-        if (lseek(in_fd, orig, SEEK_SET) == -1)
-            return -1;
-    }
-
-    return totSent;
+    return sendfileRW(out_fd, in_fd, offset, count);
 }
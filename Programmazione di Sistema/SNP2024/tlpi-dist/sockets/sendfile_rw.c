@@ -0,0 +1,109 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* sendfile_rw.c
+
+   The read()/write()/lseek() loop from sendfile.c, under a name that does
+   not clash with the C library's sendfile(), so that it can serve as the
+   portable fallback in xfer.c while the real sendfile() is also used.
+
+   Unlike the original loop, a partial write() is retried until the whole
+   buffer has been sent. If write() fails part way through a transfer, the
+   input file offset is stepped back over the bytes that were read but not
+   sent, and the number of bytes sent so far is returned (as sendfile()
+   does); -1 is returned only if nothing was transferred.
+*/
+#include "sendfile_rw.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 8192
+
+ssize_t
+sendfileRW(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    off_t orig = 0;
+
+    if (offset != NULL) {
+
+        /* Save current file offset and set offset to value in '*offset' */
+
+        orig = lseek(in_fd, 0, SEEK_CUR);
+        if (orig == -1)
+            return -1;
+        if (lseek(in_fd, *offset, SEEK_SET) == -1)
+            return -1;
+    }
+
+    size_t totSent = 0;
+    int savedErrno = 0;
+
+    while (count > 0) {
+        size_t toRead = min(BUF_SIZE, count);
+
+        char buf[BUF_SIZE];
+        ssize_t numRead = read(in_fd, buf, toRead);
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            savedErrno = errno;
+            break;
+        }
+        if (numRead == 0)
+            break;                      /* EOF */
+
+        ssize_t numSent = 0;
+        while (numSent < numRead) {
+            ssize_t n = write(out_fd, buf + numSent, numRead - numSent);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (n == 0) {               /* No progress: don't spin */
+                errno = EIO;
+                break;
+            }
+            numSent += n;
+        }
+
+        count -= numSent;
+        totSent += numSent;
+
+        if (numSent < numRead) {        /* write() failed */
+            savedErrno = errno;
+
+            /* Unread the unsent bytes (fails harmlessly on a pipe or
+               socket, where they are lost, as with any failed copy) */
+
+            lseek(in_fd, numSent - numRead, SEEK_CUR);
+            break;
+        }
+    }
+
+    if (offset != NULL) {
+
+        /* Return updated file offset in '*offset', and reset the file offset
+           to the value it had when we were called. */
+
+        *offset = lseek(in_fd, 0, SEEK_CUR);
+        if (*offset == -1)
+            return -1;
+        if (lseek(in_fd, orig, SEEK_SET) == -1)
+            return -1;
+    }
+
+    if (totSent == 0 && savedErrno != 0) {
+        errno = savedErrno;
+        return -1;
+    }
+    return totSent;
+}
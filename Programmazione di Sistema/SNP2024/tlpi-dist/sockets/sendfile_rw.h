@@ -0,0 +1,24 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* sendfile_rw.h
+
+   Header file for sendfile_rw.c.
+*/
+#ifndef SENDFILE_RW_H
+#define SENDFILE_RW_H
+
+#include <sys/types.h>
+
+ssize_t sendfileRW(int out_fd, int in_fd, off_t *offset, size_t count);
+
+#endif
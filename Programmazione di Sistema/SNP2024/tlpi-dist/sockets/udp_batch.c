@@ -0,0 +1,432 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* udp_batch.c
+
+   Batched datagram I/O, for UDP servers that must handle hundreds of
+   thousands of datagrams per second. A server such as id_echo_sv.c makes
+   two system calls (recvfrom() and sendto()) per datagram; here:
+
+   * A batch (struct ubBatch) holds a preallocated array of mmsghdr
+     structures, each with its own buffer, address, and control message
+     space, so that ubRecv() can receive many datagrams with a single
+     recvmmsg() call, and ubSend() can send many with a single sendmmsg()
+     call. A datagram received into a batch can be sent back (e.g.,
+     echoed, or modified in place) without copying it.
+
+   * If UDP_GRO is enabled on a socket (ubEnableGro()), the kernel may
+     coalesce a run of datagrams of the same size from the same sender
+     into one buffer; ubRecv() records the segment size from the UDP_GRO
+     control message. Conversely, if a datagram to be sent has a nonzero
+     segment size, ubSend() attaches a UDP_SEGMENT control message, so
+     that the kernel splits the buffer into datagrams of that size (GSO).
+     So a coalesced buffer can be echoed as a single unit.
+
+   * ubEngineStart() creates 'numThreads' threads, each with its own
+     socket bound to the same port with SO_REUSEPORT, so that the kernel
+     spreads incoming datagrams (by a hash of the sender's address) across
+     the threads, without any sharing between them. Each thread receives
+     a batch, calls the handler, which leaves in the batch whatever is to
+     be sent in reply, and sends it.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE             /* For recvmmsg() and sendmmsg() */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "inet_sockets.h"
+#include "udp_batch.h"
+#include "tlpi_hdr.h"
+
+#define UB_CTRL_LEN     CMSG_SPACE(sizeof(int))
+
+/* Create a batch of 'capacity' buffers of 'bufSize' bytes each */
+
+struct ubBatch *
+ubBatchCreate(int capacity, size_t bufSize)
+{
+    struct ubBatch *b;
+
+    if (capacity <= 0 || bufSize == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    b = calloc(1, sizeof(*b));
+    if (b == NULL)
+        return NULL;
+    b->capacity = capacity;
+    b->bufSize = bufSize;
+    b->lens = calloc(capacity, sizeof(size_t));
+    b->segSizes = calloc(capacity, sizeof(int));
+    b->msgs = calloc(capacity, sizeof(struct mmsghdr));
+    b->iovs = calloc(capacity, sizeof(struct iovec));
+    b->addrs = calloc(capacity, sizeof(struct sockaddr_storage));
+    b->bufs = malloc(capacity * bufSize);
+    b->ctrl = calloc(capacity, UB_CTRL_LEN);
+    if (b->lens == NULL || b->segSizes == NULL || b->msgs == NULL ||
+            b->iovs == NULL || b->addrs == NULL || b->bufs == NULL ||
+            b->ctrl == NULL) {
+        ubBatchFree(b);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (int j = 0; j < capacity; j++) {
+        b->iovs[j].iov_base = b->bufs + j * bufSize;
+        b->msgs[j].msg_hdr.msg_iov = &b->iovs[j];
+        b->msgs[j].msg_hdr.msg_iovlen = 1;
+        b->msgs[j].msg_hdr.msg_name = &b->addrs[j];
+    }
+    return b;
+}
+
+void
+ubBatchFree(struct ubBatch *b)
+{
+    if (b == NULL)
+        return;
+    free(b->lens);
+    free(b->segSizes);
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->bufs);
+    free(b->ctrl);
+    free(b);
+}
+
+/* Return the address of the buffer of datagram 'j' */
+
+char *
+ubData(struct ubBatch *b, int j)
+{
+    return b->bufs + j * b->bufSize;
+}
+
+/* Return the number of datagrams in buffer 'j' (more than 1 if it was
+   coalesced by GRO, or is to be segmented by GSO) */
+
+int
+ubNumSegments(const struct ubBatch *b, int j)
+{
+    if (b->segSizes[j] <= 0 || b->lens[j] == 0)
+        return 1;
+    return (b->lens[j] + b->segSizes[j] - 1) / b->segSizes[j];
+}
+
+/* Receive as many datagrams as are available (up to the batch capacity)
+   with one recvmmsg() call, waiting (unless 'flags' includes
+   MSG_DONTWAIT) for at least one. Returns the number received (also
+   recorded in 'b->count'), or -1 on error. */
+
+int
+ubRecv(int sfd, struct ubBatch *b, int flags)
+{
+    int n;
+
+    for (int j = 0; j < b->capacity; j++) {
+        struct msghdr *mh = &b->msgs[j].msg_hdr;
+
+        b->iovs[j].iov_len = b->bufSize;
+        mh->msg_namelen = sizeof(struct sockaddr_storage);
+        mh->msg_control = b->ctrl + j * UB_CTRL_LEN;
+        mh->msg_controllen = UB_CTRL_LEN;
+        mh->msg_flags = 0;
+    }
+
+    b->count = 0;
+    n = recvmmsg(sfd, b->msgs, b->capacity, flags | MSG_WAITFORONE, NULL);
+    if (n == -1)
+        return -1;
+
+    for (int j = 0; j < n; j++) {
+        struct msghdr *mh = &b->msgs[j].msg_hdr;
+        struct cmsghdr *cmsg;
+
+        b->lens[j] = b->msgs[j].msg_len;
+        b->segSizes[j] = 0;
+        for (cmsg = CMSG_FIRSTHDR(mh); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(mh, cmsg))
+            if (cmsg->cmsg_level == IPPROTO_UDP &&
+                    cmsg->cmsg_type == UDP_GRO)
+                memcpy(&b->segSizes[j], CMSG_DATA(cmsg), sizeof(int));
+    }
+    b->count = n;
+    return n;
+}
+
+/* Append a datagram to the batch, to be sent to 'addr' (NULL for a
+   connected socket). If 'data' is NULL, the caller has already placed
+   the datagram in ubData(b, b->count). If 'segSize' is nonzero, the
+   kernel will send the data as datagrams of that size (GSO). Returns
+   the datagram's index, or -1 if the batch is full. */
+
+int
+ubAdd(struct ubBatch *b, const void *data, size_t len,
+      const struct sockaddr *addr, socklen_t addrlen, int segSize)
+{
+    int j = b->count;
+
+    if (j == b->capacity || len > b->bufSize ||
+            addrlen > sizeof(struct sockaddr_storage)) {
+        errno = (j == b->capacity) ? ENOBUFS : EINVAL;
+        return -1;
+    }
+
+    if (data != NULL)
+        memcpy(ubData(b, j), data, len);
+    b->lens[j] = len;
+    b->segSizes[j] = segSize;
+    if (addr != NULL)
+        memcpy(&b->addrs[j], addr, addrlen);
+    b->msgs[j].msg_hdr.msg_namelen = (addr != NULL) ? addrlen : 0;
+    b->count++;
+    return j;
+}
+
+/* Send the 'b->count' datagrams in the batch, to the addresses they were
+   received from (or that were given to ubAdd()), with as few sendmmsg()
+   calls as possible. Datagrams that can't be sent (e.g., because of an
+   ICMP error reported for an earlier datagram) are skipped. Returns the
+   number of buffers sent, or -1 if 'flags' included MSG_DONTWAIT and
+   none could be sent; 'b->sentSegs' is set to the number of (GSO)
+   segments in the buffers that were sent. The batch is left empty. */
+
+int
+ubSend(int sfd, struct ubBatch *b, int flags)
+{
+    int sent = 0, j = 0;
+
+    b->sentSegs = 0;
+    for (int k = 0; k < b->count; k++) {
+        struct msghdr *mh = &b->msgs[k].msg_hdr;
+
+        b->iovs[k].iov_len = b->lens[k];
+        mh->msg_flags = 0;
+        if (b->segSizes[k] > 0 && b->lens[k] > (size_t) b->segSizes[k]) {
+            struct cmsghdr *cmsg;
+            uint16_t gso = b->segSizes[k];
+
+            mh->msg_control = b->ctrl + k * UB_CTRL_LEN;
+            mh->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            cmsg = CMSG_FIRSTHDR(mh);
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cmsg), &gso, sizeof(gso));
+        } else {
+            mh->msg_control = NULL;
+            mh->msg_controllen = 0;
+        }
+    }
+
+    while (j < b->count) {
+        int n = sendmmsg(sfd, &b->msgs[j], b->count - j, flags);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (sent == 0) {
+                    b->count = 0;
+                    return -1;
+                }
+                break;
+            }
+            j++;                /* Error on first datagram: skip it */
+            continue;
+        }
+        for (int k = j; k < j + n; k++)
+            b->sentSegs += ubNumSegments(b, k);
+        sent += n;
+        j += n;
+    }
+    b->count = 0;
+    return sent;
+}
+
+int
+ubEnableGro(int sfd)
+{
+    int optval = 1;
+
+    return setsockopt(sfd, IPPROTO_UDP, UDP_GRO, &optval, sizeof(optval));
+}
+
+struct engineThread {
+    struct UdpEngine *e;
+    int index;
+    int sfd;
+    pthread_t thread;
+    struct ubStats stats;
+    char pad[64];               /* Keep threads' counters apart */
+};
+
+struct UdpEngine {
+    struct ubEngineOptions opts;
+    ubHandler handler;
+    void *arg;
+    struct engineThread *threads;
+};
+
+void
+ubDefaultEngineOptions(struct ubEngineOptions *opts)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(opts, 0, sizeof(*opts));
+    opts->numThreads = (n > 0) ? n : 1;
+    opts->batchSize = 64;
+    opts->bufSize = 2048;
+    opts->gro = false;
+    opts->rcvBuf = 0;
+}
+
+static void
+addStat(unsigned long *cnt, unsigned long n)
+{
+    __atomic_store_n(cnt, __atomic_load_n(cnt, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);     /* Only this thread updates */
+}
+
+static void *
+engineFunc(void *arg)
+{
+    struct engineThread *t = arg;
+    struct UdpEngine *e = t->e;
+    struct ubBatch *b;
+
+    b = ubBatchCreate(e->opts.batchSize, e->opts.bufSize);
+    if (b == NULL)
+        errExit("ubBatchCreate");
+
+    for (;;) {
+        int n = ubRecv(t->sfd, b, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("recvmmsg");
+        }
+
+        unsigned long segs = 0;
+        for (int j = 0; j < n; j++)
+            segs += ubNumSegments(b, j);
+        addStat(&t->stats.rxDgrams, segs);
+        addStat(&t->stats.rxCalls, 1);
+
+        e->handler(b, t->index, e->arg);
+
+        if (b->count > 0) {
+            segs = 0;
+            for (int j = 0; j < b->count; j++)
+                segs += ubNumSegments(b, j);
+            ubSend(t->sfd, b, 0);
+            addStat(&t->stats.txCalls, 1);
+            addStat(&t->stats.txDgrams, b->sentSegs);
+            if (b->sentSegs != segs)
+                addStat(&t->stats.txErrors, segs - b->sentSegs);
+        }
+    }
+    return NULL;
+}
+
+/* Create the engine's sockets and start its threads, which run until
+   the process terminates. 'handler' is called by each thread, with the
+   thread's number, for each batch of datagrams received; it should
+   leave in the batch the datagrams to be sent in reply (for example, by
+   leaving the batch unchanged, to echo all of them, or by setting
+   'b->count' to 0, to send none). */
+
+/* Close the sockets opened so far by ubEngineStart(), and free the
+   engine, preserving 'errno' for the caller */
+
+static void
+engineFree(struct UdpEngine *e, int numOpened)
+{
+    int savedErrno = errno;
+
+    for (int j = 0; j < numOpened; j++)
+        close(e->threads[j].sfd);
+    free(e->threads);
+    free(e);
+    errno = savedErrno;
+}
+
+struct UdpEngine *
+ubEngineStart(const struct ubEngineOptions *opts, ubHandler handler,
+              void *arg)
+{
+    struct UdpEngine *e;
+    int s;
+
+    e = calloc(1, sizeof(*e));
+    if (e == NULL)
+        return NULL;
+    e->opts = *opts;
+    e->handler = handler;
+    e->arg = arg;
+    e->threads = calloc(opts->numThreads, sizeof(struct engineThread));
+    if (e->threads == NULL) {
+        engineFree(e, 0);
+        return NULL;
+    }
+
+    /* Create all of the sockets before starting any thread, so that an
+       error leaves nothing running */
+
+    for (int j = 0; j < opts->numThreads; j++) {
+        struct engineThread *t = &e->threads[j];
+
+        t->e = e;
+        t->index = j;
+        t->sfd = inetBindReusePort(opts->service, SOCK_DGRAM, NULL);
+        if (t->sfd == -1) {
+            engineFree(e, j);
+            return NULL;
+        }
+        if ((opts->gro && ubEnableGro(t->sfd) == -1) ||
+                (opts->rcvBuf > 0 && setsockopt(t->sfd, SOL_SOCKET,
+                    SO_RCVBUF, &opts->rcvBuf, sizeof(opts->rcvBuf)) == -1)) {
+            engineFree(e, j + 1);
+            return NULL;
+        }
+    }
+
+    for (int j = 0; j < opts->numThreads; j++) {
+        s = pthread_create(&e->threads[j].thread, NULL, engineFunc,
+                           &e->threads[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    return e;
+}
+
+/* Sum the statistics of all threads (the engine continues to run, so
+   the result is only a snapshot) */
+
+void
+ubEngineGetStats(struct UdpEngine *e, struct ubStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int j = 0; j < e->opts.numThreads; j++) {
+        struct ubStats *ts = &e->threads[j].stats;
+
+        stats->rxDgrams += __atomic_load_n(&ts->rxDgrams, __ATOMIC_RELAXED);
+        stats->rxCalls += __atomic_load_n(&ts->rxCalls, __ATOMIC_RELAXED);
+        stats->txDgrams += __atomic_load_n(&ts->txDgrams, __ATOMIC_RELAXED);
+        stats->txCalls += __atomic_load_n(&ts->txCalls, __ATOMIC_RELAXED);
+        stats->txErrors += __atomic_load_n(&ts->txErrors, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,88 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* udp_batch.h
+
+   Header file for udp_batch.c.
+*/
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdbool.h>
+
+#define UB_MAX_DGRAM    65507   /* Largest UDP payload (IPv4) */
+
+struct ubBatch {                /* A preallocated set of datagram buffers */
+    int capacity;               /* Number of buffers */
+    size_t bufSize;             /* Size of each buffer */
+    int count;                  /* Datagrams received, or queued to send */
+    unsigned long sentSegs;     /* Segments sent by the last ubSend() */
+    size_t *lens;               /* Length of each datagram */
+    int *segSizes;              /* GRO/GSO segment size (0: none) */
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    char *bufs;                 /* 'capacity' buffers of 'bufSize' bytes */
+    char *ctrl;                 /* Control message space for each buffer */
+};
+
+struct ubBatch *ubBatchCreate(int capacity, size_t bufSize);
+
+void ubBatchFree(struct ubBatch *b);
+
+char *ubData(struct ubBatch *b, int j);
+
+int ubNumSegments(const struct ubBatch *b, int j);
+
+int ubRecv(int sfd, struct ubBatch *b, int flags);
+
+int ubAdd(struct ubBatch *b, const void *data, size_t len,
+          const struct sockaddr *addr, socklen_t addrlen, int segSize);
+
+int ubSend(int sfd, struct ubBatch *b, int flags);
+
+int ubEnableGro(int sfd);
+
+/* The engine: threads, each with its own SO_REUSEPORT socket, that
+   receive batches of datagrams and pass them to a handler */
+
+typedef void (*ubHandler)(struct ubBatch *b, int thread, void *arg);
+
+struct ubEngineOptions {
+    const char *service;        /* Port to bind */
+    int numThreads;
+    int batchSize;              /* Datagrams per recvmmsg() */
+    size_t bufSize;             /* Bytes per datagram buffer */
+    bool gro;                   /* Enable UDP_GRO (use a large 'bufSize') */
+    int rcvBuf;                 /* SO_RCVBUF (0: system default) */
+};
+
+struct ubStats {
+    unsigned long rxDgrams;     /* Datagrams (GRO segments) received */
+    unsigned long rxCalls;      /* recvmmsg() calls */
+    unsigned long txDgrams;     /* Datagrams (GSO segments) sent */
+    unsigned long txCalls;      /* sendmmsg() calls */
+    unsigned long txErrors;     /* Datagrams that could not be sent */
+};
+
+struct UdpEngine;               /* Opaque; see udp_batch.c */
+
+void ubDefaultEngineOptions(struct ubEngineOptions *opts);
+
+struct UdpEngine *ubEngineStart(const struct ubEngineOptions *opts,
+                                ubHandler handler, void *arg);
+
+void ubEngineGetStats(struct UdpEngine *e, struct ubStats *stats);
+
+#endif
@@ -0,0 +1,291 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* udp_pktgen.c
+
+   A UDP packet generator, for measuring the throughput of a UDP echo
+   server such as id_echo_sv.c or id_echo_mmsg_sv.c.
+
+   Usage: udp_pktgen [-t threads] [-s size] [-b batch] [-g segs]
+                [-r pps] [-d secs] host service
+
+   Each of 'threads' (default 1) threads uses its own connected socket
+   (and so its own source port, which lets a server using SO_REUSEPORT
+   spread the load over its threads). For 'secs' (default 5) seconds,
+   each thread sends datagrams of 'size' (default 64) bytes, 'batch'
+   (default 32) per sendmmsg() call, and reads the echoes with
+   nonblocking recvmmsg() calls. With -g, each buffer holds 'segs'
+   datagrams that the kernel splits with UDP_SEGMENT (GSO). With -r, the
+   total send rate is limited to about 'pps' datagrams per second;
+   otherwise, the threads send as fast as they can.
+
+   Each datagram carries a sequence number. After sending, the threads
+   wait briefly for the last echoes, and then the program displays the
+   datagrams sent and echoed per second, the number of datagrams lost
+   (sent but not echoed), and the increase in the host's UDP receive
+   errors (RcvbufErrors, from /proc/net/snmp) during the run, which
+   counts datagrams dropped because a socket receive buffer was full.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "udp_batch.h"
+#include "tlpi_hdr.h"
+
+#define GRACE_SECS 1            /* Time to wait for the last echoes */
+
+static int numThreads = 1;
+static size_t dgramSize = 64;
+static int batchSize = 32;
+static int gsoSegs = 1;
+static long ratePps = 0;
+static int durationSecs = 5;
+static const char *host, *service;
+
+struct threadInfo {
+    pthread_t thread;
+    unsigned long nextSeq;      /* Datagrams attempted (next seq. number) */
+    unsigned long sent;         /* Datagrams sent */
+    unsigned long echoed;       /* Datagrams echoed */
+    unsigned long badSeq;       /* Echoes with unexpected contents */
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Return the RcvbufErrors count from the "Udp:" lines of /proc/net/snmp,
+   or -1 if it can't be found */
+
+static long
+rcvbufErrors(void)
+{
+    char names[1024], values[1024];
+    char *n, *v, *sn, *sv;
+    long result = -1;
+    FILE *fp;
+
+    fp = fopen("/proc/net/snmp", "r");
+    if (fp == NULL)
+        return -1;
+
+    while (fgets(names, sizeof(names), fp) != NULL) {
+        if (strncmp(names, "Udp:", 4) != 0)
+            continue;
+        if (fgets(values, sizeof(values), fp) == NULL)
+            break;
+        for (n = strtok_r(names, " \n", &sn), v = strtok_r(values, " \n", &sv);
+                n != NULL && v != NULL;
+                n = strtok_r(NULL, " \n", &sn), v = strtok_r(NULL, " \n", &sv))
+            if (strcmp(n, "RcvbufErrors") == 0)
+                result = atol(v);
+        break;
+    }
+    fclose(fp);
+    return result;
+}
+
+/* Read all echoes that are already waiting, checking their sequence
+   numbers */
+
+static void
+drainEchoes(int sfd, struct ubBatch *rb, struct threadInfo *ti)
+{
+    for (;;) {
+        int n = ubRecv(sfd, rb, MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            if (errno == ECONNREFUSED)      /* No server (yet) */
+                continue;
+            errExit("recvmmsg");
+        }
+
+        for (int j = 0; j < n; j++) {
+            uint64_t seq;
+
+            if (rb->lens[j] < sizeof(seq)) {
+                ti->badSeq++;
+                continue;
+            }
+            memcpy(&seq, ubData(rb, j), sizeof(seq));
+            if (seq >= ti->nextSeq)
+                ti->badSeq++;
+            else
+                ti->echoed++;
+        }
+    }
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct threadInfo *ti = arg;
+    struct ubBatch *sb, *rb;
+    double start, end, perDgram;
+    int sfd;
+
+    sfd = inetConnect(host, service, SOCK_DGRAM);
+    if (sfd == -1)
+        errExit("inetConnect");
+
+    sb = ubBatchCreate(batchSize, dgramSize * gsoSegs);
+    rb = ubBatchCreate(256, dgramSize);
+    if (sb == NULL || rb == NULL)
+        errExit("ubBatchCreate");
+
+    /* Rate per thread, as seconds per datagram */
+
+    perDgram = (ratePps > 0) ? (double) numThreads / ratePps : 0;
+
+    start = now();
+    end = start + durationSecs;
+
+    for (double t = start; t < end; t = now()) {
+        int numBufs = batchSize;
+
+        /* When rate-limited, send only the datagrams that are now due,
+           or if none is, wait until the next one is (or the run ends) */
+
+        if (perDgram > 0) {
+            unsigned long numDue = (unsigned long) ((t - start) / perDgram)
+                                   + 1;
+            if (numDue <= ti->nextSeq) {
+                drainEchoes(sfd, rb, ti);
+                double wait = min(start + ti->nextSeq * perDgram, end) - t;
+                if (wait > 0.0001) {
+                    struct timespec ts;
+                    ts.tv_sec = (time_t) wait;
+                    ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+                    nanosleep(&ts, NULL);
+                }
+                continue;
+            }
+            numDue -= ti->nextSeq;
+            numBufs = min((unsigned long) batchSize,
+                          (numDue + gsoSegs - 1) / gsoSegs);
+        }
+
+        /* Build a batch; each datagram begins with its sequence number.
+           Sequence numbers advance by the datagrams attempted, so that
+           one that ubSend() had to skip is never reused. */
+
+        unsigned long seq = ti->nextSeq;
+        for (int j = 0; j < numBufs; j++) {
+            char *p = ubData(sb, j);
+            for (int k = 0; k < gsoSegs; k++) {
+                memset(p + k * dgramSize, 'x', dgramSize);
+                memcpy(p + k * dgramSize, &seq, sizeof(uint64_t));
+                seq++;
+            }
+            ubAdd(sb, NULL, dgramSize * gsoSegs, NULL, 0,
+                  (gsoSegs > 1) ? dgramSize : 0);
+        }
+
+        ti->nextSeq = seq;
+        ubSend(sfd, sb, 0);
+        ti->sent += sb->sentSegs;
+
+        drainEchoes(sfd, rb, ti);
+    }
+
+    /* Collect the echoes that are still in flight */
+
+    for (end = now() + GRACE_SECS; now() < end; ) {
+        struct timespec ts = { 0, 1000000 };
+        drainEchoes(sfd, rb, ti);
+        nanosleep(&ts, NULL);
+    }
+
+    ubBatchFree(sb);
+    ubBatchFree(rb);
+    close(sfd);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct threadInfo *ti;
+    unsigned long sent = 0, echoed = 0, badSeq = 0;
+    long errsBefore, errsAfter;
+    int opt, s;
+
+    while ((opt = getopt(argc, argv, "t:s:b:g:r:d:")) != -1) {
+        switch (opt) {
+        case 't': numThreads = getInt(optarg, GN_GT_0, "threads");      break;
+        case 's': dgramSize = getInt(optarg, GN_GT_0, "size");          break;
+        case 'b': batchSize = getInt(optarg, GN_GT_0, "batch");         break;
+        case 'g': gsoSegs = getInt(optarg, GN_GT_0, "segs");            break;
+        case 'r': ratePps = getLong(optarg, GN_GT_0, "pps");            break;
+        case 'd': durationSecs = getInt(optarg, GN_GT_0, "secs");       break;
+        default:
+            usageErr("%s [-t threads] [-s size] [-b batch] [-g segs] "
+                     "[-r pps] [-d secs] host service\n", argv[0]);
+        }
+    }
+    if (optind + 2 != argc)
+        usageErr("%s [options] host service\n", argv[0]);
+    host = argv[optind];
+    service = argv[optind + 1];
+
+    if (dgramSize < sizeof(uint64_t))
+        cmdLineErr("size must be at least %zu\n", sizeof(uint64_t));
+    if (dgramSize * gsoSegs > UB_MAX_DGRAM || gsoSegs > 64)
+        cmdLineErr("size * segs must be at most %d, and segs at most 64\n",
+                   UB_MAX_DGRAM);
+
+    ti = calloc(numThreads, sizeof(struct threadInfo));
+    if (ti == NULL)
+        errExit("calloc");
+
+    errsBefore = rcvbufErrors();
+    double start = now();
+
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_create(&ti[j].thread, NULL, threadFunc, &ti[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_join(ti[j].thread, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        sent += ti[j].sent;
+        echoed += ti[j].echoed;
+        badSeq += ti[j].badSeq;
+    }
+
+    double secs = now() - start - GRACE_SECS;
+    errsAfter = rcvbufErrors();
+
+    printf("Sent:    %10lu datagrams (%.0f/s)\n", sent, sent / secs);
+    printf("Echoed:  %10lu datagrams (%.0f/s)\n", echoed, echoed / secs);
+    unsigned long lost = (sent > echoed) ? sent - echoed : 0;
+    printf("Lost:    %10lu datagrams (%.2f%%)\n", lost,
+           sent ? 100.0 * lost / sent : 0.0);
+    if (badSeq > 0)
+        printf("Invalid: %10lu echoes\n", badSeq);
+    if (errsBefore >= 0 && errsAfter >= 0)
+        printf("RcvbufErrors increase: %ld\n", errsAfter - errsBefore);
+
+    free(ti);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,33 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_xfr_v3.h
+
+   Header file for us_xfr_v3_sv.c and us_xfr_v3_cl.c.
+
+   Each connection begins with an 'int' header. If a file descriptor
+   accompanies the header (as SCM_RIGHTS ancillary data), the client is
+   handing over a file (or memfd) whose contents the server should copy
+   to its output; otherwise, the data follows the header on the socket.
+*/
+#define _GNU_SOURCE             /* For splice(), memfd_create(), and
+                                   F_SETPIPE_SZ */
+#include <sys/socket.h>
+#include <fcntl.h>
+#include "unix_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define SV_SOCK_PATH "us_xfr_v3"
+
+#define DEF_BUF_SIZE (1024 * 1024)  /* Default socket/pipe buffer size */
+
+#define XFR_STREAM 0            /* Header value when data follows inline */
@@ -0,0 +1,160 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_xfr_v3_cl.c
+
+   Client for us_xfr_v3_sv.c: transmit the contents of stdin to the
+   server, avoiding copies through a user-space buffer where possible.
+
+   Usage: us_xfr_v3_cl [-b buf-size] [-m]
+
+   By default, the data is sent on the socket after an XFR_STREAM header:
+   with sendfile() if stdin is a regular file, with splice() if stdin is
+   a pipe, and otherwise with read() and write().
+
+   With -m, the data is not sent on the socket at all. Instead, a file
+   descriptor is passed to the server (with sendfd() from scm_functions.c),
+   which maps the file and copies it to its output. If stdin is a regular
+   file, stdin itself is passed; otherwise stdin is first copied into a
+   memfd (memfd_create()), which is then passed.
+
+   'buf-size' (default 1 MiB) sets the socket's SO_SNDBUF, which, for
+   UNIX domain stream sockets, limits the data in flight to the server.
+
+   This program is Linux-specific. See also us_xfr_v3_sv.c.
+*/
+#include "us_xfr_v3.h"         /* Defines _GNU_SOURCE, so comes first */
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "scm_functions.h"
+
+static size_t bufSize = DEF_BUF_SIZE;
+
+/* Copy from 'inFd' to 'outFd' with read() and write() */
+
+static void
+copyFd(int inFd, int outFd)
+{
+    char *buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+
+    ssize_t numRead;
+    while ((numRead = read(inFd, buf, bufSize)) != 0) {
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("read");
+        }
+        for (ssize_t off = 0; off < numRead; ) {
+            ssize_t numWritten = write(outFd, buf + off, numRead - off);
+            if (numWritten == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("write");
+            }
+            off += numWritten;
+        }
+    }
+    free(buf);
+}
+
+/* Send stdin on the socket 'sfd', using sendfile() or splice() if we can */
+
+static void
+sendStream(int sfd, const struct stat *sb)
+{
+    int hdr = XFR_STREAM;
+    if (write(sfd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        fatal("failed to write header");
+
+    for (;;) {
+        ssize_t numSent;
+
+        if (S_ISREG(sb->st_mode))
+            numSent = sendfile(sfd, STDIN_FILENO, NULL, bufSize);
+        else if (S_ISFIFO(sb->st_mode))
+            numSent = splice(STDIN_FILENO, NULL, sfd, NULL, bufSize,
+                             SPLICE_F_MOVE | SPLICE_F_MORE);
+        else
+            break;
+
+        if (numSent == 0)
+            return;                     /* EOF on stdin */
+        if (numSent == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL || errno == ENOSYS)
+                break;                  /* Not supported; copy instead */
+            errExit("sendfile/splice");
+        }
+    }
+
+    copyFd(STDIN_FILENO, sfd);
+}
+
+/* Return a descriptor for a file containing the data on stdin, with its
+   file offset set to the start of the data */
+
+static int
+stdinAsFile(const struct stat *sb)
+{
+    if (S_ISREG(sb->st_mode))
+        return STDIN_FILENO;
+
+    int fd = memfd_create("us_xfr_v3", MFD_CLOEXEC);
+    if (fd == -1)
+        errExit("memfd_create");
+
+    copyFd(STDIN_FILENO, fd);
+
+    if (lseek(fd, 0, SEEK_SET) == -1)
+        errExit("lseek");
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool passFd = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:m")) != -1) {
+        switch (opt) {
+        case 'b': bufSize = getInt(optarg, GN_GT_0, "buf-size");        break;
+        case 'm': passFd = true;                                        break;
+        default:  usageErr("%s [-b buf-size] [-m]\n", argv[0]);
+        }
+    }
+
+    struct stat sb;
+    if (fstat(STDIN_FILENO, &sb) == -1)
+        errExit("fstat");
+
+    int sfd = unixConnect(SV_SOCK_PATH, SOCK_STREAM);
+    if (sfd == -1)
+        errExit("unixConnect");
+
+    int optval = bufSize;
+    if (setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)) == -1)
+        errMsg("setsockopt-SO_SNDBUF");
+
+    if (passFd) {
+        if (sendfd(sfd, stdinAsFile(&sb)) == -1)
+            errExit("sendfd");
+    } else {
+        sendStream(sfd, &sb);
+    }
+
+    exit(EXIT_SUCCESS);     /* Closes our socket; server sees EOF */
+}
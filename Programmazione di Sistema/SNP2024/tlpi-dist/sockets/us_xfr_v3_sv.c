@@ -0,0 +1,281 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* us_xfr_v3_sv.c
+
+   A high-throughput version of us_xfr_v2_sv.c. Accepts connections and
+   copies data sent by clients to stdout, avoiding copies through a user
+   space buffer:
+
+   * If the client sends its data on the socket, the data is moved with
+     splice() from the socket into a pipe, and then from the pipe to
+     stdout. If stdout does not support splice() (e.g., a terminal),
+     the data is read from the pipe and written with write().
+
+   * If the client hands over a file descriptor (see us_xfr_v3_cl -m),
+     the file is mapped with mmap() and written to stdout directly from
+     the mapping.
+
+   Usage: us_xfr_v3_sv [-b buf-size] [-c]
+
+   'buf-size' (default 1 MiB) sets SO_RCVBUF and the pipe capacity
+   (F_SETPIPE_SZ; values above /proc/sys/fs/pipe-max-size are silently
+   ignored for unprivileged users). For UNIX domain stream sockets, the
+   amount of data in flight is governed mainly by the sender's SO_SNDBUF;
+   see us_xfr_v3_cl -b.
+
+   The -c option uses read()/write() with a 'buf-size' buffer instead of
+   splice(), for comparison.
+
+   After each connection, the number of bytes transferred and the
+   transfer rate are printed on stderr.
+
+   This program is Linux-specific. See also us_xfr_v3_cl.c.
+*/
+#include "us_xfr_v3.h"         /* Defines _GNU_SOURCE, so comes first */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static size_t bufSize = DEF_BUF_SIZE;
+static char *copyBuf;                   /* Used when splice() isn't */
+
+/* Write all of 'len' bytes from 'buf' to stdout */
+
+static void
+writeAll(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t numWritten = write(STDOUT_FILENO, buf, len);
+        if (numWritten == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("write");
+        }
+        buf += numWritten;
+        len -= numWritten;
+    }
+}
+
+/* Copy from 'cfd' to stdout with read() and write() */
+
+static long long
+copyStream(int cfd)
+{
+    long long totBytes = 0;
+    ssize_t numRead;
+
+    while ((numRead = read(cfd, copyBuf, bufSize)) != 0) {
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("read");
+        }
+        writeAll(copyBuf, numRead);
+        totBytes += numRead;
+    }
+    return totBytes;
+}
+
+/* Move data from 'cfd' to stdout via the pipe 'pfd' using splice() */
+
+static long long
+spliceStream(int cfd, int pfd[2])
+{
+    static bool spliceOut = true;       /* Does stdout accept splice()? */
+    long long totBytes = 0;
+
+    for (;;) {
+        ssize_t numIn = splice(cfd, NULL, pfd[1], NULL, bufSize,
+                               SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (numIn == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("splice (socket to pipe)");
+        }
+        if (numIn == 0)
+            return totBytes;            /* EOF on socket */
+
+        /* Drain everything that was just placed in the pipe */
+
+        for (ssize_t left = numIn; left > 0; ) {
+            ssize_t numOut;
+
+            if (spliceOut) {
+                numOut = splice(pfd[0], NULL, STDOUT_FILENO, NULL, left,
+                                SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (numOut == -1 && errno == EINVAL) {
+                    spliceOut = false;  /* Fall back to read()/write() */
+                    continue;
+                }
+            } else {
+                numOut = read(pfd[0], copyBuf, min(left, (ssize_t) bufSize));
+                if (numOut > 0)
+                    writeAll(copyBuf, numOut);
+            }
+
+            if (numOut == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("splice (pipe to stdout)");
+            }
+            left -= numOut;
+        }
+        totBytes += numIn;
+    }
+}
+
+/* Write the contents of the file referred to by 'fd' (from its current
+   offset onward) to stdout, from a mapping of the file */
+
+static long long
+copyMapped(int fd)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || offset > sb.st_size)
+        offset = 0;
+
+    if (sb.st_size == 0)
+        return 0;                       /* Can't mmap() an empty file */
+
+    char *addr = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+
+    /* We expect to read the mapping once, from start to end */
+
+    if (madvise(addr, sb.st_size, MADV_SEQUENTIAL) == -1)
+        errMsg("madvise");
+
+    writeAll(addr + offset, sb.st_size - offset);
+
+    if (munmap(addr, sb.st_size) == -1)
+        errExit("munmap");
+
+    return sb.st_size - offset;
+}
+
+/* Read the connection header; return the descriptor that accompanied
+   it, -1 if there was none, or -2 on error/EOF */
+
+static int
+recvHeader(int cfd)
+{
+    union {
+        char   buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controlMsg;
+    struct msghdr msgh;
+    struct iovec iov;
+    int hdr, fd;
+
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    if (recvmsg(cfd, &msgh, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(hdr))
+        return -2;
+
+    struct cmsghdr *cmsgp = CMSG_FIRSTHDR(&msgh);
+    if (cmsgp == NULL || cmsgp->cmsg_level != SOL_SOCKET ||
+            cmsgp->cmsg_type != SCM_RIGHTS ||
+            cmsgp->cmsg_len != CMSG_LEN(sizeof(int)))
+        return -1;
+
+    memcpy(&fd, CMSG_DATA(cmsgp), sizeof(int));
+    return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool useCopy = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:c")) != -1) {
+        switch (opt) {
+        case 'b': bufSize = getInt(optarg, GN_GT_0, "buf-size");        break;
+        case 'c': useCopy = true;                                       break;
+        default:  usageErr("%s [-b buf-size] [-c]\n", argv[0]);
+        }
+    }
+
+    copyBuf = malloc(bufSize);
+    if (copyBuf == NULL)
+        errExit("malloc");
+
+    int pfd[2];
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    if (fcntl(pfd[1], F_SETPIPE_SZ, (int) bufSize) == -1)
+        errMsg("fcntl-F_SETPIPE_SZ");   /* Not fatal; keep default size */
+
+    int sfd = unixBind(SV_SOCK_PATH, SOCK_STREAM);
+    if (sfd == -1)
+        errExit("unixBind");
+
+    /* Accepted sockets inherit the buffer size of the listening socket */
+
+    int optval = bufSize;
+    if (setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval)) == -1)
+        errMsg("setsockopt-SO_RCVBUF");
+
+    if (listen(sfd, 5) == -1)
+        errExit("listen");
+
+    for (int connNum = 1; ; connNum++) {    /* Handle clients iteratively */
+        int cfd = accept(sfd, NULL, NULL);
+        if (cfd == -1)
+            errExit("accept");
+
+        struct timespec start, end;
+        if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+            errExit("clock_gettime");
+
+        long long numBytes;
+        const char *mode;
+        int fd = recvHeader(cfd);
+
+        if (fd >= 0) {
+            mode = "mmap";
+            numBytes = copyMapped(fd);
+            close(fd);
+        } else if (fd == -1) {
+            mode = useCopy ? "read/write" : "splice";
+            numBytes = useCopy ? copyStream(cfd) : spliceStream(cfd, pfd);
+        } else {
+            mode = "bad header";
+            numBytes = 0;
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+            errExit("clock_gettime");
+
+        double secs = (end.tv_sec - start.tv_sec) +
+                      (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Connection %d (%s): %lld bytes in %.3f s "
+                "(%.1f MB/s)\n", connNum, mode, numBytes, secs,
+                (secs > 0) ? numBytes / secs / 1e6 : 0.0);
+
+        if (close(cfd) == -1)
+            errMsg("close");
+    }
+}
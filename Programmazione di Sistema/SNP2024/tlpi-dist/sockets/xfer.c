@@ -0,0 +1,168 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* xfer.c
+
+   Copy data between two file descriptors using the best primitive the
+   kernel offers for the pair of file types:
+
+        file -> file            copy_file_range()
+        file -> socket, etc.    sendfile()
+        pipe at either end      splice()
+        anything else           read()/write() (sendfileRW())
+
+   xferData() has the same offset semantics as sendfile(): if 'offset' is
+   not NULL, data is read starting at '*offset', '*offset' is updated, and
+   the file offset of 'inFd' is left unchanged; otherwise, data is read
+   from (and advances) the file offset of 'inFd'. Data is always written
+   at the file offset of 'outFd'. Since a pipe has no offset, 'offset' must
+   be NULL if 'inFd' is a pipe.
+
+   Unlike sendfile(), xferData() keeps going until 'count' bytes have been
+   transferred or end-of-file is reached, so the caller need not loop over
+   partial transfers. If an error occurs after some data has been
+   transferred, the byte count so far is returned (a further call will
+   report the error); -1 is returned only if nothing was transferred. If a
+   primitive turns out not to be supported for the descriptors at hand
+   (e.g., copy_file_range() across file systems on older kernels), the next
+   method in the chain copy_file_range() -> sendfile() -> read()/write()
+   is tried, so a transfer never fails merely because of the method chosen.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE             /* For copy_file_range() and splice() */
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "sendfile_rw.h"
+#include "xfer.h"
+#include "tlpi_hdr.h"
+
+/* The kernel transfers at most about 2 GiB per call; ask for less so that
+   counts always fit in an ssize_t on 32-bit systems */
+
+#define MAX_CHUNK (1024 * 1024 * 1024)
+
+/* Return the method that XFER_AUTO selects for the given descriptors */
+
+int
+xferMethod(int outFd, int inFd)
+{
+    struct stat inSb, outSb;
+
+    if (fstat(inFd, &inSb) == -1 || fstat(outFd, &outSb) == -1)
+        return XFER_RW;
+
+    if (S_ISFIFO(inSb.st_mode) || S_ISFIFO(outSb.st_mode))
+        return XFER_SPLICE;
+    if (S_ISREG(inSb.st_mode) && S_ISREG(outSb.st_mode))
+        return XFER_COPY_RANGE;
+    if (S_ISREG(inSb.st_mode) || S_ISBLK(inSb.st_mode))
+        return XFER_SENDFILE;
+    return XFER_RW;
+}
+
+const char *
+xferMethodName(int method)
+{
+    switch (method) {
+    case XFER_AUTO:         return "auto";
+    case XFER_RW:           return "read/write";
+    case XFER_SENDFILE:     return "sendfile";
+    case XFER_COPY_RANGE:   return "copy_file_range";
+    case XFER_SPLICE:       return "splice";
+    default:                return "unknown";
+    }
+}
+
+/* Does 'err' mean that a method can't be used for this pair of
+   descriptors (as opposed to a real I/O error)? */
+
+static bool
+unsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV ||
+           err == EOPNOTSUPP;
+}
+
+static ssize_t
+spliceChunk(int outFd, int inFd, off_t *offset, size_t len)
+{
+    struct stat sb;
+
+    if (fstat(inFd, &sb) == -1)
+        return -1;
+
+    if (S_ISFIFO(sb.st_mode)) {
+        if (offset != NULL) {           /* Can't read a pipe at an offset */
+            errno = ESPIPE;
+            return -1;
+        }
+        return splice(inFd, NULL, outFd, NULL, len,
+                      SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+
+    /* 'outFd' must be the pipe. With a non-NULL 'offset', splice() (like
+       sendfile()) leaves the input file offset unchanged. */
+
+    return splice(inFd, offset, outFd, NULL, len,
+                  SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+ssize_t
+xferData(int outFd, int inFd, off_t *offset, size_t count, int method)
+{
+    if (method == XFER_AUTO)
+        method = xferMethod(outFd, inFd);
+
+    size_t totXfer = 0;
+
+    while (count > 0) {
+        size_t len = min(count, (size_t) MAX_CHUNK);
+        ssize_t numXfer;
+
+        switch (method) {
+        case XFER_COPY_RANGE:
+            numXfer = copy_file_range(inFd, offset, outFd, NULL, len, 0);
+            break;
+        case XFER_SENDFILE:
+            numXfer = sendfile(outFd, inFd, offset, len);
+            break;
+        case XFER_SPLICE:
+            numXfer = spliceChunk(outFd, inFd, offset, len);
+            break;
+        default:
+            numXfer = sendfileRW(outFd, inFd, offset, len);
+            break;
+        }
+
+        if (numXfer == -1) {
+            if (errno == EINTR)
+                continue;
+            if (method != XFER_RW && unsupported(errno)) {
+                method = (method == XFER_COPY_RANGE) ? XFER_SENDFILE :
+                                                       XFER_RW;
+                continue;
+            }
+            if (totXfer > 0)
+                break;
+            return -1;
+        }
+        if (numXfer == 0)
+            break;                      /* EOF */
+
+        totXfer += numXfer;
+        count -= numXfer;
+    }
+
+    return totXfer;
+}
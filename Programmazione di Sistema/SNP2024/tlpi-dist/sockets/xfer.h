@@ -0,0 +1,37 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* xfer.h
+
+   Header file for xfer.c.
+*/
+#ifndef XFER_H
+#define XFER_H
+
+#include <sys/types.h>
+
+/* Transfer methods; XFER_AUTO picks one from the types of the descriptors */
+
+#define XFER_AUTO       0
+#define XFER_RW         1       /* read()/write() loop (sendfileRW()) */
+#define XFER_SENDFILE   2       /* sendfile() */
+#define XFER_COPY_RANGE 3       /* copy_file_range() */
+#define XFER_SPLICE     4       /* splice(); one end must be a pipe */
+
+int xferMethod(int outFd, int inFd);
+
+const char *xferMethodName(int method);
+
+ssize_t xferData(int outFd, int inFd, off_t *offset, size_t count,
+                 int method);
+
+#endif
@@ -0,0 +1,220 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* xfer_bench.c
+
+   Compare the transfer methods of xfer.c for file sizes from 4 KiB up to
+   'max-size' (default 4 GiB), in steps of a factor of 4, for three kinds
+   of destination: a regular file, a pipe, and a UNIX domain stream socket.
+
+   Usage: xfer_bench [-d dir] [-m max-size] [-t bytes-per-test]
+
+   A source file of 'max-size' bytes is created in 'dir' (default: the
+   current directory; the file system must have room for two such files).
+   For each size, the first 'size' bytes of that file are transferred
+   repeatedly, until at least 'bytes-per-test' (default 256 MiB) bytes
+   have been moved, and the throughput is reported in MB/s. A '-' means
+   that the method does not apply to that destination.
+
+   The source is in the page cache after it has been created, and data
+   written to the destination file is not flushed, so the figures reflect
+   the cost of the copying itself rather than of the storage device. Pipe
+   and socket destinations are drained by a child process that reads and
+   discards the data.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "xfer.h"
+#include "tlpi_hdr.h"
+
+#define FILL_BUF_SIZE (1024 * 1024)
+
+static const int methods[] = { XFER_RW, XFER_SENDFILE, XFER_COPY_RANGE,
+                               XFER_SPLICE };
+#define NUM_METHODS ((int) (sizeof(methods) / sizeof(methods[0])))
+
+enum { SINK_FILE, SINK_PIPE, SINK_SOCKET, NUM_SINKS };
+static const char *sinkName[NUM_SINKS] = { "file", "pipe", "socket" };
+
+/* Can 'method' move data from a regular file to 'sink'? */
+
+static bool
+applies(int method, int sink)
+{
+    switch (method) {
+    case XFER_COPY_RANGE:   return sink == SINK_FILE;
+    case XFER_SPLICE:       return sink == SINK_PIPE;
+    default:                return true;
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+makeSource(int fd, long long size)
+{
+    char *buf = malloc(FILL_BUF_SIZE);
+    if (buf == NULL)
+        errExit("malloc");
+    for (int j = 0; j < FILL_BUF_SIZE; j++)
+        buf[j] = 'a' + j % 26;
+
+    for (long long left = size; left > 0; ) {
+        ssize_t numWritten = write(fd, buf, min(left, FILL_BUF_SIZE));
+        if (numWritten == -1)
+            errExit("write (creating source file)");
+        left -= numWritten;
+    }
+    free(buf);
+}
+
+/* Create a pipe or socket pair for 'sink', with a child that drains the
+   read end. Returns the write end; the child's PID is placed in '*pid'. */
+
+static int
+startDrain(int sink, pid_t *pid)
+{
+    int fds[2];
+
+    if (sink == SINK_PIPE) {
+        if (pipe(fds) == -1)
+            errExit("pipe");
+    } else {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            errExit("socketpair");
+    }
+
+    switch (*pid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        close(fds[1]);
+        char *buf = malloc(FILL_BUF_SIZE);
+        if (buf == NULL)
+            errExit("malloc");
+        while (read(fds[0], buf, FILL_BUF_SIZE) > 0)
+            continue;
+        _exit(EXIT_SUCCESS);
+
+    default:
+        close(fds[0]);
+        return fds[1];
+    }
+}
+
+/* Return the throughput (MB/s) of transferring 'size' bytes from 'srcFd'
+   to 'outFd' with 'method', repeated to move 'perTest' bytes in all */
+
+static double
+measure(int outFd, int srcFd, int sink, int method, long long size,
+        long long perTest)
+{
+    long long reps = max(1, perTest / size);
+    double start = now();
+
+    for (long long r = 0; r < reps; r++) {
+        off_t offset = 0;
+
+        if (sink == SINK_FILE && lseek(outFd, 0, SEEK_SET) == -1)
+            errExit("lseek");
+
+        ssize_t numXfer = xferData(outFd, srcFd, &offset, size, method);
+        if (numXfer != size)
+            fatal("%s to %s: transferred %lld of %lld bytes",
+                  xferMethodName(method), sinkName[sink],
+                  (long long) numXfer, size);
+    }
+
+    return reps * size / (now() - start) / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dir = ".";
+    long long maxSize = 4LL * 1024 * 1024 * 1024;
+    long long perTest = 256 * 1024 * 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:m:t:")) != -1) {
+        switch (opt) {
+        case 'd': dir = optarg;                                         break;
+        case 'm': maxSize = getLong(optarg, GN_ANY_BASE | GN_GT_0,
+                                    "max-size");                        break;
+        case 't': perTest = getLong(optarg, GN_ANY_BASE | GN_GT_0,
+                                    "bytes-per-test");                  break;
+        default:  usageErr("%s [-d dir] [-m max-size] [-t bytes-per-test]\n",
+                           argv[0]);
+        }
+    }
+
+    char srcPath[PATH_MAX], dstPath[PATH_MAX];
+    snprintf(srcPath, sizeof(srcPath), "%s/xfer_bench.src", dir);
+    snprintf(dstPath, sizeof(dstPath), "%s/xfer_bench.dst", dir);
+
+    int srcFd = open(srcPath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (srcFd == -1)
+        errExit("open %s", srcPath);
+    int dstFd = open(dstPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (dstFd == -1)
+        errExit("open %s", dstPath);
+
+    makeSource(srcFd, maxSize);
+
+    printf("%-6s %12s", "sink", "size");
+    for (int m = 0; m < NUM_METHODS; m++)
+        printf(" %15s", xferMethodName(methods[m]));
+    printf("    (MB/s)\n");
+
+    for (int sink = 0; sink < NUM_SINKS; sink++) {
+        pid_t childPid = -1;
+        int outFd = (sink == SINK_FILE) ? dstFd : startDrain(sink, &childPid);
+
+        for (long long size = 4096; size <= maxSize; size *= 4) {
+            printf("%-6s %12lld", sinkName[sink], size);
+            for (int m = 0; m < NUM_METHODS; m++) {
+                if (applies(methods[m], sink))
+                    printf(" %15.1f", measure(outFd, srcFd, sink, methods[m],
+                                              size, perTest));
+                else
+                    printf(" %15s", "-");
+                fflush(stdout);
+            }
+            printf("\n");
+        }
+
+        if (sink != SINK_FILE) {
+            close(outFd);               /* Child sees EOF */
+            if (waitpid(childPid, NULL, 0) == -1)
+                errExit("waitpid");
+        }
+    }
+
+    unlink(srcPath);
+    unlink(dstPath);
+    exit(EXIT_SUCCESS);
+}
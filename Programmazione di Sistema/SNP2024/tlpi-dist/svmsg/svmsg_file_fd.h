@@ -0,0 +1,59 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_fd.h
+
+   Header file for svmsg_file_fd_server.c and svmsg_file_fd_client.c.
+
+   The request and response messages are those of svmsg_file.h, and the
+   server uses the same well-known key, so that svmsg_file_client can also
+   be used with svmsg_file_fd_server. The 'mtype' field of a request
+   (unused by svmsg_file_server) selects how the file is returned.
+*/
+#define _GNU_SOURCE                     /* For memfd_create() */
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "svmsg_file.h"
+
+/* Request types (client to server) */
+
+#define REQ_MT_MSG 1            /* Send file data in messages, as
+                                   svmsg_file_server does */
+#define REQ_MT_FD  2            /* Pass a file descriptor (see below) */
+
+/* Additional response type: for a REQ_MT_FD request, the server passes a
+   descriptor open on the file (or, if the file can't be mapped, on a memfd
+   holding a copy of its contents) as SCM_RIGHTS ancillary data on a UNIX
+   domain datagram socket that the client has bound to the abstract name
+   built by fdSockName(), and then sends a zero-length RESP_MT_FD message
+   on the client's queue. Only this control message travels through the
+   message queue; the client maps the file to get at its contents. */
+
+#define RESP_MT_FD 4
+
+#define FD_SOCK_FMT "svmsg_file_fd.%d"  /* Format of abstract socket name;
+                                           argument is client queue ID */
+
+/* Build the (abstract) address of the socket for client 'clientId' in
+   'addr'; return the length to be passed to bind() or sendmsg() */
+
+static inline socklen_t
+fdSockName(struct sockaddr_un *addr, int clientId)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    snprintf(&addr->sun_path[1], sizeof(addr->sun_path) - 1, FD_SOCK_FMT,
+             clientId);
+    return offsetof(struct sockaddr_un, sun_path) + 1 +
+           strlen(&addr->sun_path[1]);
+}
@@ -0,0 +1,221 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_fd_client.c
+
+   Request the contents of the file named on the command line from
+   svmsg_file_fd_server.c. By default, the server passes us a file
+   descriptor over a UNIX domain socket and we map the file; with -m, the
+   contents are sent in messages, as with svmsg_file_client.c.
+
+   Usage: svmsg_file_fd_client [-m] pathname
+
+   Either way, every byte of the file is read (a checksum is computed), so
+   that the timings reported for the two modes are comparable.
+
+   This program is Linux-specific.
+*/
+#include "svmsg_file_fd.h"       /* Defines _GNU_SOURCE, so comes first */
+#include <time.h>
+
+static int clientId;
+
+static void
+removeQueue(void)
+{
+    if (msgctl(clientId, IPC_RMID, NULL) == -1)
+        errExit("msgctl");
+}
+
+/* Receive a descriptor sent with SCM_RIGHTS on 'sockFd' */
+
+static int
+recvFd(int sockFd)
+{
+    union {
+        char   buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controlMsg;
+    struct msghdr msgh;
+    struct iovec iov;
+    int data, fd;
+
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = &data;
+    iov.iov_len = sizeof(data);
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    if (recvmsg(sockFd, &msgh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC) == -1)
+        return -1;
+
+    struct cmsghdr *cmsgp = CMSG_FIRSTHDR(&msgh);
+    if (cmsgp == NULL || cmsgp->cmsg_level != SOL_SOCKET ||
+            cmsgp->cmsg_type != SCM_RIGHTS ||
+            cmsgp->cmsg_len != CMSG_LEN(sizeof(int))) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    memcpy(&fd, CMSG_DATA(cmsgp), sizeof(int));
+    return fd;
+}
+
+/* Add the contents of 'buf' to 'sum', a word at a time so that the
+   checksum isn't the bottleneck. 'buf' must be suitably aligned; both a
+   mapping and the 'data' field of a message are. */
+
+static unsigned long
+checksum(const char *buf, size_t len, unsigned long sum)
+{
+    const unsigned long *wp = (const unsigned long *) buf;
+    size_t j;
+
+    for (j = 0; j < len / sizeof(long); j++)
+        sum += wp[j];
+    for (j *= sizeof(long); j < len; j++)
+        sum += (unsigned char) buf[j];
+    return sum;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct requestMsg req;
+    struct responseMsg resp;
+    bool useMsgs = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        if (opt == 'm')
+            useMsgs = true;
+        else
+            usageErr("%s [-m] pathname\n", argv[0]);
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-m] pathname\n", argv[0]);
+
+    const char *pathname = argv[optind];
+    if (strlen(pathname) > sizeof(req.pathname) - 1)
+        cmdLineErr("pathname too long (max: %ld bytes)\n",
+                (long) sizeof(req.pathname) - 1);
+
+    /* Get server's queue identifier; create queue for response */
+
+    int serverId = msgget(SERVER_KEY, S_IWUSR);
+    if (serverId == -1)
+        errExit("msgget - server message queue");
+
+    clientId = msgget(IPC_PRIVATE, S_IRUSR | S_IWUSR | S_IWGRP);
+    if (clientId == -1)
+        errExit("msgget - client message queue");
+
+    if (atexit(removeQueue) != 0)
+        errExit("atexit");
+
+    /* Bind the socket on which the server will pass us a descriptor.
+       This must be done before sending the request. */
+
+    int sockFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockFd == -1)
+        errExit("socket");
+
+    struct sockaddr_un addr;
+    socklen_t addrLen = fdSockName(&addr, clientId);
+    if (bind(sockFd, (struct sockaddr *) &addr, addrLen) == -1)
+        errExit("bind");
+
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    /* Send message asking for the file */
+
+    req.mtype = useMsgs ? REQ_MT_MSG : REQ_MT_FD;
+    req.clientId = clientId;
+    strncpy(req.pathname, pathname, sizeof(req.pathname) - 1);
+    req.pathname[sizeof(req.pathname) - 1] = '\0';
+
+    if (msgsnd(serverId, &req, REQ_MSG_SIZE, 0) == -1)
+        errExit("msgsnd");
+
+    /* Get first response, which may be failure notification */
+
+    ssize_t msgLen = msgrcv(clientId, &resp, RESP_MSG_SIZE, 0, 0);
+    if (msgLen == -1)
+        errExit("msgrcv");
+
+    if (resp.mtype == RESP_MT_FAILURE) {
+        printf("%s\n", resp.data);      /* Display msg from server */
+        exit(EXIT_FAILURE);
+    }
+
+    long long totBytes = 0;
+    unsigned long sum = 0;
+    int numMsgs = 1;
+
+    if (resp.mtype == RESP_MT_FD) {
+
+        /* The descriptor was sent before the control message, so it is
+           already waiting on our socket */
+
+        int fd = recvFd(sockFd);
+        if (fd == -1)
+            errExit("recvFd");
+
+        struct stat sb;
+        if (fstat(fd, &sb) == -1)
+            errExit("fstat");
+        totBytes = sb.st_size;
+
+        if (totBytes > 0) {
+            char *addr = mmap(NULL, totBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+                errExit("mmap");
+            if (madvise(addr, totBytes, MADV_SEQUENTIAL) == -1)
+                errMsg("madvise");
+            sum = checksum(addr, totBytes, 0);
+            if (munmap(addr, totBytes) == -1)
+                errExit("munmap");
+        }
+        close(fd);
+
+    } else {
+
+        /* Process messages (including the one already received)
+           containing file data */
+
+        totBytes = msgLen;
+        sum = checksum(resp.data, msgLen, 0);
+        for ( ; resp.mtype == RESP_MT_DATA; numMsgs++) {
+            msgLen = msgrcv(clientId, &resp, RESP_MSG_SIZE, 0, 0);
+            if (msgLen == -1)
+                errExit("msgrcv");
+
+            totBytes += msgLen;
+            sum = checksum(resp.data, msgLen, sum);
+        }
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Received %lld bytes (%d messages, checksum %lu) in %.3f s "
+           "(%.1f MB/s)\n", totBytes, numMsgs, sum, secs,
+           (secs > 0) ? totBytes / secs / 1e6 : 0.0);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,289 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_fd_server.c
+
+   A variant of svmsg_file_server.c with two changes:
+
+   * Instead of forking a child for each request, the server preforks a
+     pool of worker processes, each of which loops reading requests from
+     the server queue (System V message queues may have any number of
+     readers; each message goes to just one of them). The parent replaces
+     any worker that terminates unexpectedly, but no more often than once
+     every RESPAWN_SECS seconds, so that workers that die at once (e.g.,
+     because of a persistent error) don't cause a fork storm.
+
+   * For requests of type REQ_MT_FD (see svmsg_file_fd.h), the file
+     contents don't pass through the message queue at all. Instead, the
+     worker passes a descriptor for the file to the client over a UNIX
+     domain socket and sends just a control message on the client's
+     queue; the client then maps the file. If the file can't be mapped
+     (e.g., it is a FIFO or a /proc file), its contents are first copied
+     into a memfd, whose descriptor is passed instead.
+
+   Requests of any other type are answered with data messages, exactly as
+   svmsg_file_server does, so svmsg_file_client works with this server.
+
+   Usage: svmsg_file_fd_server [num-workers]        (default: 4)
+
+   Terminate the server with SIGINT or SIGTERM; the parent then removes
+   the server queue, which causes the workers to terminate.
+
+   This program is Linux-specific. See also svmsg_file_fd_client.c.
+*/
+#include "svmsg_file_fd.h"     /* Defines _GNU_SOURCE, so comes first */
+#include <time.h>
+
+#define COPY_BUF_SIZE 65536
+#define RESPAWN_SECS 1          /* Minimum interval between respawns */
+
+static volatile sig_atomic_t terminate = 0;
+
+static void
+termHandler(int sig)
+{
+    terminate = 1;
+}
+
+/* Send descriptor 'fd' to the socket bound by client 'clientId' */
+
+static int
+sendFd(int sockFd, int clientId, int fd)
+{
+    union {
+        char   buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } controlMsg;
+    struct sockaddr_un addr;
+    struct msghdr msgh;
+    struct iovec iov;
+    int data = 0;                       /* At least 1 byte of real data */
+
+    memset(&msgh, 0, sizeof(msgh));
+    msgh.msg_name = &addr;
+    msgh.msg_namelen = fdSockName(&addr, clientId);
+    iov.iov_base = &data;
+    iov.iov_len = sizeof(data);
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    struct cmsghdr *cmsgp = CMSG_FIRSTHDR(&msgh);
+    cmsgp->cmsg_level = SOL_SOCKET;
+    cmsgp->cmsg_type = SCM_RIGHTS;
+    cmsgp->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsgp), &fd, sizeof(int));
+
+    return (sendmsg(sockFd, &msgh, 0) == -1) ? -1 : 0;
+}
+
+/* Return a descriptor for a copy of the contents of 'fd' in a memfd, or
+   -1 on error */
+
+static int
+copyToMemfd(int fd)
+{
+    int mfd = memfd_create("svmsg_file_fd", MFD_CLOEXEC);
+    if (mfd == -1)
+        return -1;
+
+    char buf[COPY_BUF_SIZE];
+    ssize_t numRead;
+    while ((numRead = read(fd, buf, COPY_BUF_SIZE)) > 0)
+        if (write(mfd, buf, numRead) != numRead) {
+            close(mfd);
+            return -1;
+        }
+
+    return mfd;
+}
+
+static void
+sendFailure(int clientId, const char *msg)
+{
+    struct responseMsg resp;
+
+    resp.mtype = RESP_MT_FAILURE;
+    snprintf(resp.data, sizeof(resp.data), "%s", msg);
+    msgsnd(clientId, &resp, strlen(resp.data) + 1, 0);
+}
+
+/* Serve a single request; 'sockFd' is a datagram socket used to pass
+   descriptors. We don't diagnose errors once we have started sending
+   the file, since we can't notify client. */
+
+static void
+serveRequest(const struct requestMsg *req, int sockFd)
+{
+    struct responseMsg resp;
+
+    int fd = open(req->pathname, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {                     /* Open failed: send error text */
+        sendFailure(req->clientId, "Couldn't open");
+        return;
+    }
+
+    if (req->mtype == REQ_MT_FD) {
+
+        /* Only regular files can be mapped in full by the client; for
+           anything else, pass a memfd holding a snapshot of the data.
+           Files whose size is reported as 0 (e.g., most /proc files) are
+           also copied, in case they do in fact have contents. */
+
+        struct stat sb;
+        if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0) {
+            int mfd = copyToMemfd(fd);
+            close(fd);
+            fd = mfd;
+        }
+
+        if (fd == -1 || sendFd(sockFd, req->clientId, fd) == -1)
+            sendFailure(req->clientId, "Couldn't pass file descriptor");
+        else {
+            resp.mtype = RESP_MT_FD;
+            msgsnd(req->clientId, &resp, 0, 0);
+        }
+
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    /* Transmit file contents in messages with type RESP_MT_DATA */
+
+    ssize_t numRead;
+    resp.mtype = RESP_MT_DATA;
+    while ((numRead = read(fd, resp.data, RESP_MSG_SIZE)) > 0)
+        if (msgsnd(req->clientId, &resp, numRead, 0) == -1)
+            break;
+
+    /* Send a message of type RESP_MT_END to signify end-of-file */
+
+    resp.mtype = RESP_MT_END;
+    msgsnd(req->clientId, &resp, 0, 0);         /* Zero-length mtext */
+    close(fd);
+}
+
+/* Worker process: serve requests until the server queue is removed */
+
+static void
+worker(int serverId)
+{
+    struct requestMsg req;
+
+    /* Leave termination to the parent */
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+
+    int sockFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockFd == -1)
+        errExit("socket");
+
+    for (;;) {
+        ssize_t msgLen = msgrcv(serverId, &req, REQ_MSG_SIZE, 0, 0);
+        if (msgLen == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EIDRM)         /* EIDRM: parent removed queue */
+                errMsg("msgrcv");
+            _exit(EXIT_SUCCESS);
+        }
+        serveRequest(&req, sockFd);
+    }
+}
+
+static pid_t
+startWorker(int serverId)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+        errMsg("fork");
+    else if (pid == 0)
+        worker(serverId);
+    return pid;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageErr("%s [num-workers]\n", argv[0]);
+
+    int numWorkers = (argc > 1) ? getInt(argv[1], GN_GT_0, "num-workers") : 4;
+
+    /* Create server message queue */
+
+    int serverId = msgget(SERVER_KEY, IPC_CREAT | IPC_EXCL |
+                          S_IRUSR | S_IWUSR | S_IWGRP);
+    if (serverId == -1)
+        errExit("msgget");
+
+    /* No SA_RESTART: SIGINT/SIGTERM must interrupt wait() below */
+
+    struct sigaction sa;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = termHandler;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    /* If we can't start the whole pool, give up at the first failure */
+
+    for (int j = 0; j < numWorkers; j++) {
+        if (startWorker(serverId) == -1) {
+            terminate = 1;
+            break;
+        }
+    }
+
+    /* Replace workers that die, until we are told to terminate */
+
+    time_t lastSpawn = 0;
+
+    while (!terminate) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) {
+            if (errno == EINTR)
+                continue;
+            errMsg("wait");
+            break;
+        }
+        fprintf(stderr, "Worker %ld terminated (status 0x%x); replacing\n",
+                (long) pid, (unsigned int) status);
+
+        /* Throttle respawns; a termination signal cuts the sleep short */
+
+        if (time(NULL) - lastSpawn < RESPAWN_SECS) {
+            sleep(RESPAWN_SECS);
+            if (terminate)
+                break;
+        }
+        lastSpawn = time(NULL);
+
+        if (startWorker(serverId) == -1)
+            break;
+    }
+
+    /* Removing the queue makes the workers' msgrcv() calls fail with
+       EIDRM, and so they terminate */
+
+    if (msgctl(serverId, IPC_RMID, NULL) == -1)
+        errExit("msgctl");
+    while (wait(NULL) > 0)
+        continue;
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,200 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* binary_sems_bench.c
+
+   Measure the cost of the binary semaphore operations of binary_sems.h.
+   The same source is built twice: as binary_sems_bench_sysv, linked with
+   binary_sems.o (System V semaphores), and as binary_sems_bench_futex,
+   compiled with -DUSE_FUTEX_SEMS and linked with futex_sems.o.
+
+   Usage: binary_sems_bench_{sysv,futex} [-n loops] [-p num-procs]
+
+   Three tests are run:
+
+   uncontended  One process reserves and releases a semaphore 'loops'
+                times; the cost per reserve+release pair is reported.
+
+   ping-pong    Two processes hand control back and forth 'loops' times
+                with a pair of semaphores, as svshm_xfr_writer.c and
+                svshm_xfr_reader.c do.
+
+   contended    'num-procs' (default 4) processes each reserve the
+                semaphore, increment a counter in shared memory, and
+                release the semaphore, 'loops' times. The final counter
+                value is checked.
+*/
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#ifdef USE_FUTEX_SEMS
+#include "futex_sems.h"
+#define IMPL_NAME "futex"
+#define semGet(nsems) fsemGet(IPC_PRIVATE, (nsems), S_IRUSR | S_IWUSR)
+#define semRemove(semId) fsemRemove(semId)
+#else
+#include "semun.h"
+#include "binary_sems.h"
+#define IMPL_NAME "System V"
+#define semGet(nsems) semget(IPC_PRIVATE, (nsems), S_IRUSR | S_IWUSR)
+static int
+semRemove(int semId)
+{
+    union semun dummy;
+
+    return semctl(semId, 0, IPC_RMID, dummy);
+}
+#endif
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+waitAll(void)
+{
+    int status;
+
+    while (wait(&status) != -1)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("child failed");
+}
+
+static void
+uncontended(int semId, long loops)
+{
+    if (initSemAvailable(semId, 0) == -1)
+        errExit("initSemAvailable");
+
+    double start = now();
+    for (long j = 0; j < loops; j++)
+        if (reserveSem(semId, 0) == -1 || releaseSem(semId, 0) == -1)
+            errExit("reserveSem/releaseSem");
+    double secs = now() - start;
+
+    printf("%-12s %10.1f ns per reserve+release\n", "uncontended",
+           secs / loops * 1e9);
+}
+
+static void
+pingPong(int semId, long loops)
+{
+    if (initSemAvailable(semId, 0) == -1 || initSemInUse(semId, 1) == -1)
+        errExit("initSem");
+
+    double start = now();
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:                     /* Child: "reader" */
+        for (long j = 0; j < loops; j++)
+            if (reserveSem(semId, 1) == -1 || releaseSem(semId, 0) == -1)
+                errExit("reserveSem/releaseSem");
+        _exit(EXIT_SUCCESS);
+
+    default:                    /* Parent: "writer" */
+        for (long j = 0; j < loops; j++)
+            if (reserveSem(semId, 0) == -1 || releaseSem(semId, 1) == -1)
+                errExit("reserveSem/releaseSem");
+        waitAll();
+    }
+
+    double secs = now() - start;
+    printf("%-12s %10.1f ns per handoff (%.0f handoffs/s)\n", "ping-pong",
+           secs / (2 * loops) * 1e9, 2 * loops / secs);
+}
+
+static void
+contended(int semId, long loops, int numProcs)
+{
+    long *counter = mmap(NULL, sizeof(long), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (counter == MAP_FAILED)
+        errExit("mmap");
+    *counter = 0;
+
+    if (initSemAvailable(semId, 0) == -1)
+        errExit("initSemAvailable");
+
+    double start = now();
+
+    for (int p = 0; p < numProcs; p++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+
+        case 0:
+            for (long j = 0; j < loops; j++) {
+                if (reserveSem(semId, 0) == -1)
+                    errExit("reserveSem");
+                (*counter)++;           /* Critical section */
+                if (releaseSem(semId, 0) == -1)
+                    errExit("releaseSem");
+            }
+            _exit(EXIT_SUCCESS);
+
+        default:
+            break;
+        }
+    }
+    waitAll();
+
+    double secs = now() - start;
+    if (*counter != loops * numProcs)
+        fatal("counter is %ld; expected %ld", *counter, loops * numProcs);
+
+    printf("%-12s %10.1f ns per reserve+release (%d processes, "
+           "%.0f ops/s)\n", "contended", secs / (loops * numProcs) * 1e9,
+           numProcs, loops * numProcs / secs);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long loops = 1000000;
+    int numProcs = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+        switch (opt) {
+        case 'n': loops = getLong(optarg, GN_GT_0, "loops");            break;
+        case 'p': numProcs = getInt(optarg, GN_GT_0, "num-procs");      break;
+        default:  usageErr("%s [-n loops] [-p num-procs]\n", argv[0]);
+        }
+    }
+
+    int semId = semGet(2);
+    if (semId == -1)
+        errExit("semGet");
+
+    printf("%s semaphores, %ld loops\n", IMPL_NAME, loops);
+    uncontended(semId, loops);
+    pingPong(semId, loops);
+    contended(semId, loops, numProcs);
+
+    if (semRemove(semId) == -1)
+        errExit("semRemove");
+    exit(EXIT_SUCCESS);
+}
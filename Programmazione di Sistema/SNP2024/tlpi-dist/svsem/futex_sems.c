@@ -0,0 +1,287 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_sems.c
+
+   Implement the binary semaphore (binary_sems.h) and event flag
+   (event_flags.h) protocols with futexes, instead of System V semaphores.
+
+   A "semaphore set" is a System V shared memory segment containing an
+   array of 'struct fsem', one per semaphore (each on its own cache line),
+   and the 'semId' passed to the functions is the segment's identifier.
+   Each semaphore holds a value and a count of waiters. Operations that
+   don't need to block are done entirely in user space with atomic
+   instructions; only a process that must wait makes a system call
+   (FUTEX_WAIT), and a process that changes the value makes one
+   (FUTEX_WAKE) only if there are waiters. An uncontended reserveSem() or
+   releaseSem() therefore costs a few nanoseconds, rather than the cost
+   of a semop() system call.
+
+   Differences from the System V implementation:
+
+   * bsUseSemUndo is ignored: the kernel can't undo a futex operation
+     when a process terminates.
+
+   * Segments are attached on first use of an identifier and remain
+     attached until fsemRemove() is called. The table of attached
+     segments is not protected by a lock, so a multithreaded program
+     should attach its sets (e.g., with fsemGet()) before creating
+     threads.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include "futex_sems.h"
+#include "tlpi_hdr.h"
+
+Boolean bsUseSemUndo = FALSE;           /* Ignored; see above */
+Boolean bsRetryOnEintr = TRUE;
+
+#define CACHE_LINE 64
+
+struct fsem {
+    int val;                    /* Semaphore value; also the futex word */
+    int waiters;                /* Number of processes in FUTEX_WAIT */
+    char pad[CACHE_LINE - 2 * sizeof(int)];
+};
+
+#define MAX_SETS 64             /* Sets that may be attached at once */
+
+static struct {
+    int semId;
+    int nsems;
+    struct fsem *sems;
+} sets[MAX_SETS];
+static int numSets = 0;
+
+/* Attach the segment 'semId' and add it to the table */
+
+static struct fsem *
+attachSet(int semId, int *nsems)
+{
+    struct shmid_ds ds;
+
+    if (numSets == MAX_SETS) {
+        errno = ENOSPC;
+        return NULL;
+    }
+    if (shmctl(semId, IPC_STAT, &ds) == -1)
+        return NULL;
+
+    struct fsem *sems = shmat(semId, NULL, 0);
+    if (sems == (void *) -1)
+        return NULL;
+
+    sets[numSets].semId = semId;
+    sets[numSets].nsems = ds.shm_segsz / sizeof(struct fsem);
+    sets[numSets].sems = sems;
+    *nsems = sets[numSets].nsems;
+    numSets++;
+    return sems;
+}
+
+/* Return a pointer to semaphore 'semNum' of set 'semId', attaching the
+   set if this is the first time we've seen it, or NULL on error */
+
+static struct fsem *
+getSem(int semId, int semNum)
+{
+    struct fsem *sems = NULL;
+    int nsems = 0;
+
+    for (int j = 0; j < numSets; j++)
+        if (sets[j].semId == semId) {
+            sems = sets[j].sems;
+            nsems = sets[j].nsems;
+            break;
+        }
+
+    if (sems == NULL && (sems = attachSet(semId, &nsems)) == NULL)
+        return NULL;
+
+    if (semNum < 0 || semNum >= nsems) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &sems[semNum];
+}
+
+/* Sleep while 'sem->val' equals 'val'. Returns 0 when woken (perhaps
+   spuriously; the caller rechecks), or -1 with errno set to EINTR. */
+
+static int
+waitWhile(struct fsem *sem, int val)
+{
+    int s;
+
+    __atomic_add_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    s = syscall(SYS_futex, &sem->val, FUTEX_WAIT, val, NULL, NULL, 0);
+    __atomic_sub_fetch(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (s == -1 && errno == EAGAIN)     /* Value changed before we slept */
+        return 0;
+    return s;
+}
+
+/* Having changed 'sem->val', wake up to 'numToWake' waiters, if any */
+
+static int
+wakeWaiters(struct fsem *sem, int numToWake)
+{
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) == 0)
+        return 0;
+    if (syscall(SYS_futex, &sem->val, FUTEX_WAKE, numToWake,
+                NULL, NULL, 0) == -1)
+        return -1;
+    return 0;
+}
+
+/* Set the value of a semaphore, waking everyone waiting on it */
+
+static int
+setVal(int semId, int semNum, int val)
+{
+    struct fsem *sem = getSem(semId, semNum);
+    if (sem == NULL)
+        return -1;
+
+    __atomic_store_n(&sem->val, val, __ATOMIC_SEQ_CST);
+    return wakeWaiters(sem, INT_MAX);
+}
+
+/* Create (or open) a set of 'nsems' semaphores; the arguments are as for
+   semget(). Newly created semaphores have the value 0, as on Linux with
+   semget(). Returns the set identifier, or -1 on error. */
+
+int
+fsemGet(key_t key, int nsems, int semflg)
+{
+    int semId = shmget(key, nsems * sizeof(struct fsem), semflg);
+    if (semId == -1)
+        return -1;
+
+    return (getSem(semId, 0) == NULL) ? -1 : semId;     /* Attach now */
+}
+
+/* Remove a set, and detach it from this process */
+
+int
+fsemRemove(int semId)
+{
+    if (shmctl(semId, IPC_RMID, NULL) == -1)
+        return -1;
+
+    for (int j = 0; j < numSets; j++)
+        if (sets[j].semId == semId) {
+            if (shmdt(sets[j].sems) == -1)
+                return -1;
+            sets[j] = sets[--numSets];
+            break;
+        }
+    return 0;
+}
+
+/* Binary semaphores: see binary_sems.c */
+
+int                     /* Initialize semaphore to 1 (i.e., "available") */
+initSemAvailable(int semId, int semNum)
+{
+    return setVal(semId, semNum, 1);
+}
+
+int                     /* Initialize semaphore to 0 (i.e., "in use") */
+initSemInUse(int semId, int semNum)
+{
+    return setVal(semId, semNum, 0);
+}
+
+/* Reserve semaphore (blocking), return 0 on success, or -1 with 'errno'
+   set to EINTR if operation was interrupted by a signal handler */
+
+int                     /* Reserve semaphore - decrement it by 1 */
+reserveSem(int semId, int semNum)
+{
+    struct fsem *sem = getSem(semId, semNum);
+    if (sem == NULL)
+        return -1;
+
+    for (;;) {
+        int val = __atomic_load_n(&sem->val, __ATOMIC_RELAXED);
+
+        if (val > 0) {
+            if (__atomic_compare_exchange_n(&sem->val, &val, val - 1, false,
+                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return 0;
+            continue;                   /* Lost a race; try again */
+        }
+
+        if (waitWhile(sem, 0) == -1 && (errno != EINTR || !bsRetryOnEintr))
+            return -1;
+    }
+}
+
+int                     /* Release semaphore - increment it by 1 */
+releaseSem(int semId, int semNum)
+{
+    struct fsem *sem = getSem(semId, semNum);
+    if (sem == NULL)
+        return -1;
+
+    __atomic_add_fetch(&sem->val, 1, __ATOMIC_SEQ_CST);
+    return wakeWaiters(sem, 1);
+}
+
+/* Event flags: see event_flags.c. As there, the "set" value is 0 and
+   the "clear" value is 1. */
+
+int
+waitForEventFlag(int semId, int semNum)
+{
+    struct fsem *sem = getSem(semId, semNum);
+    if (sem == NULL)
+        return -1;
+
+    for (;;) {
+        int val = __atomic_load_n(&sem->val, __ATOMIC_ACQUIRE);
+        if (val == 0)
+            return 0;
+        if (waitWhile(sem, val) == -1 && errno != EINTR)
+            return -1;
+    }
+}
+
+int
+clearEventFlag(int semId, int semNum)
+{
+    return setVal(semId, semNum, 1);
+}
+
+int
+setEventFlag(int semId, int semNum)
+{
+    return setVal(semId, semNum, 0);
+}
+
+int
+getFlagState(int semId, int semNum, Boolean *isSet)
+{
+    struct fsem *sem = getSem(semId, semNum);
+    if (sem == NULL)
+        return -1;
+
+    *isSet = (__atomic_load_n(&sem->val, __ATOMIC_ACQUIRE) == 0) ? TRUE : FALSE;
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_sems.h
+
+   Header file for futex_sems.c, which implements the interfaces of
+   binary_sems.h and event_flags.h with futexes.
+
+   A program switches implementation by linking with futex_sems.o instead
+   of binary_sems.o and event_flags.o, and by creating and removing its
+   "semaphore set" with fsemGet() and fsemRemove() in place of semget()
+   and semctl(IPC_RMID). The identifier returned by fsemGet() is passed
+   to the usual functions (reserveSem(), setEventFlag(), ...).
+*/
+#ifndef FUTEX_SEMS_H
+#define FUTEX_SEMS_H
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include "binary_sems.h"
+#include "event_flags.h"
+
+int fsemGet(key_t key, int nsems, int semflg);
+
+int fsemRemove(int semId);
+
+#endif
@@ -0,0 +1,222 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_ring.c
+
+   A single-producer, single-consumer ring of slots in shared memory.
+
+   The producer fills the slot returned by ringGetFree() and then calls
+   ringPublish(); the consumer empties the slot returned by ringGetFull()
+   and then calls ringRelease(). As long as the ring is neither full nor
+   empty, the two sides run concurrently and no system calls are made:
+   each side just advances its own cursor with a release store and
+   reads the other's with an acquire load.
+
+   Only when a side finds the ring full (producer) or empty (consumer)
+   does it block. It first spins briefly, re-reading the other cursor;
+   then it sets its 'waiting' flag and sleeps with FUTEX_WAIT on the other
+   side's cursor. The other side issues a FUTEX_WAKE after advancing its
+   cursor only if that flag is set. (A full barrier between "advance
+   cursor" and "test flag" on one side, and between "set flag" and
+   "recheck cursor" on the other, ensures that a wakeup can't be missed.)
+
+   The consumer may attach the segment before the producer has called
+   ringInit(). ringInit() therefore stores the 'magic' field last, with
+   release semantics, and ringAwaitInit() sleeps on that field until it
+   reads RING_MAGIC; only then are 'numSlots' and the cursors valid.
+
+   Since the futex word lives in a shared mapping, the (non-private) futex
+   operations work between unrelated processes.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <string.h>
+#include "svshm_ring.h"
+#include "tlpi_hdr.h"
+
+#define SPIN_LIMIT 1000         /* Cursor checks before sleeping */
+
+static void
+futexWait(unsigned int *addr, unsigned int val)
+{
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+            errno != EAGAIN && errno != EINTR)
+        errExit("futex-FUTEX_WAIT");
+}
+
+static void
+futexWake(unsigned int *addr)
+{
+    if (syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0) == -1)
+        errExit("futex-FUTEX_WAKE");
+}
+
+/* Return after the other side's cursor ('other') has moved from 'seen';
+   'self' is the caller's cursor */
+
+static void
+awaitChange(struct ringCursor *self, struct ringCursor *other,
+            unsigned int seen)
+{
+    for (int j = 0; j < SPIN_LIMIT; j++)
+        if (__atomic_load_n(&other->pos, __ATOMIC_ACQUIRE) != seen)
+            return;
+
+    __atomic_store_n(&self->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&other->pos, __ATOMIC_ACQUIRE) == seen) {
+        self->numWaits++;
+        futexWait(&other->pos, seen);
+    }
+
+    __atomic_store_n(&self->waiting, 0, __ATOMIC_RELAXED);
+}
+
+/* Advance the caller's cursor 'self' and wake the other side, if it
+   is asleep waiting for that to happen */
+
+static void
+advance(struct ringCursor *self, struct ringCursor *other)
+{
+    __atomic_store_n(&self->pos, self->pos + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&other->waiting, __ATOMIC_RELAXED))
+        futexWake(&self->pos);
+}
+
+/* The cursors wrap at 2^32, so the slot for a cursor value is found with
+   a mask: for that to stay consistent across the wrap, the number of
+   slots is rounded up to a power of 2 */
+
+static unsigned int
+roundSlots(unsigned int numSlots)
+{
+    unsigned int n = 1;
+
+    while (n < numSlots)
+        n <<= 1;
+    return n;
+}
+
+static struct ringSlot *
+slotAt(struct ring *r, unsigned int pos)
+{
+    return (struct ringSlot *)
+           ((char *) (r + 1) + (size_t) (pos & (r->numSlots - 1)) * r->stride);
+}
+
+static size_t
+slotStride(unsigned int slotSize)
+{
+    size_t len = offsetof(struct ringSlot, buf) + slotSize;
+
+    return (len + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+/* Return the number of bytes of shared memory needed for a ring of (at
+   least) 'numSlots' slots */
+
+size_t
+ringSize(unsigned int numSlots, unsigned int slotSize)
+{
+    return sizeof(struct ring) +
+           (size_t) roundSlots(numSlots) * slotStride(slotSize);
+}
+
+/* Initialize an (empty) ring in 'r', which must be at least
+   ringSize(numSlots, slotSize) bytes and zero-filled, and wake a consumer
+   waiting in ringAwaitInit(). 'numSlots' is rounded up to a power of 2. */
+
+void
+ringInit(struct ring *r, unsigned int numSlots, unsigned int slotSize)
+{
+    memset(r, 0, sizeof(struct ring));
+    r->numSlots = roundSlots(numSlots);
+    r->slotSize = slotSize;
+    r->stride = slotStride(slotSize);
+
+    __atomic_store_n(&r->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    futexWake(&r->magic);
+}
+
+/* Consumer: wait until the producer has initialized the ring */
+
+void
+ringAwaitInit(struct ring *r)
+{
+    for (;;) {
+        unsigned int m = __atomic_load_n(&r->magic, __ATOMIC_ACQUIRE);
+        if (m == RING_MAGIC)
+            return;
+        futexWait(&r->magic, m);
+    }
+}
+
+/* Producer: return the next slot to fill, waiting while the ring is full */
+
+struct ringSlot *
+ringGetFree(struct ring *r)
+{
+    for (;;) {
+        unsigned int c = __atomic_load_n(&r->cons.pos, __ATOMIC_ACQUIRE);
+        if (r->prod.pos - c < r->numSlots)
+            return slotAt(r, r->prod.pos);
+        awaitChange(&r->prod, &r->cons, c);
+    }
+}
+
+/* Producer: hand the slot returned by ringGetFree() to the consumer */
+
+void
+ringPublish(struct ring *r)
+{
+    advance(&r->prod, &r->cons);
+}
+
+/* Consumer: return the next slot to empty, waiting while the ring is empty */
+
+struct ringSlot *
+ringGetFull(struct ring *r)
+{
+    for (;;) {
+        unsigned int p = __atomic_load_n(&r->prod.pos, __ATOMIC_ACQUIRE);
+        if (p != r->cons.pos)
+            return slotAt(r, r->cons.pos);
+        awaitChange(&r->cons, &r->prod, p);
+    }
+}
+
+/* Consumer: give the slot returned by ringGetFull() back to the producer */
+
+void
+ringRelease(struct ring *r)
+{
+    advance(&r->cons, &r->prod);
+}
+
+/* Producer: wait until the consumer has emptied every published slot */
+
+void
+ringDrain(struct ring *r)
+{
+    for (;;) {
+        unsigned int c = __atomic_load_n(&r->cons.pos, __ATOMIC_ACQUIRE);
+        if (c == r->prod.pos)
+            return;
+        awaitChange(&r->prod, &r->cons, c);
+    }
+}
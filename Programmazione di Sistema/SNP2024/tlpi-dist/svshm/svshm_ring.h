@@ -0,0 +1,76 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_ring.h
+
+   Header file for svshm_ring.c: a single-producer, single-consumer ring
+   of fixed-size slots, laid out in a shared memory segment.
+*/
+#ifndef SVSHM_RING_H
+#define SVSHM_RING_H
+
+#include <stddef.h>
+
+#define CACHE_LINE 64           /* Assumed size of a CPU cache line */
+
+#define RING_MAGIC 0x52494e47   /* "RING": set once the ring is initialized */
+
+/* Each cursor is written by one side only, and has a cache line to itself,
+   so that the producer and consumer don't invalidate each other's cache
+   line on every slot. 'pos' counts slots produced (or consumed) since the
+   ring was initialized; it also serves as the futex word on which the
+   other side sleeps when the ring is empty (or full). */
+
+struct ringCursor {
+    unsigned int pos;           /* Slots produced/consumed so far */
+    int waiting;                /* Owner is (about to go) asleep */
+    unsigned long numWaits;     /* Times the owner had to sleep */
+    char pad[CACHE_LINE - 2 * sizeof(int) - sizeof(unsigned long)];
+};
+
+struct ringSlot {
+    int cnt;                    /* Number of bytes used in 'buf' */
+    char buf[];                 /* 'slotSize' bytes */
+};
+
+/* A newly created System V segment is zero-filled, so 'magic' reads as 0
+   until ringInit() has finished; the consumer must not touch the ring
+   before ringAwaitInit() has seen RING_MAGIC. */
+
+struct ring {
+    size_t stride;              /* Bytes between successive slots */
+    unsigned int numSlots;      /* A power of 2, fixed by ringInit() */
+    unsigned int slotSize;
+    unsigned int magic;         /* RING_MAGIC, stored last by ringInit() */
+    char pad[CACHE_LINE - sizeof(size_t) - 3 * sizeof(int)];
+    struct ringCursor prod;     /* Written only by the producer */
+    struct ringCursor cons;     /* Written only by the consumer */
+    /* Followed by 'numSlots' slots, each 'stride' bytes */
+};
+
+size_t ringSize(unsigned int numSlots, unsigned int slotSize);
+
+void ringInit(struct ring *r, unsigned int numSlots, unsigned int slotSize);
+
+void ringAwaitInit(struct ring *r);
+
+struct ringSlot *ringGetFree(struct ring *r);
+
+void ringPublish(struct ring *r);
+
+struct ringSlot *ringGetFull(struct ring *r);
+
+void ringRelease(struct ring *r);
+
+void ringDrain(struct ring *r);
+
+#endif
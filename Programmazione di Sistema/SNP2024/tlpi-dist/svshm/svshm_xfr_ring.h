@@ -0,0 +1,32 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/*  svshm_xfr_ring.h
+
+   Header file used by the svshm_xfr_ring_reader.c and
+   svshm_xfr_ring_writer.c programs.
+*/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/shm.h>
+#include "svshm_ring.h"         /* Declares our ring buffer functions */
+#include "tlpi_hdr.h"
+
+/* Hard-coded key for the shared memory segment (distinct from the key
+   used by svshm_xfr_writer.c, so both pairs of programs can coexist) */
+
+#define SHM_KEY 0x1235
+
+#define OBJ_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+
+#define DEF_NUM_SLOTS 16        /* Default ring geometry */
+#define DEF_SLOT_SIZE 65536
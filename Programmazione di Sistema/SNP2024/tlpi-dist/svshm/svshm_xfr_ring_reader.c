@@ -0,0 +1,79 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/*  svshm_xfr_ring_reader.c
+
+   Read data from the ring of slots in a System V shared memory segment
+   created by svshm_xfr_ring_writer.c, and report the transfer rate.
+
+   Unlike svshm_xfr_reader.c, we must attach the segment read-write,
+   since we advance the consumer cursor that lives in the segment.
+
+   This program is Linux-specific.
+*/
+#include <time.h>
+#include "svshm_xfr_ring.h"
+
+int
+main(int argc, char *argv[])
+{
+    /* Get ID for the shared memory created by writer */
+
+    int shmid = shmget(SHM_KEY, 0, 0);
+    if (shmid == -1)
+        errExit("shmget");
+
+    struct ring *r = shmat(shmid, NULL, 0);
+    if (r == (void *) -1)
+        errExit("shmat");
+
+    /* The writer may not yet have initialized the ring */
+
+    ringAwaitInit(r);
+
+    struct timespec start, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    /* Transfer blocks of data from shared memory to stdout */
+
+    long long bytes = 0;
+    long xfrs;
+
+    for (xfrs = 0; ; xfrs++) {
+        struct ringSlot *slot = ringGetFull(r);         /* Wait for data */
+
+        int cnt = slot->cnt;
+        if (cnt > 0 && write(STDOUT_FILENO, slot->buf, cnt) != cnt)
+            fatal("partial/failed write");
+        bytes += cnt;
+
+        ringRelease(r);                                 /* Slot is free */
+
+        if (cnt == 0)                           /* Writer encountered EOF */
+            break;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Received %lld bytes (%ld xfrs, %lu waits for data) "
+            "in %.3f s (%.1f MB/s)\n", bytes, xfrs, r->cons.numWaits,
+            secs, (secs > 0) ? bytes / secs / 1e6 : 0.0);
+
+    if (shmdt(r) == -1)
+        errExit("shmdt");
+
+    exit(EXIT_SUCCESS);
+}
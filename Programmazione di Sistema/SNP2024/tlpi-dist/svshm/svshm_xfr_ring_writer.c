@@ -0,0 +1,98 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/*  svshm_xfr_ring_writer.c
+
+   A version of svshm_xfr_writer.c that transfers data through a ring of
+   slots in the shared memory segment (see svshm_ring.c), rather than
+   through a single buffer handed back and forth with a pair of
+   semaphores. The writer can fill free slots while the reader is still
+   emptying earlier ones, and neither side makes a system call (other
+   than read() or write() for the data itself) unless the ring becomes
+   full or empty.
+
+   Usage: svshm_xfr_ring_writer [-n num-slots] [-s slot-size]
+
+   As with svshm_xfr_writer, this program must be started before the
+   reader, since it creates the shared memory segment:
+
+        $ svshm_xfr_ring_writer < infile &
+        $ svshm_xfr_ring_reader > out_file
+
+   This program is Linux-specific.
+*/
+#include "svshm_xfr_ring.h"
+
+int
+main(int argc, char *argv[])
+{
+    int numSlots = DEF_NUM_SLOTS, slotSize = DEF_SLOT_SIZE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n': numSlots = getInt(optarg, GN_GT_0, "num-slots");      break;
+        case 's': slotSize = getInt(optarg, GN_GT_0, "slot-size");      break;
+        default:  usageErr("%s [-n num-slots] [-s slot-size]\n", argv[0]);
+        }
+    }
+
+    /* Create shared memory; attach at address chosen by system. We insist
+       on a new (hence zero-filled) segment: ringAwaitInit() in the reader
+       relies on the ring's magic number being 0 until ringInit(). */
+
+    int shmid = shmget(SHM_KEY, ringSize(numSlots, slotSize),
+                       IPC_CREAT | IPC_EXCL | OBJ_PERMS);
+    if (shmid == -1)
+        errExit("shmget");
+
+    struct ring *r = shmat(shmid, NULL, 0);
+    if (r == (void *) -1)
+        errExit("shmat");
+
+    ringInit(r, numSlots, slotSize);
+
+    /* Transfer blocks of data from stdin to shared memory. A slot
+       with a count of 0 tells the reader that we reached EOF. */
+
+    long long bytes = 0;
+    long xfrs;
+
+    for (xfrs = 0; ; xfrs++) {
+        struct ringSlot *slot = ringGetFree(r);         /* Wait for space */
+
+        slot->cnt = read(STDIN_FILENO, slot->buf, slotSize);
+        if (slot->cnt == -1)
+            errExit("read");
+        bytes += slot->cnt;
+
+        ringPublish(r);                                 /* Pass to reader */
+
+        if (slot->cnt == 0)
+            break;
+    }
+
+    /* Wait until the reader has emptied the ring. We then know
+       reader has finished, and so we can delete the segment. */
+
+    ringDrain(r);
+
+    fprintf(stderr, "Sent %lld bytes (%ld xfrs, %lu waits for space)\n",
+            bytes, xfrs, r->prod.numWaits);
+
+    if (shmdt(r) == -1)
+        errExit("shmdt");
+    if (shmctl(shmid, IPC_RMID, NULL) == -1)
+        errExit("shmctl");
+
+    exit(EXIT_SUCCESS);
+}
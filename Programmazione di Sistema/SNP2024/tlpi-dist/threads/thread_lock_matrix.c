@@ -0,0 +1,551 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 33 */
+
+/* thread_lock_matrix.c
+
+   An in-process extension of thread_lock_speed.c. Rather than running the
+   program once per configuration under time(1), this program runs a
+   matrix of configurations itself, measuring each for a fixed time. In
+   each configuration, a number of threads repeatedly acquire a lock,
+   increment a shared variable 'cs-len' times (the critical section),
+   release the lock, and then do 'think' iterations of private work.
+
+   The locks compared are:
+
+        mutex       A default (PTHREAD_MUTEX_NORMAL) mutex
+        adaptive    A PTHREAD_MUTEX_ADAPTIVE_NP mutex, which spins briefly
+                    before sleeping
+        rwlock      A read-write lock, always locked for writing
+        spin        A pthread spin lock
+        ticket      A ticket lock: FIFO, but all waiters spin on one word
+        mcs         An MCS queue lock: FIFO, each waiter spins on its own
+                    queue node
+        futex       A mutex built directly on futex(2), as in Drepper's
+                    "Futexes Are Tricky"
+        faa         No lock: each increment is an atomic fetch-and-add
+
+   The ticket and MCS locks yield the CPU after spinning for a while, so
+   that they remain usable when there are more threads than CPUs.
+
+   For each configuration, the program displays the throughput (critical
+   sections per second), the fairness of the distribution of critical
+   sections among threads (the ratio of the smallest to the largest
+   per-thread count, and Jain's fairness index, which is 1 when all
+   threads do the same amount of work), and, if perf_event_open(2) is
+   available, the number of cache misses per critical section.
+
+   Usage: thread_lock_matrix [-l lock,...] [-t threads,...] [-c cs-len,...]
+                [-w think,...] [-d msecs]
+
+   Each option takes a comma-separated list. The defaults are: all locks;
+   1,2,4,8,16 threads; critical sections of 1 and 100 increments; think
+   times of 0 and 100 iterations; and 100 milliseconds per configuration.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define SPINS_BEFORE_YIELD 1000
+#define MAX_LIST 32
+
+struct mcsNode {
+    struct mcsNode *next;
+    int locked;
+};
+
+struct thread {                 /* Per-thread state */
+    pthread_t tid;
+    long ops;                   /* Critical sections completed */
+    uint64_t misses;            /* Cache misses */
+    bool haveMisses;
+    struct mcsNode node;        /* This thread's MCS queue node */
+    char pad[64];
+};
+
+struct lockType {
+    const char *name;
+    void (*init)(void);
+    void (*lock)(struct thread *t);
+    void (*unlock)(struct thread *t);
+};
+
+/* The shared variable and the locks; each in its own cache line. The
+   other variables are aligned too, so that none of them can share a
+   line with a lock. */
+
+#define CACHE_ALIGNED __attribute__((aligned(64)))
+
+static struct { volatile long val; char pad[64]; } glob CACHE_ALIGNED;
+
+static pthread_mutex_t mtx CACHE_ALIGNED;
+static pthread_rwlock_t rwl CACHE_ALIGNED;
+static pthread_spinlock_t splock CACHE_ALIGNED;
+static struct { unsigned int next; char pad[64];
+                unsigned int serving; } ticket CACHE_ALIGNED;
+static struct mcsNode *mcsTail CACHE_ALIGNED;
+static int futexWord CACHE_ALIGNED;
+
+static int csLen CACHE_ALIGNED, thinkLen;
+static int stop CACHE_ALIGNED;
+static pthread_barrier_t barrier CACHE_ALIGNED;
+
+static void
+cpuRelax(int *spins)
+{
+    if (++*spins >= SPINS_BEFORE_YIELD) {
+        *spins = 0;
+        sched_yield();
+    } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        __asm__ __volatile__("yield");
+#endif
+    }
+}
+
+/***********************************************************************/
+
+static void
+mutexInit(void)
+{
+    int s = pthread_mutex_init(&mtx, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_init");
+}
+
+static void
+adaptiveInit(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    int s = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    if (s != 0)
+        errExitEN(s, "pthread_mutexattr_settype");
+    s = pthread_mutex_init(&mtx, &attr);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_init");
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void
+mutexLock(struct thread *t)
+{
+    int s = pthread_mutex_lock(&mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+}
+
+static void
+mutexUnlock(struct thread *t)
+{
+    int s = pthread_mutex_unlock(&mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+}
+
+static void
+rwlockInit(void)
+{
+    int s = pthread_rwlock_init(&rwl, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_rwlock_init");
+}
+
+static void
+rwlockLock(struct thread *t)
+{
+    int s = pthread_rwlock_wrlock(&rwl);
+    if (s != 0)
+        errExitEN(s, "pthread_rwlock_wrlock");
+}
+
+static void
+rwlockUnlock(struct thread *t)
+{
+    int s = pthread_rwlock_unlock(&rwl);
+    if (s != 0)
+        errExitEN(s, "pthread_rwlock_unlock");
+}
+
+static void
+spinInit(void)
+{
+    int s = pthread_spin_init(&splock, PTHREAD_PROCESS_PRIVATE);
+    if (s != 0)
+        errExitEN(s, "pthread_spin_init");
+}
+
+static void
+spinLock(struct thread *t)
+{
+    int s = pthread_spin_lock(&splock);
+    if (s != 0)
+        errExitEN(s, "pthread_spin_lock");
+}
+
+static void
+spinUnlock(struct thread *t)
+{
+    int s = pthread_spin_unlock(&splock);
+    if (s != 0)
+        errExitEN(s, "pthread_spin_unlock");
+}
+
+/* Ticket lock: take a number, and wait until it is being served */
+
+static void
+ticketInit(void)
+{
+    ticket.next = ticket.serving = 0;
+}
+
+static void
+ticketLock(struct thread *t)
+{
+    unsigned int my = __atomic_fetch_add(&ticket.next, 1, __ATOMIC_RELAXED);
+    int spins = 0;
+
+    while (__atomic_load_n(&ticket.serving, __ATOMIC_ACQUIRE) != my)
+        cpuRelax(&spins);
+}
+
+static void
+ticketUnlock(struct thread *t)
+{
+    __atomic_store_n(&ticket.serving, ticket.serving + 1, __ATOMIC_RELEASE);
+}
+
+/* MCS lock: waiters form a queue, each spinning on its own node until
+   its predecessor hands the lock on */
+
+static void
+mcsInit(void)
+{
+    mcsTail = NULL;
+}
+
+static void
+mcsLock(struct thread *t)
+{
+    struct mcsNode *me = &t->node;
+    int spins = 0;
+
+    me->next = NULL;
+    me->locked = 1;
+    struct mcsNode *pred = __atomic_exchange_n(&mcsTail, me,
+                                               __ATOMIC_ACQ_REL);
+    if (pred != NULL) {
+        __atomic_store_n(&pred->next, me, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE))
+            cpuRelax(&spins);
+    }
+}
+
+static void
+mcsUnlock(struct thread *t)
+{
+    struct mcsNode *me = &t->node;
+    int spins = 0;
+
+    struct mcsNode *succ = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if (succ == NULL) {
+        struct mcsNode *expected = me;
+        if (__atomic_compare_exchange_n(&mcsTail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;                     /* No waiters */
+
+        /* A waiter has swapped itself into 'mcsTail', but not yet linked
+           itself to us */
+
+        while ((succ = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL)
+            cpuRelax(&spins);
+    }
+    __atomic_store_n(&succ->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* Futex mutex: 0 = unlocked, 1 = locked, 2 = locked with (possible)
+   waiters */
+
+static void
+futexInit(void)
+{
+    futexWord = 0;
+}
+
+static void
+futexLock(struct thread *t)
+{
+    int c = 0;
+
+    if (__atomic_compare_exchange_n(&futexWord, &c, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;                         /* Uncontended */
+
+    if (c != 2)
+        c = __atomic_exchange_n(&futexWord, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        syscall(SYS_futex, &futexWord, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        c = __atomic_exchange_n(&futexWord, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static void
+futexUnlock(struct thread *t)
+{
+    if (__atomic_fetch_sub(&futexWord, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&futexWord, 0, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &futexWord, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static const struct lockType lockTypes[] = {
+    { "mutex",    mutexInit,    mutexLock,    mutexUnlock },
+    { "adaptive", adaptiveInit, mutexLock,    mutexUnlock },
+    { "rwlock",   rwlockInit,   rwlockLock,   rwlockUnlock },
+    { "spin",     spinInit,     spinLock,     spinUnlock },
+    { "ticket",   ticketInit,   ticketLock,   ticketUnlock },
+    { "mcs",      mcsInit,      mcsLock,      mcsUnlock },
+    { "futex",    futexInit,    futexLock,    futexUnlock },
+    { "faa",      NULL,         NULL,         NULL },
+};
+
+#define NUM_LOCK_TYPES (sizeof(lockTypes) / sizeof(lockTypes[0]))
+
+static const struct lockType *curLock CACHE_ALIGNED;
+
+/***********************************************************************/
+
+/* Open a counter for cache misses in the calling thread. Returns -1 if
+   perf_event_open() isn't available (e.g., in many virtual machines, or
+   if /proc/sys/kernel/perf_event_paranoid forbids it). */
+
+static int
+openMissCounter(void)
+{
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_MISSES;
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct thread *t = arg;
+    volatile long think = 0;
+
+    int perfFd = openMissCounter();
+
+    pthread_barrier_wait(&barrier);     /* Start together */
+    if (perfFd != -1)
+        ioctl(perfFd, PERF_EVENT_IOC_ENABLE, 0);
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        if (curLock->lock != NULL) {
+            curLock->lock(t);
+            for (int k = 0; k < csLen; k++)
+                glob.val++;
+            curLock->unlock(t);
+        } else {
+            for (int k = 0; k < csLen; k++)
+                __atomic_fetch_add(&glob.val, 1, __ATOMIC_RELAXED);
+        }
+        t->ops++;
+
+        for (int k = 0; k < thinkLen; k++)
+            think++;
+    }
+
+    if (perfFd != -1) {
+        ioctl(perfFd, PERF_EVENT_IOC_DISABLE, 0);
+        t->haveMisses = read(perfFd, &t->misses, sizeof(uint64_t)) ==
+                        sizeof(uint64_t);
+        close(perfFd);
+    }
+    return NULL;
+}
+
+/* Run one configuration for 'msecs' milliseconds, and print a line of
+   results */
+
+static void
+runOne(const struct lockType *lt, int numThreads, long msecs)
+{
+    struct thread *threads = calloc(numThreads, sizeof(struct thread));
+    int s;
+
+    if (threads == NULL)
+        errExit("calloc");
+
+    curLock = lt;
+    if (lt->init != NULL)
+        lt->init();
+    glob.val = 0;
+    stop = 0;
+
+    s = pthread_barrier_init(&barrier, NULL, numThreads + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_create(&threads[j].tid, NULL, threadFunc, &threads[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    struct timespec start, end, req = { msecs / 1000,
+                                        (msecs % 1000) * 1000000 };
+    pthread_barrier_wait(&barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nanosleep(&req, NULL);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_join(threads[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&barrier);
+
+    /* Summarize */
+
+    long total = 0, minOps = LONG_MAX, maxOps = 0;
+    double sumSq = 0;
+    uint64_t misses = 0;
+    bool haveMisses = true;
+
+    for (int j = 0; j < numThreads; j++) {
+        total += threads[j].ops;
+        minOps = min(minOps, threads[j].ops);
+        maxOps = max(maxOps, threads[j].ops);
+        sumSq += (double) threads[j].ops * threads[j].ops;
+        misses += threads[j].misses;
+        haveMisses = haveMisses && threads[j].haveMisses;
+    }
+
+    if (glob.val != total * csLen)
+        fatal("%s: shared variable is %ld; expected %ld", lt->name,
+              glob.val, total * csLen);
+
+    double secs = (end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1e9;
+    double jain = (sumSq > 0) ? (double) total * total /
+                                (numThreads * sumSq) : 0;
+
+    printf("%-9s %7d %6d %6d %10.3f %7.3f %6.3f ", lt->name, numThreads,
+           csLen, thinkLen, total / secs / 1e6,
+           (maxOps > 0) ? (double) minOps / maxOps : 0, jain);
+    if (haveMisses && total > 0)
+        printf("%9.2f\n", (double) misses / total);
+    else
+        printf("%9s\n", "-");
+    fflush(stdout);
+
+    free(threads);
+}
+
+/* Parse a comma-separated list of positive integers */
+
+static int
+parseList(char *str, int list[], const char *name)
+{
+    int n = 0;
+
+    for (char *tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_LIST)
+            cmdLineErr("Too many values for %s\n", name);
+        list[n++] = getInt(tok, GN_NONNEG, name);
+    }
+    return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool useLock[NUM_LOCK_TYPES];
+    int threadList[MAX_LIST] = { 1, 2, 4, 8, 16 }, numThreadVals = 5;
+    int csList[MAX_LIST] = { 1, 100 }, numCsVals = 2;
+    int thinkList[MAX_LIST] = { 0, 100 }, numThinkVals = 2;
+    long msecs = 100;
+    int opt;
+
+    for (size_t j = 0; j < NUM_LOCK_TYPES; j++)
+        useLock[j] = true;
+
+    while ((opt = getopt(argc, argv, "l:t:c:w:d:")) != -1) {
+        switch (opt) {
+        case 'l':
+            for (size_t j = 0; j < NUM_LOCK_TYPES; j++)
+                useLock[j] = false;
+            for (char *tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                size_t j;
+                for (j = 0; j < NUM_LOCK_TYPES; j++)
+                    if (strcmp(tok, lockTypes[j].name) == 0)
+                        break;
+                if (j == NUM_LOCK_TYPES)
+                    cmdLineErr("Unknown lock type: %s\n", tok);
+                useLock[j] = true;
+            }
+            break;
+        case 't': numThreadVals = parseList(optarg, threadList, "threads");
+                                                                        break;
+        case 'c': numCsVals = parseList(optarg, csList, "cs-len");      break;
+        case 'w': numThinkVals = parseList(optarg, thinkList, "think"); break;
+        case 'd': msecs = getLong(optarg, GN_GT_0, "msecs");            break;
+        default:
+            usageErr("%s [-l lock,...] [-t threads,...] [-c cs-len,...] "
+                     "[-w think,...] [-d msecs]\n", argv[0]);
+        }
+    }
+
+    for (int j = 0; j < numThreadVals; j++)
+        if (threadList[j] < 1)
+            cmdLineErr("Thread counts must be at least 1\n");
+
+    printf("%-9s %7s %6s %6s %10s %7s %6s %9s\n", "Lock", "Threads",
+           "CS", "Think", "Mops/s", "Min/max", "Jain", "Miss/op");
+
+    for (int c = 0; c < numCsVals; c++) {
+        csLen = csList[c];
+        for (int w = 0; w < numThinkVals; w++) {
+            thinkLen = thinkList[w];
+            for (size_t l = 0; l < NUM_LOCK_TYPES; l++) {
+                if (!useLock[l])
+                    continue;
+                for (int t = 0; t < numThreadVals; t++)
+                    runOne(&lockTypes[l], threadList[t], msecs);
+            }
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,430 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* work_queue.c
+
+   A bounded multi-producer, multi-consumer work queue, intended as a
+   reusable replacement for the pattern in prod_condvar.c, where a single
+   mutex and condition variable protect a global count of available
+   units, and a consumer is woken for each unit produced.
+
+   Here, the queue is divided into one "lane" (a ring buffer with its own
+   mutex) for each consumer:
+
+   * Producers add items in batches: all of the items passed to one
+     wqPushBatch() call go, as far as space permits, to a single lane,
+     with successive calls choosing lanes round robin. So the cost of
+     locking is shared by the items in a batch.
+
+   * A consumer takes a batch of items from its own lane. If that is
+     empty, it steals up to half of the items in another consumer's lane.
+
+   * A thread that finds the queue empty (or, for a producer, full) polls
+     for a while ('spinIters') before going to sleep on a condition
+     variable. Threads are woken only if some thread is actually asleep,
+     so that, under load, producers and consumers don't touch the shared
+     mutex at all.
+
+   If 'timestamps' is set, each batch is stamped when it is enqueued, and
+   the time each item spent in the queue is recorded in a histogram by the
+   consumer that dequeues it.
+
+   A given consumer number should be used by only one thread at a time.
+*/
+#include <pthread.h>
+#include <time.h>
+#include "work_queue.h"
+#include "tlpi_hdr.h"
+
+struct slot {
+    void *item;
+    long long enqNs;            /* When enqueued, if 'timestamps' */
+};
+
+struct lane {
+    pthread_mutex_t mtx;
+    struct slot *ring;
+    size_t head, tail;          /* Take at head; add at tail */
+    char pad[64];               /* Keep lanes in separate cache lines */
+};
+
+struct consumer {
+    struct wqStats stats;       /* Updated only by this consumer */
+    char pad[64];
+};
+
+struct WorkQueue {
+    struct wqOptions opts;
+    int numLanes;
+    size_t laneCap;             /* A power of 2 */
+    struct lane *lanes;
+    struct consumer *consumers;
+    long count;                 /* Items in all lanes */
+    long limit;                 /* Most items the lanes can hold */
+    unsigned long nextLane;     /* Lane for the next producer batch */
+    int closed;
+    pthread_mutex_t parkMtx;    /* Protects waiting on the conditions */
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    int consWaiting;            /* Consumers asleep on 'notEmpty' */
+    int prodWaiting;            /* Producers asleep on 'notFull' */
+    unsigned long numPushed;
+    unsigned long numProducerWaits;
+};
+
+void
+wqDefaultOptions(struct wqOptions *opts)
+{
+    opts->capacity = 4096;
+    opts->numConsumers = 1;
+    opts->spinIters = 200;
+    opts->timestamps = 0;
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+cpuRelax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/* Create a queue. Returns NULL on error, with errno set. */
+
+struct WorkQueue *
+wqCreate(const struct wqOptions *opts)
+{
+    if (opts->numConsumers < 1 || opts->capacity < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct WorkQueue *wq = calloc(1, sizeof(struct WorkQueue));
+    if (wq == NULL)
+        return NULL;
+    wq->opts = *opts;
+    wq->numLanes = opts->numConsumers;
+
+    size_t perLane = (opts->capacity + wq->numLanes - 1) / wq->numLanes;
+    for (wq->laneCap = 1; wq->laneCap < perLane; wq->laneCap *= 2)
+        continue;
+    wq->limit = wq->laneCap * wq->numLanes;
+
+    wq->lanes = calloc(wq->numLanes, sizeof(struct lane));
+    wq->consumers = calloc(wq->numLanes, sizeof(struct consumer));
+    if (wq->lanes == NULL || wq->consumers == NULL)
+        goto fail;
+
+    for (int j = 0; j < wq->numLanes; j++) {
+        wq->lanes[j].ring = malloc(wq->laneCap * sizeof(struct slot));
+        if (wq->lanes[j].ring == NULL)
+            goto fail;
+        pthread_mutex_init(&wq->lanes[j].mtx, NULL);
+    }
+    pthread_mutex_init(&wq->parkMtx, NULL);
+    pthread_cond_init(&wq->notEmpty, NULL);
+    pthread_cond_init(&wq->notFull, NULL);
+    return wq;
+
+fail:
+    if (wq->lanes != NULL)
+        for (int j = 0; j < wq->numLanes; j++)
+            free(wq->lanes[j].ring);
+    free(wq->lanes);
+    free(wq->consumers);
+    free(wq);
+    errno = ENOMEM;
+    return NULL;
+}
+
+/* Wake threads sleeping on 'cond', if there are any. The sleeper
+   increments '*waiting' before checking the queue state, and we check
+   '*waiting' after changing the queue state (both with sequentially
+   consistent operations), so at least one of us sees the other's
+   change. */
+
+static void
+wakeWaiters(struct WorkQueue *wq, int *waiting, pthread_cond_t *cond,
+            bool all)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) == 0)
+        return;
+
+    pthread_mutex_lock(&wq->parkMtx);
+    if (all)
+        pthread_cond_broadcast(cond);
+    else
+        pthread_cond_signal(cond);
+    pthread_mutex_unlock(&wq->parkMtx);
+}
+
+/* Add as many of 'items' as fit to 'ln', returning the number added */
+
+static size_t
+addToLane(struct WorkQueue *wq, struct lane *ln, void *items[], size_t n,
+          long long stamp)
+{
+    pthread_mutex_lock(&ln->mtx);
+
+    size_t m = min(n, wq->laneCap - (ln->tail - ln->head));
+    for (size_t j = 0; j < m; j++) {
+        struct slot *s = &ln->ring[ln->tail++ & (wq->laneCap - 1)];
+        s->item = items[j];
+        s->enqNs = stamp;
+    }
+    if (m > 0)
+        __atomic_add_fetch(&wq->count, m, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&ln->mtx);
+    return m;
+}
+
+/* Enqueue 'n' items, sleeping while the queue is full. Returns 0 on
+   success, or -1 (with errno set to EPIPE) if the queue has been closed,
+   in which case some of the items may have been enqueued. */
+
+int
+wqPushBatch(struct WorkQueue *wq, void *items[], size_t n)
+{
+    long long stamp = wq->opts.timestamps ? nowNs() : 0;
+    size_t total = n;
+
+    while (n > 0) {
+        if (__atomic_load_n(&wq->closed, __ATOMIC_ACQUIRE)) {
+            errno = EPIPE;
+            return -1;
+        }
+
+        unsigned long start = __atomic_fetch_add(&wq->nextLane, 1,
+                                                 __ATOMIC_RELAXED);
+        for (int k = 0; k < wq->numLanes && n > 0; k++) {
+            struct lane *ln = &wq->lanes[(start + k) % wq->numLanes];
+            size_t m = addToLane(wq, ln, items, n, stamp);
+            if (m > 0) {
+                items += m;
+                n -= m;
+                wakeWaiters(wq, &wq->consWaiting, &wq->notEmpty, m > 1);
+            }
+        }
+        if (n == 0)
+            break;
+
+        /* Every lane is full. Poll for a while, then sleep. */
+
+        int spin;
+        for (spin = 0; spin < wq->opts.spinIters; spin++) {
+            if (__atomic_load_n(&wq->count, __ATOMIC_RELAXED) < wq->limit)
+                break;
+            cpuRelax();
+        }
+        if (spin < wq->opts.spinIters)
+            continue;
+
+        pthread_mutex_lock(&wq->parkMtx);
+        __atomic_add_fetch(&wq->prodWaiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&wq->count, __ATOMIC_SEQ_CST) >= wq->limit &&
+                !__atomic_load_n(&wq->closed, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&wq->notFull, &wq->parkMtx);
+        __atomic_sub_fetch(&wq->prodWaiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&wq->parkMtx);
+        __atomic_add_fetch(&wq->numProducerWaits, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(&wq->numPushed, total, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int
+wqPush(struct WorkQueue *wq, void *item)
+{
+    return wqPushBatch(wq, &item, 1);
+}
+
+/* Take up to 'max' items from 'ln' into 'out' */
+
+static size_t
+takeFromLane(struct WorkQueue *wq, struct lane *ln, struct slot *out,
+             size_t max)
+{
+    pthread_mutex_lock(&ln->mtx);
+
+    size_t m = min(max, ln->tail - ln->head);
+    for (size_t j = 0; j < m; j++)
+        out[j] = ln->ring[ln->head++ & (wq->laneCap - 1)];
+    if (m > 0)
+        __atomic_sub_fetch(&wq->count, m, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_unlock(&ln->mtx);
+    return m;
+}
+
+static size_t
+laneLen(const struct lane *ln)
+{
+    return __atomic_load_n(&ln->tail, __ATOMIC_RELAXED) -
+           __atomic_load_n(&ln->head, __ATOMIC_RELAXED);
+}
+
+/* Take up to 'max' items into 'items', for consumer number 'consumer',
+   sleeping while the queue is empty. Returns the number of items taken,
+   or 0 if the queue has been closed and is empty. */
+
+size_t
+wqPopBatch(struct WorkQueue *wq, int consumer, void *items[], size_t max)
+{
+    struct consumer *cs = &wq->consumers[consumer];
+    struct slot out[256];
+    size_t got = 0;
+
+    max = min(max, sizeof(out) / sizeof(out[0]));
+    if (max == 0)
+        return 0;
+
+    for (;;) {
+        struct lane *own = &wq->lanes[consumer];
+        if (laneLen(own) > 0)
+            got = takeFromLane(wq, own, out, max);
+
+        for (int k = 1; got == 0 && k < wq->numLanes; k++) {
+            struct lane *ln = &wq->lanes[(consumer + k) % wq->numLanes];
+            size_t len = laneLen(ln);   /* Peek without locking */
+            if (len > 0) {
+                got = takeFromLane(wq, ln, out, min(max, (len + 1) / 2));
+                if (got > 0)
+                    cs->stats.numSteals++;
+            }
+        }
+        if (got > 0)
+            break;
+
+        if (__atomic_load_n(&wq->closed, __ATOMIC_ACQUIRE) &&
+                __atomic_load_n(&wq->count, __ATOMIC_ACQUIRE) == 0)
+            return 0;
+
+        /* Poll for a while, then sleep */
+
+        int spin;
+        for (spin = 0; spin < wq->opts.spinIters; spin++) {
+            if (__atomic_load_n(&wq->count, __ATOMIC_RELAXED) > 0)
+                break;
+            cpuRelax();
+        }
+        if (spin < wq->opts.spinIters)
+            continue;
+
+        pthread_mutex_lock(&wq->parkMtx);
+        __atomic_add_fetch(&wq->consWaiting, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&wq->count, __ATOMIC_SEQ_CST) == 0 &&
+                !__atomic_load_n(&wq->closed, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&wq->notEmpty, &wq->parkMtx);
+        __atomic_sub_fetch(&wq->consWaiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&wq->parkMtx);
+        cs->stats.numConsumerWaits++;
+    }
+
+    wakeWaiters(wq, &wq->prodWaiting, &wq->notFull, true);
+
+    long long now = wq->opts.timestamps ? nowNs() : 0;
+    for (size_t j = 0; j < got; j++) {
+        items[j] = out[j].item;
+        if (wq->opts.timestamps) {
+            unsigned long lat = now - out[j].enqNs;
+            int b = (lat == 0) ? 0 : 64 - __builtin_clzll(lat);
+            cs->stats.latHist[min(b, WQ_LAT_BUCKETS - 1)]++;
+            if (lat > cs->stats.latMaxNs)
+                cs->stats.latMaxNs = lat;
+        }
+    }
+    cs->stats.numPopped += got;
+    cs->stats.numPops++;
+    return got;
+}
+
+/* Refuse further items, and wake all sleepers. Consumers can still
+   take the items already queued. */
+
+void
+wqClose(struct WorkQueue *wq)
+{
+    pthread_mutex_lock(&wq->parkMtx);
+    __atomic_store_n(&wq->closed, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&wq->notEmpty);
+    pthread_cond_broadcast(&wq->notFull);
+    pthread_mutex_unlock(&wq->parkMtx);
+}
+
+/* Return the sum of the statistics of all consumers. The result is
+   exact only if no thread is using the queue. */
+
+void
+wqGetStats(struct WorkQueue *wq, struct wqStats *stats)
+{
+    memset(stats, 0, sizeof(struct wqStats));
+    for (int j = 0; j < wq->numLanes; j++) {
+        const struct wqStats *cs = &wq->consumers[j].stats;
+        stats->numPopped += cs->numPopped;
+        stats->numPops += cs->numPops;
+        stats->numSteals += cs->numSteals;
+        stats->numConsumerWaits += cs->numConsumerWaits;
+        for (int b = 0; b < WQ_LAT_BUCKETS; b++)
+            stats->latHist[b] += cs->latHist[b];
+        stats->latMaxNs = max(stats->latMaxNs, cs->latMaxNs);
+    }
+    stats->numPushed = __atomic_load_n(&wq->numPushed, __ATOMIC_RELAXED);
+    stats->numProducerWaits = __atomic_load_n(&wq->numProducerWaits,
+                                              __ATOMIC_RELAXED);
+}
+
+/* Return an upper bound on the 'pct' percentile (0 to 100) of queueing
+   latency, in nanoseconds, from the histogram in 'stats' */
+
+unsigned long
+wqLatencyPercentile(const struct wqStats *stats, double pct)
+{
+    unsigned long total = 0, sum = 0;
+
+    for (int b = 0; b < WQ_LAT_BUCKETS; b++)
+        total += stats->latHist[b];
+
+    for (int b = 0; b < WQ_LAT_BUCKETS; b++) {
+        sum += stats->latHist[b];
+        if (total > 0 && sum >= total * pct / 100)
+            return min(1UL << b, max(stats->latMaxNs, 1UL));
+    }
+    return 0;
+}
+
+void
+wqDestroy(struct WorkQueue *wq)
+{
+    for (int j = 0; j < wq->numLanes; j++) {
+        pthread_mutex_destroy(&wq->lanes[j].mtx);
+        free(wq->lanes[j].ring);
+    }
+    pthread_mutex_destroy(&wq->parkMtx);
+    pthread_cond_destroy(&wq->notEmpty);
+    pthread_cond_destroy(&wq->notFull);
+    free(wq->lanes);
+    free(wq->consumers);
+    free(wq);
+}
@@ -0,0 +1,65 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* work_queue.h
+
+   Header file for work_queue.c.
+*/
+#ifndef WORK_QUEUE_H
+#define WORK_QUEUE_H
+
+#include <stddef.h>
+
+struct wqOptions {
+    size_t capacity;            /* Most items the queue holds at once */
+    int numConsumers;           /* Consumers are numbered 0..N-1 */
+    int spinIters;              /* Times to poll before sleeping */
+    int timestamps;             /* If nonzero, measure queueing latency */
+};
+
+#define WQ_LAT_BUCKETS 40       /* Latency histogram: bucket 'j' counts
+                                   items that waited [2^(j-1), 2^j) ns */
+
+struct wqStats {
+    unsigned long numPushed;    /* Items enqueued */
+    unsigned long numPopped;    /* Items dequeued */
+    unsigned long numPops;      /* Successful wqPopBatch() calls */
+    unsigned long numSteals;    /* Pops that took items from another
+                                   consumer's lane */
+    unsigned long numConsumerWaits;     /* Times a consumer slept */
+    unsigned long numProducerWaits;     /* Times a producer slept */
+    unsigned long latHist[WQ_LAT_BUCKETS];
+    unsigned long latMaxNs;     /* Longest time an item waited */
+};
+
+struct WorkQueue;               /* Opaque; see work_queue.c */
+
+void wqDefaultOptions(struct wqOptions *opts);
+
+struct WorkQueue *wqCreate(const struct wqOptions *opts);
+
+int wqPush(struct WorkQueue *wq, void *item);
+
+int wqPushBatch(struct WorkQueue *wq, void *items[], size_t n);
+
+size_t wqPopBatch(struct WorkQueue *wq, int consumer, void *items[],
+                  size_t max);
+
+void wqClose(struct WorkQueue *wq);
+
+void wqGetStats(struct WorkQueue *wq, struct wqStats *stats);
+
+unsigned long wqLatencyPercentile(const struct wqStats *stats, double pct);
+
+void wqDestroy(struct WorkQueue *wq);
+
+#endif
@@ -0,0 +1,352 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* work_queue_bench.c
+
+   Compare the throughput and queueing latency of work_queue.c with that
+   of the single mutex and condition variable scheme of prod_condvar.c.
+
+   Usage: work_queue_bench [-t max-threads] [-n items] [-b batch]
+                [-q capacity] [-s spin-iters] [-w work-iters]
+
+   For 1, 2, 4, ... up to 'max-threads' (default 64), the program runs
+   that many producer threads and that many consumer threads, which
+   between them pass 'items' (default 1000000) items through a queue
+   holding at most 'capacity' (default 4096) items. Each consumer does
+   'work-iters' (default 0) iterations of a dummy computation for each
+   item.
+
+   This is done first with a queue implemented as in prod_condvar.c: one
+   mutex and condition variable (plus a second condition variable, for
+   producers to wait on when the queue is full), with each item enqueued
+   and dequeued individually, and a signal sent for each item. Then it is
+   done with work_queue.c, with producers enqueuing 'batch' (default 64)
+   items at a time, and consumers dequeuing up to 'batch' items at a time.
+
+   For each run, the items processed per second, and the median, 99th
+   percentile, and maximum time spent in the queue, are displayed.
+*/
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "work_queue.h"
+#include "tlpi_hdr.h"
+
+static long numItems = 1000000;
+static int numThreads;          /* Producers (and also consumers) */
+static size_t batchSize = 64;
+static size_t capacity = 4096;
+static long workIters = 0;
+
+static struct WorkQueue *wq;
+static struct {                 /* Per-consumer sums of items, to check
+                                   that each item was consumed once */
+    unsigned long sum;
+    char pad[64];               /* Keep consumers' sums in separate cache
+                                   lines */
+} *sums;
+
+/* The baseline queue, as in prod_condvar.c */
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t condFull = PTHREAD_COND_INITIALIZER;
+static uintptr_t *ring;
+static long long *ringNs;
+static size_t head, tail;
+static bool done;
+static struct wqStats *cvStats; /* Per-consumer latency counts */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+doWork(uintptr_t item)
+{
+    volatile uintptr_t x = item;
+
+    for (long j = 0; j < workIters; j++)
+        x = x * 6364136223846793005ULL + 1;
+}
+
+/* Producer 'tnum' produces the items 'tnum' + 1, 'tnum' + 1 +
+   'numThreads', ..., so that the sum of all items is known. As in
+   work_queue.c, items are stamped before the mutex is locked, and on
+   removal after it is unlocked, so that clock_gettime() is never called
+   inside the critical section. */
+
+static void *
+cvProducer(void *arg)
+{
+    long tnum = (long) arg;
+
+    for (long v = tnum + 1; v <= numItems; v += numThreads) {
+        long long stamp = nowNs();
+
+        int s = pthread_mutex_lock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+
+        while (tail - head == capacity)
+            pthread_cond_wait(&condFull, &mtx);
+
+        ringNs[tail % capacity] = stamp;
+        ring[tail++ % capacity] = v;
+
+        s = pthread_mutex_unlock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+
+        s = pthread_cond_signal(&cond);         /* Wake sleeping consumer */
+        if (s != 0)
+            errExitEN(s, "pthread_cond_signal");
+    }
+    return NULL;
+}
+
+static void *
+cvConsumer(void *arg)
+{
+    long tnum = (long) arg;
+    struct wqStats *st = &cvStats[tnum];
+
+    for (;;) {
+        int s = pthread_mutex_lock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+
+        while (head == tail && !done)
+            pthread_cond_wait(&cond, &mtx);
+        if (head == tail) {                     /* 'done' and empty */
+            pthread_mutex_unlock(&mtx);
+            break;
+        }
+
+        uintptr_t item = ring[head % capacity];
+        long long stamp = ringNs[head % capacity];
+        head++;
+
+        s = pthread_mutex_unlock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+        pthread_cond_signal(&condFull);
+
+        unsigned long lat = nowNs() - stamp;
+
+        int b = (lat == 0) ? 0 : 64 - __builtin_clzll(lat);
+        st->latHist[min(b, WQ_LAT_BUCKETS - 1)]++;
+        st->latMaxNs = max(st->latMaxNs, lat);
+
+        doWork(item);
+        sums[tnum].sum += item;
+    }
+    return NULL;
+}
+
+static void *
+wqProducer(void *arg)
+{
+    long tnum = (long) arg;
+    void **batch = calloc(batchSize, sizeof(void *));
+    size_t n = 0;
+
+    if (batch == NULL)
+        errExit("calloc");
+
+    for (long v = tnum + 1; v <= numItems; v += numThreads) {
+        batch[n++] = (void *) (uintptr_t) v;
+        if (n == batchSize || v + numThreads > numItems) {
+            if (wqPushBatch(wq, batch, n) == -1)
+                errExit("wqPushBatch");
+            n = 0;
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+static void *
+wqConsumer(void *arg)
+{
+    long tnum = (long) arg;
+    void **batch = calloc(batchSize, sizeof(void *));
+    size_t n;
+
+    if (batch == NULL)
+        errExit("calloc");
+
+    while ((n = wqPopBatch(wq, tnum, batch, batchSize)) > 0) {
+        for (size_t j = 0; j < n; j++) {
+            doWork((uintptr_t) batch[j]);
+            sums[tnum].sum += (uintptr_t) batch[j];
+        }
+    }
+    free(batch);
+    return NULL;
+}
+
+/* Run 'numThreads' producers and consumers, returning elapsed seconds.
+   'finish' is called once all producers have finished. */
+
+static double
+runThreads(void *(*prodFunc)(void *), void *(*consFunc)(void *),
+           void (*finish)(void))
+{
+    pthread_t *prod = calloc(numThreads, sizeof(pthread_t));
+    pthread_t *cons = calloc(numThreads, sizeof(pthread_t));
+    int s;
+
+    if (prod == NULL || cons == NULL)
+        errExit("calloc");
+    memset(sums, 0, numThreads * sizeof(*sums));
+
+    long long start = nowNs();
+    for (long j = 0; j < numThreads; j++) {
+        s = pthread_create(&cons[j], NULL, consFunc, (void *) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+        s = pthread_create(&prod[j], NULL, prodFunc, (void *) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_join(prod[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    finish();
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_join(cons[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    double secs = (nowNs() - start) / 1e9;
+
+    unsigned long sum = 0;
+    for (int j = 0; j < numThreads; j++)
+        sum += sums[j].sum;
+    if (sum != (unsigned long) numItems * (numItems + 1) / 2)
+        fatal("sum of items consumed is %lu; expected %lu", sum,
+              (unsigned long) numItems * (numItems + 1) / 2);
+
+    free(prod);
+    free(cons);
+    return secs;
+}
+
+static void
+cvFinish(void)
+{
+    pthread_mutex_lock(&mtx);
+    done = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+static void
+wqFinish(void)
+{
+    wqClose(wq);
+}
+
+static void
+printResult(const char *name, double secs, const struct wqStats *st)
+{
+    printf("%-9s %7d %12.0f %9.1f %9.1f %9.1f", name, numThreads,
+           numItems / secs, wqLatencyPercentile(st, 50) / 1000.0,
+           wqLatencyPercentile(st, 99) / 1000.0, st->latMaxNs / 1000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct wqOptions opts;
+    int maxThreads = 64;
+    int opt;
+
+    wqDefaultOptions(&opts);
+
+    while ((opt = getopt(argc, argv, "t:n:b:q:s:w:")) != -1) {
+        switch (opt) {
+        case 't': maxThreads = getInt(optarg, GN_GT_0, "max-threads");  break;
+        case 'n': numItems = getLong(optarg, GN_GT_0, "items");         break;
+        case 'b': batchSize = getLong(optarg, GN_GT_0, "batch");        break;
+        case 'q': capacity = getLong(optarg, GN_GT_0, "capacity");      break;
+        case 's': opts.spinIters = getInt(optarg, GN_NONNEG,
+                                          "spin-iters");                break;
+        case 'w': workIters = getLong(optarg, GN_NONNEG, "work-iters"); break;
+        default:
+            usageErr("%s [-t max-threads] [-n items] [-b batch] "
+                     "[-q capacity] [-s spin-iters] [-w work-iters]\n",
+                     argv[0]);
+        }
+    }
+
+    ring = calloc(capacity, sizeof(uintptr_t));
+    ringNs = calloc(capacity, sizeof(long long));
+    sums = calloc(maxThreads, sizeof(*sums));
+    cvStats = calloc(maxThreads, sizeof(struct wqStats));
+    if (ring == NULL || ringNs == NULL || sums == NULL || cvStats == NULL)
+        errExit("calloc");
+
+    printf("%-9s %7s %12s %9s %9s %9s\n", "Queue", "Threads", "Items/s",
+           "p50 (us)", "p99 (us)", "max (us)");
+
+    for (numThreads = 1; numThreads <= maxThreads;
+            numThreads = (numThreads < maxThreads &&
+                          numThreads * 2 > maxThreads) ? maxThreads :
+                                                         numThreads * 2) {
+        struct wqStats st;
+
+        /* Baseline: prod_condvar.c scheme */
+
+        head = tail = 0;
+        done = false;
+        memset(cvStats, 0, maxThreads * sizeof(struct wqStats));
+        double secs = runThreads(cvProducer, cvConsumer, cvFinish);
+
+        memset(&st, 0, sizeof(st));
+        for (int j = 0; j < numThreads; j++) {
+            for (int b = 0; b < WQ_LAT_BUCKETS; b++)
+                st.latHist[b] += cvStats[j].latHist[b];
+            st.latMaxNs = max(st.latMaxNs, cvStats[j].latMaxNs);
+        }
+        printResult("condvar", secs, &st);
+        printf("\n");
+
+        /* work_queue.c */
+
+        opts.capacity = capacity;
+        opts.numConsumers = numThreads;
+        opts.timestamps = 1;
+        wq = wqCreate(&opts);
+        if (wq == NULL)
+            errExit("wqCreate");
+        secs = runThreads(wqProducer, wqConsumer, wqFinish);
+
+        wqGetStats(wq, &st);
+        printResult("workqueue", secs, &st);
+        printf("  (batch %.1f; steals %lu; sleeps %lu/%lu)\n",
+               (double) st.numPopped / st.numPops, st.numSteals,
+               st.numConsumerWaits, st.numProducerWaits);
+        wqDestroy(wq);
+    }
+
+    exit(EXIT_SUCCESS);
+}
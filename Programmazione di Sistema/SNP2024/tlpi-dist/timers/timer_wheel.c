@@ -0,0 +1,467 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel.c
+
+   A hierarchical timing wheel, for programs (such as network servers)
+   that need very many timers, for example, one idle timeout for each of
+   a million connections. Creating a POSIX timer for each, as in
+   ptmr_sigev_thread.c and ptmr_sigev_signal.c, costs a kernel object and
+   system calls for each timer, and a signal or thread creation for each
+   expiration.
+
+   Here, timers are structures embedded in the caller's own structures,
+   so that adding and cancelling a timer allocates nothing and takes
+   constant time. Time is divided into ticks of 'tickUsecs' microseconds.
+   The wheel has TMW_LEVELS levels of TMW_SIZE slots, each slot being a
+   list of timers:
+
+   * Level 0 has a slot for each of the next TMW_SIZE ticks.
+
+   * Each slot of level 1 covers TMW_SIZE ticks, each slot of level 2
+     covers TMW_SIZE * TMW_SIZE ticks, and so on.
+
+   Each time the wheel's position passes a multiple of TMW_SIZE ticks, the
+   timers in the next slot of level 1 are redistributed ("cascaded") into
+   level 0, and so on for the higher levels, as in the traditional Linux
+   kernel timer wheel. Timeouts beyond the range of the wheel (2^32 ticks)
+   are reduced to that range.
+
+   The whole wheel is driven by a single timerfd (see demo_timerfd.c),
+   which the caller monitors with epoll (or poll(), or select()) in the
+   thread that owns the wheel, calling tmwProcess() when it is readable.
+   The timerfd is set (with TFD_TIMER_ABSTIME) for the next tick that
+   has timers, found using a bitmap of the nonempty slots in level 0, or
+   for the next point at which timers must be cascaded, so that an idle
+   wheel doesn't wake the caller on every tick.
+
+   tmwProcess() moves all of the timers that have expired onto a queue,
+   and then calls their callback functions, in the calling thread. A
+   callback may add or cancel any timer, including its own; cancelling a
+   timer that has expired but whose callback has not yet been called
+   removes it from the queue.
+
+   A wheel is not thread-safe: it should be used by only one thread.
+
+   This module is Linux-specific.
+*/
+#include <sys/timerfd.h>
+#include <time.h>
+#include "timer_wheel.h"
+#include "tlpi_hdr.h"
+
+#define TMW_BITS        8
+#define TMW_SIZE        (1 << TMW_BITS)
+#define TMW_MASK        (TMW_SIZE - 1)
+#define TMW_LEVELS      4
+#define TMW_MAX_TICKS   ((1ULL << (TMW_BITS * TMW_LEVELS)) - 1)
+
+#define NOT_ARMED       UINT64_MAX
+
+struct TimerWheel {
+    int fd;                     /* timerfd */
+    long long tickNs;
+    long long baseNs;           /* CLOCK_MONOTONIC time of tick 0 */
+    uint64_t now;               /* Next tick to be processed */
+    uint64_t armedTick;         /* Tick that timerfd is set for */
+    bool processing;            /* In tmwProcess(); timerfd is set at end */
+    unsigned long numPending;
+    struct tmwStats stats;
+    uint64_t bitmap[TMW_SIZE / 64];     /* Nonempty slots of level 0 */
+    struct tmwTimer expired;    /* Queue of expired timers */
+    struct tmwTimer slots[TMW_LEVELS][TMW_SIZE];
+                                /* Each slot is a circular list, whose
+                                   head is a dummy timer structure */
+};
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+listInit(struct tmwTimer *head)
+{
+    head->prev = head->next = head;
+}
+
+static bool
+listEmpty(const struct tmwTimer *head)
+{
+    return head->next == head;
+}
+
+static void
+listAppend(struct tmwTimer *head, struct tmwTimer *t)
+{
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+/* Move all of the timers in list 'from' to the end of list 'to' */
+
+static void
+listSplice(struct tmwTimer *to, struct tmwTimer *from)
+{
+    if (listEmpty(from))
+        return;
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    listInit(from);
+}
+
+/* Remove 't' from its list. If that leaves a level 0 slot empty, clear
+   the slot's bit in the bitmap. */
+
+static void
+unlinkTimer(struct TimerWheel *tw, struct tmwTimer *t)
+{
+    struct tmwTimer *prev = t->prev;
+
+    prev->next = t->next;
+    t->next->prev = prev;
+
+    if (prev == t->next && prev >= &tw->slots[0][0] &&
+            prev < &tw->slots[0][TMW_SIZE]) {
+        long idx = prev - &tw->slots[0][0];
+        tw->bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+}
+
+/* Place a timer in the appropriate slot, given the wheel's current
+   position */
+
+static void
+enqueue(struct TimerWheel *tw, struct tmwTimer *t)
+{
+    uint64_t delta;
+    int level, idx;
+
+    if (t->expires < tw->now)
+        t->expires = tw->now;
+    delta = t->expires - tw->now;
+    if (delta > TMW_MAX_TICKS) {
+        t->expires = tw->now + TMW_MAX_TICKS;
+        delta = TMW_MAX_TICKS;
+    }
+
+    for (level = 0; level < TMW_LEVELS - 1; level++)
+        if (delta < (1ULL << (TMW_BITS * (level + 1))))
+            break;
+
+    idx = (t->expires >> (TMW_BITS * level)) & TMW_MASK;
+    listAppend(&tw->slots[level][idx], t);
+    if (level == 0)
+        tw->bitmap[idx / 64] |= 1ULL << (idx % 64);
+}
+
+/* Return the index of the first nonempty level 0 slot at or after 'idx',
+   or TMW_SIZE if there is none */
+
+static int
+nextNonEmpty(const struct TimerWheel *tw, int idx)
+{
+    for (int w = idx / 64; w < TMW_SIZE / 64; w++) {
+        uint64_t bits = tw->bitmap[w];
+
+        if (w == idx / 64)
+            bits &= ~0ULL << (idx % 64);
+        if (bits != 0)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+    return TMW_SIZE;
+}
+
+/* Redistribute the timers in slot 'idx' of 'level' */
+
+static void
+cascade(struct TimerWheel *tw, int level, int idx)
+{
+    struct tmwTimer list;
+
+    listInit(&list);
+    listSplice(&list, &tw->slots[level][idx]);
+    while (!listEmpty(&list)) {
+        struct tmwTimer *t = list.next;
+
+        list.next = t->next;
+        t->next->prev = &list;
+        enqueue(tw, t);
+        tw->stats.numCascaded++;
+    }
+}
+
+/* Process tick 'tw->now': cascade if we are at the start of a level 0
+   rotation, and move the timers in the current slot to the expired
+   queue */
+
+static void
+processTick(struct TimerWheel *tw)
+{
+    int idx = tw->now & TMW_MASK;
+
+    if (idx == 0) {
+        for (int level = 1; level < TMW_LEVELS; level++) {
+            int lidx = (tw->now >> (TMW_BITS * level)) & TMW_MASK;
+
+            cascade(tw, level, lidx);
+            if (lidx != 0)
+                break;
+        }
+    }
+
+    listSplice(&tw->expired, &tw->slots[0][idx]);
+    tw->bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    tw->now++;
+}
+
+/* Set the timerfd to expire at the start of tick 'tick' */
+
+static void
+armTimer(struct TimerWheel *tw, uint64_t tick)
+{
+    struct itimerspec ts;
+    long long ns;
+
+    if (tick == tw->armedTick)
+        return;
+
+    memset(&ts, 0, sizeof(ts));
+    if (tick != NOT_ARMED) {
+        ns = tw->baseNs + (long long) tick * tw->tickNs;
+        ts.it_value.tv_sec = ns / 1000000000;
+        ts.it_value.tv_nsec = ns % 1000000000;
+    }
+    if (timerfd_settime(tw->fd, TFD_TIMER_ABSTIME, &ts, NULL) == -1)
+        errMsg("timer_wheel: timerfd_settime");
+    tw->armedTick = tick;
+    tw->stats.numRearms++;
+}
+
+/* Set the timerfd for the next tick at which there is work to do: the
+   next nonempty level 0 slot in the current rotation, or else the start
+   of the next rotation, when we must cascade */
+
+static void
+rearm(struct TimerWheel *tw)
+{
+    int idx, next;
+
+    if (tw->numPending == 0) {
+        armTimer(tw, NOT_ARMED);
+        return;
+    }
+
+    idx = tw->now & TMW_MASK;
+    next = (idx == 0) ? 0 : nextNonEmpty(tw, idx);
+    armTimer(tw, (tw->now & ~(uint64_t) TMW_MASK) + next);
+}
+
+void
+tmwTimerInit(struct tmwTimer *t, tmwFunc func, void *arg)
+{
+    t->prev = t->next = NULL;
+    t->expires = 0;
+    t->func = func;
+    t->arg = arg;
+    t->pending = false;
+}
+
+/* Create a timer wheel with a resolution of 'tickUsecs' microseconds */
+
+struct TimerWheel *
+tmwCreate(long tickUsecs)
+{
+    struct TimerWheel *tw;
+
+    if (tickUsecs <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tw = calloc(1, sizeof(*tw));
+    if (tw == NULL)
+        return NULL;
+
+    tw->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tw->fd == -1) {
+        free(tw);
+        return NULL;
+    }
+
+    tw->tickNs = tickUsecs * 1000LL;
+    tw->baseNs = nowNs();
+    tw->now = 0;
+    tw->armedTick = NOT_ARMED;
+    listInit(&tw->expired);
+    for (int level = 0; level < TMW_LEVELS; level++)
+        for (int j = 0; j < TMW_SIZE; j++)
+            listInit(&tw->slots[level][j]);
+    return tw;
+}
+
+/* Return the file descriptor that becomes readable when tmwProcess()
+   should be called */
+
+int
+tmwGetFd(struct TimerWheel *tw)
+{
+    return tw->fd;
+}
+
+/* Start a timer that expires in 'usecs' microseconds (rounded up to a
+   whole tick). The timer must not already be pending. */
+
+int
+tmwAdd(struct TimerWheel *tw, struct tmwTimer *t, long long usecs)
+{
+    long long ns;
+
+    if (t->pending) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (usecs < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ns = nowNs() - tw->baseNs + usecs * 1000;
+    t->expires = (ns + tw->tickNs - 1) / tw->tickNs;
+    t->pending = true;
+    enqueue(tw, t);
+    tw->numPending++;
+    tw->stats.numAdded++;
+
+    if (!tw->processing && t->expires < tw->armedTick)
+        armTimer(tw, t->expires);
+    return 0;
+}
+
+/* Cancel a timer. Returns true if it was pending. The timerfd is not
+   reset; if it fires with nothing to do, tmwProcess() just rearms it. */
+
+bool
+tmwCancel(struct TimerWheel *tw, struct tmwTimer *t)
+{
+    if (!t->pending)
+        return false;
+    unlinkTimer(tw, t);
+    t->pending = false;
+    tw->numPending--;
+    tw->stats.numCancelled++;
+    return true;
+}
+
+/* Restart a timer (pending or not) so that it expires in 'usecs' */
+
+int
+tmwMod(struct TimerWheel *tw, struct tmwTimer *t, long long usecs)
+{
+    tmwCancel(tw, t);
+    return tmwAdd(tw, t, usecs);
+}
+
+/* Advance the wheel to the current time, and call the functions of the
+   timers that have expired. Returns the number of timers that expired,
+   or -1 on error. */
+
+long
+tmwProcess(struct TimerWheel *tw)
+{
+    uint64_t numExp, curTick;
+    long long ns;
+    long cnt;
+
+    if (read(tw->fd, &numExp, sizeof(numExp)) == -1 && errno != EAGAIN)
+        return -1;
+    tw->armedTick = NOT_ARMED;          /* Timer has fired, or will be
+                                           reset below in any case */
+
+    ns = nowNs() - tw->baseNs;
+    curTick = ns / tw->tickNs;
+
+    while (tw->now <= curTick) {
+        int idx = tw->now & TMW_MASK;
+
+        if (idx != 0) {
+
+            /* Skip over empty slots, but not past the start of the next
+               rotation, when we must cascade */
+
+            int next = nextNonEmpty(tw, idx);
+            uint64_t target = (tw->now & ~(uint64_t) TMW_MASK) + next;
+
+            if (target > curTick) {
+                tw->now = curTick + 1;
+                break;
+            }
+            tw->now = target;
+            if (next == TMW_SIZE)
+                continue;
+        }
+        processTick(tw);
+    }
+
+    /* Call the functions of the expired timers. The queue is consulted
+       afresh each time, since a callback may cancel other timers. */
+
+    cnt = 0;
+    tw->processing = true;
+    while (!listEmpty(&tw->expired)) {
+        struct tmwTimer *t = tw->expired.next;
+
+        unlinkTimer(tw, t);
+        t->pending = false;
+        tw->numPending--;
+        cnt++;
+        t->func(t, t->arg);
+    }
+    tw->processing = false;
+    if (cnt > 0) {
+        tw->stats.numExpired += cnt;
+        tw->stats.numBatches++;
+    }
+
+    rearm(tw);
+    return cnt;
+}
+
+unsigned long
+tmwNumPending(struct TimerWheel *tw)
+{
+    return tw->numPending;
+}
+
+void
+tmwGetStats(struct TimerWheel *tw, struct tmwStats *stats)
+{
+    *stats = tw->stats;
+}
+
+/* Free the wheel. Pending timers belong to the caller, and are simply
+   forgotten. */
+
+void
+tmwDestroy(struct TimerWheel *tw)
+{
+    close(tw->fd);
+    free(tw);
+}
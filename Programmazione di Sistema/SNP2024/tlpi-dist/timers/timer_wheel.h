@@ -0,0 +1,67 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel.h
+
+   Header file for timer_wheel.c.
+*/
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct tmwTimer;
+
+typedef void (*tmwFunc)(struct tmwTimer *t, void *arg);
+
+struct tmwTimer {               /* Embedded in the caller's structures;
+                                   fields are private to timer_wheel.c */
+    struct tmwTimer *prev, *next;
+    uint64_t expires;           /* Tick at which the timer expires */
+    tmwFunc func;
+    void *arg;
+    bool pending;               /* In the wheel, or in the expired queue */
+};
+
+struct TimerWheel;              /* Opaque; see timer_wheel.c */
+
+struct tmwStats {
+    unsigned long numAdded;
+    unsigned long numCancelled;
+    unsigned long numExpired;
+    unsigned long numCascaded;  /* Timers moved down a level */
+    unsigned long numBatches;   /* tmwProcess() calls that expired timers */
+    unsigned long numRearms;    /* timerfd_settime() calls */
+};
+
+void tmwTimerInit(struct tmwTimer *t, tmwFunc func, void *arg);
+
+struct TimerWheel *tmwCreate(long tickUsecs);
+
+int tmwGetFd(struct TimerWheel *tw);
+
+int tmwAdd(struct TimerWheel *tw, struct tmwTimer *t, long long usecs);
+
+bool tmwCancel(struct TimerWheel *tw, struct tmwTimer *t);
+
+int tmwMod(struct TimerWheel *tw, struct tmwTimer *t, long long usecs);
+
+long tmwProcess(struct TimerWheel *tw);
+
+unsigned long tmwNumPending(struct TimerWheel *tw);
+
+void tmwGetStats(struct TimerWheel *tw, struct tmwStats *stats);
+
+void tmwDestroy(struct TimerWheel *tw);
+
+#endif
@@ -0,0 +1,274 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2024.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel_bench.c
+
+   Measure the cost of timer churn with a large number of active timers,
+   using the timing wheel in timer_wheel.c, and using one POSIX timer per
+   timeout (as in ptmr_sigev_signal.c, but with SIGEV_NONE).
+
+   Usage: timer_wheel_bench [-n timers] [-r resets] [-k tick-usecs]
+                [-d secs] [-p posix-timers]
+
+   With the timing wheel (tick 'tick-usecs', default 1000), the program:
+
+   * adds 'timers' (default 1000000) timers, with random timeouts of
+     between 1 and 60 seconds, as a server might for the idle timeouts
+     of its connections;
+
+   * restarts 'resets' (default 10000000) randomly chosen timers, with
+     new random timeouts, as the server would on each request;
+
+   * cancels all of the timers; and
+
+   * adds 'timers' timers again, with timeouts spread over the next
+     'secs' (default 5) seconds, and lets them all expire, monitoring the
+     wheel's timerfd with poll() and calling tmwProcess() as needed.
+
+   For the first three steps, the average time per operation is displayed.
+   For the last, the program displays the expirations per second, the
+   number of wakeups and average number of expirations per wakeup, and
+   the mean and maximum lateness of the callbacks (measured from when
+   the timer was due, or from when the program started polling, if that
+   was later).
+
+   Then the first three steps are repeated with 'posix-timers' (default
+   100000) POSIX timers, using timer_create(), timer_settime(), and
+   timer_delete(). The number of POSIX timers may be limited by memory
+   or by RLIMIT_SIGPENDING.
+
+   This program is Linux-specific.
+*/
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "timer_wheel.h"
+#include "tlpi_hdr.h"
+
+#define MAX_TIMEOUT_USECS (60 * 1000000LL)
+
+struct conn {                   /* Stands in for a server's connection */
+    struct tmwTimer timer;
+    long long deadlineNs;
+};
+
+static unsigned long long rngState = 88172645463325252ULL;
+
+static unsigned long long
+rnd(void)                       /* xorshift64 */
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long
+randTimeout(void)               /* Microseconds, 1 to 60 seconds */
+{
+    return 1000000 + rnd() % (MAX_TIMEOUT_USECS - 1000000);
+}
+
+static long long latSumNs, latMaxNs;
+static long long loopStartNs;   /* Timers that expired while we were still
+                                   adding timers are late only from here */
+
+static void
+expireFunc(struct tmwTimer *t, void *arg)
+{
+    struct conn *c = arg;
+    long long late = nowNs() - max(c->deadlineNs, loopStartNs);
+
+    latSumNs += late;
+    latMaxNs = max(latMaxNs, late);
+}
+
+static void
+printOp(const char *impl, const char *op, long n, long long ns)
+{
+    printf("%-7s %-8s %10ld ops %9.1f ns/op\n", impl, op, n,
+           (double) ns / n);
+}
+
+static void
+benchWheel(long numTimers, long numResets, long tickUsecs, long secs)
+{
+    struct TimerWheel *tw;
+    struct conn *conns;
+    struct tmwStats st;
+    long long start;
+
+    conns = calloc(numTimers, sizeof(struct conn));
+    if (conns == NULL)
+        errExit("calloc");
+    tw = tmwCreate(tickUsecs);
+    if (tw == NULL)
+        errExit("tmwCreate");
+
+    for (long j = 0; j < numTimers; j++)
+        tmwTimerInit(&conns[j].timer, expireFunc, &conns[j]);
+
+    start = nowNs();
+    for (long j = 0; j < numTimers; j++)
+        if (tmwAdd(tw, &conns[j].timer, randTimeout()) == -1)
+            errExit("tmwAdd");
+    printOp("wheel", "add", numTimers, nowNs() - start);
+
+    start = nowNs();
+    for (long j = 0; j < numResets; j++)
+        if (tmwMod(tw, &conns[rnd() % numTimers].timer, randTimeout()) == -1)
+            errExit("tmwMod");
+    printOp("wheel", "reset", numResets, nowNs() - start);
+
+    start = nowNs();
+    for (long j = 0; j < numTimers; j++)
+        tmwCancel(tw, &conns[j].timer);
+    printOp("wheel", "cancel", numTimers, nowNs() - start);
+
+    /* Let 'numTimers' timers expire over the next 'secs' seconds */
+
+    long long secsUsecs = secs * 1000000LL;
+    for (long j = 0; j < numTimers; j++) {
+        long long usecs = 1 + rnd() % secsUsecs;
+
+        conns[j].deadlineNs = nowNs() + usecs * 1000;
+        if (tmwAdd(tw, &conns[j].timer, usecs) == -1)
+            errExit("tmwAdd");
+    }
+
+    struct tmwStats before;
+    tmwGetStats(tw, &before);
+    latSumNs = latMaxNs = 0;
+
+    struct pollfd pfd = { .fd = tmwGetFd(tw), .events = POLLIN };
+    long numWakeups = 0;
+    start = loopStartNs = nowNs();
+    while (tmwNumPending(tw) > 0) {
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+        numWakeups++;
+        if (tmwProcess(tw) == -1)
+            errExit("tmwProcess");
+    }
+    double elapsed = (nowNs() - start) / 1e9;
+
+    tmwGetStats(tw, &st);
+    long numExp = st.numExpired - before.numExpired;
+    printf("%-7s %-8s %10ld exp %9.0f exp/s; %ld wakeups (%.1f exp/wakeup)\n",
+           "wheel", "expire", numExp, numExp / elapsed, numWakeups,
+           (double) numExp / numWakeups);
+    printf("%-7s %-8s %10s     late: mean %.3f ms, max %.3f ms; "
+           "%lu cascaded\n", "", "", "", latSumNs / 1e6 / numExp,
+           latMaxNs / 1e6, st.numCascaded);
+
+    tmwDestroy(tw);
+    free(conns);
+}
+
+static void
+randItimerspec(struct itimerspec *ts)
+{
+    long long usecs = randTimeout();
+
+    ts->it_interval.tv_sec = ts->it_interval.tv_nsec = 0;
+    ts->it_value.tv_sec = usecs / 1000000;
+    ts->it_value.tv_nsec = (usecs % 1000000) * 1000;
+}
+
+static void
+benchPosix(long numTimers, long numResets)
+{
+    struct sigevent sev;
+    struct itimerspec ts;
+    timer_t *tids;
+    long long start;
+    long n;
+
+    tids = calloc(numTimers, sizeof(timer_t));
+    if (tids == NULL)
+        errExit("calloc");
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_NONE;
+
+    start = nowNs();
+    for (n = 0; n < numTimers; n++) {
+        if (timer_create(CLOCK_MONOTONIC, &sev, &tids[n]) == -1) {
+            errMsg("timer_create (after %ld timers)", n);
+            break;
+        }
+        randItimerspec(&ts);
+        if (timer_settime(tids[n], 0, &ts, NULL) == -1)
+            errExit("timer_settime");
+    }
+    if (n == 0) {
+        free(tids);
+        return;
+    }
+    printOp("posix", "add", n, nowNs() - start);
+
+    start = nowNs();
+    for (long j = 0; j < numResets; j++) {
+        randItimerspec(&ts);
+        if (timer_settime(tids[rnd() % n], 0, &ts, NULL) == -1)
+            errExit("timer_settime");
+    }
+    printOp("posix", "reset", numResets, nowNs() - start);
+
+    start = nowNs();
+    for (long j = 0; j < n; j++)
+        if (timer_delete(tids[j]) == -1)
+            errExit("timer_delete");
+    printOp("posix", "cancel", n, nowNs() - start);
+
+    free(tids);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long numTimers = 1000000, numResets = 10000000;
+    long tickUsecs = 1000, secs = 5, numPosix = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:k:d:p:")) != -1) {
+        switch (opt) {
+        case 'n': numTimers = getLong(optarg, GN_GT_0, "timers");       break;
+        case 'r': numResets = getLong(optarg, GN_GT_0, "resets");       break;
+        case 'k': tickUsecs = getLong(optarg, GN_GT_0, "tick-usecs");   break;
+        case 'd': secs = getLong(optarg, GN_GT_0, "secs");              break;
+        case 'p': numPosix = getLong(optarg, GN_NONNEG, "posix-timers"); break;
+        default:
+            usageErr("%s [-n timers] [-r resets] [-k tick-usecs] "
+                     "[-d secs] [-p posix-timers]\n", argv[0]);
+        }
+    }
+
+    benchWheel(numTimers, numResets, tickUsecs, secs);
+    if (numPosix > 0)
+        benchPosix(numPosix, numResets);
+
+    exit(EXIT_SUCCESS);
+}
@@ -1,10 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <spawn.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char **environ;
+
 #define RUN_COMMAND 10
 
 // Funzione per calcolare la media
@@ -22,13 +26,18 @@ double timespec_to_seconds(struct timespec *ts) {
 }
 
 int main(int argc, char* argv[]) {
-    // Controllo argomenti
-    if (argc < 2) {
-        fprintf(stderr, "Uso: %s <comando>\n", argv[0]);
+    // Controllo argomenti: con -n il comando (e i suoi argomenti) viene
+    // eseguito direttamente, senza passare per /bin/sh
+    int senza_shell = argc > 1 && strcmp(argv[1], "-n") == 0;
+    if (argc < 2 + senza_shell) {
+        fprintf(stderr, "Uso: %s [-n] <comando> [argomenti...]\n", argv[0]);
         return 1;
     }
 
-    char *comando = argv[1];
+    char *comando = argv[1 + senza_shell];
+    char *argv_shell[] = { "sh", "-c", comando, NULL };
+    char **argv_figlio = senza_shell ? &argv[2] : argv_shell;
+    const char *programma = senza_shell ? comando : "/bin/sh";
     
     // Array per le misurazioni
     double misurazioni_wall[RUN_COMMAND];
@@ -47,18 +56,21 @@ int main(int argc, char* argv[]) {
         // Tempo wall di inizio
         clock_gettime(CLOCK_REALTIME, &start_wall);
         
-        // Esegui il comando con fork + exec per misurare correttamente
-        pid_t pid = fork();
-        
-        if (pid == 0) {
-            // Processo figlio: esegui il comando
-            execl("/bin/sh", "sh", "-c", comando, (char*)NULL);
-            perror("exec");
-            exit(1);
-        } else if (pid > 0) {
+        // Esegui il comando con posix_spawn(): a differenza di fork(), il
+        // costo non cresce con la memoria del padre (glibc crea il figlio
+        // con clone(CLONE_VM | CLONE_VFORK), senza copiare le page table),
+        // quindi il tempo misurato e' quello del comando e non del lancio
+        pid_t pid;
+        int err = posix_spawnp(&pid, programma, NULL, NULL, argv_figlio,
+                               environ);
+
+        if (err != 0) {
+            fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+            return 1;
+        } else {
             // Processo padre: aspetta e misura
-            wait(NULL);
-            
+            waitpid(pid, NULL, 0);
+
             // Tempo wall di fine
             clock_gettime(CLOCK_REALTIME, &end_wall);
             
@@ -87,10 +99,6 @@ int main(int argc, char* argv[]) {
             // Debug: mostra ogni misurazione (opzionale)
             printf("Esecuzione %d - Wall: %.6f, User: %.6f, Sys: %.6f\n", 
                    i+1, wall_time, user_time, sys_time);
-                   
-        } else {
-            perror("fork");
-            return 1;
         }
     }
     